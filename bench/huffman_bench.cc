@@ -0,0 +1,260 @@
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <source_location>
+#include "huffman_codec.h"
+#include "record_store.h"
+
+/*
+ * Compares the entropy backends on the same inputs. Every file is encoded and decoded a few times per backend,
+ * the best run is kept to filter out noise. Ratio counts the .bin plus its table file against the input size.
+ *
+ * Usage: huffman_bench [FILE.txt ...]   (defaults to the files in tests/test_files)
+ *        huffman_bench --scaling [FILE.txt]   (huffman MB/s by worker count, floating vs pinned workers)
+ *        huffman_bench --latency [FILE.txt]   (per call latency from 64 B to 1 MB, small path vs the pool)
+ *        huffman_bench --records [COUNT]   (record store ratio and get latency on COUNT JSON-like records)
+ */
+
+static const std::string TEST_FILES_DIR = std::filesystem::path(std::source_location::current().file_name())
+        .parent_path().parent_path().string() + "/tests/test_files";
+
+static constexpr int RUNS = 3;
+
+struct bench_result {
+    double encode_s = std::numeric_limits<double>::max();
+    double decode_s = std::numeric_limits<double>::max();
+    uintmax_t encoded_size = 0;
+};
+
+template<typename F>
+static double time_best(double best, F&& func)
+{
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const auto stop = std::chrono::steady_clock::now();
+    return std::min(best, std::chrono::duration<double>(stop - start).count());
+}
+
+static bench_result run_backend(const std::string& file, huffman_codec::Backend backend, const codec_options& opts,
+                                const std::shared_ptr<worker_pool>& pool = nullptr)
+{
+    const auto tmp = std::filesystem::temp_directory_path() / "huffman_bench";
+    const std::string bin = tmp.string() + "ENC.bin";
+    const std::string table = tmp.string() + "Table.txt";
+    const std::string dec = tmp.string() + "DEC.txt";
+
+    bench_result res;
+    for (int i = 0; i < RUNS; ++i) {
+        res.encode_s = time_best(res.encode_s, [&] {
+            huffman_codec hmc(opts, pool);
+            hmc.encode(file, bin, table, backend);
+        });
+        res.decode_s = time_best(res.decode_s, [&] {
+            huffman_codec hmc(opts, pool);
+            hmc.decode(bin, dec, table);
+        });
+    }
+    res.encoded_size = std::filesystem::file_size(bin) + std::filesystem::file_size(table);
+
+    std::filesystem::remove(bin);
+    std::filesystem::remove(table);
+    std::filesystem::remove(dec);
+    return res;
+}
+
+/*
+ * Doubles the worker count up to every CPU, once with workers left to the scheduler and once pinned node by node
+ * with per node tables and huge page buffers. Where the pinned rate keeps climbing past one node's worth of workers
+ * and the floating one flattens, cross socket traffic was what held it back.
+ */
+static void run_scaling(const std::string& file)
+{
+    const double mb = static_cast<double>(std::filesystem::file_size(file)) / (1024 * 1024);
+    const auto& nodes = numa_topology::nodes();
+    const auto cpus = static_cast<unsigned>(numa_topology::cpus().size());
+    std::cout << std::filesystem::path(file).filename().string() << ": " << nodes.size() << " NUMA node(s), "
+              << cpus << " CPUs" << std::endl;
+    std::cout << std::right << std::setw(8) << "workers" << std::setw(10) << "pinned"
+              << std::setw(12) << "enc MB/s" << std::setw(12) << "dec MB/s" << std::endl;
+
+    for (unsigned workers = 1;; workers = std::min(cpus, 2 * workers)) {
+        for (const bool pinned : {false, true}) {
+            const auto pool = std::make_shared<worker_pool>(workers, pinned);
+            const bench_result res = run_backend(file, huffman_codec::Backend::Huffman, {.numa = pinned}, pool);
+            std::cout << std::setw(8) << workers << std::setw(10) << (pinned ? "yes" : "no") << std::fixed
+                      << std::setprecision(1) << std::setw(12) << mb / res.encode_s << std::setw(12)
+                      << mb / res.decode_s << std::endl;
+        }
+        if (workers == cpus) break;
+    }
+}
+
+// Median of many calls in microseconds, the first few warm up the pool and the thread's buffers
+template<typename F>
+static double median_us(size_t bytes, F&& func)
+{
+    const size_t calls = std::clamp<size_t>((64 << 20) / std::max<size_t>(bytes, 1), 20, 2000);
+    std::vector<double> times;
+    for (size_t i = 0; i < calls + 5; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        func();
+        const auto stop = std::chrono::steady_clock::now();
+        if (i >= 5) times.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+    }
+    std::ranges::nth_element(times, times.begin() + static_cast<ptrdiff_t>(times.size() / 2));
+    return times[times.size() / 2];
+}
+
+/*
+ * Encode and decode latency of slices of one file, through encode_small/decode_small and through the in-memory
+ * stream API with its table text, which goes through the histogram pass and the pool however small the input.
+ */
+static void run_latency(const std::string& file)
+{
+    std::ifstream ifs(file, std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+    std::string sample = source.str();
+    while (sample.size() < (1 << 20))
+        sample += sample;
+
+    std::cout << std::filesystem::path(file).filename().string() << std::endl;
+    std::cout << std::right << std::setw(10) << "bytes" << std::setw(14) << "small enc us" << std::setw(14)
+              << "small dec us" << std::setw(14) << "pool enc us" << std::setw(14) << "pool dec us"
+              << std::setw(12) << "small size" << std::setw(12) << "pool size" << std::endl;
+
+    for (size_t bytes = 64; bytes <= (1 << 20); bytes *= 4) {
+        const std::string_view text(sample.data(), bytes);
+        std::vector<char> bin, decoded;
+        const double small_enc = median_us(bytes, [&] {
+            bin.clear();
+            huffman_codec::encode_small(text, bin);
+        });
+        const double small_dec = median_us(bytes, [&] {
+            decoded.clear();
+            huffman_codec::decode_small(bin, decoded);
+        });
+
+        std::string pool_bin, pool_table;
+        const double pool_enc = median_us(bytes, [&] {
+            std::stringstream input{std::string(text)}, output, table;
+            huffman_codec().encode(input, output, table);
+            pool_bin = output.str();
+            pool_table = table.str();
+        });
+        const double pool_dec = median_us(bytes, [&] {
+            std::stringstream input(pool_bin), table(pool_table), output;
+            huffman_codec().decode(input, output, table);
+        });
+
+        std::cout << std::setw(10) << bytes << std::fixed << std::setprecision(1) << std::setw(14) << small_enc
+                  << std::setw(14) << small_dec << std::setw(14) << pool_enc << std::setw(14) << pool_dec
+                  << std::setw(12) << bin.size() << std::setw(12) << pool_bin.size() + pool_table.size() << std::endl;
+    }
+}
+
+/*
+ * Packs count synthetic JSON events of about 110 bytes into a record store in memory, then times get on random IDs
+ * one at a time and get_batch over all of them.
+ */
+static void run_records(size_t count)
+{
+    std::mt19937 rng(42);
+    std::vector<std::string> records;
+    uint64_t raw = 0;
+    for (size_t i = 0; i < count; ++i) {
+        std::string rec = "{\"id\":" + std::to_string(i) + ",\"user\":\"user" + std::to_string(rng() % 5000) +
+                          "\",\"event\":\"" + (rng() % 4 ? "view" : "purchase") + "\",\"page\":\"/item/" +
+                          std::to_string(rng() % 100000) + "\",\"ts\":" + std::to_string(1700000000 + i * 3) +
+                          ",\"tags\":[";
+        for (size_t t = rng() % 6; t > 0; --t)
+            rec += "\"tag" + std::to_string(rng() % 40) + "\",";
+        rec += "]}";
+        raw += rec.size();
+        records.push_back(std::move(rec));
+    }
+
+    const std::vector<std::string_view> views(records.begin(), records.end());
+    std::stringstream out;
+    const double write_s = time_best(std::numeric_limits<double>::max(), [&] { record_store::write(views, out); });
+    const std::string bytes = out.str();
+    const record_store store{std::span<const char>(bytes)};
+
+    std::vector<uint64_t> ids(count);
+    for (auto& id : ids)
+        id = rng() % count;
+    size_t next = 0;
+    std::string rec;
+    const double get_us = median_us(0, [&] { store.get(ids[next++ % count], rec); });
+    const double batch_s = time_best(std::numeric_limits<double>::max(), [&] { (void) store.get_batch(ids); });
+
+    std::cout << count << " records of " << raw / std::max<size_t>(count, 1) << " bytes on average" << std::endl
+              << std::fixed << std::setprecision(3) << "ratio " << static_cast<double>(bytes.size()) / raw
+              << std::setprecision(1) << ", write " << raw / write_s / (1024 * 1024) << " MB/s, get "
+              << std::setprecision(2) << get_us << " us, get_batch " << std::setprecision(1)
+              << count / batch_s / 1e6 << " M records/s" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> files(argv + 1, argv + argc);
+    if (!files.empty() && files.front() == "--records") {
+        run_records(files.size() > 1 ? std::stoull(files[1]) : 1000000);
+        return 0;
+    }
+    const bool scaling = !files.empty() && files.front() == "--scaling";
+    const bool latency = !files.empty() && files.front() == "--latency";
+    if (scaling || latency) files.erase(files.begin());
+    if (files.empty()) {
+        for (const auto& e : std::filesystem::directory_iterator(TEST_FILES_DIR))
+            if (e.path().extension() == ".txt")
+                files.push_back(e.path().string());
+        std::ranges::sort(files);
+    }
+
+    if (scaling) {
+        // Largest file, scaling shows best where every worker gets plenty of chunks
+        run_scaling(*std::ranges::max_element(files, {}, [](const auto& f) { return std::filesystem::file_size(f); }));
+        return 0;
+    }
+    if (latency) {
+        // Smallest file, it gets repeated up to the largest size anyway
+        run_latency(*std::ranges::min_element(files, {}, [](const auto& f) { return std::filesystem::file_size(f); }));
+        return 0;
+    }
+
+    // huffman-o1 is the order-1 mode with the most tables, what it costs in MB/s against what it gains in ratio
+    const std::tuple<const char*, huffman_codec::Backend, codec_options> backends[] = {
+            {"huffman", huffman_codec::Backend::Huffman, {}},
+            {"huffman-o1", huffman_codec::Backend::Huffman, {.context_tables = context_model::MAX_TABLES}},
+            {"tans", huffman_codec::Backend::TANS, {}},
+            {"tunstall", huffman_codec::Backend::Tunstall, {}},
+    };
+
+    // HUFFMANCODEC_KERNELS=scalar|bmi2|avx2 forces a kernel path, handy to compare them on one host
+    std::cout << "kernels: " << huffman_kernels::isa_name(huffman_kernels::get().isa) << std::endl;
+
+    std::cout << std::left << std::setw(20) << "file" << std::setw(12) << "backend"
+              << std::right << std::setw(10) << "ratio" << std::setw(12) << "enc MB/s" << std::setw(12) << "dec MB/s"
+              << std::endl;
+
+    for (const auto& file : files) {
+        const double mb = static_cast<double>(std::filesystem::file_size(file)) / (1024 * 1024);
+        for (const auto& [name, backend, opts] : backends) {
+            try {
+                const bench_result res = run_backend(file, backend, opts);
+                std::cout << std::left << std::setw(20) << std::filesystem::path(file).filename().string()
+                          << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+                          << std::setw(10) << static_cast<double>(res.encoded_size) / std::filesystem::file_size(file)
+                          << std::setprecision(1)
+                          << std::setw(12) << mb / res.encode_s << std::setw(12) << mb / res.decode_s << std::endl;
+            }
+            catch (const std::exception& e) {
+                std::cout << std::left << std::setw(20) << std::filesystem::path(file).filename().string()
+                          << std::setw(12) << name << "FAILED: " << e.what() << std::endl;
+            }
+        }
+    }
+}
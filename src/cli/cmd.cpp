@@ -1,6 +1,180 @@
 #include <argumentum/argparse.h>
+#include <atomic>
 #include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include "huffman_codec.h"
+#include "record_store.h"
+#include "serve.h"
+
+// Byte count with an optional K/M/G suffix, e.g. 512M
+static size_t parse_size(const std::string& str)
+{
+    size_t pos = 0;
+    const unsigned long long value = std::stoull(str, &pos);
+    const std::string suffix = str.substr(pos);
+    if (suffix.empty() || suffix == "B") return value;
+    if (suffix == "K" || suffix == "KB") return value << 10;
+    if (suffix == "M" || suffix == "MB") return value << 20;
+    if (suffix == "G" || suffix == "GB") return value << 30;
+    throw std::invalid_argument("Unknown size suffix: " + suffix);
+}
+
+// Framed .bin files carry their own table, "-" stands in for the table file then
+static std::string_view table_arg(const std::string& table_file)
+{
+    return table_file == "-" ? std::string_view{} : std::string_view{table_file};
+}
+
+// A single byte for --columns, tab (or \t) for tabs
+static char parse_delimiter(const std::string& str)
+{
+    if (str == "tab" || str == "\\t") return '\t';
+    if (str.size() != 1 || str == "\n") {
+        throw std::invalid_argument("Column delimiter should be a single byte: " + str);
+    }
+    return str[0];
+}
+
+// Token of the job currently running, Ctrl+C cancels it instead of killing the process mid-write
+static std::atomic<cancel_token*> active_cancel{nullptr};
+
+// Throughput and ETA on stderr, redrawn a few times a second at most
+class ProgressPrinter
+{
+public:
+    void operator()(const codec_progress& p)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        if (p.bytes_done < p.bytes_total && now - last_print < std::chrono::milliseconds(200)) return;
+        last_print = now;
+
+        const double elapsed = std::chrono::duration<double>(now - start).count();
+        const double rate = elapsed > 0 ? static_cast<double>(p.bytes_done) / elapsed : 0;
+        const double percent = p.bytes_total != 0 ? 100.0 * static_cast<double>(p.bytes_done) / static_cast<double>(p.bytes_total) : 100.0;
+        const auto eta = static_cast<long long>(rate > 0 ? static_cast<double>(p.bytes_total - p.bytes_done) / rate : 0);
+
+        std::cerr << "\r" << std::fixed << std::setprecision(1) << std::setw(5) << percent << "%  "
+                  << std::setw(8) << rate / (1024 * 1024) << " MB/s  ETA "
+                  << std::setfill('0') << std::setw(2) << eta / 60 << ':' << std::setw(2) << eta % 60
+                  << std::setfill(' ') << std::flush;
+        if (p.bytes_done >= p.bytes_total) std::cerr << std::endl;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_print{};
+};
+
+// Shared by encode and decode
+struct RunOptions
+{
+    std::optional<size_t> max_inflight;
+    std::optional<std::string> max_memory;
+    bool progress = false;
+    bool numa = false;
+    std::optional<std::string> max_read_rate;
+    std::optional<std::string> max_write_rate;
+    std::optional<double> max_cpu;
+    bool low_priority = false;
+    std::optional<double> checkpoint;
+    bool resume = false;
+    bool stages = false;
+    bool counters = false;
+    std::optional<std::string> trace_file;
+
+    ProgressPrinter printer;
+    std::shared_ptr<cancel_token> cancel = std::make_shared<cancel_token>();
+
+    codec_options to_codec_options()
+    {
+        codec_options opts{max_inflight.value_or(0), max_memory ? parse_size(*max_memory) : 0};
+        opts.numa = numa;
+        opts.max_read_rate = max_read_rate ? parse_size(*max_read_rate) : 0;
+        opts.max_write_rate = max_write_rate ? parse_size(*max_write_rate) : 0;
+        opts.max_cpu = max_cpu.value_or(0) / 100;
+        opts.low_priority = low_priority;
+        opts.checkpoint_interval = checkpoint.value_or(0);
+        opts.resume = resume;
+        if (progress)
+            opts.on_progress = [this](const codec_progress& p) { printer(p); };
+
+        if (trace_file)
+            opts.trace = trace = std::make_shared<trace_recorder>();
+        if (counters)
+            opts.perf = perf = std::make_shared<perf_counters>();
+
+        opts.cancel = cancel;
+        active_cancel = cancel.get();
+        std::signal(SIGINT, [](int) {
+            if (cancel_token* token = active_cancel.load()) token->cancel();
+        });
+        return opts;
+    }
+
+    void add_parameters(argumentum::ParameterConfig& params)
+    {
+        params.add_parameter(max_inflight, "--max-inflight").maxargs(1)
+            .help("Chunks read but not yet written out (default 2 per worker thread)");
+        params.add_parameter(max_memory, "--max-memory").maxargs(1)
+            .help("Approximate cap on chunk buffers in flight, accepts K/M/G suffixes (default unlimited)");
+        params.add_parameter(progress, "-p", "--progress").nargs(0)
+            .help("Show progress, throughput and ETA on stderr");
+        params.add_parameter(numa, "--numa").nargs(0)
+            .help("Pin workers to CPUs node by node, keep table copies per NUMA node and chunk buffers on huge pages");
+        params.add_parameter(max_read_rate, "--max-read-rate").maxargs(1)
+            .help("Cap on input reads per second, accepts K/M/G suffixes (default uncapped)");
+        params.add_parameter(max_write_rate, "--max-write-rate").maxargs(1)
+            .help("Cap on output writes per second, accepts K/M/G suffixes (default uncapped)");
+        params.add_parameter(max_cpu, "--max-cpu").maxargs(1)
+            .help("Percent of their time workers may spend busy, they idle the rest (default 100)");
+        params.add_parameter(low_priority, "--low-priority").nargs(0)
+            .help("Run workers at the lowest CPU and I/O priority");
+        params.add_parameter(checkpoint, "--checkpoint").maxargs(1)
+            .help("Save progress next to the output every this many seconds, a cancelled run keeps its output (default off)");
+        params.add_parameter(resume, "--resume").nargs(0)
+            .help("Carry on from the checkpoint a cancelled or killed run of the same input left (checkpoints every 60s)");
+        params.add_parameter(stages, "--stages").nargs(0)
+            .help("Print how busy the read, code and write stages were, the busiest one is the bottleneck");
+        params.add_parameter(counters, "--perf-counters").nargs(0)
+            .help("Print IPC and cache/branch misses per byte of the histogram, encode and decode kernels");
+        params.add_parameter(trace_file, "--trace").maxargs(1)
+            .help("Write a Chrome trace JSON timeline of every thread to this file");
+    }
+
+    // Cancelled runs with checkpoints leave their output behind to carry on from
+    [[nodiscard]] const char* cancel_note() const
+    {
+        return checkpoint || resume ? " Run it again with --resume to carry on." : "";
+    }
+
+    // Whatever of --stages and --perf-counters was asked for
+    void print_stats(const huffman_codec& hmc) const
+    {
+        if (perf) perf->write_report(std::cerr);
+        if (!stages) return;
+        const pipeline_stats stats = hmc.stats();
+        std::cerr << std::fixed << std::setprecision(1) << "Stages over " << stats.seconds << "s:";
+        for (const auto& [name, stage] : {std::pair{"read", stats.read}, {"code", stats.code}, {"write", stats.write}}) {
+            if (stage.threads == 0) continue;
+            std::cerr << "  " << name << ' ' << 100 * stage.utilization(stats.seconds) << "% of " << stage.threads
+                      << (stage.threads == 1 ? " thread" : " threads");
+        }
+        std::cerr << std::endl;
+    }
+
+    // Once the run is over, the workers are idle by then
+    void write_trace() const
+    {
+        if (trace) trace->write_json(*trace_file);
+    }
+
+private:
+    std::shared_ptr<trace_recorder> trace;
+    std::shared_ptr<perf_counters> perf;
+};
 
 class EncodeOptions : public argumentum::CommandOptions
 {
@@ -8,14 +182,40 @@ public:
     std::string in_file;
     std::optional<std::string> out_file;
     std::optional<std::string> table_file;
+    std::optional<std::string> backend;
+    std::optional<std::string> chunk_size;
+    std::optional<std::string> sync_interval;
+    std::optional<size_t> context_tables;
+    std::optional<std::string> columns;
+    bool dedup = false;
+    bool frame = false;
+    RunOptions run;
 
     explicit EncodeOptions(std::string_view name) : CommandOptions(name) {}
 
     void execute(const argumentum::ParseResult& res) override
     {
         try {
-            huffman_codec hmc;
-            hmc.encode(in_file, out_file, table_file);
+            codec_options opts = run.to_codec_options();
+            opts.chunk_size = chunk_size ? parse_size(*chunk_size) : 0;
+            if (sync_interval)
+                opts.sync_interval = parse_size(*sync_interval) == 0 ? SIZE_MAX : parse_size(*sync_interval);
+            opts.context_tables = context_tables.value_or(0);
+            if (columns) opts.column_delimiter = parse_delimiter(*columns);
+            opts.dedup = dedup;
+            opts.framed = frame;
+
+            huffman_codec hmc(opts);
+            const std::string coder = backend.value_or("huffman");
+            hmc.encode(in_file, out_file, table_file,
+                       coder == "tans" ? huffman_codec::Backend::TANS
+                       : coder == "tunstall" ? huffman_codec::Backend::Tunstall : huffman_codec::Backend::Huffman);
+            run.print_stats(hmc);
+            run.write_trace();
+        }
+        catch (const codec_cancelled&) {
+            std::cout << std::endl << "Encode cancelled." << run.cancel_note() << std::endl;
+            std::exit(130);
         }
         catch (const std::exception& e) {
             std::cout << "ENCODE FAILED: " << e.what() << std::endl
@@ -31,6 +231,21 @@ protected:
         params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input text file");
         params.add_parameter(out_file, "-o").maxargs(1).help("Output binary file");
         params.add_parameter(table_file, "-t").maxargs(1).help("Output table text file");
+        params.add_parameter(backend, "-b", "--backend").maxargs(1).choices({"huffman", "tans", "tunstall"})
+            .help("Entropy coder backend (default huffman), tunstall decodes fastest");
+        params.add_parameter(chunk_size, "--chunk-size").maxargs(1)
+            .help("Fixed chunk size, accepts K/M/G suffixes (default from the cache size and saved autotune results)");
+        params.add_parameter(sync_interval, "--sync-interval").maxargs(1)
+            .help("Input bytes between decode sync points, 0 writes none (default 64K)");
+        params.add_parameter(context_tables, "--context-tables").maxargs(1)
+            .help("Order-1 huffman with up to this many code tables picked by the previous byte, at most 16 (default 0, order-0)");
+        params.add_parameter(columns, "--columns").maxargs(1)
+            .help("Code each field of delimited records (CSV, TSV, logs) with a table of its own, split on this byte (tab for tabs)");
+        params.add_parameter(dedup, "--dedup").nargs(0)
+            .help("Store chunks identical to an earlier one as a reference to it");
+        params.add_parameter(frame, "--frame").nargs(0)
+            .help("Write a self-contained frame with the table inside the .bin, frames can be concatenated with cat");
+        run.add_parameters(params);
     }
 };
 
@@ -40,14 +255,21 @@ public:
     std::string in_file;
     std::optional<std::string> out_file;
     std::string table_file;
+    RunOptions run;
 
     explicit DecodeOptions(std::string_view name) : CommandOptions(name) {}
 
     void execute(const argumentum::ParseResult& res) override
     {
         try {
-            huffman_codec hmc;
-            hmc.decode(in_file, out_file, table_file);
+            huffman_codec hmc(run.to_codec_options());
+            hmc.decode(in_file, out_file, table_arg(table_file));
+            run.print_stats(hmc);
+            run.write_trace();
+        }
+        catch (const codec_cancelled&) {
+            std::cout << std::endl << "Decode cancelled." << run.cancel_note() << std::endl;
+            std::exit(130);
         }
         catch (const std::exception& e) {
             std::cout << "DECODE FAILED: " << e.what() << std::endl
@@ -61,8 +283,413 @@ protected:
     void add_parameters(argumentum::ParameterConfig& params) override
     {
         params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input binary file");
-        params.add_parameter(table_file, "TABLE_FILE").nargs(1).help("Input table text file");
+        params.add_parameter(table_file, "TABLE_FILE").nargs(1).help("Input table text file, - for framed input");
         params.add_parameter(out_file, "-o").maxargs(1).help("Output text file");
+        run.add_parameters(params);
+    }
+};
+
+class SearchOptions: public argumentum::CommandOptions
+{
+public:
+    std::string pattern;
+    std::string in_file;
+    std::string table_file;
+    bool line_numbers = false;
+    RunOptions run;
+
+    explicit SearchOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        size_t count = 0;
+        try {
+            // grep style "offset:text", or "line:offset:text" with -n
+            huffman_codec hmc(run.to_codec_options());
+            hmc.search(in_file, table_arg(table_file), pattern, [&](const search_match& m) {
+                if (line_numbers) std::cout << m.line << ':';
+                std::cout << m.offset << ':' << m.text << '\n';
+                ++count;
+            });
+            run.print_stats(hmc);
+            run.write_trace();
+        }
+        catch (const codec_cancelled&) {
+            std::cout << std::endl << "Search cancelled." << std::endl;
+            std::exit(130);
+        }
+        catch (const std::exception& e) {
+            std::cout << "SEARCH FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(3);
+        }
+
+        std::cerr << count << " matching lines" << std::endl;
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(pattern, "PATTERN").nargs(1)
+            .help("Literal to look for, a leading ^ or trailing $ anchors it to the line start/end");
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input binary file");
+        params.add_parameter(table_file, "TABLE_FILE").nargs(1).help("Input table text file, - for framed input");
+        params.add_parameter(line_numbers, "-n").nargs(0).help("Prefix every match with its line number");
+        run.add_parameters(params);
+    }
+};
+
+class LinesOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::string table_file;
+    uint64_t first_line = 1;
+    std::optional<uint64_t> count;
+
+    explicit LinesOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        try {
+            huffman_codec hmc;
+            hmc.read_lines(in_file, table_arg(table_file), first_line, count.value_or(1), std::cout);
+        }
+        catch (const std::exception& e) {
+            std::cout << "LINES FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(3);
+        }
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input binary file");
+        params.add_parameter(table_file, "TABLE_FILE").nargs(1).help("Input table text file, - for framed input");
+        params.add_parameter(first_line, "FIRST_LINE").nargs(1).help("First line to print, counted from 1");
+        params.add_parameter(count, "-c", "--count").maxargs(1).help("Lines to print (default 1)");
+    }
+};
+
+class CutOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::string table_file;
+    std::string fields;
+
+    explicit CutOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        try {
+            // 1,3-4 like cut -f, fields are counted from 1 here and from 0 by the codec
+            std::vector<size_t> columns;
+            std::stringstream list(fields);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                const auto dash = item.find('-');
+                const size_t first = std::stoul(item.substr(0, dash));
+                const size_t last = dash == std::string::npos ? first : std::stoul(item.substr(dash + 1));
+                if (first == 0 || last < first) {
+                    throw std::invalid_argument("Fields are counted from 1, bad field list: " + fields);
+                }
+                for (size_t f = first; f <= last; ++f)
+                    columns.push_back(f - 1);
+            }
+
+            huffman_codec hmc;
+            hmc.read_columns(in_file, table_arg(table_file), columns, std::cout);
+        }
+        catch (const std::exception& e) {
+            std::cout << "CUT FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(3);
+        }
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input binary file, encoded with --columns");
+        params.add_parameter(table_file, "TABLE_FILE").nargs(1).help("Input table text file, - for framed input");
+        params.add_parameter(fields, "-f", "--fields").nargs(1).required(true)
+            .help("Fields to print, counted from 1, like cut: 2 or 1,3-4");
+    }
+};
+
+class PackOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::string out_file;
+
+    explicit PackOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        size_t count = 0;
+        try {
+            std::ifstream ifs(in_file, std::ios::binary);
+            if (!ifs) {
+                throw std::invalid_argument("Cannot open input file.");
+            }
+            std::ofstream ofs(out_file, std::ios::binary);
+            if (!ofs) {
+                throw std::invalid_argument("Cannot open output file to write.");
+            }
+            // Lines are read twice, for the table and then a part at a time for coding, never all at once
+            count = record_store::write(ifs, ofs);
+        }
+        catch (const std::exception& e) {
+            std::cout << "PACK FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(2);
+        }
+
+        std::cout << "Packed " << count << " records.";
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input text file, one record per line");
+        params.add_parameter(out_file, "-o").nargs(1).required(true).help("Output record store");
+    }
+};
+
+class GetOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::vector<uint64_t> ids;
+
+    explicit GetOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        try {
+            const record_store store(in_file);
+            for (const auto& record : store.get_batch(ids))
+                std::cout << record << '\n';
+            std::cout << std::flush;
+        }
+        catch (const std::exception& e) {
+            std::cout << "GET FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(3);
+        }
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "STORE_FILE").nargs(1).help("Input record store, written by pack");
+        params.add_parameter(ids, "IDS").minargs(1).help("Records to print, one per line, counted from 0");
+    }
+};
+
+class AppendOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::string bin_file;
+    std::string table_file;
+    std::optional<double> max_drift;
+    RunOptions run;
+
+    explicit AppendOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        try {
+            codec_options opts = run.to_codec_options();
+            opts.max_drift = max_drift.value_or(0) / 100;
+
+            huffman_codec hmc(opts);
+            const append_result result = hmc.append(in_file, bin_file, table_file);
+            run.print_stats(hmc);
+            run.write_trace();
+
+            if (result.reencoded)
+                std::cout << "Table drifted " << std::fixed << std::setprecision(1) << 100 * result.drift
+                          << "% from the new data, encoded the whole file again.";
+            else if (result.bytes == 0)
+                std::cout << "Nothing new to append.";
+            else
+                std::cout << "Appended " << result.bytes << " bytes (table drift " << std::fixed
+                          << std::setprecision(1) << 100 * result.drift << "%).";
+        }
+        catch (const codec_cancelled&) {
+            std::cout << std::endl << "Append cancelled, encode the file again." << std::endl;
+            std::exit(130);
+        }
+        catch (const std::exception& e) {
+            std::cout << "APPEND FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(2);
+        }
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Text file that grew since it was encoded");
+        params.add_parameter(bin_file, "BIN_FILE").nargs(1).help("Binary file encoded from it, grown in place");
+        params.add_parameter(table_file, "TABLE_FILE").nargs(1).help("Table text file of the binary file");
+        params.add_parameter(max_drift, "--max-drift").maxargs(1)
+            .help("Percent the table may code the new data worse than a fresh one before re-encoding (default 5)");
+        run.add_parameters(params);
+    }
+};
+
+class VerifyOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::optional<std::string> table_file;
+    bool decode = false;
+    RunOptions run;
+
+    explicit VerifyOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        verify_result result;
+        try {
+            huffman_codec hmc(run.to_codec_options());
+            result = hmc.verify(in_file, table_file ? table_arg(*table_file) : std::string_view{}, decode);
+            run.print_stats(hmc);
+            run.write_trace();
+        }
+        catch (const codec_cancelled&) {
+            std::cout << std::endl << "Verify cancelled." << std::endl;
+            std::exit(130);
+        }
+        catch (const std::exception& e) {
+            std::cout << "VERIFY FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(3);
+        }
+
+        for (const uint64_t chunk : result.corrupt_chunks)
+            std::cout << "chunk " << chunk << ": payload checksum mismatch\n";
+        for (const uint64_t chunk : result.mismatched_chunks)
+            std::cout << "chunk " << chunk << ": decodes to something other than was encoded\n";
+        std::cout << result.chunks << " chunks, "
+                  << result.corrupt_chunks.size() + result.mismatched_chunks.size() << " bad." << std::endl;
+        if (!result.ok()) std::exit(4);
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Input binary file");
+        params.add_parameter(table_file, "-t", "--table").maxargs(1)
+            .help("Input table text file, only needed with --decode and not for framed input");
+        params.add_parameter(decode, "--decode").nargs(0)
+            .help("Decode every chunk as well and check it against the checksum of what was encoded");
+        run.add_parameters(params);
+    }
+};
+
+class AutotuneOptions: public argumentum::CommandOptions
+{
+public:
+    std::string in_file;
+    std::optional<std::string> out_file;
+
+    explicit AutotuneOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        try {
+            std::ifstream ifs(in_file, std::ios::binary);
+            if (!ifs.is_open()) {
+                throw std::invalid_argument("Provided input file path does not exist: " + in_file);
+            }
+            const std::string sample{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+
+            std::cout << "Tuning on " << worker_pool::shared()->size() << " workers, L2 cache "
+                      << chunk_tuner::cache_size() / 1024 << " KB" << std::endl;
+            const chunk_tuning tuning = chunk_tuner::autotune(sample, [](const chunk_tuner::measurement& m) {
+                std::cout << "  chunk " << std::setw(6) << m.chunk_size / 1024 << " KB";
+                if (m.chunks_per_worker != 0)
+                    std::cout << ", " << std::setw(2) << m.chunks_per_worker << " per worker";
+                std::cout << ": " << std::fixed << std::setprecision(1) << m.mb_per_s << " MB/s" << std::endl;
+            });
+
+            const std::filesystem::path path = out_file ? std::filesystem::path(*out_file) : chunk_tuner::default_path();
+            chunk_tuner::save(tuning, path);
+            std::cout << "Best: chunks up to " << tuning.max_chunk / 1024 << " KB, " << tuning.chunks_per_worker
+                      << " per worker. Saved to " << path.string() << std::endl;
+        }
+        catch (const std::exception& e) {
+            std::cout << "AUTOTUNE FAILED: " << e.what() << std::endl
+                      << "Terminating..." << std::endl;
+            std::exit(2);
+        }
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Sample text file to tune on");
+        params.add_parameter(out_file, "-o").maxargs(1)
+            .help("Tuning file to write (default HUFFMANCODEC_TUNING or the user config directory)");
+    }
+};
+
+class ServeOptions: public argumentum::CommandOptions
+{
+public:
+    std::string socket_path;
+    std::optional<unsigned> threads;
+    std::optional<std::string> max_request;
+
+    explicit ServeOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        try {
+            const uint64_t limit = max_request ? parse_size(*max_request) : SERVE_MAX_REQUEST;
+            if (const int rc = run_serve(socket_path, threads.value_or(0), limit); rc != 0)
+                std::exit(rc);
+        }
+        catch (const std::exception& e) {
+            std::cout << e.what() << std::endl;
+            std::exit(1);
+        }
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(socket_path, "SOCKET").nargs(1).help("Unix domain socket path to listen on");
+        params.add_parameter(threads, "-j").maxargs(1).help("Worker threads (default hardware concurrency)");
+        params.add_parameter(max_request, "--max-request").maxargs(1)
+            .help("Largest table or payload a request may carry, e.g. 64M (default 256M)");
+    }
+};
+
+class LoadgenOptions: public argumentum::CommandOptions
+{
+public:
+    std::string socket_path;
+    std::string in_file;
+    std::optional<size_t> requests;
+    std::optional<unsigned> concurrency;
+    bool decode = false;
+    bool shm = false;
+
+    explicit LoadgenOptions(std::string_view name) : CommandOptions(name) {}
+
+    void execute(const argumentum::ParseResult& res) override
+    {
+        if (const int rc = run_loadgen(socket_path, in_file, requests.value_or(1000), concurrency.value_or(4), decode, shm); rc != 0)
+            std::exit(rc);
+    }
+protected:
+    void add_parameters(argumentum::ParameterConfig& params) override
+    {
+        params.add_parameter(socket_path, "SOCKET").nargs(1).help("Socket of a running serve instance");
+        params.add_parameter(in_file, "INPUT_FILE").nargs(1).help("Payload sent with every request");
+        params.add_parameter(requests, "-n").maxargs(1).help("Total requests (default 1000)");
+        params.add_parameter(concurrency, "-c").maxargs(1).help("Concurrent connections (default 4)");
+        params.add_parameter(decode, "--decode").nargs(0).help("Send decode requests instead of encode");
+        params.add_parameter(shm, "--shm").nargs(0).help("Pass payloads through shared memory");
     }
 };
 
@@ -74,6 +701,16 @@ int init_cli( int argc, char** argv )
     parser.config().program( argv[0] ).description( "huffman_codec" );
     params.add_command<EncodeOptions>("encode").help("Encode a text file to binary");
     params.add_command<DecodeOptions>("decode").help("Decode a binary file to text");
+    params.add_command<SearchOptions>("search").help("Print the lines of a binary file matching a pattern, without decoding it to disk");
+    params.add_command<LinesOptions>("lines").help("Print a range of lines of a binary file, decoding only around them");
+    params.add_command<CutOptions>("cut").help("Print some fields of a column coded binary file, decoding only those columns");
+    params.add_command<PackOptions>("pack").help("Pack the lines of a text file into a record store sharing one table");
+    params.add_command<GetOptions>("get").help("Print records of a record store by ID");
+    params.add_command<AppendOptions>("append").help("Encode what a text file gained since it was encoded onto its binary file");
+    params.add_command<VerifyOptions>("verify").help("Check every chunk of a binary file against its checksums");
+    params.add_command<AutotuneOptions>("autotune").help("Measure the best chunk sizes on this machine and save them");
+    params.add_command<ServeOptions>("serve").help("Serve encode/decode requests over a Unix domain socket");
+    params.add_command<LoadgenOptions>("loadgen").help("Benchmark a running serve instance");
 
     auto res = parser.parse_args( argc, argv, 1 );
     if ( !res )
@@ -0,0 +1,468 @@
+#include "serve.h"
+#include "huffman_codec.h"
+
+#include <set>
+#include <span>
+#include <chrono>
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <spanstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) { stop_requested = 1; }
+
+static bool read_full(int fd, void* buf, size_t len)
+{
+    auto* p = static_cast<char*>(buf);
+    while (len > 0) {
+        const ssize_t n = ::read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* buf, size_t len)
+{
+    const auto* p = static_cast<const char*>(buf);
+    while (len > 0) {
+        const ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static int connect_socket(const std::string& socket_path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("Socket path is too long: " + socket_path);
+    }
+    std::ranges::copy(socket_path, addr.sun_path);
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Cannot connect to " + socket_path);
+    }
+    return fd;
+}
+
+// Mapping of a POSIX shared memory object, unmapped (not unlinked) when it goes out of scope
+class shm_mapping {
+public:
+    shm_mapping(const std::string& name, size_t len, bool create) : len{len}
+    {
+        // A new object only, never one that's already there
+        const int fd = ::shm_open(name.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDONLY, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open shared memory object " + name);
+        }
+        if (create && ::ftruncate(fd, static_cast<off_t>(len)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot size shared memory object " + name);
+        }
+        // Pages past the end of a shorter object would fault on first touch instead of failing here
+        struct stat st{};
+        if (!create && (::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < len)) {
+            ::close(fd);
+            throw std::invalid_argument("Shared memory object " + name + " is smaller than shm_len.");
+        }
+        if (len > 0) {
+            addr = ::mmap(nullptr, len, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("Cannot map shared memory object " + name);
+        }
+    }
+    ~shm_mapping() { if (addr && addr != MAP_FAILED) ::munmap(addr, len); }
+
+    shm_mapping(const shm_mapping&) = delete;
+    shm_mapping& operator=(const shm_mapping&) = delete;
+
+    [[nodiscard]] std::span<char> data() const { return {static_cast<char*>(addr), len}; }
+
+private:
+    void* addr = nullptr;
+    size_t len;
+};
+
+struct serve_reply {
+    serve_status status = serve_status::Ok;
+    uint8_t flags = 0;
+    std::string table;
+    std::string payload;
+    uint64_t shm_len = 0;
+};
+
+struct serve_state {
+    std::shared_ptr<worker_pool> pool;
+    uint64_t max_request = SERVE_MAX_REQUEST;
+
+    // Table files named by path are parsed once and their decode tables reused until they change on disk, or a
+    // .bin of another kind (the backend, flags and delimiter bytes of its header) names them
+    struct cached_table {
+        std::filesystem::file_time_type mtime;
+        std::string kind;
+        std::shared_ptr<const huffman_codec::decode_tables> tables;
+    };
+    std::mutex cache_mtx;
+    std::map<std::string, cached_table> table_cache;
+
+    std::mutex conn_mtx;
+    std::condition_variable conn_cv;
+    std::set<int> connections;
+};
+
+static std::shared_ptr<const huffman_codec::decode_tables> cached_tables(serve_state& state, const std::string& path,
+                                                                        std::span<const char> payload)
+{
+    const auto abs = std::filesystem::absolute(path).string();
+    const auto mtime = std::filesystem::last_write_time(abs);
+    const std::string kind(payload.data() + std::min<size_t>(payload.size(), 5), payload.size() >= 8 ? 3 : 0);
+
+    std::lock_guard<std::mutex> lock(state.cache_mtx);
+    auto it = state.table_cache.find(abs);
+    if (it == state.table_cache.end() || it->second.mtime != mtime || it->second.kind != kind) {
+        std::ifstream ifs(abs, std::ios::binary);
+        if (!ifs) {
+            throw std::invalid_argument("Cannot open table file " + abs);
+        }
+        std::ispanstream input(payload);
+        auto tables = huffman_codec({}, state.pool).load_tables(input, ifs);
+        it = state.table_cache.insert_or_assign(abs, serve_state::cached_table{mtime, kind, std::move(tables)}).first;
+    }
+    return it->second.tables;
+}
+
+static serve_reply run_request(serve_state& state, const serve_header& hdr, const std::string& table,
+                               std::span<const char> payload)
+{
+    serve_reply reply;
+    std::ispanstream input(payload);
+    std::ostringstream output(std::ios::binary);
+
+    huffman_codec hmc({}, state.pool);
+    if (static_cast<serve_op>(hdr.op) == serve_op::Encode) {
+        std::ostringstream table_out;
+        hmc.encode(input, output, table_out, static_cast<huffman_codec::Backend>(hdr.backend));
+        reply.table = std::move(table_out).str();
+    } else {
+        if (hdr.flags & SERVE_TABLE_PATH) {
+            hmc.decode(input, output, cached_tables(state, table, payload));
+        } else {
+            std::istringstream table_in(table);
+            hmc.decode(input, output, table_in);
+        }
+    }
+    reply.payload = std::move(output).str();
+    return reply;
+}
+
+static serve_reply handle_request(serve_state& state, const serve_header& hdr, const std::string& table,
+                                  const std::string& payload)
+{
+    const auto op = static_cast<serve_op>(hdr.op);
+    if (op == serve_op::Ping) return {};
+    if (op != serve_op::Encode && op != serve_op::Decode) {
+        throw std::invalid_argument("Unknown request op.");
+    }
+    if (hdr.backend > static_cast<uint8_t>(huffman_codec::Backend::Tunstall)) {
+        throw std::invalid_argument("Unknown backend.");
+    }
+
+    if (!(hdr.flags & SERVE_SHM))
+        return run_request(state, hdr, table, payload);
+
+    // Payload section only names the object, the data itself never goes through the socket. Only our own names,
+    // so a client can't have the reply written over some other object the server's user owns
+    if (!payload.starts_with(SERVE_SHM_PREFIX) || payload.find('/', 1) != std::string::npos) {
+        throw std::invalid_argument("Shared memory object names must start with " + std::string(SERVE_SHM_PREFIX) +
+                                    " and hold no other '/'.");
+    }
+    serve_reply reply;
+    {
+        const shm_mapping in(payload, hdr.shm_len, false);
+        reply = run_request(state, hdr, table, in.data());
+    }
+    if (reply.payload.size() > state.max_request) {
+        throw std::invalid_argument("Reply is over the " + std::to_string(state.max_request) + " byte limit.");
+    }
+    const std::string out_name = payload + "-r";
+    const shm_mapping out(out_name, reply.payload.size(), true);
+    std::ranges::copy(reply.payload, out.data().begin());
+
+    reply.flags = SERVE_SHM;
+    reply.shm_len = reply.payload.size();
+    reply.payload = out_name;
+    return reply;
+}
+
+static bool send_reply(int fd, const serve_header& hdr, const serve_reply& reply)
+{
+    serve_header res{{'H', 'M', 'C', 'R'}, static_cast<uint8_t>(reply.status), hdr.backend, reply.flags, 0,
+                     static_cast<uint32_t>(reply.table.size()), 0, reply.payload.size(), reply.shm_len};
+    return write_full(fd, &res, sizeof(res)) && write_full(fd, reply.table.data(), reply.table.size()) &&
+           write_full(fd, reply.payload.data(), reply.payload.size());
+}
+
+static void serve_connection(serve_state& state, int fd)
+{
+    serve_header hdr{};
+    while (read_full(fd, &hdr, sizeof(hdr))) {
+        if (!std::equal(hdr.magic, hdr.magic + 4, "HMCQ")) break;
+
+        // Sizes come straight from the client, so check them before allocating anything. The sections of an
+        // oversized request are never read, which leaves the stream out of step, so the connection goes after the reply
+        if (hdr.table_len > state.max_request || hdr.payload_len > state.max_request || hdr.shm_len > state.max_request) {
+            send_reply(fd, hdr, {serve_status::Error, 0, {}, "Request is over the " + std::to_string(state.max_request) +
+                                 " byte limit.", 0});
+            break;
+        }
+
+        std::string table(hdr.table_len, '\0');
+        std::string payload(hdr.payload_len, '\0');
+        if (!read_full(fd, table.data(), table.size()) || !read_full(fd, payload.data(), payload.size())) break;
+
+        serve_reply reply;
+        try {
+            reply = handle_request(state, hdr, table, payload);
+        }
+        catch (const std::exception& e) {
+            reply = {serve_status::Error, 0, {}, e.what(), 0};
+        }
+        if (!send_reply(fd, hdr, reply)) break;
+    }
+
+    // Closed under the lock, or accept could hand the same fd number to a new connection before it's erased here
+    std::lock_guard<std::mutex> lock(state.conn_mtx);
+    state.connections.erase(fd);
+    ::close(fd);
+    state.conn_cv.notify_all();
+}
+
+void stop_serve()
+{
+    stop_requested = 1;
+}
+
+int run_serve(const std::string& socket_path, unsigned threads, uint64_t max_request)
+{
+    stop_requested = 0;
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+
+    serve_state state;
+    state.pool = std::make_shared<worker_pool>(threads ? threads : std::thread::hardware_concurrency());
+    state.max_request = max_request;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Socket path is too long: " << socket_path << std::endl;
+        return 1;
+    }
+    std::ranges::copy(socket_path, addr.sun_path);
+
+    const int lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(socket_path.c_str());
+    if (lfd < 0 || ::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(lfd, SOMAXCONN) != 0) {
+        std::cout << "Cannot listen on " << socket_path << std::endl;
+        if (lfd >= 0) ::close(lfd);
+        return 1;
+    }
+
+    std::cout << "Serving on " << socket_path << " with " << state.pool->size() << " workers" << std::endl;
+
+    while (!stop_requested) {
+        pollfd pfd{lfd, POLLIN, 0};
+        if (::poll(&pfd, 1, 200) <= 0) continue;
+
+        const int cfd = ::accept(lfd, nullptr, nullptr);
+        if (cfd < 0) continue;
+
+        std::lock_guard<std::mutex> lock(state.conn_mtx);
+        state.connections.insert(cfd);
+        std::thread(serve_connection, std::ref(state), cfd).detach();
+    }
+
+    ::close(lfd);
+    ::unlink(socket_path.c_str());
+
+    // Kick idle clients off and wait for in-flight requests to finish
+    std::unique_lock<std::mutex> lock(state.conn_mtx);
+    for (const int fd : state.connections)
+        ::shutdown(fd, SHUT_RDWR);
+    state.conn_cv.wait(lock, [&state]() {return state.connections.empty();});
+    return 0;
+}
+
+static bool roundtrip(int fd, const serve_header& hdr, const std::string& table, std::string_view payload,
+                      serve_header& res, std::string& res_table, std::string& res_payload)
+{
+    if (!write_full(fd, &hdr, sizeof(hdr)) || !write_full(fd, table.data(), table.size()) ||
+        !write_full(fd, payload.data(), payload.size()) || !read_full(fd, &res, sizeof(res))) return false;
+
+    res_table.resize(res.table_len);
+    res_payload.resize(res.payload_len);
+    return read_full(fd, res_table.data(), res_table.size()) && read_full(fd, res_payload.data(), res_payload.size());
+}
+
+int run_loadgen(const std::string& socket_path, const std::string& input_file, size_t requests, unsigned concurrency,
+                bool decode, bool use_shm)
+{
+    std::signal(SIGPIPE, SIG_IGN);
+    concurrency = std::max(1u, concurrency);
+
+    std::ifstream ifs(input_file, std::ios::binary);
+    if (!ifs) {
+        std::cout << "Cannot read " << input_file << std::endl;
+        return 1;
+    }
+    std::string payload((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::string table;
+    serve_op op = serve_op::Encode;
+
+    if (decode) {
+        // Decode runs replay the server's own encoding of the input
+        const int fd = connect_socket(socket_path);
+        serve_header hdr{{'H', 'M', 'C', 'Q'}, static_cast<uint8_t>(serve_op::Encode), 0, 0, 0, 0, 0, payload.size(), 0};
+        serve_header res{};
+        std::string res_payload;
+        const bool ok = roundtrip(fd, hdr, {}, payload, res, table, res_payload);
+        ::close(fd);
+        if (!ok || res.op != static_cast<uint8_t>(serve_status::Ok)) {
+            std::cout << "Priming encode failed: " << res_payload << std::endl;
+            return 1;
+        }
+        payload = std::move(res_payload);
+        op = serve_op::Decode;
+    }
+
+    std::vector<std::vector<double>> latencies(concurrency);
+    std::atomic_size_t errors = 0;
+    std::vector<std::thread> clients;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < concurrency; ++t) {
+        const size_t count = requests / concurrency + (t < requests % concurrency ? 1 : 0);
+        clients.emplace_back([&, t, count]() {
+            int fd = -1;
+            try {
+                fd = connect_socket(socket_path);
+            }
+            catch (const std::exception& e) {
+                std::cout << e.what() << std::endl;
+                errors += count;
+                return;
+            }
+
+            std::string shm_name;
+            std::unique_ptr<shm_mapping> shm;
+            if (use_shm) {
+                shm_name = SERVE_SHM_PREFIX + ("loadgen-" + std::to_string(::getpid()) + "-" + std::to_string(t));
+                // Left over from a run that was killed
+                ::shm_unlink(shm_name.c_str());
+                ::shm_unlink((shm_name + "-r").c_str());
+                try {
+                    shm = std::make_unique<shm_mapping>(shm_name, payload.size(), true);
+                }
+                catch (const std::exception& e) {
+                    std::cout << e.what() << std::endl;
+                    errors += count;
+                    ::close(fd);
+                    return;
+                }
+                std::ranges::copy(payload, shm->data().begin());
+            }
+
+            serve_header hdr{{'H', 'M', 'C', 'Q'}, static_cast<uint8_t>(op), 0,
+                             static_cast<uint8_t>(use_shm ? SERVE_SHM : 0), 0, static_cast<uint32_t>(table.size()), 0,
+                             use_shm ? shm_name.size() : payload.size(), use_shm ? payload.size() : 0};
+            const std::string_view body = use_shm ? std::string_view(shm_name) : std::string_view(payload);
+
+            serve_header res{};
+            std::string res_table, res_payload;
+            for (size_t i = 0; i < count; ++i) {
+                const auto req_start = std::chrono::steady_clock::now();
+                const bool ok = roundtrip(fd, hdr, table, body, res, res_table, res_payload);
+                if (ok && res.flags & SERVE_SHM) {
+                    const shm_mapping out(res_payload, res.shm_len, false);
+                    ::shm_unlink(res_payload.c_str());
+                }
+                const auto req_stop = std::chrono::steady_clock::now();
+
+                if (!ok || res.op != static_cast<uint8_t>(serve_status::Ok)) {
+                    ++errors;
+                    if (!ok) break;
+                    continue;
+                }
+                latencies[t].push_back(std::chrono::duration<double, std::milli>(req_stop - req_start).count());
+            }
+
+            if (use_shm) ::shm_unlink(shm_name.c_str());
+            ::close(fd);
+        });
+    }
+    for (auto&& c : clients)
+        c.join();
+    const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const auto& l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::ranges::sort(all);
+
+    auto percentile = [&all](double p) {
+        return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(p * static_cast<double>(all.size())))];
+    };
+
+    const double mb = static_cast<double>(payload.size()) * static_cast<double>(all.size()) / (1024 * 1024);
+    std::cout << std::fixed << std::setprecision(3)
+              << (decode ? "decode" : "encode") << " requests: " << all.size() << " ok, " << errors << " failed" << std::endl
+              << "latency ms: p50 " << percentile(0.50) << ", p99 " << percentile(0.99)
+              << ", max " << (all.empty() ? 0.0 : all.back()) << std::endl
+              << "throughput: " << static_cast<double>(all.size()) / wall_s << " req/s, " << mb / wall_s << " MB/s"
+              << std::endl;
+    return errors == 0 ? 0 : 2;
+}
+
+#else
+
+int run_serve(const std::string&, unsigned, uint64_t)
+{
+    std::cout << "serve needs Unix domain sockets, which this platform doesn't have." << std::endl;
+    return 1;
+}
+
+int run_loadgen(const std::string&, const std::string&, size_t, unsigned, bool, bool)
+{
+    std::cout << "loadgen needs Unix domain sockets, which this platform doesn't have." << std::endl;
+    return 1;
+}
+
+void stop_serve() {}
+
+#endif
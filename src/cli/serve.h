@@ -0,0 +1,51 @@
+#ifndef HUFFMANCODEC_SERVE_H
+#define HUFFMANCODEC_SERVE_H
+
+#include <string>
+#include <cstdint>
+
+/*
+ * Wire protocol of `huffman_codec serve`. Requests and responses share one fixed header, followed by a table
+ * section and a payload section whose sizes the header carries. Integers are in host byte order since the socket
+ * never leaves the machine.
+ *
+ * Encode: payload is the text, the response carries the table in its table section and the .bin in its payload.
+ * Decode: table section is the table text (or a path on the server with SERVE_TABLE_PATH, whose decode tables are
+ *         cached by path and mtime so the file is neither read nor parsed again), payload is the .bin, the response
+ *         payload is the text.
+ * With SERVE_SHM the payload section only names a POSIX shared memory object of shm_len bytes holding the data,
+ * starting with SERVE_SHM_PREFIX and with no other '/'. The server answers in a new object with "-r" appended to
+ * that name, which must not exist yet and which the client unlinks after reading. Replies over max_request fail.
+ * Table, payload and shm_len over the server's max_request get an error response and the connection is closed.
+ */
+enum class serve_op : uint8_t {Encode = 1, Decode = 2, Ping = 3};
+enum class serve_status : uint8_t {Ok = 0, Error = 1};
+
+constexpr uint8_t SERVE_TABLE_PATH = 1;
+constexpr uint8_t SERVE_SHM = 2;
+// Every shared memory object name serve reads from or replies in starts with this
+constexpr const char* SERVE_SHM_PREFIX = "/hmc-";
+
+struct serve_header {
+    char magic[4];          // "HMCQ" on requests, "HMCR" on responses
+    uint8_t op;             // serve_op on requests, serve_status on responses
+    uint8_t backend;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t table_len;
+    uint32_t reserved2;
+    uint64_t payload_len;
+    uint64_t shm_len;
+};
+static_assert(sizeof(serve_header) == 32);
+
+// Largest table, payload or shared memory object serve takes by default
+constexpr uint64_t SERVE_MAX_REQUEST = 256ull << 20;
+
+int run_serve(const std::string& socket_path, unsigned threads, uint64_t max_request = SERVE_MAX_REQUEST);
+// Makes a running run_serve return, like SIGINT/SIGTERM do
+void stop_serve();
+int run_loadgen(const std::string& socket_path, const std::string& input_file, size_t requests, unsigned concurrency,
+                bool decode, bool use_shm);
+
+#endif //HUFFMANCODEC_SERVE_H
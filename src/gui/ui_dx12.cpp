@@ -36,6 +36,9 @@
 #define IMGUI_ENABLE_WIN32_DEFAULT_IME_FUNCTIONS
 
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 struct FrameContext
 {
@@ -72,6 +75,72 @@ void WaitForLastSubmittedFrame();
 FrameContext* WaitForNextFrameResources();
 LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
+// Encode/decode job running off the UI thread, the frame loop only polls its progress and status
+struct CodecJob
+{
+    std::thread thread;
+    std::shared_ptr<cancel_token> cancel;
+    std::atomic_bool running = false;
+    std::atomic<uint64_t> bytes_done = 0;
+    std::atomic<uint64_t> bytes_total = 0;
+    std::chrono::steady_clock::time_point start;
+
+    std::mutex mtx;
+    std::string status;
+
+    void run(std::function<void(huffman_codec&)> work)
+    {
+        if (thread.joinable()) thread.join();
+
+        cancel = std::make_shared<cancel_token>();
+        bytes_done = bytes_total = 0;
+        start = std::chrono::steady_clock::now();
+        running = true;
+        set_status("");
+
+        codec_options opts;
+        opts.cancel = cancel;
+        opts.on_progress = [this](const codec_progress& p) {
+            bytes_total = p.bytes_total;
+            bytes_done = p.bytes_done;
+        };
+
+        thread = std::thread([this, opts, work = std::move(work)]() {
+            std::string result = "Done.";
+            try {
+                huffman_codec hmc(opts);
+                work(hmc);
+            }
+            catch (const codec_cancelled&) {
+                result = "Cancelled.";
+            }
+            catch (const std::exception& e) {
+                result = std::string("Failed: ") + e.what();
+            }
+            set_status(result);
+            running = false;
+        });
+    }
+
+    void stop()
+    {
+        if (cancel) cancel->cancel();
+        if (thread.joinable()) thread.join();
+    }
+
+    void set_status(std::string s)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        status = std::move(s);
+    }
+
+    std::string get_status()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return status;
+    }
+};
+
 
 // Main code
 int init_gui(int, char**)
@@ -133,6 +202,7 @@ int init_gui(int, char**)
     bool show_demo_window = true;
     bool show_another_window = false;
     bool isEncode = true;
+    bool useTans = false;
 
     static constexpr size_t INPUT_SZ = 100;
 
@@ -143,6 +213,8 @@ int init_gui(int, char**)
     bool input_valid = false, output_valid = false, table_valid = false;
     bool attempt = false;
 
+    CodecJob job;
+
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
     // Main loop
@@ -284,35 +356,51 @@ int init_gui(int, char**)
             }
             table_valid = ext_table == ".txt";
 
+            if (isEncode) {
+                ImGui::Text("Backend:     ");
+                ImGui::SameLine();
+                if (ImGui::RadioButton("Huffman", !useTans)) useTans = false;
+                ImGui::SameLine();
+                if (ImGui::RadioButton("tANS", useTans)) useTans = true;
+            }
+
             ImGui::NewLine();
-            if (ImGui::Button("Start")) {
+            if (job.running) {
+                // Job runs on its own thread, the window keeps redrawing and can cancel it
+                const uint64_t total = job.bytes_total, done_bytes = job.bytes_done;
+                const float fraction = total != 0 ? static_cast<float>(done_bytes) / static_cast<float>(total) : 0.f;
+                const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.start).count();
+                const double rate = elapsed > 0 ? static_cast<double>(done_bytes) / elapsed : 0;
+
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "%.1f MB/s, ETA %.0fs", rate / (1024 * 1024),
+                         rate > 0 ? static_cast<double>(total - done_bytes) / rate : 0.0);
+                ImGui::ProgressBar(fraction, ImVec2(400.f, 0.f), overlay);
+                ImGui::SameLine();
+                if (ImGui::Button("Cancel")) job.cancel->cancel();
+            }
+            else if (ImGui::Button("Start")) {
 
                 if (input_valid && output_valid && table_valid) {
                     if (isEncode) {
-                        try {
-                            huffman_codec hmc;
-                            hmc.encode(input_file, output_file, table_file);
-                        }
-                        catch (const std::exception& e) {
-                            input_valid = output_valid = table_valid = false;
-                        }
-                        done = true;
+                        const auto backend = useTans ? huffman_codec::Backend::TANS : huffman_codec::Backend::Huffman;
+                        job.run([in = i_file, out = o_file, table = t_file, backend](huffman_codec& hmc) {
+                            hmc.encode(in, out, table, backend);
+                        });
                     } else {
-                        try {
-                            huffman_codec hmc;
-                            hmc.decode(input_file, output_file, table_file);
-                        }
-                        catch (const std::exception& e) {
-                            input_valid = output_valid = table_valid = false;
-                        }
-                        done = true;
+                        job.run([in = i_file, out = o_file, table = t_file](huffman_codec& hmc) {
+                            hmc.decode(in, out, table);
+                        });
                     }
                 } else {
                     attempt = true;
                 }
             }                        // Buttons return true when clicked (most widgets return true when edited/activated)
 
-
+            if (!job.running) {
+                if (const std::string status = job.get_status(); !status.empty())
+                    ImGui::Text("%s", status.c_str());
+            }
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
             ImGui::End();
@@ -360,6 +448,8 @@ int init_gui(int, char**)
         frameCtx->FenceValue = fenceValue;
     }
 
+    // Closing the window mid-job cancels it, so the output isn't left half written
+    job.stop();
     WaitForLastSubmittedFrame();
 
     // Cleanup
@@ -0,0 +1,80 @@
+#ifndef HUFFMANCODEC_BUFFER_POOL_H
+#define HUFFMANCODEC_BUFFER_POOL_H
+
+#include <mutex>
+#include <vector>
+
+#include "numa_topology.h"
+
+/*
+ * Chunk buffers handed back after use, so steady state runs reuse the same few allocations instead of getting a
+ * fresh std::vector per chunk. At most max_buffers are kept around, anything beyond that is freed. Every NUMA node
+ * has a free list of its own, a pinned worker gets back buffers whose pages sit on its node.
+ */
+class buffer_pool {
+public:
+    explicit buffer_pool(size_t max_buffers = 0) : free_buffers(numa_topology::nodes().size()), max_buffers{max_buffers} {}
+
+    std::vector<char> acquire(size_t size) { return acquire(size, numa_topology::current_node()); }
+
+    // From the free list of node rather than the caller's, for buffers some other thread codes
+    std::vector<char> acquire(size_t size, unsigned node)
+    {
+        std::vector<char> buffer;
+        auto& free_list = node_list(node);
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!free_list.empty()) {
+            buffer = std::move(free_list.back());
+            free_list.pop_back();
+            --kept;
+        }
+        lock.unlock();
+
+        // Huge pages have to be asked for before the pages get touched
+        if (huge_pages && size > buffer.capacity()) {
+            buffer.reserve(size);
+            numa_topology::advise_huge_pages(buffer.data(), buffer.capacity());
+        }
+        buffer.resize(size);
+        return buffer;
+    }
+
+    void release(std::vector<char>&& buffer) { release(std::move(buffer), numa_topology::current_node()); }
+
+    // Back onto the list of the node it was acquired for
+    void release(std::vector<char>&& buffer, unsigned node)
+    {
+        if (buffer.capacity() == 0) return;
+        auto& free_list = node_list(node);
+        std::lock_guard<std::mutex> lock(mtx);
+        if (kept < max_buffers) {
+            free_list.push_back(std::move(buffer));
+            ++kept;
+        }
+    }
+
+    void set_max_buffers(size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        max_buffers = count;
+        for (auto& free_list : free_buffers) {
+            while (kept > max_buffers && !free_list.empty()) {
+                free_list.pop_back();
+                --kept;
+            }
+        }
+    }
+
+    void set_huge_pages(bool enabled) { huge_pages = enabled; }
+
+private:
+    std::vector<std::vector<char>>& node_list(unsigned node) { return free_buffers[node % free_buffers.size()]; }
+
+    std::mutex mtx;
+    std::vector<std::vector<std::vector<char>>> free_buffers;
+    size_t max_buffers;
+    size_t kept = 0;
+    bool huge_pages = false;
+};
+
+#endif //HUFFMANCODEC_BUFFER_POOL_H
@@ -0,0 +1,90 @@
+#include "checkpoint_file.h"
+
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+checkpoint_file::checkpoint_file(std::filesystem::path path, double interval) :
+    file{std::move(path)}, interval{interval} {}
+
+bool checkpoint_file::load(const std::string& fingerprint, std::string& plan, std::vector<chunk>& chunks) const {
+    std::ifstream ifs(file, std::ios::binary);
+    if (!ifs.is_open()) return false;
+
+    // [magic][uint64 length][fingerprint][uint64 length][plan][chunk records...]
+    char magic[sizeof(MAGIC)] = {};
+    uint64_t len = 0;
+    ifs.read(magic, sizeof(magic));
+    ifs.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!ifs || !std::equal(std::begin(MAGIC), std::end(MAGIC), magic) || len != fingerprint.size()) return false;
+
+    std::string stored(len, '\0');
+    ifs.read(stored.data(), static_cast<std::streamsize>(len));
+    if (!ifs || stored != fingerprint) return false;
+
+    ifs.read(reinterpret_cast<char*>(&len), sizeof(len));
+    const auto here = ifs.tellg();
+    ifs.seekg(0, std::ios::end);
+    if (!ifs || len > static_cast<uint64_t>(ifs.tellg() - here)) return false;
+    ifs.seekg(here);
+    plan.assign(len, '\0');
+    ifs.read(plan.data(), static_cast<std::streamsize>(len));
+
+    // A save cut short leaves half a record behind, it and anything after it never happened
+    chunks.clear();
+    chunk record;
+    while (ifs.read(reinterpret_cast<char*>(&record), sizeof(record)))
+        chunks.push_back(record);
+    return true;
+}
+
+void checkpoint_file::start(const std::string& fingerprint, const std::string& plan, const std::vector<chunk>& keep) {
+    // Written aside and moved over, a kill half way leaves the old checkpoint rather than a broken one
+    const auto tmp = std::filesystem::path(file).concat(".tmp");
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) {
+            throw std::invalid_argument("Cannot open checkpoint file to write: " + file.string());
+        }
+        const uint64_t fingerprint_len = fingerprint.size(), plan_len = plan.size();
+        ofs.write(MAGIC, sizeof(MAGIC));
+        ofs.write(reinterpret_cast<const char*>(&fingerprint_len), sizeof(fingerprint_len));
+        ofs.write(fingerprint.data(), static_cast<std::streamsize>(fingerprint.size()));
+        ofs.write(reinterpret_cast<const char*>(&plan_len), sizeof(plan_len));
+        ofs.write(plan.data(), static_cast<std::streamsize>(plan.size()));
+        ofs.write(reinterpret_cast<const char*>(keep.data()), static_cast<std::streamsize>(keep.size() * sizeof(chunk)));
+        if (!ofs) {
+            throw std::invalid_argument("Cannot write checkpoint file: " + file.string());
+        }
+    }
+    std::filesystem::rename(tmp, file);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    pending.clear();
+    last_save = std::chrono::steady_clock::now();
+}
+
+bool checkpoint_file::add(const chunk& written) {
+    std::lock_guard<std::mutex> lock(mtx);
+    pending.push_back(written);
+    return std::chrono::steady_clock::now() - last_save >= interval;
+}
+
+void checkpoint_file::save() {
+    std::lock_guard<std::mutex> lock(mtx);
+    last_save = std::chrono::steady_clock::now();
+    if (pending.empty()) return;
+
+    std::ofstream ofs(file, std::ios::binary | std::ios::app);
+    ofs.write(reinterpret_cast<const char*>(pending.data()), static_cast<std::streamsize>(pending.size() * sizeof(chunk)));
+    ofs.flush();
+    // A checkpoint that can't be written costs the next resume some work, not this run its output
+    if (ofs) pending.clear();
+}
+
+void checkpoint_file::remove() {
+    std::error_code ec;
+    std::filesystem::remove(file, ec);
+    std::lock_guard<std::mutex> lock(mtx);
+    pending.clear();
+}
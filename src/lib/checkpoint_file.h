@@ -0,0 +1,60 @@
+#ifndef HUFFMANCODEC_CHECKPOINT_FILE_H
+#define HUFFMANCODEC_CHECKPOINT_FILE_H
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+/*
+ * Progress of a long run, kept next to its output so a run that got killed can carry on where it stopped. The file
+ * starts with a fingerprint of the run (input, options) and a plan the codec writes once it knows its tables, every
+ * save appends the chunks written out since the one before. A chunk record carries the hash of the bytes that went
+ * into the output, so the run resuming from it can check they are still there before skipping the chunk.
+ */
+class checkpoint_file {
+public:
+    struct chunk {
+        uint64_t id = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint64_t hash_lo = 0;
+        uint64_t hash_hi = 0;
+        // Whatever else the codec wants back for the chunk, its checksums
+        uint64_t tag = 0;
+    };
+    static_assert(sizeof(chunk) == 48);
+
+    // Saves are due every interval seconds at most
+    checkpoint_file(std::filesystem::path path, double interval);
+
+    checkpoint_file(const checkpoint_file&) = delete;
+    checkpoint_file& operator=(const checkpoint_file&) = delete;
+
+    // Plan and chunks left behind by a run with this fingerprint, false if there is no such file or it is another run's
+    bool load(const std::string& fingerprint, std::string& plan, std::vector<chunk>& chunks) const;
+    // Starts the file over, the chunks of a resumed run that still hold go back in with keep
+    void start(const std::string& fingerprint, const std::string& plan, const std::vector<chunk>& keep = {});
+
+    // Any thread, true when a save is due. Whatever the chunk was written through has to be flushed before saving
+    bool add(const chunk& written);
+    // Appends the chunks added since the last save
+    void save();
+    void remove();
+
+    [[nodiscard]] const std::filesystem::path& path() const { return file; }
+
+private:
+    static constexpr char MAGIC[8] = {'H', 'M', 'C', 'C', 'K', 'P', 'T', '2'};
+
+    std::filesystem::path file;
+    std::chrono::duration<double> interval;
+
+    std::mutex mtx;
+    std::vector<chunk> pending;
+    std::chrono::steady_clock::time_point last_save = std::chrono::steady_clock::now();
+};
+
+#endif //HUFFMANCODEC_CHECKPOINT_FILE_H
@@ -0,0 +1,146 @@
+#include "chunk_tuner.h"
+#include "huffman_codec.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
+
+size_t chunk_tuner::chunk_size(const size_t input_size, const size_t workers, const chunk_tuning& tuning) {
+    const size_t max_chunk = std::max<size_t>(256, tuning.max_chunk != 0 ? tuning.max_chunk : 4 * cache_size());
+    const size_t min_chunk = std::clamp<size_t>(tuning.min_chunk, 256, max_chunk);
+
+    // Enough chunks for every worker to get a few, rounded up so the last one isn't a tiny leftover
+    const size_t target_chunks = std::max<size_t>(1, workers) * std::max<size_t>(1, tuning.chunks_per_worker);
+    const size_t size = (input_size + target_chunks - 1) / target_chunks;
+
+    return std::clamp(size, min_chunk, max_chunk);
+}
+
+size_t chunk_tuner::cache_size() {
+    static const size_t size = []() -> size_t {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        if (const long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE); l2 > 0)
+            return static_cast<size_t>(l2);
+#endif
+        // Reasonable guess for anything made in the last decade
+        return 1024 * 1024;
+    }();
+    return size;
+}
+
+std::filesystem::path chunk_tuner::default_path() {
+    if (const char* path = std::getenv("HUFFMANCODEC_TUNING"); path && *path)
+        return path;
+
+    std::filesystem::path dir;
+    if (const char* xdg = std::getenv("XDG_CONFIG_HOME"); xdg && *xdg)
+        dir = xdg;
+    else if (const char* home = std::getenv("HOME"); home && *home)
+        dir = std::filesystem::path(home) / ".config";
+    else if (const char* appdata = std::getenv("APPDATA"); appdata && *appdata)
+        dir = appdata;
+    else
+        dir = std::filesystem::temp_directory_path();
+
+    return dir / "huffman_codec" / "tuning.txt";
+}
+
+chunk_tuning chunk_tuner::load(const std::filesystem::path& path) {
+    chunk_tuning tuning;
+    std::ifstream ifs(path);
+
+    // Same "key value" lines as the table files, unknown keys are skipped so older binaries can read newer files
+    std::string key;
+    size_t value = 0;
+    while (ifs >> key >> value) {
+        if (key == "chunks_per_worker") tuning.chunks_per_worker = std::max<size_t>(1, value);
+        else if (key == "min_chunk") tuning.min_chunk = value;
+        else if (key == "max_chunk") tuning.max_chunk = value;
+    }
+    return tuning;
+}
+
+void chunk_tuner::save(const chunk_tuning& tuning, const std::filesystem::path& path) {
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path());
+
+    std::ofstream ofs(path);
+    if (!ofs.is_open()) {
+        throw std::invalid_argument("Cannot open tuning file to write: " + path.string());
+    }
+    ofs << "chunks_per_worker " << tuning.chunks_per_worker << std::endl
+        << "min_chunk " << tuning.min_chunk << std::endl
+        << "max_chunk " << tuning.max_chunk << std::endl;
+}
+
+const chunk_tuning& chunk_tuner::saved() {
+    static const chunk_tuning tuning = load(default_path());
+    return tuning;
+}
+
+chunk_tuning chunk_tuner::autotune(const std::string& sample, const std::function<void(const measurement&)>& report) {
+    if (sample.empty()) {
+        throw std::invalid_argument("Cannot autotune on an empty sample.");
+    }
+
+    // Large chunk sizes only show their effect on inputs spanning many of them, so small samples get repeated
+    constexpr size_t TUNE_BYTES = 64 * 1024 * 1024;
+    std::string data = sample;
+    while (data.size() < TUNE_BYTES)
+        data += sample;
+
+    const size_t workers = worker_pool::shared()->size();
+    constexpr int RUNS = 2;
+
+    // Encode + decode round trip through memory, best of a few runs
+    auto measure = [&](const std::string& input, size_t chunk_size) {
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < RUNS; ++i) {
+            std::istringstream in(input);
+            std::stringstream bin, table, out;
+
+            const auto start = std::chrono::steady_clock::now();
+            huffman_codec enc({.chunk_size = chunk_size});
+            enc.encode(in, bin, table);
+            huffman_codec dec;
+            dec.decode(bin, out, table);
+            const auto stop = std::chrono::steady_clock::now();
+
+            best = std::min(best, std::chrono::duration<double>(stop - start).count());
+        }
+        return static_cast<double>(input.size()) / (1024 * 1024) / best;
+    };
+
+    chunk_tuning tuning;
+
+    // Pass 1: largest chunk worth having, every worker still gets plenty of chunks at any of these on TUNE_BYTES
+    double best_rate = 0;
+    for (size_t size = 64 * 1024; size <= 16 * 1024 * 1024; size *= 2) {
+        const double rate = measure(data, size);
+        if (report) report({size, 0, rate});
+        if (rate > best_rate) {
+            best_rate = rate;
+            tuning.max_chunk = size;
+        }
+    }
+
+    // Pass 2: with just one max_chunk per worker worth of input, how much finer splitting pays for itself
+    const std::string slice = data.substr(0, std::min(data.size(), workers * tuning.max_chunk));
+    best_rate = 0;
+    for (size_t per_worker = 1; per_worker <= 16; per_worker *= 2) {
+        const chunk_tuning candidate{per_worker, tuning.min_chunk, tuning.max_chunk};
+        const size_t size = chunk_size(slice.size(), workers, candidate);
+        const double rate = measure(slice, size);
+        if (report) report({size, per_worker, rate});
+        if (rate > best_rate) {
+            best_rate = rate;
+            tuning.chunks_per_worker = per_worker;
+        }
+    }
+
+    return tuning;
+}
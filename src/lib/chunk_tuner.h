@@ -0,0 +1,51 @@
+#ifndef HUFFMANCODEC_CHUNK_TUNER_H
+#define HUFFMANCODEC_CHUNK_TUNER_H
+
+#include <string>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+
+// How encode splits its input into chunks, see chunk_tuner::chunk_size
+struct chunk_tuning {
+    // Chunks handed to every worker, more than one evens out the load when some chunks take longer than others
+    size_t chunks_per_worker = 4;
+    // Chunks never get smaller than this (unless the whole input is), below it per chunk overhead dominates
+    size_t min_chunk = 64 * 1024;
+    // Nor larger than this, 0 means a few times the L2 cache size
+    size_t max_chunk = 0;
+};
+
+/*
+ * Picks the chunk size of an encode run from the input size, the number of workers and the cache size, instead of
+ * handing every hardware thread exactly one chunk. Small files still get split finely enough to keep every worker
+ * busy, huge ones get many cache sized chunks (which also lets a machine with more cores decode them in parallel).
+ *
+ * `huffman_codec autotune` measures the best limits on the current host and saves them, every later run in the
+ * process picks them up through saved().
+ */
+class chunk_tuner {
+public:
+    struct measurement {
+        size_t chunk_size;
+        size_t chunks_per_worker;
+        double mb_per_s;
+    };
+
+    static size_t chunk_size(size_t input_size, size_t workers, const chunk_tuning& tuning);
+    static size_t cache_size();
+
+    // HUFFMANCODEC_TUNING if set, otherwise tuning.txt in the user's config directory
+    static std::filesystem::path default_path();
+    // Missing files give the default tuning
+    static chunk_tuning load(const std::filesystem::path& path);
+    static void save(const chunk_tuning& tuning, const std::filesystem::path& path);
+    // Tuning at default_path(), loaded once per process
+    static const chunk_tuning& saved();
+
+    // Times encode + decode of the sample over a range of chunk sizes, then over chunks_per_worker at the best one
+    static chunk_tuning autotune(const std::string& sample,
+                                 const std::function<void(const measurement&)>& report = {});
+};
+
+#endif //HUFFMANCODEC_CHUNK_TUNER_H
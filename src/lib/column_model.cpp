@@ -0,0 +1,221 @@
+#include "column_model.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+// Just past the delimiter or '\n' ending the field that starts at pos, the end of the data if it runs off it
+static size_t field_end(std::span<const char> data, size_t pos, char delimiter, bool last_column)
+{
+    for (size_t i = pos; i < data.size(); ++i)
+        if (data[i] == '\n' || (!last_column && data[i] == delimiter)) return i + 1;
+    return data.size();
+}
+
+// Calls on_field(column, start, end) for every field, and on_record(fields) once every record is over
+template<typename Field, typename Record>
+static void walk_fields(std::span<const char> data, char delimiter, size_t columns, Field&& on_field, Record&& on_record)
+{
+    size_t column = 0;
+    for (size_t pos = 0; pos < data.size();) {
+        const size_t end = field_end(data, pos, delimiter, column + 1 == columns);
+        on_field(column, pos, end);
+        pos = end;
+        if (data[end - 1] == '\n') {
+            on_record(column + 1);
+            column = 0;
+        } else if (end != data.size()) {
+            ++column;
+        }
+    }
+    // Last record without its '\n', a delimiter right at the end leaves an empty field after it
+    if (!data.empty() && data.back() != '\n')
+        on_record(column + 1);
+}
+
+struct column_layout {
+    column_model::chunk_header header;
+    std::vector<uint64_t> symbols;
+    std::vector<column_model::shape_run> shape;
+    std::vector<std::span<const char>> streams;
+};
+
+static column_layout parse_layout(std::span<const char> payload, size_t tables)
+{
+    const auto corrupt = [] { return std::invalid_argument("Corrupt column chunk."); };
+    column_layout layout;
+    if (payload.size() < sizeof(column_model::chunk_header)) throw corrupt();
+    std::memcpy(&layout.header, payload.data(), sizeof(layout.header));
+    const size_t columns = layout.header.columns;
+    if (columns == 0 || columns > tables || layout.header.shape_runs > payload.size()) throw corrupt();
+
+    size_t pos = sizeof(layout.header);
+    const size_t fixed = pos + 2 * columns * sizeof(uint64_t) + layout.header.shape_runs * sizeof(column_model::shape_run);
+    if (fixed > payload.size()) throw corrupt();
+
+    std::vector<uint64_t> bytes(columns);
+    layout.symbols.resize(columns);
+    layout.shape.resize(layout.header.shape_runs);
+    std::memcpy(layout.symbols.data(), payload.data() + pos, columns * sizeof(uint64_t));
+    pos += columns * sizeof(uint64_t);
+    std::memcpy(bytes.data(), payload.data() + pos, columns * sizeof(uint64_t));
+    pos += columns * sizeof(uint64_t);
+    std::memcpy(layout.shape.data(), payload.data() + pos, layout.shape.size() * sizeof(column_model::shape_run));
+    pos += layout.shape.size() * sizeof(column_model::shape_run);
+
+    for (size_t c = 0; c < columns; ++c) {
+        if (bytes[c] > payload.size() - pos) throw corrupt();
+        layout.streams.push_back(payload.subspan(pos, bytes[c]));
+        pos += bytes[c];
+    }
+    return layout;
+}
+
+// Decodes a column stream into out, which the caller keeps for as long as it reads the column
+static std::span<const char> decode_column(const column_layout& layout, size_t column,
+                                           const std::vector<huffman_kernels::decode_table>& tables,
+                                           std::vector<char>& out)
+{
+    out.resize(layout.symbols[column]);
+    if (!out.empty())
+        huffman_kernels::get().decode(layout.streams[column], tables[column], out, 0);
+    return out;
+}
+
+void column_model::histogram(std::span<const char> data, char delimiter, std::vector<std::array<uint64_t, 256>> &freqs) {
+    walk_fields(data, delimiter, freqs.size(), [&](size_t column, size_t start, size_t end) {
+        auto& counts = freqs[column];
+        for (size_t i = start; i < end; ++i)
+            ++counts[static_cast<uint8_t>(data[i])];
+    }, [](size_t) {});
+}
+
+size_t column_model::column_count(const std::vector<std::array<uint64_t, 256>> &freqs) {
+    size_t columns = 1;
+    for (size_t c = 0; c < freqs.size(); ++c)
+        if (std::ranges::any_of(freqs[c], [](uint64_t n) { return n != 0; })) columns = c + 1;
+    return columns;
+}
+
+void column_model::encode(std::span<const char> data, char delimiter, const std::vector<huffman_kernels::code_table> &codes,
+                          std::vector<char> &record) {
+    const size_t columns = codes.size();
+    // Per call, a worker thread shouldn't hold on to the fields of the largest chunk it ever coded
+    std::vector<std::vector<char>> fields(columns), streams(columns);
+
+    chunk_header header;
+    header.columns = static_cast<uint32_t>(columns);
+    std::vector<shape_run> shape;
+    walk_fields(data, delimiter, columns, [&](size_t column, size_t start, size_t end) {
+        fields[column].insert(fields[column].end(), data.begin() + start, data.begin() + end);
+    }, [&](size_t count) {
+        ++header.records;
+        if (!shape.empty() && shape.back().fields == count)
+            ++shape.back().records;
+        else
+            shape.push_back({1, static_cast<uint32_t>(count)});
+    });
+    // Every record has every column, the usual case for CSV, needs no shape
+    if (shape.size() == 1 && shape[0].fields == columns) shape.clear();
+    header.shape_runs = static_cast<uint32_t>(shape.size());
+    header.open_end = !data.empty() && data.back() != '\n';
+
+    std::vector<uint64_t> symbols(columns), bytes(columns);
+    for (size_t c = 0; c < columns; ++c) {
+        if (!fields[c].empty()) huffman_kernels::get().encode(fields[c], SIZE_MAX, codes[c], streams[c], {});
+        symbols[c] = fields[c].size();
+        bytes[c] = streams[c].size();
+    }
+
+    const auto put = [&](const void* src, size_t len) {
+        record.insert(record.end(), static_cast<const char*>(src), static_cast<const char*>(src) + len);
+    };
+    put(&header, sizeof(header));
+    put(symbols.data(), columns * sizeof(uint64_t));
+    put(bytes.data(), columns * sizeof(uint64_t));
+    put(shape.data(), shape.size() * sizeof(shape_run));
+    for (size_t c = 0; c < columns; ++c)
+        put(streams[c].data(), streams[c].size());
+}
+
+void column_model::decode(std::span<const char> payload, char delimiter,
+                          const std::vector<huffman_kernels::decode_table> &tables, std::span<char> decoded) {
+    const column_layout layout = parse_layout(payload, tables.size());
+    const size_t columns = layout.header.columns;
+    std::vector<std::vector<char>> scratch(columns);
+    std::vector<std::span<const char>> column_bytes;
+    std::vector<size_t> cursors(columns, 0);
+    for (size_t c = 0; c < columns; ++c)
+        column_bytes.push_back(decode_column(layout, c, tables, scratch[c]));
+
+    // Fields are taken from the columns in turn, a '\n' sends the next one back to the first column
+    size_t column = 0, out = 0;
+    while (out < decoded.size()) {
+        const auto src = column_bytes[column];
+        const size_t pos = cursors[column];
+        if (pos >= src.size()) {
+            throw std::invalid_argument("Corrupt column chunk.");
+        }
+        const size_t end = field_end(src, pos, delimiter, column + 1 == columns);
+        if (end - pos > decoded.size() - out) {
+            throw std::invalid_argument("Corrupt column chunk.");
+        }
+        std::memcpy(decoded.data() + out, src.data() + pos, end - pos);
+        out += end - pos;
+        cursors[column] = end;
+
+        if (src[end - 1] == '\n')
+            column = 0;
+        else if (column + 1 < columns && src[end - 1] == delimiter)
+            ++column;
+    }
+}
+
+void column_model::project(std::span<const char> payload, char delimiter,
+                           const std::vector<huffman_kernels::decode_table> &tables, const std::vector<size_t> &selected,
+                           std::vector<char> &out) {
+    const column_layout layout = parse_layout(payload, tables.size());
+    const size_t columns = layout.header.columns;
+    std::vector<std::vector<char>> scratch(columns);
+    std::vector<std::span<const char>> column_bytes(columns);
+    std::vector<size_t> cursors(columns, 0);
+    std::vector<std::pair<size_t, size_t>> ranges(columns, {SIZE_MAX, 0});
+    std::vector<bool> decoded(columns, false);
+    for (const size_t c : selected) {
+        if (c >= columns || decoded[c]) continue;
+        decoded[c] = true;
+        column_bytes[c] = decode_column(layout, c, tables, scratch[c]);
+    }
+
+    size_t run = 0, left_in_run = layout.shape.empty() ? layout.header.records : layout.shape[0].records;
+    for (uint64_t r = 0; r < layout.header.records; ++r) {
+        while (left_in_run == 0) {
+            if (++run >= layout.shape.size()) {
+                throw std::invalid_argument("Corrupt column chunk.");
+            }
+            left_in_run = layout.shape[run].records;
+        }
+        --left_in_run;
+        const size_t fields = layout.shape.empty() ? columns : layout.shape[run].fields;
+
+        // Field of every selected column this record has, without the byte that ends it
+        for (const size_t c : selected) {
+            if (c >= fields || ranges[c].first != SIZE_MAX) continue;
+            const auto src = column_bytes[c];
+            const size_t pos = cursors[c];
+            size_t end = field_end(src, pos, delimiter, c + 1 == columns);
+            cursors[c] = end;
+            if (end > pos && (src[end - 1] == '\n' || (c + 1 < columns && src[end - 1] == delimiter))) --end;
+            ranges[c] = {pos, end};
+        }
+        for (size_t i = 0; i < selected.size(); ++i) {
+            if (i > 0) out.push_back(delimiter);
+            const size_t c = selected[i];
+            if (c >= fields) continue;
+            out.insert(out.end(), column_bytes[c].begin() + ranges[c].first, column_bytes[c].begin() + ranges[c].second);
+        }
+        for (const size_t c : selected)
+            if (c < columns) ranges[c].first = SIZE_MAX;
+        if (r + 1 < layout.header.records || !layout.header.open_end) out.push_back('\n');
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef HUFFMANCODEC_COLUMN_MODEL_H
+#define HUFFMANCODEC_COLUMN_MODEL_H
+
+#include <span>
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "huffman_kernels.h"
+
+/*
+ * Column coding for delimited records (CSV, TSV, logs). A record is split on the delimiter into fields, field i of
+ * every record goes into column i and the byte ending a field (its delimiter, or the '\n' of the record) goes with
+ * it. Fields past the last column stay in it, so the last column holds the rest of the record. Every column is
+ * coded with a table of its own into a bitstream of its own, laid out in the chunk as:
+ *
+ *   [chunk_header][symbols of every column][stream bytes of every column][shape runs][column streams]
+ *
+ * The shape says how many fields every record has and is only there when some record has fewer than the chunk
+ * has columns. With it (or without it, every record having all of them) any set of columns can be read without
+ * decoding the others.
+ */
+class column_model {
+public:
+    static constexpr size_t MAX_COLUMNS = 32;
+
+    struct chunk_header {
+        uint32_t columns = 0;
+        uint32_t shape_runs = 0;
+        uint64_t records = 0;
+        // 1 when the last record ends without its '\n'
+        uint32_t open_end = 0;
+        uint32_t reserved = 0;
+    };
+    static_assert(sizeof(chunk_header) == 24);
+
+    // This many records in a row have this many fields
+    struct shape_run {
+        uint32_t records = 0;
+        uint32_t fields = 0;
+    };
+    static_assert(sizeof(shape_run) == 8);
+
+    // Adds the bytes of data to the histogram of their column, there are as many columns as freqs has
+    static void histogram(std::span<const char> data, char delimiter, std::vector<std::array<uint64_t, 256>>& freqs);
+    // Columns of a histogram over MAX_COLUMNS of them that any record reached
+    static size_t column_count(const std::vector<std::array<uint64_t, 256>>& freqs);
+
+    // Appends the column layout of data to record, with one code table per column
+    static void encode(std::span<const char> data, char delimiter, const std::vector<huffman_kernels::code_table>& codes,
+                       std::vector<char>& record);
+    // Whole records back, decoded has to be the size of the chunk's input
+    static void decode(std::span<const char> payload, char delimiter,
+                       const std::vector<huffman_kernels::decode_table>& tables, std::span<char> decoded);
+    /*
+     * The selected columns of every record, in the order given and joined by the delimiter, decoding only their
+     * streams. A record without one of them gets an empty field. Records keep their '\n'.
+     */
+    static void project(std::span<const char> payload, char delimiter,
+                        const std::vector<huffman_kernels::decode_table>& tables, const std::vector<size_t>& selected,
+                        std::vector<char>& out);
+};
+
+#endif //HUFFMANCODEC_COLUMN_MODEL_H
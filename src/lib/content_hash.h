@@ -0,0 +1,57 @@
+#ifndef HUFFMANCODEC_CONTENT_HASH_H
+#define HUFFMANCODEC_CONTENT_HASH_H
+
+#include <bit>
+#include <span>
+#include <compare>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Fast non-cryptographic hash used to spot identical chunks. Two independent 64 bit lanes run over the data 8
+ * bytes at a time, so telling two chunks apart by hash alone takes a 128 bit collision.
+ */
+struct content_hash {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    uint64_t length = 0;
+
+    auto operator<=>(const content_hash&) const = default;
+
+    static content_hash of(std::span<const char> data)
+    {
+        constexpr uint64_t P1 = 0x9E3779B97F4A7C15ull, P2 = 0xC2B2AE3D27D4EB4Full, P3 = 0x165667B19E3779F9ull;
+        uint64_t a = P1 ^ data.size(), b = P2 + data.size();
+
+        auto round = [&](uint64_t w) {
+            a = std::rotl((a ^ w) * P1, 31);
+            b = std::rotl(b + w * P2, 27) * P3;
+        };
+
+        size_t i = 0;
+        for (; i + 8 <= data.size(); i += 8) {
+            uint64_t w;
+            std::memcpy(&w, data.data() + i, 8);
+            round(w);
+        }
+        if (i < data.size()) {
+            uint64_t w = 0;
+            std::memcpy(&w, data.data() + i, data.size() - i);
+            round(w);
+        }
+
+        return {avalanche(a), avalanche(b ^ a), data.size()};
+    }
+
+private:
+    static uint64_t avalanche(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDull;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ull;
+        return x ^ (x >> 33);
+    }
+};
+
+#endif //HUFFMANCODEC_CONTENT_HASH_H
@@ -0,0 +1,88 @@
+#include "context_model.h"
+
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+std::array<uint8_t, 256> context_model::cluster(const huffman_kernels::context_histogram &freqs, size_t tables) {
+    std::array<uint64_t, 256> totals{};
+    std::vector<size_t> active;
+    for (size_t c = 0; c < 256; ++c) {
+        totals[c] = std::accumulate(freqs[c].begin(), freqs[c].end(), uint64_t{0});
+        if (totals[c] != 0) active.push_back(c);
+    }
+
+    std::array<uint8_t, 256> context{};
+    const size_t k = std::min({std::max<size_t>(1, tables), MAX_TABLES, active.size()});
+    if (k <= 1) return context;
+
+    // Busiest contexts seed the groups, they matter most for the final size
+    std::ranges::stable_sort(active, std::greater{}, [&](size_t c) { return totals[c]; });
+    std::array<size_t, 256> assigned{};
+    for (size_t c : active) assigned[c] = k;
+    for (size_t g = 0; g < k; ++g) assigned[active[g]] = g;
+
+    // First round only knows the seeds, unassigned contexts are just skipped in the sums
+    for (int round = 0; round < 10; ++round) {
+        std::vector<std::array<double, 256>> sums(k, std::array<double, 256>{});
+        for (size_t c : active) {
+            if (assigned[c] == k) continue;
+            for (size_t s = 0; s < 256; ++s)
+                sums[assigned[c]][s] += static_cast<double>(freqs[c][s]);
+        }
+
+        // Half a count for unseen bytes, so a group never rules a context out completely
+        std::vector<std::array<double, 256>> cost(k);
+        for (size_t g = 0; g < k; ++g) {
+            const double total = std::accumulate(sums[g].begin(), sums[g].end(), 0.0) + 128.0;
+            for (size_t s = 0; s < 256; ++s)
+                cost[g][s] = -std::log2((sums[g][s] + 0.5) / total);
+        }
+
+        bool changed = false;
+        for (size_t c : active) {
+            size_t best = 0;
+            double best_bits = std::numeric_limits<double>::max();
+            for (size_t g = 0; g < k; ++g) {
+                double bits = 0;
+                for (size_t s = 0; s < 256; ++s)
+                    if (freqs[c][s] != 0) bits += static_cast<double>(freqs[c][s]) * cost[g][s];
+                if (bits < best_bits) {
+                    best_bits = bits;
+                    best = g;
+                }
+            }
+            changed |= best != assigned[c];
+            assigned[c] = best;
+        }
+        if (!changed) break;
+    }
+
+    // Groups that lost all their contexts are dropped, the rest renumbered in order
+    std::array<int, MAX_TABLES> renumber;
+    renumber.fill(-1);
+    int next = 0;
+    for (size_t c = 0; c < 256; ++c) {
+        if (totals[c] == 0) continue;
+        if (renumber[assigned[c]] < 0) renumber[assigned[c]] = next++;
+        context[c] = static_cast<uint8_t>(renumber[assigned[c]]);
+    }
+    return context;
+}
+
+size_t context_model::table_count(const std::array<uint8_t, 256> &context) {
+    return static_cast<size_t>(*std::ranges::max_element(context)) + 1;
+}
+
+std::vector<std::map<char, uint64_t>> context_model::table_freqs(const huffman_kernels::context_histogram &freqs,
+                                                                 const std::array<uint8_t, 256> &context) {
+    std::vector<std::map<char, uint64_t>> tables(table_count(context));
+    for (size_t c = 0; c < 256; ++c) {
+        for (size_t s = 0; s < 256; ++s) {
+            if (freqs[c][s] != 0)
+                tables[context[c]][static_cast<char>(s)] += freqs[c][s];
+        }
+    }
+    return tables;
+}
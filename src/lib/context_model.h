@@ -0,0 +1,29 @@
+#ifndef HUFFMANCODEC_CONTEXT_MODEL_H
+#define HUFFMANCODEC_CONTEXT_MODEL_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "huffman_kernels.h"
+
+/*
+ * Order-1 modeling for the huffman backend. A full table per preceding byte would cost 256 tables in the table
+ * file and thrash the cache while coding, so preceding bytes whose next byte statistics look alike share a table.
+ * Grouping is a small k-means over the order-1 histogram: a context joins the group whose combined statistics
+ * would code its own bytes in the fewest bits.
+ */
+class context_model {
+public:
+    static constexpr size_t MAX_TABLES = 16;
+
+    // Table of every preceding byte, tables are numbered from 0 without gaps and never more than `tables` of them
+    static std::array<uint8_t, 256> cluster(const huffman_kernels::context_histogram& freqs, size_t tables);
+    static size_t table_count(const std::array<uint8_t, 256>& context);
+
+    // Summed next byte counts of every table, ready for huffman_tree
+    static std::vector<std::map<char, uint64_t>> table_freqs(const huffman_kernels::context_histogram& freqs,
+                                                             const std::array<uint8_t, 256>& context);
+};
+
+#endif //HUFFMANCODEC_CONTEXT_MODEL_H
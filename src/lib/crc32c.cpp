@@ -0,0 +1,103 @@
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HUFFMANCODEC_CRC_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HUFFMANCODEC_CRC_ARM
+#endif
+
+// Reflected Castagnoli polynomial, table[k][b] is the CRC of byte b followed by k zero bytes
+static constexpr auto CRC_TABLES = [] {
+    constexpr uint32_t POLY = 0x82F63B78;
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; ++i)
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        tables[0][b] = crc;
+    }
+    for (size_t k = 1; k < 8; ++k)
+        for (uint32_t b = 0; b < 256; ++b)
+            tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+    return tables;
+}();
+
+uint32_t crc32c::of_software(std::span<const char> data, uint32_t crc) {
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    size_t len = data.size();
+    crc = ~crc;
+
+    // Eight bytes per step, little endian words so the low byte is the first one
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        word ^= crc;
+        crc = CRC_TABLES[7][word & 0xFF] ^ CRC_TABLES[6][(word >> 8) & 0xFF] ^
+              CRC_TABLES[5][(word >> 16) & 0xFF] ^ CRC_TABLES[4][(word >> 24) & 0xFF] ^
+              CRC_TABLES[3][(word >> 32) & 0xFF] ^ CRC_TABLES[2][(word >> 40) & 0xFF] ^
+              CRC_TABLES[1][(word >> 48) & 0xFF] ^ CRC_TABLES[0][word >> 56];
+    }
+    for (; len > 0; ++p, --len)
+        crc = (crc >> 8) ^ CRC_TABLES[0][(crc ^ *p) & 0xFF];
+    return ~crc;
+}
+
+#ifdef HUFFMANCODEC_CRC_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc_hardware(std::span<const char> data, uint32_t crc)
+{
+    const char* p = data.data();
+    size_t len = data.size();
+    uint64_t state = ~crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        state = _mm_crc32_u64(state, word);
+    }
+    auto state32 = static_cast<uint32_t>(state);
+    for (; len > 0; ++p, --len)
+        state32 = _mm_crc32_u8(state32, static_cast<uint8_t>(*p));
+    return ~state32;
+}
+#elif defined(HUFFMANCODEC_CRC_ARM)
+static uint32_t crc_hardware(std::span<const char> data, uint32_t crc)
+{
+    const char* p = data.data();
+    size_t len = data.size();
+    crc = ~crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; len > 0; ++p, --len)
+        crc = __crc32cb(crc, static_cast<uint8_t>(*p));
+    return ~crc;
+}
+#endif
+
+bool crc32c::accelerated() {
+#ifdef HUFFMANCODEC_CRC_SSE42
+    static const bool sse42 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+    }();
+    return sse42;
+#elif defined(HUFFMANCODEC_CRC_ARM)
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t crc32c::of(std::span<const char> data, uint32_t crc) {
+#if defined(HUFFMANCODEC_CRC_SSE42) || defined(HUFFMANCODEC_CRC_ARM)
+    if (accelerated()) return crc_hardware(data, crc);
+#endif
+    return of_software(data, crc);
+}
@@ -0,0 +1,19 @@
+#ifndef HUFFMANCODEC_CRC32C_H
+#define HUFFMANCODEC_CRC32C_H
+
+#include <span>
+#include <cstdint>
+
+/*
+ * CRC32C (Castagnoli), the checksum of every chunk. Runs on the crc32 instruction when the CPU has one (SSE4.2 on
+ * x86-64, the CRC extension on ARMv8), on slicing-by-8 tables otherwise. Either way it is far faster than coding
+ * the chunk it checks.
+ */
+struct crc32c {
+    // Pass the checksum of what came before to carry on over data
+    static uint32_t of(std::span<const char> data, uint32_t crc = 0);
+    static uint32_t of_software(std::span<const char> data, uint32_t crc = 0);
+    static bool accelerated();
+};
+
+#endif //HUFFMANCODEC_CRC32C_H
@@ -4,285 +4,3101 @@
 
 #include "huffman_codec.h"
 
+#if __has_include(<unistd.h>) && __has_include(<fcntl.h>)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#define HUFFMANCODEC_PWRITE 1
+#endif
+
+// Counts of a histogram that are there, ready for huffman_tree
+static std::map<char, uint64_t> symbol_freqs(const std::array<uint64_t, 256>& freqs) {
+    std::map<char, uint64_t> map;
+    for (size_t ch = 0; ch < freqs.size(); ++ch)
+        if (freqs[ch] != 0) map.emplace(static_cast<char>(ch), freqs[ch]);
+    return map;
+}
+
+// For the stage counters
+static int64_t nanos_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 void huffman_codec::encode(const std::string_view input_file,
                            const std::optional<std::string_view> output_file,
-                           const std::optional<std::string_view> table_file)
+                           const std::optional<std::string_view> table_file,
+                           const Backend backend)
                            {
     const std::string in_abs = std::filesystem::absolute(input_file).replace_extension().string();
-    init_streams(input_file, output_file.value_or(in_abs + "ENC.bin"), CodecType::Encoding);
-
-    // Bind function to "this" context
-    std::function<void(const std::vector<char>&&, std::mutex&, size_t)> fp =
-            std::bind(&huffman_codec::fetch_char_freqs, this,
-                      std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
-
-    partition(fp, CodecType::Encoding);
-
-    huffman_table = huffman_tree::huffman_table(std::move(frequency_map));
-
-
-    istrm.clear();
-    istrm.seekg(0, std::ios::beg);
+    const std::string out_name = output_file ? std::string(*output_file) : in_abs + "ENC.bin";
+    input_start = 0;
 
-    fp = std::bind(&huffman_codec::write_huffman_encoded, this,
-                   std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
-
-    partition(fp, CodecType::Encoding);
+    // Anything that changes the bytes of the output has to match for a checkpoint to be resumed from
+    std::ostringstream settings;
+    settings << "encode " << static_cast<int>(backend) << ' ' << opts.sync_interval << ' ' << opts.context_tables
+             << ' ' << opts.dedup << ' ' << opts.framed << ' ' << static_cast<int>(opts.column_delimiter);
+    const bool resumed = open_checkpoint(out_name, input_file, settings.str());
+    init_streams(input_file, out_name, CodecType::Encoding, resumed);
+    out_path = std::filesystem::absolute(out_name);
 
     // If table file output is provided make it owned else just append "Table.txt" to input file
     const auto t_file = table_file.transform([](auto tf) {return std::string(tf);})
             .value_or(in_abs + "Table.txt");
 
+    // Small frames are done before the pool would even get going
+    if (encode_small_stream(backend)) return;
+
+    try {
+        encode_streams(backend);
+    }
+    catch (const codec_cancelled&) {
+        out_file.close();
+        // With a checkpoint the output is what a resume carries on from
+        if (checkpoint)
+            checkpoint->save();
+        else
+            std::filesystem::remove(out_name);
+        checkpoint.reset();
+        throw;
+    }
+    catch (...) {
+        out_file.close();
+        if (checkpoint) checkpoint->save();
+        checkpoint.reset();
+        throw;
+    }
+
+    if (checkpoint) {
+        // Whatever the run before left past the new end is stale
+        const auto end = static_cast<uint64_t>(out_file.tellp());
+        out_file.close();
+        if (resumed) std::filesystem::resize_file(out_path, end);
+        checkpoint->remove();
+        checkpoint.reset();
+    }
+
+    // Frames carry their table inside the .bin
+    if (opts.framed) return;
     std::ofstream table_strm(t_file);
-    write_huffman_table(table_strm);
+    write_table(table_strm, backend);
 }
 
+void huffman_codec::encode(std::istream &input, std::ostream &output, std::ostream &table, const Backend backend) {
+    istrm = &input;
+    ostrm = &output;
+    out_path.clear();
+    checkpoint.reset();
+    resuming = false;
+    input_start = 0;
+    BLOCK_SIZE = block_size(input);
+
+    if (encode_small_stream(backend)) return;
+    encode_streams(backend);
+    if (!opts.framed) write_table(table, backend);
+}
 
 void huffman_codec::decode(const std::string_view input_file,
                            const std::optional<std::string_view> output_file,
                            const std::string_view table_file) {
     const std::string in_abs = std::filesystem::absolute(input_file).replace_extension().string();
-    init_streams(input_file, output_file.value_or(in_abs + "DEC.txt"), CodecType::Decoding);
-
-    if (!std::filesystem::exists(table_file)) {
+    const std::string out_name = output_file ? std::string(*output_file) : in_abs + "DEC.txt";
+    if (!table_file.empty() && !std::filesystem::exists(table_file)) {
         throw std::invalid_argument("Provided table_file_path path does not exist.");
     }
 
-    std::string abs_file = std::filesystem::absolute(table_file).string();
-    std::ifstream tstrm(abs_file);
+    const bool resumed = open_checkpoint(out_name, input_file, "decode " + file_stamp(table_file));
+    init_streams(input_file, out_name, CodecType::Decoding, resumed);
+    out_path = std::filesystem::absolute(out_name);
 
-    read_huffman_table(tstrm);
+    // No table file is fine as long as the input is framed, read_frame_tables checks
+    std::ifstream tstrm;
+    if (table_file.empty())
+        tstrm.setstate(std::ios::failbit);
+    else
+        tstrm.open(std::filesystem::absolute(table_file));
 
-    for (const auto &e : huffman_table)
-        rev_huffman_table[e.second] = e.first;
+    if (decode_small_stream()) return;
+    try {
+        decode_streams(tstrm);
+    }
+    catch (const codec_cancelled&) {
+        out_file.close();
+        if (checkpoint)
+            checkpoint->save();
+        else
+            std::filesystem::remove(out_name);
+        checkpoint.reset();
+        throw;
+    }
+    catch (...) {
+        out_file.close();
+        if (checkpoint) checkpoint->save();
+        checkpoint.reset();
+        throw;
+    }
+
+    // Files a resume can't skip into get decoded from the start without their checkpoint, stale tail or not
+    if (resumed) {
+        const auto end = static_cast<uint64_t>(out_file.tellp());
+        out_file.close();
+        std::filesystem::resize_file(out_path, end);
+    }
+    if (checkpoint) checkpoint->remove();
+    checkpoint.reset();
+}
 
-    // Bind function to "this" context
-    const std::function<void(const std::vector<char>&&, std::mutex&, size_t)> fp =
-            std::bind(&huffman_codec::write_huffman_decoded, this,
-                      std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+void huffman_codec::decode(std::istream &input, std::ostream &output, std::istream &table) {
+    istrm = &input;
+    ostrm = &output;
+    out_path.clear();
+    checkpoint.reset();
+    resuming = false;
 
-    partition(fp, CodecType::Decoding);
+    if (decode_small_stream()) return;
+    decode_streams(table);
 }
 
-void huffman_codec::init_streams(const std::string_view &input_file, const std::string_view &output_file,
-                                 const huffman_codec::CodecType codec_type) {
-    if (!std::filesystem::exists(input_file)) {
-        throw std::invalid_argument("Provided input file path does not exist: " + std::string(input_file));
+std::shared_ptr<const huffman_codec::decode_tables> huffman_codec::load_tables(std::istream &input, std::istream &table) {
+    istrm = &input;
+    const auto start = input.tellg();
+    const Backend backend = read_file_header();
+    std::shared_ptr<decode_tables> tables;
+    if (!inline_table) {
+        read_frame_tables(backend, table);
+        tables = std::make_shared<decode_tables>();
+        tables->backend = backend;
+        tables->order1 = order1;
+        tables->column_coded = column_coded;
+        tables->column_delimiter = column_delimiter;
+        tables->segment = std::move(decode_segment);
+        tables->columns = std::move(column_decode);
     }
+    input.clear();
+    input.seekg(start);
+    return tables;
+}
 
-    const auto in_ext = std::filesystem::path(input_file).extension();
-    const auto out_ext = std::filesystem::path(output_file).extension();
-    if (codec_type == CodecType::Encoding && (in_ext != ".txt" || out_ext != ".bin") ||
-            codec_type == CodecType::Decoding && (in_ext != ".bin" || out_ext != ".txt"))
-    {
-        throw std::invalid_argument("File extensions invalid. Input/Output extension should be .txt/.bin for \n"
-                                    "encode operations and .bin/.txt for decode operations, respectively.");
+void huffman_codec::decode(std::istream &input, std::ostream &output, std::shared_ptr<const decode_tables> tables) {
+    std::istringstream no_table;
+    no_table.setstate(std::ios::failbit);
+    preloaded_tables = std::move(tables);
+    try {
+        decode(input, output, no_table);
+    }
+    catch (...) {
+        preloaded_tables.reset();
+        throw;
     }
+    preloaded_tables.reset();
+}
 
-    std::string abs_in_file = std::filesystem::absolute(input_file).string();
-    std::string abs_out_file = std::filesystem::absolute(output_file).string();
+void huffman_codec::encode_small(std::span<const char> input, std::vector<char> &output) {
+    std::array<uint64_t, 256> freqs{};
+    huffman_kernels::get().histogram(input, freqs);
+    const auto lengths = huffman_tree::code_lengths(freqs);
+    const huffman_kernels::code_table codes = huffman_kernels::canonical_code_table(lengths);
 
-    std::ifstream ifs(abs_in_file, codec_type == CodecType::Encoding ? std::ios::in : std::ios::binary);
-    std::ofstream ofs(abs_out_file, codec_type == CodecType::Decoding ? std::ios::out : std::ios::binary);
+    // Kept by the thread, so only its first call allocates
+    thread_local std::vector<char> payload;
+    payload.clear();
+    if (!input.empty()) huffman_kernels::get().encode(input, SIZE_MAX, codes, payload, {});
 
-    // Whatever that can happen lol...
-    if (!ofs.is_open() || ofs.bad() || ofs.fail()) {
-        throw std::invalid_argument("Cannot open output file to write.");
+    // Same frame encode writes with codec_options::framed, only the table is code lengths instead of text
+    uint16_t symbols = 0;
+    for (const uint8_t len : lengths)
+        symbols += len != 0;
+    const uint64_t table_len = sizeof(symbols) + 2 * symbols;
+    const uint64_t chunks = input.empty() ? 0 : 1;
+    const uint64_t chunks_start = 8 + sizeof(table_len) + table_len;
+    const uint64_t record_size = chunks * (CHUNK_HEADER + payload.size());
+    const size_t start = output.size();
+    output.reserve(start + chunks_start + record_size + 2 * sizeof(size_t) + sizeof(chunks) +
+                   chunks * (sizeof(line_index_entry) + sizeof(uint64_t) + sizeof(chunk_checksum)) +
+                   sizeof(uint64_t) + sizeof(LINE_INDEX_MAGIC));
+    const auto put = [&](const void* src, size_t len) {
+        output.insert(output.end(), static_cast<const char*>(src), static_cast<const char*>(src) + len);
+    };
+
+    const char header[8] = {FILE_MAGIC[0], FILE_MAGIC[1], FILE_MAGIC[2], FILE_MAGIC[3],
+                            static_cast<char>(FILE_VERSION), static_cast<char>(Backend::Huffman),
+                            static_cast<char>(FLAG_FRAMED | FLAG_LINE_INDEX | FLAG_CHECKSUMS | FLAG_COMPACT_TABLE), 0};
+    put(header, sizeof(header));
+    put(&table_len, sizeof(table_len));
+    put(&symbols, sizeof(symbols));
+    for (size_t ch = 0; ch < lengths.size(); ++ch) {
+        if (lengths[ch] == 0) continue;
+        const char entry[2] = {static_cast<char>(ch), static_cast<char>(lengths[ch])};
+        put(entry, sizeof(entry));
     }
 
-    if (codec_type == CodecType::Encoding) {
-        // Calculate chunk size for each thread
-        ifs.seekg(0, std::ios::end);
-        const auto ch_count = ifs.tellg();
+    chunk_checksum sum{};
+    if (chunks) {
+        const uint64_t record[3] = {0, payload.size(), input.size()};
+        put(record, sizeof(record));
+        put(payload.data(), payload.size());
+        sum = {crc32c::of(input), crc32c::of(std::span<const char>(output).subspan(start + chunks_start + 2 * sizeof(size_t)))};
+    }
 
-        static const unsigned THREAD_COUNT = std::thread::hardware_concurrency();
-        // Launch extra threads only when chunks are >256 bytes (to avoid
-        // additional multithreading bookkeeping costs when files are small)
-        BLOCK_SIZE = std::max((long double)256, std::floor((long double)ch_count / THREAD_COUNT));
-        ifs.clear();
-        ifs.seekg(0, std::ios::beg);
+    const size_t closing[2] = {SIZE_MAX, 0};
+    put(closing, sizeof(closing));
+    put(&chunks, sizeof(chunks));
+    if (chunks) {
+        const line_index_entry entry{chunks_start, 0, 0, 1};
+        const uint64_t lines = std::ranges::count(input, '\n');
+        put(&entry, sizeof(entry));
+        put(&lines, sizeof(lines));
+        put(&sum, sizeof(sum));
     }
+    const uint64_t index_offset = chunks_start + record_size;
+    put(&index_offset, sizeof(index_offset));
+    put(LINE_INDEX_MAGIC, sizeof(LINE_INDEX_MAGIC));
+}
 
-    istrm = std::move(ifs);
-    ostrm = std::move(ofs);
+void huffman_codec::decode_small(std::span<const char> input, std::vector<char> &output) {
+    if (!decode_compact_frames(input, output)) {
+        throw std::invalid_argument("Input has frames encode_small didn't write, decode it with decode instead.");
+    }
 }
 
-void huffman_codec::partition(const std::function<void(const std::vector<char> &&, std::mutex &, size_t)> &func,
-                              const huffman_codec::CodecType codec_type) {
+bool huffman_codec::decode_compact_frames(std::span<const char> input, std::vector<char> &output) {
+    size_t pos = 0;
+    const auto get = [&](void* dst, size_t len) {
+        if (len > input.size() - pos) {
+            throw std::invalid_argument("Input file ends in the middle of a frame.");
+        }
+        std::memcpy(dst, input.data() + pos, len);
+        pos += len;
+    };
+    // Tables are rebuilt in place, so a thread decoding frame after frame allocates nothing for them
+    thread_local huffman_kernels::decode_table table;
 
-    std::mutex mtx;
-    std::vector<std::thread> threads;
-    size_t block_id = 0;
-    while (!istrm.eof() && !istrm.fail())
-    {
-        std::vector<char> _buffer(BLOCK_SIZE);
-        // chunk_id is read from file in decode or incremented using block_id in encode
-        size_t chunk_id = 0;
-        if (codec_type == CodecType::Decoding) {
-            size_t byte_len = 0;
-            constexpr size_t sz = sizeof(size_t);
-            istrm.read(reinterpret_cast<char*>(&chunk_id), sz);
-            istrm.read(reinterpret_cast<char*>(&byte_len), sz);
+    while (pos < input.size()) {
+        char header[8] = {};
+        if (input.size() - pos < sizeof(header)) return false;
+        get(header, sizeof(header));
+        if (!std::equal(std::begin(FILE_MAGIC), std::end(FILE_MAGIC), header) ||
+                static_cast<uint8_t>(header[4]) > FILE_VERSION || header[5] != static_cast<char>(Backend::Huffman) ||
+                static_cast<uint8_t>(header[6]) != (FLAG_FRAMED | FLAG_LINE_INDEX | FLAG_CHECKSUMS | FLAG_COMPACT_TABLE)) {
+            return false;
+        }
 
-            if (byte_len == 0) break;
-            // Chunk starts with an extra size_t for character length which is read at encode
-            byte_len += sz;
+        uint64_t table_len = 0;
+        get(&table_len, sizeof(table_len));
+        if (table_len > input.size() - pos) {
+            throw std::invalid_argument("Corrupt inline table.");
+        }
+        huffman_kernels::canonical_decode_table(read_compact_table(input.subspan(pos, table_len)), table);
+        pos += table_len;
+
+        // Chunks up to the closing record, each symbol takes a bit at least
+        for (;;) {
+            size_t record[2] = {};
+            get(record, sizeof(record));
+            if (record[0] == SIZE_MAX && record[1] == 0) break;
+            uint64_t data_count = 0;
+            get(&data_count, sizeof(data_count));
+            if (record[1] > input.size() - pos || data_count > 8 * record[1]) {
+                throw std::invalid_argument("Input file ends in the middle of a chunk.");
+            }
+            const size_t at = output.size();
+            output.resize(at + data_count);
+            huffman_kernels::get().decode(input.subspan(pos, record[1]), table, std::span<char>(output).subspan(at), 0);
+            pos += record[1];
+        }
 
-            _buffer.resize(byte_len);
-            istrm.read(_buffer.data(), byte_len);
-            // some assert
+        // Nothing in the line index is needed here, it is only stepped over
+        uint64_t chunks = 0, segments = 0;
+        get(&chunks, sizeof(chunks));
+        if (chunks > input.size()) {
+            throw std::invalid_argument("Corrupt line index.");
         }
-        if (codec_type == CodecType::Encoding) {
-            istrm.read(_buffer.data(), BLOCK_SIZE);
-            _buffer.resize(istrm.gcount());
-            chunk_id = block_id;
+        for (uint64_t c = 0; c < chunks; ++c) {
+            line_index_entry entry{};
+            get(&entry, sizeof(entry));
+            if (entry.segments > input.size()) {
+                throw std::invalid_argument("Corrupt line index.");
+            }
+            segments += entry.segments;
         }
+        const uint64_t rest = segments * sizeof(uint64_t) + chunks * sizeof(chunk_checksum) + sizeof(uint64_t);
+        if (rest + sizeof(LINE_INDEX_MAGIC) > input.size() - pos) {
+            throw std::invalid_argument("Corrupt line index.");
+        }
+        pos += rest;
+        char magic[sizeof(LINE_INDEX_MAGIC)];
+        get(magic, sizeof(magic));
+        if (!std::equal(std::begin(LINE_INDEX_MAGIC), std::end(LINE_INDEX_MAGIC), magic)) {
+            throw std::invalid_argument("Corrupt line index.");
+        }
+    }
+    return true;
+}
 
-        // Extra check never hurts
-        if (_buffer.empty()) break;
+std::array<uint8_t, 256> huffman_codec::read_compact_table(std::span<const char> table) {
+    uint16_t symbols = 0;
+    if (table.size() < sizeof(symbols)) {
+        throw std::invalid_argument("Corrupt inline table.");
+    }
+    std::memcpy(&symbols, table.data(), sizeof(symbols));
+    if (table.size() != sizeof(symbols) + 2 * static_cast<size_t>(symbols)) {
+        throw std::invalid_argument("Corrupt inline table.");
+    }
 
-        ++block_id;
+    std::array<uint8_t, 256> lengths{};
+    for (size_t i = 0; i < symbols; ++i) {
+        const auto ch = static_cast<uint8_t>(table[sizeof(symbols) + 2 * i]);
+        const auto len = static_cast<uint8_t>(table[sizeof(symbols) + 2 * i + 1]);
+        if (len == 0 || lengths[ch] != 0) {
+            throw std::invalid_argument("Corrupt inline table.");
+        }
+        lengths[ch] = len;
+    }
+    return lengths;
+}
 
-        // Need to reference wrap mutex, so it doesn't get moved.
-        threads.push_back(std::thread(func, std::move(_buffer), std::ref(mtx), chunk_id));
+bool huffman_codec::encode_small_stream(const Backend backend) {
+    // Anything the single buffer can't honour (chunking, sync points, tracing, counters, rate caps) takes the pool
+    if (!opts.framed || backend != Backend::Huffman || opts.context_tables != 0 || opts.column_delimiter != 0 ||
+            opts.dedup || checkpoint || opts.chunk_size != 0 ||
+            (opts.sync_interval != 0 && opts.sync_interval != SIZE_MAX) || !small_path_plain()) {
+        return false;
     }
+    const uint64_t size = stream_remaining(*istrm);
+    if (size > SMALL_INPUT) return false;
 
-    for (auto&& t : threads)
-        t.join();
+    reset_stats();
+    thread_local std::vector<char> input, output;
+    input.resize(size);
+    istrm->read(input.data(), static_cast<std::streamsize>(size));
+    if (istrm->gcount() != static_cast<std::streamsize>(size)) {
+        throw std::invalid_argument("Cannot read input file.");
+    }
+    output.clear();
+    encode_small(input, output);
+    ostrm->write(output.data(), static_cast<std::streamsize>(output.size()));
+    ostrm->flush();
+    // Both passes at once
+    if (opts.on_progress) opts.on_progress({2 * size, 2 * size});
+    return true;
 }
 
-void huffman_codec::write_huffman_encoded(const std::vector<char> &&data, std::mutex &mtx, size_t chunk_id) {
-    size_t data_len = std::size(data);
+bool huffman_codec::small_path_plain() const {
+    return !opts.trace && !opts.perf && opts.max_read_rate == 0 && opts.max_write_rate == 0;
+}
 
-    if (data_len == 0) {return;}
-    std::vector<char> converted;
+bool huffman_codec::decode_small_stream() {
+    if (checkpoint || !small_path_plain()) return false;
+    const auto start = istrm->tellg();
+    const uint64_t size = stream_remaining(*istrm);
+    // Input that doesn't compress comes out a little larger than it went in
+    if (size > 2 * SMALL_INPUT) return false;
 
-    uint8_t byte = 0;
-    uint8_t offset = 0;
+    char header[8] = {};
+    istrm->read(header, sizeof(header));
+    istrm->clear();
+    istrm->seekg(start);
+    if (!(static_cast<uint8_t>(header[6]) & FLAG_COMPACT_TABLE)) return false;
 
-    // Bit manipulation bamboozle
-    for (const char c : data) {
-        const std::string hm_repr = huffman_table[c];
-        const size_t repr_len = hm_repr.length();
-        int ch_bin = std::stoi(hm_repr, 0, 2);
+    reset_stats();
+    thread_local std::vector<char> input, output;
+    input.resize(size);
+    istrm->read(input.data(), static_cast<std::streamsize>(size));
+    output.clear();
+    if (istrm->gcount() != static_cast<std::streamsize>(size) || !decode_compact_frames(input, output)) {
+        // Frames of every kind mixed together, the pool takes them
+        istrm->clear();
+        istrm->seekg(start);
+        return false;
+    }
+    ostrm->write(output.data(), static_cast<std::streamsize>(output.size()));
+    ostrm->flush();
+    if (opts.on_progress) opts.on_progress({size, size});
+    return true;
+}
 
-        for(int i = 0; i < repr_len; ++i) {
-            byte <<= 1;
-            byte |= (0b00000001 & (ch_bin >> (repr_len - i - 1)));
-            if (++offset == 8) {
-                converted.push_back((char)byte);
-                byte = 0;
-                offset = 0;
-            }
-        }
+void huffman_codec::search(const std::string_view input_file, const std::string_view table_file,
+                           const std::string_view pattern, const std::function<void(const search_match&)>& on_match) {
+    if (!std::filesystem::exists(input_file)) {
+        throw std::invalid_argument("Provided input file path does not exist: " + std::string(input_file));
+    }
+    if (!table_file.empty() && !std::filesystem::exists(table_file)) {
+        throw std::invalid_argument("Provided table_file_path path does not exist.");
     }
 
-    // If last byte was half way done shift to align
-    if (offset > 0) {
-        while (++offset <= 8) byte <<= 1;
-        converted.push_back((char)byte);
+    in_file = std::ifstream(std::filesystem::absolute(input_file), std::ios::binary);
+    std::ifstream tstrm;
+    if (table_file.empty())
+        tstrm.setstate(std::ios::failbit);
+    else
+        tstrm.open(std::filesystem::absolute(table_file));
+    search(in_file, tstrm, pattern, on_match);
+}
+
+void huffman_codec::search(std::istream &input, std::istream &table, const std::string_view pattern,
+                           const std::function<void(const search_match&)>& on_match) {
+    istrm = &input;
+    ostrm = nullptr;
+    match_sink = on_match;
+
+    search_streams(table, pattern);
+}
+
+verify_result huffman_codec::verify(const std::string_view input_file, const std::string_view table_file, bool decode) {
+    if (!std::filesystem::exists(input_file)) {
+        throw std::invalid_argument("Provided input file path does not exist: " + std::string(input_file));
+    }
+    if (!table_file.empty() && !std::filesystem::exists(table_file)) {
+        throw std::invalid_argument("Provided table_file_path path does not exist.");
+    }
+
+    in_file = std::ifstream(std::filesystem::absolute(input_file), std::ios::binary);
+    std::ifstream tstrm;
+    if (table_file.empty())
+        tstrm.setstate(std::ios::failbit);
+    else
+        tstrm.open(std::filesystem::absolute(table_file));
+    return verify(in_file, tstrm, decode);
+}
+
+verify_result huffman_codec::verify(std::istream &input, std::istream &table, bool decode) {
+    istrm = &input;
+    ostrm = nullptr;
+    out_path.clear();
+    checkpoint.reset();
+    resuming = false;
+
+    return verify_streams(table, decode);
+}
+
+void huffman_codec::read_lines(const std::string_view input_file, const std::string_view table_file,
+                               uint64_t first_line, uint64_t count, std::ostream &output) {
+    if (!std::filesystem::exists(input_file)) {
+        throw std::invalid_argument("Provided input file path does not exist: " + std::string(input_file));
+    }
+    if (!table_file.empty() && !std::filesystem::exists(table_file)) {
+        throw std::invalid_argument("Provided table_file_path path does not exist.");
+    }
+
+    in_file = std::ifstream(std::filesystem::absolute(input_file), std::ios::binary);
+    std::ifstream tstrm;
+    if (table_file.empty())
+        tstrm.setstate(std::ios::failbit);
+    else
+        tstrm.open(std::filesystem::absolute(table_file));
+    read_lines(in_file, tstrm, first_line, count, output);
+}
+
+void huffman_codec::read_lines(std::istream &input, std::istream &table, uint64_t first_line, uint64_t count,
+                               std::ostream &output) {
+    istrm = &input;
+    prepare_decode(table);
+    if (!line_index) {
+        throw std::invalid_argument("Input file has no line index, decode it instead.");
+    }
+    if (first_line == 0) {
+        throw std::invalid_argument("Lines are counted from 1.");
     }
 
-    size_t conv_len = converted.size();
+    // Entries alone, the segment counts are only read for the chunk the first line is in
+    const file_index index = read_file_index(false);
+    const auto& [entries, segment_lines, sums, frames, chunk_frames, closing_offset, frame_closings, segment_offsets] = index;
+    const size_t chunks = entries.size();
+    if (chunks == 0 || count == 0) return;
 
     /*
-     * Multithreading bookkeeping stuff to write:
-     *
-     * 1. Thread chunk's id to sync thread order in decode.
-     * 2. Converted byte length (above) so partition function knows how long each chunk is to then read and
-     *    pass to threads.
-     * 3. Original character length of text file. An example is adequate to illustrate the necessity to have this information.
-     *    Imagine a text file is only consisted of a's and b's, and we assign 0 to a and 1 to b. A chunk that
-     *    is reading its last byte, suppose 10110000, cannot decide whether the last four 0's are to be translated
-     *    as a's or they're just useless byte alignment (see above). The only way is to know how many characters were
-     *    in the original chunk, so we can interpret the last byte (Again, this ambiguity only arises for last bytes).
+     * Line N starts right after newline N - 1, which is in the last chunk with fewer newlines than that before it.
+     * Entries are in file order, so first_line only grows.
      */
+    const uint64_t skip = first_line - 1;
+    const auto after = std::ranges::lower_bound(entries, skip, {}, &line_index_entry::first_line);
+    size_t chunk = after == entries.begin() ? 0 : after - entries.begin() - 1;
 
-    std::unique_lock<std::mutex> lock(mtx);
-    ostrm.write(reinterpret_cast<char*>(&chunk_id), sizeof(size_t));
-    ostrm.write(reinterpret_cast<char*>(&conv_len), sizeof(size_t));
-    ostrm.write(reinterpret_cast<char*>(&data_len), sizeof(size_t));
-    ostrm.write(converted.data(), conv_len);
-    lock.unlock();
+    // Newlines up to the end of every segment of that chunk, the first one that gets that far holds the line
+    std::vector<uint64_t> segment_ends = read_segment_lines(index, chunk);
+    std::partial_sum(segment_ends.begin(), segment_ends.end(), segment_ends.begin());
+    for (auto& end : segment_ends)
+        end += entries[chunk].first_line;
+    if (segment_ends.empty() || segment_ends.back() < skip) return;
+    size_t segment = std::ranges::lower_bound(segment_ends, skip) - segment_ends.begin();
+
+    // Whatever comes before the first line in its segment is skipped, decoding stops after the last one
+    uint64_t newlines = segment == 0 ? entries[chunk].first_line : segment_ends[segment - 1];
+    uint64_t written = 0;
+    std::vector<char> body, window;
+    std::vector<std::pair<uint64_t, uint64_t>> segments;
+    size_t frame = SIZE_MAX;
+    for (; chunk < chunks && written < count; ++chunk, segment = 0) {
+        input.clear();
+        if (inline_table && chunk_frames[chunk] != frame) {
+            // Every frame brings its own flags and tables
+            frame = chunk_frames[chunk];
+            input.seekg(static_cast<std::streamoff>(frames[frame]));
+            read_frame_tables(read_file_header(), table);
+        }
+
+        size_t header[3] = {};
+        input.seekg(static_cast<std::streamoff>(entries[chunk].file_offset));
+        read_exact(input, header, sizeof(header));
+        if (dedup_chunks && (header[1] & CHUNK_DUPLICATE)) {
+            // Same content as an earlier chunk of the frame, decode that one instead
+            uint64_t source = 0;
+            read_exact(input, &source, sizeof(source));
+            const size_t first_chunk = std::ranges::find(chunk_frames, chunk_frames[chunk]) - chunk_frames.begin();
+            if (source >= chunk - first_chunk) {
+                throw std::invalid_argument("Corrupt duplicate chunk.");
+            }
+            input.seekg(static_cast<std::streamoff>(entries[first_chunk + source].file_offset));
+            read_exact(input, header, sizeof(header));
+        }
+        if (dedup_chunks)
+            header[1] &= CHUNK_LENGTH_MASK;
+        body.resize(header[1]);
+        read_exact(input, body.data(), body.size());
+
+        segments.clear();
+        const auto payload = parse_segments(body, header[2], segments);
+        if (segments.size() != entries[chunk].segments + 1) {
+            throw std::invalid_argument("Line index does not match the chunk.");
+        }
+
+        for (; segment + 1 < segments.size() && written < count; ++segment) {
+            const auto [symbol, bit] = segments[segment];
+            const auto [next_symbol, next_bit] = segments[segment + 1];
+            const uint64_t first_byte = bit / 8, end_byte = (next_bit + 7) / 8;
+            window.resize(next_symbol - symbol);
+            decode_segment(payload.subspan(first_byte, end_byte - first_byte), static_cast<uint32_t>(bit % 8), window);
+
+            const char* pos = window.data();
+            const char* const end = window.data() + window.size();
+            while (newlines < skip && pos != end) {
+                pos = std::find(pos, end, '\n');
+                if (pos != end) {
+                    ++pos;
+                    ++newlines;
+                }
+            }
+            while (written < count && pos != end) {
+                const char* nl = std::find(pos, end, '\n');
+                const char* stop = nl == end ? end : nl + 1;
+                output.write(pos, stop - pos);
+                if (nl != end) ++written;
+                pos = stop;
+            }
+        }
+    }
 }
 
-void huffman_codec::fetch_char_freqs(const std::vector<char> &&data, std::mutex &mtx, size_t chunk_id) {
-    std::unordered_map<char, uint64_t> freq_map_temp;
-    for (auto c : data) {
-        auto [mp_iterator, inserted] = freq_map_temp.try_emplace(c, 1);
-        if (!inserted) {
-            mp_iterator->second++;
+void huffman_codec::read_columns(const std::string_view input_file, const std::string_view table_file,
+                                 const std::vector<size_t> &columns, std::ostream &output) {
+    if (!std::filesystem::exists(input_file)) {
+        throw std::invalid_argument("Provided input file path does not exist: " + std::string(input_file));
+    }
+    if (!table_file.empty() && !std::filesystem::exists(table_file)) {
+        throw std::invalid_argument("Provided table_file_path path does not exist.");
+    }
+
+    in_file = std::ifstream(std::filesystem::absolute(input_file), std::ios::binary);
+    std::ifstream tstrm;
+    if (table_file.empty())
+        tstrm.setstate(std::ios::failbit);
+    else
+        tstrm.open(std::filesystem::absolute(table_file));
+    read_columns(in_file, tstrm, columns, output);
+}
+
+void huffman_codec::read_columns(std::istream &input, std::istream &table, const std::vector<size_t> &columns,
+                                 std::ostream &output) {
+    istrm = &input;
+    ostrm = &output;
+    out_path.clear();
+    checkpoint.reset();
+    resuming = false;
+
+    prepare_decode(table);
+    if (!column_coded) {
+        throw std::invalid_argument("Input file is not column coded, decode it instead.");
+    }
+    if (dedup_chunks) {
+        throw std::invalid_argument("Column reads don't follow dedup references, decode the file instead.");
+    }
+
+    // Chunk bodies go to the workers as they are, the projection of each is written in chunk order
+    selected_columns = columns;
+    frame_columns = {{0, column_decode}};
+    ordered_writes = true;
+    thread_chunk.store(0, std::memory_order_relaxed);
+    try {
+        partition([this](const std::vector<char>&& body, size_t chunk_id) {
+            write_ordered(project_chunk(body, chunk_id), chunk_id);
+        }, CodecType::Decoding);
+    }
+    catch (...) {
+        frame_columns.clear();
+        throw;
+    }
+    frame_columns.clear();
+}
+
+std::vector<char> huffman_codec::project_chunk(std::span<const char> body, size_t chunk_id) {
+    std::shared_ptr<const node_local<column_decoder>> decoder;
+    {
+        std::lock_guard<std::mutex> lock(window_mtx);
+        for (const auto& [first_chunk, frame_decoder] : frame_columns)
+            if (first_chunk <= chunk_id) decoder = frame_decoder;
+    }
+    if (!decoder) {
+        throw std::invalid_argument("Frame is not column coded, decode it instead.");
+    }
+
+    std::vector<char> out = buffers.acquire(0);
+    const auto span = trace_span("decode kernel");
+    const column_decoder& columns = decoder->get();
+    column_model::project(body.subspan(sizeof(uint64_t)), columns.delimiter, columns.tables, selected_columns, out);
+    return out;
+}
+
+append_result huffman_codec::append(const std::string_view input_file, const std::string_view bin_file,
+                                   const std::string_view table_file) {
+    for (const auto path : {input_file, bin_file, table_file}) {
+        if (!std::filesystem::exists(path)) {
+            throw std::invalid_argument("Provided path does not exist: " + std::string(path));
         }
     }
-    std::unique_lock<std::mutex> lock(mtx);
-    for (const auto& [ch, fr] : freq_map_temp) {
-        auto [mp_iterator, inserted] = frequency_map.try_emplace(ch, fr);
-        if (!inserted) {
-            mp_iterator->second += fr;
+
+    /*
+     * New chunks go over the old closing record and index, which are all that changes, so only those are kept aside.
+     * They go to an undo file first, so an append killed half way is rolled back by the next one; a failed or
+     * cancelled one puts them back right away.
+     */
+    const auto bin_path = std::filesystem::absolute(bin_file);
+    const auto undo = std::filesystem::path(bin_path).concat(".undo");
+    if (std::filesystem::exists(undo)) restore_append_tail(bin_path, undo);
+    const uint64_t bin_size = std::filesystem::file_size(bin_path);
+
+    append_result result;
+    Backend backend;
+    {
+        std::ifstream input(std::filesystem::absolute(input_file), std::ios::binary);
+        std::fstream bin(bin_path, std::ios::binary | std::ios::in | std::ios::out);
+        std::ifstream table(std::filesystem::absolute(table_file));
+        if (!bin.is_open()) {
+            throw std::invalid_argument("Cannot open binary file to append to.");
+        }
+
+        // A file without a sane trailer is refused by the append before anything is written
+        uint64_t tail_offset = bin_size;
+        char magic[sizeof(LINE_INDEX_MAGIC)] = {};
+        if (bin_size >= sizeof(tail_offset) + sizeof(magic)) {
+            uint64_t offset = 0;
+            bin.seekg(-static_cast<std::streamoff>(sizeof(offset) + sizeof(magic)), std::ios::end);
+            bin.read(reinterpret_cast<char*>(&offset), sizeof(offset));
+            bin.read(magic, sizeof(magic));
+            if (bin && std::equal(std::begin(LINE_INDEX_MAGIC), std::end(LINE_INDEX_MAGIC), magic) && offset < bin_size)
+                tail_offset = offset;
         }
+        std::string tail(bin_size - tail_offset, '\0');
+        bin.clear();
+        bin.seekg(static_cast<std::streamoff>(tail_offset));
+        read_exact(bin, tail.data(), tail.size());
+        {
+            std::ofstream undo_file(undo, std::ios::binary | std::ios::trunc);
+            const uint64_t header[2] = {tail_offset, tail.size()};
+            undo_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+            undo_file.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+            if (!undo_file.flush()) {
+                throw std::invalid_argument("Cannot write undo file next to the binary file.");
+            }
+        }
+
+        try {
+            result = append(input, bin, table);
+            bin.close();
+            if (!bin) {
+                throw std::invalid_argument("Cannot write binary file to append to.");
+            }
+        }
+        catch (...) {
+            bin.close();
+            restore_append_tail(bin_path, undo);
+            throw;
+        }
+        std::filesystem::remove(undo);
+        if (result.bytes != 0 || result.drift <= drift_limit()) return result;
+
+        bin.open(bin_path, std::ios::binary | std::ios::in);
+        istrm = &bin;
+        backend = read_file_header();
     }
-    lock.unlock();
+
+    /*
+     * The table is too far off by now, start over with the same settings the file had. That goes into new files that
+     * replace both old ones once complete, a cancel or kill leaves the old pair alone.
+     */
+    codec_options fresh_opts = opts;
+    fresh_opts.context_tables = order1 ? context_huffman_tables.size() : 0;
+    fresh_opts.dedup = dedup_chunks;
+    fresh_opts.column_delimiter = column_coded ? column_delimiter : '\0';
+    if (!sync_points) fresh_opts.sync_interval = SIZE_MAX;
+    const auto table_path = std::filesystem::absolute(table_file);
+    // Encode wants its extensions kept
+    const auto tmp_of = [](std::filesystem::path path) {
+        return path.replace_extension(".tmp" + path.extension().string());
+    };
+    const auto bin_tmp = tmp_of(bin_path);
+    const auto table_tmp = tmp_of(table_path);
+    try {
+        huffman_codec fresh(fresh_opts, pool);
+        fresh.encode(input_file, bin_tmp.string(), table_tmp.string(), backend);
+    }
+    catch (...) {
+        std::error_code ec;
+        std::filesystem::remove(bin_tmp, ec);
+        std::filesystem::remove(table_tmp, ec);
+        throw;
+    }
+    std::filesystem::rename(table_tmp, table_path);
+    std::filesystem::rename(bin_tmp, bin_path);
+
+    result.bytes = std::filesystem::file_size(input_file);
+    result.reencoded = true;
+    return result;
 }
 
-void huffman_codec::write_huffman_decoded(const std::vector<char> &&data, std::mutex &mtx, size_t chunk_id) {
+append_result huffman_codec::append(std::istream &input, std::iostream &bin, std::istream &table) {
+    istrm = &bin;
+    ostrm = &bin;
+    checkpoint.reset();
+    bin.seekg(0);
+    return append_streams(input, table);
+}
 
-    // Retrieve character length
-    uint64_t data_count = 0;
-    for (size_t i = 0; i < 8; ++i)
-        data_count |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (std::endian::native == std::endian::little ? 8 * i : i);
+void huffman_codec::encode_streams(const Backend backend) {
+    reset_stats();
+    // One pass for the histogram, one to encode
+    progress = {0, 2 * stream_remaining(*istrm)};
+    chunk_freqs.clear();
+    chunk_offsets.clear();
+    chunk_lines.clear();
+    chunk_symbols.clear();
+    chunk_hashes.clear();
+    chunk_done.clear();
+    frame_base = 0;
+    checksums = true;
+
+    order1 = opts.context_tables != 0;
+    if (order1 && backend != Backend::Huffman) {
+        throw std::invalid_argument("Order-1 context tables are only supported by the huffman backend.");
+    }
+    column_coded = opts.column_delimiter != 0;
+    column_delimiter = opts.column_delimiter;
+    if (column_coded && (backend != Backend::Huffman || order1)) {
+        throw std::invalid_argument("Column coding is only supported by the order-0 huffman backend.");
+    }
+    if (column_delimiter == '\n') {
+        throw std::invalid_argument("Records end at '\\n', it can't split them into columns too.");
+    }
+    // A column chunk is one piece, its streams can't be entered half way
+    run_sync_interval = column_coded ? SIZE_MAX : opts.sync_interval;
+    run_dedup = opts.dedup;
+
+    std::string frame_table;
+    if (resuming) {
+        // The run before did the histogram pass and left its outcome in the checkpoint
+        frame_table = restore_plan(backend);
+        progress.bytes_done = progress.bytes_total / 2;
+    } else {
+        // An append on this codec before leaves the histogram of its new data behind
+        frequency_map.clear();
+        context_freqs = order1 ? std::make_unique<huffman_kernels::context_histogram>() : nullptr;
+        column_freqs.assign(column_coded ? column_model::MAX_COLUMNS : 0, {});
+
+        // Bind function to "this" context
+        const std::function<void(const std::vector<char>&&, size_t)> fp =
+                std::bind(&huffman_codec::fetch_char_freqs, this,
+                          std::placeholders::_1, std::placeholders::_2);
+
+        ordered_writes = false;
+        partition(fp, CodecType::Encoding);
 
-    std::vector<char> decrypted(data_count);
+        /*
+         * Every chunk points at the first one with its content, which gets marked so decode keeps it. A matching hash
+         * only makes it a candidate, the bytes of both are compared before it becomes a reference.
+         */
+        chunk_sources.resize(chunk_hashes.size());
+        chunk_referenced.assign(chunk_hashes.size(), false);
+        std::vector<uint64_t> chunk_starts(chunk_hashes.size(), input_start);
+        for (size_t id = 1; id < chunk_hashes.size(); ++id)
+            chunk_starts[id] = chunk_starts[id - 1] + chunk_symbols[id - 1];
+        std::map<content_hash, std::vector<size_t>> first_seen;
+        for (size_t id = 0; id < chunk_hashes.size(); ++id) {
+            auto& candidates = first_seen[chunk_hashes[id]];
+            const auto source = std::ranges::find_if(candidates, [&](size_t c) {
+                return same_input(chunk_starts[c], chunk_starts[id], chunk_symbols[id]);
+            });
+            chunk_sources[id] = source != candidates.end() ? *source : id;
+            if (source != candidates.end())
+                chunk_referenced[*source] = true;
+            else
+                candidates.push_back(id);
+        }
 
-    size_t idx = 0, offset = 0;
-    std::string curr;
-    for (const char byte: data | std::views::drop(8)) {
-        do {
-            curr += (0b10000000 & (byte << offset)) ? "1" : "0";
-            if (rev_huffman_table.contains(curr)) {
-                decrypted[idx] = rev_huffman_table[curr];
-                curr.clear();
-                ++idx;
+        if (backend == Backend::TANS) {
+            tans_norm_map = tans_table::normalize(std::move(frequency_map));
+            tans = tans_table(tans_norm_map);
+        } else if (backend == Backend::Tunstall) {
+            tunstall = tunstall_table(tunstall_table::normalize(frequency_map));
+            frequency_map.clear();
+        } else if (order1) {
+            context_map = context_model::cluster(*context_freqs, opts.context_tables);
+            context_huffman_tables.clear();
+            for (auto& freqs : context_model::table_freqs(*context_freqs, context_map))
+                context_huffman_tables.push_back(freqs.empty() ? std::map<char, std::string>{}
+                                                               : huffman_tree::huffman_table(std::move(freqs)));
+            context_codes = huffman_kernels::build_context_code_table(context_map, context_huffman_tables);
+            context_freqs.reset();
+            frequency_map.clear();
+            // Chunk sizes would need an order-1 histogram per chunk, so these go out in chunk order instead
+        } else if (column_coded) {
+            // As many columns as the widest record had, the tables of the ones it alone reached are tiny
+            column_freqs.resize(column_model::column_count(column_freqs));
+            column_tables.clear();
+            for (const auto& freqs : column_freqs) {
+                auto symbols = symbol_freqs(freqs);
+                column_tables.push_back(symbols.empty() ? std::map<char, std::string>{}
+                                                        : huffman_tree::huffman_table(std::move(symbols)));
             }
-        } while (++offset < 8 && idx < data_count);
-        offset = 0;
+            column_codes.clear();
+            for (const auto& table : column_tables)
+                column_codes.push_back(huffman_kernels::build_code_table(table));
+            frequency_map.clear();
+        } else {
+            huffman_table = huffman_tree::huffman_table(std::move(frequency_map));
+            huffman_codes = huffman_kernels::build_code_table(huffman_table);
+        }
+
+        // A frame's table sits between its header and its chunks, a checkpoint keeps it too
+        if (opts.framed || checkpoint) {
+            std::ostringstream table;
+            write_table(table, backend);
+            frame_table = std::move(table).str();
+        }
+    }
+    chunks_start = 8 + (opts.framed ? sizeof(uint64_t) + frame_table.size() : 0);
+    chunk_sizes.assign(chunk_lines.size(), 0);
+    chunk_checksums.assign(chunk_lines.size(), {});
+
+    // Huffman sizes follow from the histograms alone, tANS and Tunstall ones depend on how the chunk parses
+    if (!resuming && backend == Backend::Huffman && !order1 && !column_coded && !out_path.empty()) plan_chunk_offsets();
+
+    ordered_offset = chunks_start;
+    if (checkpoint)
+        checkpoint->start(run_fingerprint, encode_plan(frame_table), resuming ? resumed_chunks() : std::vector<checkpoint_file::chunk>{});
+
+    istrm->clear();
+    istrm->seekg(static_cast<std::streamoff>(input_start), std::ios::beg);
+
+    write_file_header(backend);
+    if (opts.framed) {
+        const uint64_t table_len = frame_table.size();
+        ostrm->write(reinterpret_cast<const char*>(&table_len), sizeof(table_len));
+        ostrm->write(frame_table.data(), static_cast<std::streamsize>(frame_table.size()));
+    }
+    if (!chunk_offsets.empty()) {
+        // Chunks land at their offsets through their own handles, so the file has to be full size up front
+        ostrm->flush();
+        std::filesystem::resize_file(out_path, chunk_offsets.back());
+        open_chunk_output();
+    } else if (resuming) {
+        // Chunks in order carry on right after the ones the run before got out
+        ostrm->seekp(static_cast<std::streamoff>(ordered_offset));
+    }
+
+    const auto fp = encoder(backend);
+    place_tables(backend);
+    ordered_writes = chunk_offsets.empty();
+    const auto first_left = std::ranges::find(chunk_done, false) - chunk_done.begin();
+    thread_chunk.store(frame_base + first_left, std::memory_order_relaxed);
+    try {
+        partition(fp, CodecType::Encoding);
     }
+    catch (...) {
+        close_chunk_output();
+        throw;
+    }
+    close_chunk_output();
 
-    std::unique_lock<std::mutex> lck(mtx);
-    if (thread_chunk.load(std::memory_order_relaxed) != chunk_id)
-        cond_var.wait(lck, [this, chunk_id]() {return thread_chunk.load(std::memory_order_acquire) == chunk_id;});
-    ostrm.write(decrypted.data(), data_count);
-    thread_chunk.store(chunk_id + 1, std::memory_order_release);
-    lck.unlock();
-    cond_var.notify_all();
+    write_line_index();
+    ostrm->flush();
 }
 
-void huffman_codec::read_huffman_table(std::ifstream &ifs) {
-    std::string w, repr;
+append_result huffman_codec::append_streams(std::istream &input, std::istream &table) {
+    reset_stats();
+    const Backend backend = read_file_header();
+    if (!line_index) {
+        throw std::invalid_argument("Binary file has no line index, encode it again instead.");
+    }
+    if (inline_table) {
+        throw std::invalid_argument("Framed files grow by concatenating a new frame, encode the new data with --frame.");
+    }
+    file_index index = read_file_index();
+    const size_t chunks = index.entries.size();
 
-    while (ifs >> w >> repr) {
-        char ch;
+    // The file holds everything up to the end of its last chunk
+    uint64_t encoded = 0;
+    if (chunks != 0) {
+        size_t header[3] = {};
+        istrm->clear();
+        istrm->seekg(static_cast<std::streamoff>(index.entries.back().file_offset));
+        read_exact(*istrm, header, sizeof(header));
+        encoded = index.entries.back().first_symbol + header[2];
+    }
+    input.clear();
+    input.seekg(0, std::ios::end);
+    const auto input_size = static_cast<uint64_t>(std::max<std::streamoff>(0, input.tellg()));
+    if (input_size < encoded) {
+        throw std::invalid_argument("Input is shorter than what the binary file holds, encode it again instead.");
+    }
+    // A rotated or rewritten input would get the new data appended to chunks of the old, the last one has to match
+    if (chunks != 0 && index.checksums.size() == chunks) {
+        std::vector<char> last(encoded - index.entries.back().first_symbol);
+        input.clear();
+        input.seekg(static_cast<std::streamoff>(index.entries.back().first_symbol));
+        read_exact(input, last.data(), last.size());
+        if (crc32c::of(last) != index.checksums.back().data) {
+            throw std::invalid_argument("Input changed since the binary file was encoded, encode it again instead.");
+        }
+    }
+    if (input_size == encoded) return {};
+
+    // New chunks look like the old ones: same backend and tables, sync points only if the file has them
+    if (table.fail()) {
+        throw std::invalid_argument("Appending needs the table file of the binary file.");
+    }
+    load_encode_tables(backend, table);
+    run_sync_interval = !sync_points ? SIZE_MAX : opts.sync_interval == SIZE_MAX ? 0 : opts.sync_interval;
+    run_dedup = false;
+
+    // Old chunks keep their index entries, new ones are numbered after them
+    chunk_lines = std::move(index.segment_lines);
+    chunk_symbols.assign(chunks, 0);
+    chunk_sizes.assign(chunks, 0);
+    for (size_t c = 0; c < chunks; ++c) {
+        const bool last = c + 1 == chunks;
+        chunk_symbols[c] = (last ? encoded : index.entries[c + 1].first_symbol) - index.entries[c].first_symbol;
+        chunk_sizes[c] = (last ? index.closing_offset : index.entries[c + 1].file_offset) - index.entries[c].file_offset;
+    }
+    chunk_checksums = std::move(index.checksums);
+    chunk_freqs.assign(chunks, {});
+    chunk_hashes.clear();
+    chunk_offsets.clear();
+    chunk_done.clear();
+    chunks_start = 8;
+    frame_base = chunks;
+
+    istrm = &input;
+    input_start = encoded;
+    BLOCK_SIZE = block_size(input);
+    progress = {0, 2 * (input_size - encoded)};
+
+    frequency_map.clear();
+    context_freqs = order1 ? std::make_unique<huffman_kernels::context_histogram>() : nullptr;
+    column_freqs.assign(column_coded ? column_tables.size() : 0, {});
+    std::function<void(const std::vector<char>&&, size_t)> fp =
+            std::bind(&huffman_codec::fetch_char_freqs, this,
+                      std::placeholders::_1, std::placeholders::_2);
+    ordered_writes = false;
+    partition(fp, CodecType::Encoding);
+
+    append_result result{input_size - encoded, table_drift(backend), false};
+    context_freqs.reset();
+    if (result.drift > drift_limit()) return {0, result.drift, false};
+
+    // New chunks go over the old closing record and index, a new index covering both follows them
+    fp = encoder(backend);
+    input.clear();
+    input.seekg(static_cast<std::streamoff>(input_start));
+    chunk_sizes.resize(chunk_lines.size(), 0);
+    if (checksums) chunk_checksums.resize(chunk_lines.size());
+    ostrm->seekp(static_cast<std::streamoff>(index.closing_offset));
+
+    place_tables(backend);
+    ordered_writes = true;
+    thread_chunk.store(frame_base, std::memory_order_relaxed);
+    partition(fp, CodecType::Encoding);
 
-        if (w == "BR") ch = '\n';
-        else if (w == "WS") ch = ' ';
-        else ch = w.at(0);
+    write_line_index();
+    ostrm->flush();
+    return result;
+}
 
-        huffman_table.emplace(ch, repr);
+void huffman_codec::load_encode_tables(const Backend backend, std::istream &table) {
+    if (backend == Backend::TANS) {
+        tans_norm_map.clear();
+        read_tans_table(table);
+        tans = tans_table(tans_norm_map);
+    } else if (backend == Backend::Tunstall) {
+        read_tunstall_table(table);
+    } else if (order1) {
+        read_context_table(table);
+        context_codes = huffman_kernels::build_context_code_table(context_map, context_huffman_tables);
+    } else if (column_coded) {
+        read_column_table(table);
+        column_codes.clear();
+        for (const auto& columns : column_tables)
+            column_codes.push_back(huffman_kernels::build_code_table(columns));
+    } else {
+        huffman_table.clear();
+        read_huffman_table(table);
+        huffman_codes = huffman_kernels::build_code_table(huffman_table);
     }
 }
 
-void huffman_codec::write_huffman_table(std::ofstream &ofs) {
-    for (const auto& [ch, repr]: huffman_table) {
-        std::string w;
-        switch (ch) {
-            case '\n':
-                w = "BR";
-                break;
-            case ' ':
-                w = "WS";
-                break;
-            default:
-                w = ch;
+void huffman_codec::place_tables(const Backend backend) {
+    local_codes.reset();
+    local_context_codes.reset();
+    local_tans.reset();
+    local_tunstall.reset();
+    local_column_codes.reset();
+    if (backend == Backend::TANS)
+        local_tans = std::make_unique<node_local<tans_table>>(tans);
+    else if (backend == Backend::Tunstall)
+        local_tunstall = std::make_unique<node_local<tunstall_table>>(tunstall);
+    else if (order1)
+        local_context_codes = std::make_unique<node_local<huffman_kernels::context_code_table>>(context_codes);
+    else if (column_coded)
+        local_column_codes = std::make_unique<node_local<std::vector<huffman_kernels::code_table>>>(column_codes);
+    else
+        local_codes = std::make_unique<node_local<huffman_kernels::code_table>>(huffman_codes);
+}
+
+double huffman_codec::table_drift(const Backend backend) const {
+    // Bits under the file's table against bits under one built for the new data, a missing symbol is unbounded
+    double old_bits = 0, fresh_bits = 0;
+    if (backend == Backend::TANS) {
+        const auto fresh = tans_table::normalize(std::map<char, uint64_t>(frequency_map));
+        for (const auto& [ch, freq] : frequency_map) {
+            const auto norm = tans_norm_map.find(ch);
+            if (norm == tans_norm_map.end()) return std::numeric_limits<double>::infinity();
+            old_bits += static_cast<double>(freq) * std::log2(static_cast<double>(tans_table::TABLE_SIZE) / norm->second);
+            fresh_bits += static_cast<double>(freq) * std::log2(static_cast<double>(tans_table::TABLE_SIZE) / fresh.at(ch));
+        }
+    } else if (backend == Backend::Tunstall) {
+        // The file's dictionary parses the new data into longer or shorter words than one built for it would
+        old_bits = tunstall.bits_per_symbol(frequency_map);
+        if (std::isinf(old_bits)) return old_bits;
+        fresh_bits = tunstall_table(tunstall_table::normalize(frequency_map)).bits_per_symbol(frequency_map);
+    } else if (order1) {
+        const auto fresh_map = context_model::cluster(*context_freqs, context_huffman_tables.size());
+        std::vector<std::map<char, std::string>> fresh_tables;
+        for (auto& freqs : context_model::table_freqs(*context_freqs, fresh_map))
+            fresh_tables.push_back(freqs.empty() ? std::map<char, std::string>{} : huffman_tree::huffman_table(std::move(freqs)));
+
+        for (size_t c = 0; c < 256; ++c) {
+            for (size_t ch = 0; ch < 256; ++ch) {
+                const uint64_t freq = (*context_freqs)[c][ch];
+                if (freq == 0) continue;
+                const uint8_t len = context_codes.tables[context_codes.context[c]].len[ch];
+                if (len == 0) return std::numeric_limits<double>::infinity();
+                old_bits += static_cast<double>(freq) * len;
+                fresh_bits += static_cast<double>(freq) * fresh_tables[fresh_map[c]].at(static_cast<char>(ch)).size();
+            }
+        }
+    } else if (column_coded) {
+        for (size_t c = 0; c < column_freqs.size(); ++c) {
+            const auto symbols = symbol_freqs(column_freqs[c]);
+            if (symbols.empty()) continue;
+            const auto fresh = huffman_tree::huffman_table(std::map<char, uint64_t>(symbols));
+            for (const auto& [ch, freq] : symbols) {
+                const uint8_t len = column_codes[c].len[static_cast<uint8_t>(ch)];
+                if (len == 0) return std::numeric_limits<double>::infinity();
+                old_bits += static_cast<double>(freq) * len;
+                fresh_bits += static_cast<double>(freq) * fresh.at(ch).size();
+            }
+        }
+    } else {
+        const auto fresh = huffman_tree::huffman_table(std::map<char, uint64_t>(frequency_map));
+        for (const auto& [ch, freq] : frequency_map) {
+            const uint8_t len = huffman_codes.len[static_cast<uint8_t>(ch)];
+            if (len == 0) return std::numeric_limits<double>::infinity();
+            old_bits += static_cast<double>(freq) * len;
+            fresh_bits += static_cast<double>(freq) * fresh.at(ch).size();
+        }
+    }
+    return fresh_bits == 0 ? 0 : old_bits / fresh_bits - 1;
+}
+
+void huffman_codec::prepare_decode(std::istream &table, bool need_tables) {
+    reset_stats();
+    chunk_checksums.clear();
+    const Backend backend = read_file_header();
+    if (preloaded_tables && !inline_table) {
+        const decode_tables& tables = *preloaded_tables;
+        if (tables.backend != backend || tables.order1 != order1 || tables.column_coded != column_coded ||
+                tables.column_delimiter != column_delimiter) {
+            throw std::invalid_argument("Loaded tables are for a different kind of file.");
         }
-        ofs << w << ' ' << repr << std::endl;
+        decode_segment = tables.segment;
+        column_decode = tables.columns;
+    } else if (need_tables || inline_table) {
+        read_frame_tables(backend, table);
     }
+    frame_base = frame_end = 0;
+
+    progress = {0, stream_remaining(*istrm)};
+    // Chunks only, the line index behind them isn't decoded. Frames count theirs as they get skipped
+    if (line_index && !inline_table)
+        progress.bytes_total = line_index_offset() - static_cast<uint64_t>(istrm->tellg());
+
+    // Split chunks the same way encode would split a file of this size over our own workers
+    decode_split = chunk_tuner::chunk_size(progress.bytes_total, pool->size(), chunk_tuner::saved());
+}
+
+void huffman_codec::read_frame_tables(const Backend backend, std::istream &table) {
+    std::istringstream frame_table;
+    if (inline_table) {
+        uint64_t table_len = 0;
+        istrm->read(reinterpret_cast<char*>(&table_len), sizeof(table_len));
+        if (istrm->gcount() != sizeof(table_len) || table_len > stream_remaining(*istrm)) {
+            throw std::invalid_argument("Corrupt inline table.");
+        }
+        std::string text(table_len, '\0');
+        istrm->read(text.data(), static_cast<std::streamsize>(table_len));
+        frame_table.str(std::move(text));
+    } else if (table.fail()) {
+        throw std::invalid_argument("Input file has no inline table, a table file is needed.");
+    }
+    std::istream& tables = inline_table ? frame_table : table;
+
+    // Decoders own their tables (a copy per NUMA node), tasks still decoding the frame before keep theirs alive
+    huffman_table.clear();
+    tans_norm_map.clear();
+    column_decode.reset();
+    if (backend == Backend::TANS) {
+        read_tans_table(tables);
+        const auto coder = std::make_shared<const node_local<tans_table>>(tans_table(tans_norm_map));
+        decode_segment = [coder](std::span<const char> payload, uint32_t first_bit, std::span<char> decoded) {
+            // tANS segments are separate streams, they always start on a byte
+            if (first_bit != 0) {
+                throw std::invalid_argument("Corrupt sync point index.");
+            }
+            coder->get().decode(payload, decoded);
+        };
+    } else if (backend == Backend::Tunstall) {
+        read_tunstall_table(tables);
+        const auto coder = std::make_shared<const node_local<tunstall_table>>(tunstall);
+        decode_segment = [coder](std::span<const char> payload, uint32_t first_bit, std::span<char> decoded) {
+            // Segments start on a codeword, which starts on a byte
+            if (first_bit != 0) {
+                throw std::invalid_argument("Corrupt sync point index.");
+            }
+            coder->get().decode(payload, decoded);
+        };
+    } else if (order1) {
+        read_context_table(tables);
+        const auto decode_table = std::make_shared<const node_local<huffman_kernels::context_decode_table>>(
+                huffman_kernels::build_context_decode_table(context_map, context_huffman_tables));
+        // Contexts restart at every sync point, so each segment decodes on its own like the order-0 ones
+        decode_segment = [decode_table](std::span<const char> payload, uint32_t first_bit, std::span<char> decoded) {
+            huffman_kernels::get().decode_o1(payload, decode_table->get(), decoded, first_bit);
+        };
+    } else if (column_coded) {
+        read_column_table(tables);
+        column_decoder columns{.delimiter = column_delimiter, .tables = {}};
+        for (const auto& table : column_tables)
+            columns.tables.push_back(huffman_kernels::build_decode_table(table));
+        const auto decoder = std::make_shared<const node_local<column_decoder>>(std::move(columns));
+        column_decode = decoder;
+        decode_segment = [decoder](std::span<const char> payload, uint32_t first_bit, std::span<char> decoded) {
+            // Column chunks have no sync points, the whole chunk is one segment
+            if (first_bit != 0) {
+                throw std::invalid_argument("Corrupt sync point index.");
+            }
+            const column_decoder& columns = decoder->get();
+            column_model::decode(payload, columns.delimiter, columns.tables, decoded);
+        };
+    } else if (compact_table) {
+        huffman_kernels::decode_table table;
+        huffman_kernels::canonical_decode_table(read_compact_table(std::span<const char>(frame_table.view())), table);
+        const auto decode_table = std::make_shared<const node_local<huffman_kernels::decode_table>>(std::move(table));
+        decode_segment = [decode_table](std::span<const char> payload, uint32_t first_bit, std::span<char> decoded) {
+            huffman_kernels::get().decode(payload, decode_table->get(), decoded, first_bit);
+        };
+    } else {
+        read_huffman_table(tables);
+        const auto decode_table = std::make_shared<const node_local<huffman_kernels::decode_table>>(
+                huffman_kernels::build_decode_table(huffman_table));
+        decode_segment = [decode_table](std::span<const char> payload, uint32_t first_bit, std::span<char> decoded) {
+            huffman_kernels::get().decode(payload, decode_table->get(), decoded, first_bit);
+        };
+    }
+}
+
+bool huffman_codec::next_frame() {
+    const auto index_start = istrm->tellg();
+    std::vector<line_index_entry> entries;
+    std::vector<std::vector<uint64_t>> segment_lines;
+    std::vector<chunk_checksum> sums;
+    read_line_index(entries, segment_lines, sums);
+    const auto index_end = istrm->tellg();
+    if (istrm->peek() == std::char_traits<char>::eof()) {
+        report_progress(static_cast<uint64_t>(index_end - index_start));
+        return false;
+    }
+
+    const Backend backend = read_file_header();
+    if (!inline_table || !line_index) {
+        throw std::invalid_argument("Frame is followed by data that is not a frame of its own.");
+    }
+    read_frame_tables(backend, *istrm);
+    frame_base = frame_end;
+    if (!frame_columns.empty()) {
+        std::lock_guard<std::mutex> lock(window_mtx);
+        frame_columns.emplace_back(frame_base, column_decode);
+    }
+    report_progress(static_cast<uint64_t>(istrm->tellg() - index_start));
+    return true;
+}
+
+void huffman_codec::decode_streams(std::istream &table) {
+    prepare_decode(table);
+
+    ordered_writes = true;
+    thread_chunk.store(checkpoint ? resume_decode() : 0, std::memory_order_relaxed);
+    // Decode chunks are handed out by submit_decoded
+    partition({}, CodecType::Decoding);
+}
+
+void huffman_codec::search_streams(std::istream &table, const std::string_view pattern) {
+    prepare_decode(table);
+
+    matcher = std::make_unique<line_matcher>(pattern);
+    search_offset = search_line = carry_offset = 0;
+    search_carry.clear();
+
+    ordered_writes = true;
+    thread_chunk.store(0, std::memory_order_relaxed);
+    try {
+        partition({}, CodecType::Decoding);
+    }
+    catch (...) {
+        matcher.reset();
+        throw;
+    }
+
+    // A last line without a '\n' never got closed off by a window
+    if (search_offset > carry_offset && matcher->matches(search_carry))
+        match_sink({carry_offset, search_line + 1, std::move(search_carry)});
+    matcher.reset();
+    search_carry.clear();
+}
+
+verify_result huffman_codec::verify_streams(std::istream &table, bool decode) {
+    read_file_header();
+    if (!line_index) {
+        throw std::invalid_argument("Input file has no line index, so it has no checksums either.");
+    }
+    istrm->seekg(0);
+    file_index index = read_file_index();
+    if (index.checksums.size() != index.entries.size()) {
+        throw std::invalid_argument("Input file has no chunk checksums, encode it again to verify it.");
+    }
+    istrm->clear();
+    istrm->seekg(0);
+
+    expected_checksums = std::move(index.checksums);
+    verify_state = {.chunks = expected_checksums.size(), .corrupt_chunks = {}, .mismatched_chunks = {}};
+    verify_seen.assign(expected_checksums.size(), false);
+    // Every record runs up to the next one of its frame, or to the frame's closing record
+    verify_records.clear();
+    for (size_t c = 0; c < index.entries.size(); ++c) {
+        const bool last = c + 1 == index.entries.size() || index.chunk_frames[c + 1] != index.chunk_frames[c];
+        const uint64_t end = last ? index.frame_closings[index.chunk_frames[c]] : index.entries[c + 1].file_offset;
+        // An index that can't be right checks nothing, the chunk's checksum still does
+        if (end >= index.entries[c].file_offset + 3 * sizeof(size_t))
+            verify_records[index.entries[c].file_offset] = {c, end};
+    }
+    try {
+        if (decode) {
+            // Decoded chunks are checked and dropped, the writer writes into a stream without a buffer
+            std::ostream discard(nullptr);
+            ostrm = &discard;
+            decode_streams(table);
+            ostrm = nullptr;
+        } else {
+            // Payloads only, no table and nothing waiting on the chunk before it
+            prepare_decode(table, false);
+            ordered_writes = false;
+            thread_chunk.store(0, std::memory_order_relaxed);
+            partition([this](const std::vector<char>&& body, size_t chunk_id) {
+                payload_intact(chunk_id, body);
+            }, CodecType::Decoding);
+        }
+    }
+    catch (...) {
+        ostrm = nullptr;
+        expected_checksums.clear();
+        verify_records.clear();
+        throw;
+    }
+
+    // A chunk whose id got mangled never turned up under its own
+    for (size_t c = 0; c < verify_seen.size(); ++c)
+        if (!verify_seen[c]) verify_state.corrupt_chunks.push_back(c);
+    expected_checksums.clear();
+    verify_seen.clear();
+    verify_records.clear();
+
+    verify_result result = std::move(verify_state);
+    std::ranges::sort(result.corrupt_chunks);
+    result.corrupt_chunks.erase(std::unique(result.corrupt_chunks.begin(), result.corrupt_chunks.end()), result.corrupt_chunks.end());
+    std::ranges::sort(result.mismatched_chunks);
+    return result;
+}
+
+bool huffman_codec::payload_intact(size_t chunk_id, std::span<const char> payload) {
+    const auto span = trace_span("checksum");
+    const bool intact = chunk_id < expected_checksums.size() && crc32c::of(payload) == expected_checksums[chunk_id].payload;
+
+    std::lock_guard<std::mutex> lock(window_mtx);
+    if (chunk_id < verify_seen.size()) verify_seen[chunk_id] = true;
+    if (!intact) verify_state.corrupt_chunks.push_back(chunk_id);
+    return intact;
+}
+
+void huffman_codec::check_decoded(size_t chunk_id, std::span<const char> decoded) {
+    const auto span = trace_span("checksum");
+    if (chunk_id < expected_checksums.size() && crc32c::of(decoded) == expected_checksums[chunk_id].data) return;
+
+    std::lock_guard<std::mutex> lock(window_mtx);
+    verify_state.mismatched_chunks.push_back(chunk_id);
+}
+
+void huffman_codec::init_streams(const std::string_view &input_file, const std::string_view &output_file,
+                                 const huffman_codec::CodecType codec_type, bool keep_output) {
+    if (!std::filesystem::exists(input_file)) {
+        throw std::invalid_argument("Provided input file path does not exist: " + std::string(input_file));
+    }
+
+    const auto in_ext = std::filesystem::path(input_file).extension();
+    const auto out_ext = std::filesystem::path(output_file).extension();
+    if (codec_type == CodecType::Encoding && (in_ext != ".txt" || out_ext != ".bin") ||
+            codec_type == CodecType::Decoding && (in_ext != ".bin" || out_ext != ".txt"))
+    {
+        throw std::invalid_argument("File extensions invalid. Input/Output extension should be .txt/.bin for \n"
+                                    "encode operations and .bin/.txt for decode operations, respectively.");
+    }
+
+    std::string abs_in_file = std::filesystem::absolute(input_file).string();
+    std::string abs_out_file = std::filesystem::absolute(output_file).string();
+
+    std::ifstream ifs(abs_in_file, codec_type == CodecType::Encoding ? std::ios::in : std::ios::binary);
+    std::ofstream ofs(abs_out_file, keep_output ? std::ios::in | std::ios::out | std::ios::binary
+                                               : codec_type == CodecType::Decoding ? std::ios::out : std::ios::binary);
+
+    // Whatever that can happen lol...
+    if (!ofs.is_open() || ofs.bad() || ofs.fail()) {
+        throw std::invalid_argument("Cannot open output file to write.");
+    }
+
+    if (codec_type == CodecType::Encoding) {
+        BLOCK_SIZE = block_size(ifs);
+    }
+
+    in_file = std::move(ifs);
+    out_file = std::move(ofs);
+    istrm = &in_file;
+    ostrm = &out_file;
+}
+
+std::vector<char>::size_type huffman_codec::block_size(std::istream &input) const {
+    input.seekg(0, std::ios::end);
+    const auto ch_count = static_cast<size_t>(std::max<std::streamoff>(0, input.tellg() - static_cast<std::streamoff>(input_start)));
+
+    // Sized from the cache, the worker count and the saved tuning rather than one chunk per hardware thread
+    auto size = opts.chunk_size != 0 ? std::max<size_t>(256, opts.chunk_size)
+                                     : chunk_tuner::chunk_size(ch_count, pool->size(), chunk_tuner::saved());
+
+    // A memory cap has to fit a full window of chunks, each costing about twice its size
+    if (opts.max_memory != 0)
+        size = std::min(size, std::max<std::vector<char>::size_type>(256, opts.max_memory / (2 * inflight_window())));
+    input.clear();
+    input.seekg(static_cast<std::streamoff>(input_start), std::ios::beg);
+    return size;
+}
+
+void huffman_codec::partition(const std::function<void(const std::vector<char> &&, size_t)> &func,
+                              const huffman_codec::CodecType codec_type) {
+
+    const auto run_start = std::chrono::steady_clock::now();
+
+    // At most this many chunks are read but not yet written out, the reader waits for a slot before reading more
+    const size_t window = inflight_window();
+    const size_t max_bytes = inflight_limit();
+    buffers.set_max_buffers(2 * window);
+    kept_limit = max_bytes / 2;
+    reader_node = numa_topology::current_node();
+    /*
+     * Files with a line index (and whatever encode reads) have their chunks in chunk order, so the chunk every parked
+     * one waits on is always in flight already. Older files have them in whatever order encode threads finished,
+     * if every in-flight chunk is parked waiting on one that hasn't been read yet the only way forward is to read on.
+     */
+    const bool chunks_in_order = codec_type == CodecType::Encoding || line_index;
+
+    if (opts.trace) opts.trace->name_thread("reader");
+
+    // Output in chunk order goes through a writer thread of its own, stopped once every task is done
+    struct writer_stage {
+        huffman_codec& codec;
+        std::thread thread{};
+
+        void stop()
+        {
+            if (!thread.joinable()) return;
+            {
+                std::lock_guard<std::mutex> guard(codec.window_mtx);
+                codec.writer_done = true;
+            }
+            codec.write_cv.notify_all();
+            thread.join();
+        }
+        ~writer_stage() { stop(); }
+    } writer{*this};
+    if (ordered_writes && !matcher) {
+        writer_done = false;
+        writer.thread = std::thread(&huffman_codec::run_writer, this);
+        write_threads = 1;
+    } else if (codec_type == CodecType::Encoding && !chunk_offsets.empty()) {
+        write_threads = pool->size();
+    }
+
+    size_t block_id = 0;
+    while (!istrm->eof() && !istrm->fail())
+    {
+        {
+            // A decoded chunk stays in flight until every chunk before it is written, a chunk over max_bytes on its own
+            const auto span = trace_span("wait window");
+            std::unique_lock<std::mutex> lock(window_mtx);
+            window_cv.wait(lock, [&]() {
+                return task_error || is_cancelled() || inflight_chunks == 0 ||
+                       (inflight_chunks < window && inflight_bytes + kept_bytes < max_bytes) ||
+                       (!chunks_in_order && decoded_chunks.size() == inflight_chunks);
+            });
+            if (task_error || is_cancelled()) break;
+        }
+
+        std::vector<char> _buffer;
+        // chunk_id is read from file in decode or incremented using block_id in encode
+        size_t chunk_id = 0;
+        size_t chunk_cost = 0;
+        // Input bytes this chunk accounts for in progress reports
+        size_t chunk_bytes = 0;
+        size_t chunk_flags = 0;
+        const auto read_start = std::chrono::steady_clock::now();
+        auto read_span = std::make_optional<trace_recorder::scope>(opts.trace.get(), "read chunk");
+        if (codec_type == CodecType::Decoding) {
+            size_t byte_len = 0;
+            constexpr size_t sz = sizeof(size_t);
+            const auto record_start = verify_records.empty() ? std::streamoff{-1} : std::streamoff{istrm->tellg()};
+            istrm->read(reinterpret_cast<char*>(&chunk_id), sz);
+            istrm->read(reinterpret_cast<char*>(&byte_len), sz);
+
+            if (dedup_chunks) {
+                chunk_flags = byte_len & ~CHUNK_LENGTH_MASK;
+                byte_len &= CHUNK_LENGTH_MASK;
+            }
+            // The length isn't covered by the checksum, one that disagrees with the index has the chunk skipped
+            const auto record = verify_records.find(static_cast<uint64_t>(record_start));
+            if (record != verify_records.end()) {
+                const auto [chunk, record_end] = record->second;
+                if (byte_len != record_end - record->first - 3 * sz) {
+                    {
+                        std::lock_guard<std::mutex> lock(window_mtx);
+                        verify_seen[chunk] = true;
+                        verify_state.corrupt_chunks.push_back(chunk);
+                    }
+                    report_progress(record_end - record->first);
+                    istrm->seekg(static_cast<std::streamoff>(record_end));
+                    if (!func) {
+                        // Its place in the output stays empty, like that of a chunk failing its checksum
+                        std::unique_lock<std::mutex> lock(window_mtx);
+                        ++inflight_chunks;
+                        inflight_costs[chunk] = 0;
+                        // Its flags can't be trusted either, duplicates of it get an empty chunk too
+                        if (dedup_chunks) referenced_chunks.insert(chunk);
+                        lock.unlock();
+                        write_ordered({}, chunk);
+                    }
+                    continue;
+                }
+            }
+            if (byte_len == 0) {
+                // Concatenated frames carry on right after this one's line index
+                if (inline_table && next_frame()) continue;
+                break;
+            }
+            chunk_id += frame_base;
+            frame_end = std::max(frame_end, chunk_id + 1);
+            // Chunk starts with an extra size_t for character length which is read at encode
+            byte_len += sz;
+
+            if (chunk_flags & CHUNK_REFERENCED) {
+                // Duplicates of it can read it again from here once it's no longer kept
+                if (const auto offset = istrm->tellg(); offset >= 0) {
+                    std::lock_guard<std::mutex> lock(window_mtx);
+                    referenced_records[chunk_id] = {static_cast<uint64_t>(offset), byte_len};
+                }
+            }
+            _buffer = buffers.acquire(byte_len);
+            istrm->read(_buffer.data(), byte_len);
+            if (istrm->gcount() != static_cast<std::streamsize>(byte_len)) {
+                std::lock_guard<std::mutex> lock(window_mtx);
+                task_error = std::make_exception_ptr(std::invalid_argument("Input file ends in the middle of a chunk."));
+                break;
+            }
+
+            uint64_t data_count = 0;
+            std::memcpy(&data_count, _buffer.data(), sizeof(uint64_t));
+            chunk_cost = byte_len + data_count;
+            chunk_bytes = byte_len + 2 * sz;
+        }
+        if (codec_type == CodecType::Encoding && block_id < chunk_done.size() && chunk_done[block_id]) {
+            // Already in the output of the run this one resumes, and counted as done from the start
+            istrm->seekg(static_cast<std::streamoff>(chunk_symbols[block_id]), std::ios::cur);
+            ++block_id;
+            continue;
+        }
+        if (codec_type == CodecType::Encoding) {
+            _buffer = buffers.acquire(BLOCK_SIZE);
+            istrm->read(_buffer.data(), BLOCK_SIZE);
+            _buffer.resize(istrm->gcount());
+            // Column chunks end on a record so the next one starts on the first column, unless the record is huge
+            if (column_coded && _buffer.size() == BLOCK_SIZE && _buffer.back() != '\n') {
+                // Read on a block at a time, what follows the '\n' goes back to the stream
+                constexpr size_t step = 4096;
+                for (size_t extra = 0; extra < BLOCK_SIZE;) {
+                    const size_t read_from = _buffer.size(), want = std::min(step, BLOCK_SIZE - extra);
+                    _buffer.resize(read_from + want);
+                    istrm->read(_buffer.data() + read_from, static_cast<std::streamsize>(want));
+                    const auto got = static_cast<size_t>(istrm->gcount());
+                    _buffer.resize(read_from + got);
+                    const auto* end = static_cast<const char*>(std::memchr(_buffer.data() + read_from, '\n', got));
+                    if (end) {
+                        const auto record_end = static_cast<size_t>(end - _buffer.data()) + 1;
+                        istrm->clear();
+                        istrm->seekg(-static_cast<std::streamoff>(_buffer.size() - record_end), std::ios::cur);
+                        _buffer.resize(record_end);
+                        break;
+                    }
+                    if (got < want) break;
+                    extra += got;
+                }
+            }
+            chunk_id = frame_base + block_id;
+            // Encoded output is about the size of the input at worst for text
+            chunk_cost = 2 * _buffer.size();
+            chunk_bytes = _buffer.size();
+        }
+
+        read_span.reset();
+        read_ns += nanos_since(read_start);
+        if (read_bucket.limited()) {
+            const auto span = trace_span("throttle read");
+            read_bucket.take(chunk_bytes);
+        }
+
+        // Extra check never hurts
+        if (_buffer.empty()) break;
+
+        ++block_id;
+
+        std::unique_lock<std::mutex> lock(window_mtx);
+        ++inflight_chunks;
+        inflight_bytes += chunk_cost;
+        peak_inflight_bytes = std::max(peak_inflight_bytes, inflight_bytes);
+        // Chunks written in order leave the window once written (see write_ordered)
+        if (ordered_writes) inflight_costs[chunk_id] = chunk_cost;
+        lock.unlock();
+
+        // Verifying payloads hands decode chunks to func like any other task
+        if (codec_type == CodecType::Decoding && !func) {
+            try {
+                submit_decoded(std::move(_buffer), chunk_id, chunk_bytes, chunk_flags);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(window_mtx);
+                if (!task_error) task_error = std::current_exception();
+                break;
+            }
+            continue;
+        }
+
+        // func is captured by reference, every task is done before partition returns
+        submit_task([&, buffer = std::move(_buffer), chunk_id, chunk_cost, retire = !ordered_writes]() mutable {
+            /*
+             * The reader filled the buffer on its own node. A pinned worker on another node codes from a copy it
+             * touches first, so every pass over the chunk reads local memory, and the reader gets its buffer back.
+             */
+            unsigned node = reader_node;
+            if (codec_type == CodecType::Encoding && numa_topology::current_node() != reader_node) {
+                node = numa_topology::current_node();
+                std::vector<char> local = buffers.acquire(buffer.size(), node);
+                std::memcpy(local.data(), buffer.data(), buffer.size());
+                buffers.release(std::exchange(buffer, std::move(local)), reader_node);
+            }
+            func(std::move(buffer), chunk_id);
+            buffers.release(std::move(buffer), node);
+
+            if (retire) {
+                std::lock_guard<std::mutex> guard(window_mtx);
+                --inflight_chunks;
+                inflight_bytes -= chunk_cost;
+            }
+        }, chunk_bytes);
+    }
+
+    const auto span = trace_span("wait tasks");
+    std::unique_lock<std::mutex> lock(window_mtx);
+    window_cv.wait(lock, [this]() {return pending_tasks == 0;});
+    lock.unlock();
+    writer.stop();
+    lock.lock();
+
+    // Whatever is still parked never got its gap filled, drop it so the next run starts clean
+    decoded_chunks.clear();
+    search_parts.clear();
+    duplicate_chunks.clear();
+    referenced_chunks.clear();
+    kept_chunks.clear();
+    kept_parts.clear();
+    kept_uses.clear();
+    kept_bytes = 0;
+    referenced_records.clear();
+    inflight_costs.clear();
+    write_queue.clear();
+    inflight_chunks = 0;
+    inflight_bytes = 0;
+    run_ns += nanos_since(run_start);
+
+    std::exception_ptr error = std::exchange(task_error, nullptr);
+    // Chunks may have been dropped after the last read, so a cancel at any point means the output is incomplete
+    if (!error && is_cancelled()) error = std::make_exception_ptr(codec_cancelled());
+    if (error) std::rethrow_exception(error);
+}
+
+void huffman_codec::submit_task(std::function<void()> task, uint64_t progress_bytes) {
+    std::unique_lock<std::mutex> lock(window_mtx);
+    ++pending_tasks;
+    lock.unlock();
+
+    pool->submit([this, task = std::move(task), progress_bytes]() {
+        if (opts.trace) opts.trace->name_thread("worker");
+        try {
+            // Tasks queued before a cancel are dropped rather than worked through
+            if (!is_cancelled()) {
+                const auto start = std::chrono::steady_clock::now();
+                {
+                    const auto span = trace_span("task");
+                    task();
+                }
+                code_ns += nanos_since(start);
+                report_progress(progress_bytes);
+
+                // Capped workers idle in proportion to the time they just worked
+                if (opts.max_cpu > 0 && opts.max_cpu < 1) {
+                    const auto span = trace_span("throttle cpu");
+                    std::this_thread::sleep_for((std::chrono::steady_clock::now() - start) * ((1 - opts.max_cpu) / opts.max_cpu));
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(window_mtx);
+            if (!task_error) task_error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> guard(window_mtx);
+        --pending_tasks;
+        window_cv.notify_all();
+    });
+}
+
+pipeline_stats huffman_codec::stats() const {
+    constexpr double NS = 1e9;
+    return {static_cast<double>(run_ns) / NS,
+            {1, static_cast<double>(read_ns) / NS},
+            {static_cast<size_t>(pool->size()), static_cast<double>(code_ns) / NS},
+            {write_threads, static_cast<double>(write_ns) / NS},
+            peak_inflight_bytes};
+}
+
+void huffman_codec::reset_stats() {
+    read_ns = 0;
+    code_ns = 0;
+    write_ns = 0;
+    run_ns = 0;
+    write_threads = 0;
+    peak_inflight_bytes = 0;
+}
+
+uint64_t huffman_codec::stream_remaining(std::istream &input) {
+    const auto pos = input.tellg();
+    input.seekg(0, std::ios::end);
+    const auto end = input.tellg();
+    input.seekg(pos);
+
+    return pos < 0 || end < pos ? 0 : static_cast<uint64_t>(end - pos);
+}
+
+bool huffman_codec::is_cancelled() const {
+    return opts.cancel && opts.cancel->is_cancelled();
+}
+
+void huffman_codec::report_progress(uint64_t bytes) {
+    if (!opts.on_progress) return;
+
+    std::lock_guard<std::mutex> lock(progress_mtx);
+    progress.bytes_done += bytes;
+    opts.on_progress(progress);
+}
+
+size_t huffman_codec::sync_interval() const {
+    // Tiny segments would make the index bigger than what they save, and a count past 32 bits unrepresentable
+    return run_sync_interval == 0 ? 64 * 1024 : std::max<size_t>(1024, run_sync_interval);
+}
+
+size_t huffman_codec::sync_count(size_t data_len) const {
+    return run_sync_interval == SIZE_MAX || data_len == 0 ? 0 : (data_len - 1) / sync_interval();
+}
+
+size_t huffman_codec::index_length(size_t data_len) const {
+    return run_sync_interval == SIZE_MAX ? 0 : sizeof(uint32_t) + sync_count(data_len) * sizeof(sync_point);
+}
+
+void huffman_codec::set_sync_point(std::vector<char> &record, size_t index, const sync_point &point) {
+    // Point 0 is implicit, so point i sits at slot i - 1
+    std::memcpy(record.data() + CHUNK_HEADER + sizeof(uint32_t) + (index - 1) * sizeof(sync_point), &point, sizeof(sync_point));
+}
+
+size_t huffman_codec::segment_symbols() const {
+    return run_sync_interval == SIZE_MAX ? SIZE_MAX : sync_interval();
+}
+
+size_t huffman_codec::inflight_window() const {
+    return opts.max_inflight != 0 ? opts.max_inflight : 2 * static_cast<size_t>(pool->size());
+}
+
+size_t huffman_codec::inflight_limit() const {
+    if (opts.max_memory != 0) return opts.max_memory;
+    // Encode chunks cost about twice their size (see partition), decode ones about as much
+    const size_t max_chunk = chunk_tuner::saved().max_chunk != 0 ? chunk_tuner::saved().max_chunk
+                                                                  : 4 * chunk_tuner::cache_size();
+    return 2 * inflight_window() * std::max(max_chunk, opts.chunk_size);
+}
+
+void huffman_codec::write_huffman_encoded(const std::vector<char> &&data, size_t chunk_id) {
+    size_t data_len = std::size(data);
+
+    if (data_len == 0) {return;}
+    const uint32_t data_crc = checksums ? crc32c::of(data) : 0;
+    if (write_duplicate(data_len, chunk_id, data_crc)) {return;}
+
+    if (column_coded) {
+        // No sync index, the column layout says where every stream starts
+        std::vector<char> record = buffers.acquire(CHUNK_HEADER);
+        {
+            const auto span = trace_span("encode kernel");
+            const auto counters = perf_span(perf_counters::Stage::Encode, data_len);
+            column_model::encode(data, column_delimiter, local_column_codes->get(), record);
+        }
+        write_chunk(std::move(record), data_len, chunk_id, data_crc);
+        return;
+    }
+
+    // Copies of the tables on this worker's node
+    const auto* codes = order1 ? nullptr : &local_codes->get();
+    const auto* context_codes = order1 ? &local_context_codes->get() : nullptr;
+
+    const size_t interval = sync_interval();
+    const size_t count = sync_count(data_len);
+    const size_t index_len = index_length(data_len);
+
+    // Header and sync index go in front, filled in by write_chunk and below, the kernel codes straight in behind them
+    std::vector<char> record = buffers.acquire(CHUNK_HEADER + index_len);
+    // Codes run on across segments, a segment starts wherever the bits of the one before it end
+    std::vector<uint64_t> segment_bits(count);
+    {
+        const auto span = trace_span("encode kernel");
+        const auto counters = perf_span(perf_counters::Stage::Encode, data_len);
+        if (order1)
+            huffman_kernels::get().encode_o1(data, segment_symbols(), *context_codes, record, segment_bits);
+        else
+            huffman_kernels::get().encode(data, interval, *codes, record, segment_bits);
+    }
+    if (index_len != 0) {
+        const auto count32 = static_cast<uint32_t>(count);
+        std::memcpy(record.data() + CHUNK_HEADER, &count32, sizeof(uint32_t));
+        for (size_t i = 0; i < count; ++i)
+            set_sync_point(record, i + 1, {(i + 1) * interval, segment_bits[i]});
+    }
+
+    write_chunk(std::move(record), data_len, chunk_id, data_crc);
+}
+
+template <class Coder>
+void huffman_codec::write_segments_encoded(const Coder& coder, const std::vector<char>& data, size_t chunk_id) {
+    if (data.empty()) {return;}
+    const uint32_t data_crc = checksums ? crc32c::of(data) : 0;
+    if (write_duplicate(data.size(), chunk_id, data_crc)) {return;}
+
+    const size_t interval = sync_interval();
+    const size_t count = sync_count(data.size());
+    const size_t index_len = index_length(data.size());
+
+    std::vector<char> record = buffers.acquire(CHUNK_HEADER + index_len);
+    if (index_len != 0) {
+        const auto count32 = static_cast<uint32_t>(count);
+        std::memcpy(record.data() + CHUNK_HEADER, &count32, sizeof(uint32_t));
+    }
+
+    std::vector<char> segment = buffers.acquire(0);
+    for (size_t i = 0; i <= count; ++i) {
+        if (i > 0)
+            set_sync_point(record, i, {i * interval, (record.size() - CHUNK_HEADER - index_len) * 8});
+
+        const size_t len = i == count ? data.size() - i * interval : interval;
+        const auto span = trace_span("encode kernel");
+        const auto counters = perf_span(perf_counters::Stage::Encode, len);
+        coder.encode(std::span(data).subspan(i * interval, len), segment);
+        record.insert(record.end(), segment.begin(), segment.end());
+    }
+    buffers.release(std::move(segment));
+
+    write_chunk(std::move(record), data.size(), chunk_id, data_crc);
+}
+
+void huffman_codec::write_tans_encoded(const std::vector<char> &&data, size_t chunk_id) {
+    // The coder state can't be handed across a sync point
+    write_segments_encoded(local_tans->get(), data, chunk_id);
+}
+
+void huffman_codec::write_tunstall_encoded(const std::vector<char> &&data, size_t chunk_id) {
+    // Words don't cross a sync point, so every segment is parsed and padded out to a byte on its own
+    write_segments_encoded(local_tunstall->get(), data, chunk_id);
+}
+
+std::function<void(const std::vector<char>&&, size_t)> huffman_codec::encoder(const Backend backend) {
+    auto write = &huffman_codec::write_huffman_encoded;
+    if (backend == Backend::TANS)
+        write = &huffman_codec::write_tans_encoded;
+    else if (backend == Backend::Tunstall)
+        write = &huffman_codec::write_tunstall_encoded;
+    return std::bind(write, this, std::placeholders::_1, std::placeholders::_2);
+}
+
+void huffman_codec::plan_chunk_offsets() {
+    uint64_t offset = chunks_start;
+    chunk_offsets.reserve(chunk_freqs.size() + 1);
+    chunk_offsets.push_back(offset);
+
+    for (size_t id = 0; id < chunk_freqs.size(); ++id) {
+        const auto& freqs = chunk_freqs[id];
+        uint64_t data_len = 0, bits = 0;
+        for (size_t ch = 0; ch < freqs.size(); ++ch) {
+            data_len += freqs[ch];
+            bits += freqs[ch] * huffman_codes.len[ch];
+        }
+        if (run_dedup && chunk_sources[id] != id)
+            offset += CHUNK_HEADER + sizeof(uint64_t);
+        else
+            offset += CHUNK_HEADER + index_length(data_len) + (bits + 7) / 8;
+        chunk_offsets.push_back(offset);
+    }
+}
+
+void huffman_codec::write_chunk(std::vector<char> &&record, size_t data_len, size_t chunk_id, uint32_t data_crc) {
+    size_t conv_len = record.size() - CHUNK_HEADER;
+
+    /*
+     * Multithreading bookkeeping stuff to write:
+     *
+     * 1. Thread chunk's id to sync thread order in decode.
+     * 2. Converted byte length (above) so partition function knows how long each chunk is to then read and
+     *    pass to threads.
+     * 3. Original character length of text file. An example is adequate to illustrate the necessity to have this information.
+     *    Imagine a text file is only consisted of a's and b's, and we assign 0 to a and 1 to b. A chunk that
+     *    is reading its last byte, suppose 10110000, cannot decide whether the last four 0's are to be translated
+     *    as a's or they're just useless byte alignment (see above). The only way is to know how many characters were
+     *    in the original chunk, so we can interpret the last byte (Again, this ambiguity only arises for last bytes).
+     */
+    // Dedup marks go in the top bits of the length, see CHUNK_DUPLICATE
+    size_t length_field = conv_len;
+    if (run_dedup) {
+        if (chunk_sources[chunk_id] != chunk_id) length_field |= CHUNK_DUPLICATE;
+        if (chunk_referenced[chunk_id]) length_field |= CHUNK_REFERENCED;
+    }
+
+    std::memcpy(record.data(), &chunk_id, sizeof(size_t));
+    std::memcpy(record.data() + sizeof(size_t), &length_field, sizeof(size_t));
+    std::memcpy(record.data() + 2 * sizeof(size_t), &data_len, sizeof(size_t));
+    // Every chunk has a slot of its own, read once all of them are done
+    chunk_sizes[chunk_id] = record.size();
+    if (checksums) {
+        const auto span = trace_span("checksum");
+        chunk_checksums[chunk_id] = {data_crc, crc32c::of(std::span<const char>(record).subspan(2 * sizeof(size_t)))};
+    }
+
+    if (chunk_offsets.empty()) {
+        // Size wasn't known up front, chunks go out one after another in chunk order
+        write_ordered(std::move(record), chunk_id);
+        return;
+    }
+
+    if (chunk_id + 1 >= chunk_offsets.size() || chunk_offsets[chunk_id + 1] - chunk_offsets[chunk_id] != record.size()) {
+        throw std::logic_error("Encoded chunk size differs from its precomputed size.");
+    }
+
+    // Every chunk has its own spot in the file, so workers write side by side without a lock
+    if (write_bucket.limited()) {
+        const auto span = trace_span("throttle write");
+        write_bucket.take(record.size());
+    }
+    const auto span = trace_span("write chunk");
+    const auto start = std::chrono::steady_clock::now();
+    write_chunk_at(chunk_offsets[chunk_id], record);
+    if (checkpoint) checkpoint_chunk(chunk_id, chunk_offsets[chunk_id], record, false);
+    // Workers write these themselves, the time goes to the write stage rather than the coding one
+    const int64_t write_time = nanos_since(start);
+    write_ns += write_time;
+    code_ns -= write_time;
+    buffers.release(std::move(record));
+}
+
+void huffman_codec::open_chunk_output() {
+#ifdef HUFFMANCODEC_PWRITE
+    chunk_fd = ::open(out_path.c_str(), O_WRONLY);
+    if (chunk_fd < 0) {
+#else
+    chunk_out.open(out_path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!chunk_out) {
+#endif
+        throw std::invalid_argument("Cannot open output file to write.");
+    }
+}
+
+void huffman_codec::write_chunk_at(uint64_t offset, std::span<const char> bytes) {
+#ifdef HUFFMANCODEC_PWRITE
+    // pwrite doesn't move a shared file position, so workers write side by side on the one descriptor
+    while (!bytes.empty()) {
+        const ssize_t written = ::pwrite(chunk_fd, bytes.data(), bytes.size(), static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            throw std::invalid_argument("Cannot write output file.");
+        }
+        bytes = bytes.subspan(static_cast<size_t>(written));
+        offset += static_cast<uint64_t>(written);
+    }
+#else
+    std::lock_guard<std::mutex> lock(chunk_out_mtx);
+    chunk_out.seekp(static_cast<std::streamoff>(offset));
+    chunk_out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (!chunk_out) {
+        throw std::invalid_argument("Cannot write output file.");
+    }
+#endif
+}
+
+void huffman_codec::close_chunk_output() {
+#ifdef HUFFMANCODEC_PWRITE
+    if (chunk_fd >= 0) ::close(chunk_fd);
+    chunk_fd = -1;
+#else
+    if (chunk_out.is_open()) chunk_out.close();
+#endif
+}
+
+bool huffman_codec::write_duplicate(size_t data_len, size_t chunk_id, uint32_t data_crc) {
+    if (!run_dedup || chunk_sources[chunk_id] == chunk_id) return false;
+
+    const uint64_t source = chunk_sources[chunk_id];
+    std::vector<char> record = buffers.acquire(CHUNK_HEADER + sizeof(uint64_t));
+    std::memcpy(record.data() + CHUNK_HEADER, &source, sizeof(uint64_t));
+    write_chunk(std::move(record), data_len, chunk_id, data_crc);
+    return true;
+}
+
+bool huffman_codec::same_input(uint64_t first, uint64_t second, uint64_t len) {
+    constexpr size_t block = 64 * 1024;
+    std::vector<char> a(std::min<uint64_t>(block, len)), b(a.size());
+    for (uint64_t done = 0; done < len; done += a.size()) {
+        const auto n = static_cast<std::streamsize>(std::min<uint64_t>(a.size(), len - done));
+        istrm->clear();
+        istrm->seekg(static_cast<std::streamoff>(first + done));
+        istrm->read(a.data(), n);
+        istrm->seekg(static_cast<std::streamoff>(second + done));
+        istrm->read(b.data(), n);
+        if (istrm->fail() || std::memcmp(a.data(), b.data(), static_cast<size_t>(n)) != 0) return false;
+    }
+    return true;
+}
+
+bool huffman_codec::open_checkpoint(const std::filesystem::path &output, const std::string_view input,
+                                    const std::string &settings) {
+    checkpoint.reset();
+    resuming = false;
+    if (opts.checkpoint_interval <= 0 && !opts.resume) return false;
+
+    checkpoint = std::make_unique<checkpoint_file>(std::filesystem::absolute(output).concat(".ckpt"),
+                                                   opts.checkpoint_interval > 0 ? opts.checkpoint_interval : 60);
+    run_fingerprint = settings + ' ' + file_stamp(input);
+    resuming = opts.resume && std::filesystem::exists(output) &&
+               checkpoint->load(run_fingerprint, resume_plan, resume_chunks);
+    return resuming;
+}
+
+std::string huffman_codec::file_stamp(const std::filesystem::path &path) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec) return "-";
+    const auto time = std::filesystem::last_write_time(path, ec);
+    return std::to_string(size) + ' ' + std::to_string(time.time_since_epoch().count());
+}
+
+std::string huffman_codec::encode_plan(const std::string &table_text) const {
+    // [block size][table length][table][chunk count]
+    // [per chunk: symbols, dedup source, referenced, segment count, newlines per segment][offset count][offsets]
+    std::ostringstream plan;
+    auto put = [&](uint64_t value) { plan.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+    put(BLOCK_SIZE);
+    put(table_text.size());
+    plan.write(table_text.data(), static_cast<std::streamsize>(table_text.size()));
+    put(chunk_lines.size());
+    for (size_t c = 0; c < chunk_lines.size(); ++c) {
+        put(chunk_symbols[c]);
+        put(run_dedup ? chunk_sources[c] : c);
+        put(run_dedup && chunk_referenced[c]);
+        put(chunk_lines[c].size());
+        for (const uint64_t lines : chunk_lines[c])
+            put(lines);
+    }
+    put(chunk_offsets.size());
+    for (const uint64_t offset : chunk_offsets)
+        put(offset);
+    return std::move(plan).str();
+}
+
+std::string huffman_codec::restore_plan(const Backend backend) {
+    std::istringstream plan(resume_plan);
+    auto get = [&]() {
+        uint64_t value = 0;
+        if (!plan.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+            throw std::invalid_argument("Corrupt checkpoint, remove it to start over.");
+        }
+        return value;
+    };
+    // Counts can't be larger than the plan itself
+    auto count = [&]() {
+        const uint64_t value = get();
+        if (value > resume_plan.size()) {
+            throw std::invalid_argument("Corrupt checkpoint, remove it to start over.");
+        }
+        return value;
+    };
+
+    BLOCK_SIZE = get();
+    std::string table_text(count(), '\0');
+    plan.read(table_text.data(), static_cast<std::streamsize>(table_text.size()));
+
+    const uint64_t chunks = count();
+    chunk_symbols.resize(chunks);
+    chunk_sources.resize(chunks);
+    chunk_referenced.resize(chunks);
+    chunk_lines.resize(chunks);
+    for (size_t c = 0; c < chunks; ++c) {
+        chunk_symbols[c] = get();
+        chunk_sources[c] = get();
+        chunk_referenced[c] = get() != 0;
+        chunk_lines[c].resize(count());
+        for (uint64_t& lines : chunk_lines[c])
+            lines = get();
+    }
+    chunk_offsets.resize(count());
+    for (uint64_t& offset : chunk_offsets)
+        offset = get();
+
+    std::istringstream table(table_text);
+    load_encode_tables(backend, table);
+    return table_text;
+}
+
+std::vector<checkpoint_file::chunk> huffman_codec::resumed_chunks() {
+    // Later records of a chunk win, a run resumed more than once may have written it twice
+    std::map<uint64_t, checkpoint_file::chunk> records;
+    for (const auto& chunk : resume_chunks)
+        records[chunk.id] = chunk;
+
+    std::ifstream output(out_path, std::ios::binary);
+    std::vector<checkpoint_file::chunk> kept;
+    chunk_done.assign(chunk_lines.size(), false);
+    const bool positional = !chunk_offsets.empty();
+    for (size_t id = 0; id < chunk_lines.size(); ++id) {
+        const auto record = records.find(id);
+        const bool intact = record != records.end() &&
+            record->second.offset == (positional ? chunk_offsets[id] : ordered_offset) &&
+            (!positional || record->second.size == chunk_offsets[id + 1] - chunk_offsets[id]) &&
+            chunk_intact(output, record->second);
+        if (!intact) {
+            // Chunks written in order can only be skipped up to the first one missing
+            if (positional) continue;
+            break;
+        }
+
+        chunk_done[id] = true;
+        chunk_sizes[id] = record->second.size;
+        chunk_checksums[id] = {static_cast<uint32_t>(record->second.tag), static_cast<uint32_t>(record->second.tag >> 32)};
+        progress.bytes_done += chunk_symbols[id];
+        if (!positional) ordered_offset += record->second.size;
+        kept.push_back(record->second);
+    }
+    return kept;
+}
+
+size_t huffman_codec::resume_decode() {
+    // Skipping chunks takes the line index to find them, and a duplicate may repeat a chunk from before the skip
+    if (!line_index || inline_table || dedup_chunks) {
+        checkpoint.reset();
+        return 0;
+    }
+
+    std::vector<checkpoint_file::chunk> kept;
+    ordered_offset = 0;
+    if (resuming) {
+        const auto chunks_at = static_cast<uint64_t>(istrm->tellg());
+        const file_index index = read_file_index();
+        std::map<uint64_t, checkpoint_file::chunk> records;
+        for (const auto& chunk : resume_chunks)
+            records[chunk.id] = chunk;
+
+        // Decoded chunks go out in order, so the ones to skip are those up to the first one missing
+        std::ifstream output(out_path, std::ios::binary);
+        while (kept.size() < index.entries.size()) {
+            const auto record = records.find(kept.size());
+            if (record == records.end() || record->second.offset != index.entries[kept.size()].first_symbol ||
+                !chunk_intact(output, record->second)) break;
+            kept.push_back(record->second);
+        }
+
+        const uint64_t resume_at = kept.size() < index.entries.size() ? index.entries[kept.size()].file_offset
+                                                                      : index.closing_offset;
+        if (!kept.empty()) ordered_offset = kept.back().offset + kept.back().size;
+        istrm->clear();
+        istrm->seekg(static_cast<std::streamoff>(resume_at));
+        ostrm->seekp(static_cast<std::streamoff>(ordered_offset));
+        progress.bytes_done = resume_at - chunks_at;
+    }
+    checkpoint->start(run_fingerprint, {}, kept);
+    return kept.size();
+}
+
+bool huffman_codec::chunk_intact(std::istream &output, const checkpoint_file::chunk &chunk) {
+    std::vector<char> bytes(chunk.size);
+    output.clear();
+    output.seekg(static_cast<std::streamoff>(chunk.offset));
+    output.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (output.gcount() != static_cast<std::streamsize>(bytes.size())) return false;
+
+    const content_hash hash = content_hash::of(bytes);
+    return hash.lo == chunk.hash_lo && hash.hi == chunk.hash_hi;
+}
+
+void huffman_codec::checkpoint_chunk(size_t chunk_id, uint64_t offset, std::span<const char> bytes, bool flush_output) {
+    const content_hash hash = content_hash::of(bytes);
+    // Encoded chunks take their checksums along, the line index written at the end needs them
+    uint64_t tag = 0;
+    if (chunk_id < chunk_checksums.size())
+        tag = chunk_checksums[chunk_id].data | static_cast<uint64_t>(chunk_checksums[chunk_id].payload) << 32;
+    if (!checkpoint->add({chunk_id, offset, bytes.size(), hash.lo, hash.hi, tag})) return;
+
+    // Records may only land once the chunks they vouch for are in the file
+    const auto span = trace_span("save checkpoint");
+    if (flush_output) ostrm->flush();
+    checkpoint->save();
+}
+
+void huffman_codec::fetch_char_freqs(const std::vector<char> &&data, size_t chunk_id) {
+    auto kernel_span = std::make_optional<trace_recorder::scope>(opts.trace.get(), "histogram kernel");
+    std::array<uint64_t, 256> freqs{};
+    // Order-1 counts come from the same pass, the context starts over with every chunk and sync point
+    std::unique_ptr<huffman_kernels::context_histogram> pair_freqs;
+    {
+        const auto counters = perf_span(perf_counters::Stage::Histogram, data.size());
+        huffman_kernels::get().histogram(data, freqs);
+        if (order1) {
+            pair_freqs = std::make_unique<huffman_kernels::context_histogram>();
+            huffman_kernels::get().histogram_o1(data, segment_symbols(), *pair_freqs);
+        }
+    }
+    std::vector<std::array<uint64_t, 256>> chunk_column_freqs(column_freqs.size());
+    if (column_coded) {
+        const auto counters = perf_span(perf_counters::Stage::Histogram, data.size());
+        column_model::histogram(data, column_delimiter, chunk_column_freqs);
+    }
+
+    // Newlines per sync segment, so the line index can point into the middle of a chunk
+    std::vector<uint64_t> lines;
+    const size_t segment = segment_symbols();
+    for (size_t start = 0; start < data.size(); start += std::min(segment, data.size() - start))
+        lines.push_back(std::count(data.begin() + start, data.begin() + start + std::min(segment, data.size() - start), '\n'));
+
+    const content_hash hash = run_dedup ? content_hash::of(data) : content_hash{};
+    kernel_span.reset();
+
+    std::unique_lock<std::mutex> lock(histogram_mtx, std::defer_lock);
+    {
+        const auto span = trace_span("wait histogram_mtx");
+        lock.lock();
+    }
+    if (chunk_lines.size() <= chunk_id) chunk_lines.resize(chunk_id + 1);
+    chunk_lines[chunk_id] = std::move(lines);
+    if (chunk_symbols.size() <= chunk_id) chunk_symbols.resize(chunk_id + 1);
+    chunk_symbols[chunk_id] = data.size();
+    if (run_dedup) {
+        if (chunk_hashes.size() <= chunk_id) chunk_hashes.resize(chunk_id + 1);
+        chunk_hashes[chunk_id] = hash;
+    }
+    if (pair_freqs) {
+        for (size_t c = 0; c < 256; ++c)
+            for (size_t ch = 0; ch < 256; ++ch)
+                (*context_freqs)[c][ch] += (*pair_freqs)[c][ch];
+    }
+    for (size_t c = 0; c < chunk_column_freqs.size(); ++c)
+        for (size_t ch = 0; ch < 256; ++ch)
+            column_freqs[c][ch] += chunk_column_freqs[c][ch];
+    if (chunk_freqs.size() <= chunk_id) chunk_freqs.resize(chunk_id + 1);
+    chunk_freqs[chunk_id] = freqs;
+
+    for (size_t ch = 0; ch < freqs.size(); ++ch) {
+        if (freqs[ch] == 0) continue;
+        auto [mp_iterator, inserted] = frequency_map.try_emplace(static_cast<char>(ch), freqs[ch]);
+        if (!inserted) {
+            mp_iterator->second += freqs[ch];
+        }
+    }
+    lock.unlock();
+}
+
+void huffman_codec::submit_decoded(std::vector<char> &&data, size_t chunk_id, uint64_t chunk_bytes, size_t chunk_flags,
+                                   bool check_payload) {
+    if (check_payload && !expected_checksums.empty() && !payload_intact(chunk_id, data)) {
+        // Not worth decoding, its place in the output stays empty (and so do the duplicates repeating it)
+        buffers.release(std::move(data));
+        if (chunk_flags & CHUNK_REFERENCED) {
+            std::lock_guard<std::mutex> lock(window_mtx);
+            referenced_chunks.insert(chunk_id);
+        }
+        report_progress(chunk_bytes);
+        write_ordered({}, chunk_id);
+        return;
+    }
+    if (chunk_flags & CHUNK_DUPLICATE) {
+        // Nothing to decode, the writer copies the chunk it repeats once its turn comes
+        uint64_t source = 0;
+        if (data.size() != 2 * sizeof(uint64_t)) {
+            throw std::invalid_argument("Corrupt duplicate chunk.");
+        }
+        std::memcpy(&source, data.data() + sizeof(uint64_t), sizeof(uint64_t));
+        buffers.release(std::move(data));
+        // Sources are numbered within their frame
+        source += frame_base;
+        if (source >= chunk_id) {
+            throw std::invalid_argument("Corrupt duplicate chunk.");
+        }
+
+        std::unique_lock<std::mutex> lock(window_mtx);
+        // A source written a while ago may have been dropped to stay under kept_limit
+        const bool dropped = source < thread_chunk.load(std::memory_order_relaxed) && !kept_uses.contains(source) &&
+                             referenced_records.contains(source);
+        if (!dropped) {
+            duplicate_chunks.emplace(chunk_id, source);
+            ++kept_uses[source].pins;
+        }
+        lock.unlock();
+
+        if (dropped) {
+            // Decoded again under this chunk's id, its data checksum is the source's anyway
+            std::vector<char> body = reread_chunk(source);
+            if (expected_checksums.empty() || payload_intact(source, body)) {
+                submit_decoded(std::move(body), chunk_id, chunk_bytes, 0, false);
+                return;
+            }
+            buffers.release(std::move(body));
+        }
+        report_progress(chunk_bytes);
+        write_ordered({}, chunk_id);
+        return;
+    }
+    if (chunk_flags & CHUNK_REFERENCED) {
+        std::lock_guard<std::mutex> lock(window_mtx);
+        referenced_chunks.insert(chunk_id);
+    }
+
+    // Chunk being decoded by one or more tasks, each covering a run of whole segments
+    struct decode_job {
+        std::vector<char> data;
+        std::vector<char> decoded;
+        std::span<const char> payload;
+        // Segment starts (symbol, bit in payload), closed off by an entry for the end of the chunk
+        std::vector<std::pair<uint64_t, uint64_t>> segments;
+        // Search runs only keep what every segment matched, never the whole decoded chunk
+        std::vector<search_part> parts;
+        segment_decoder decode;
+        std::atomic_size_t remaining;
+    };
+    auto job = std::make_shared<decode_job>();
+    job->data = std::move(data);
+    job->decode = decode_segment;
+
+    // Retrieve character length
+    uint64_t data_count = 0;
+    std::memcpy(&data_count, job->data.data(), sizeof(uint64_t));
+    job->payload = parse_segments(std::span<const char>(job->data).subspan(sizeof(uint64_t)), data_count, job->segments);
+    if (matcher)
+        job->parts.resize(job->segments.size() - 1);
+    else
+        job->decoded = buffers.acquire(data_count);
+
+    // Group consecutive segments into tasks of about decode_split compressed bytes
+    std::vector<std::pair<size_t, size_t>> tasks;
+    for (size_t first = 0, i = 1; i < job->segments.size(); ++i) {
+        if ((job->segments[i].second - job->segments[first].second) / 8 >= decode_split || i + 1 == job->segments.size()) {
+            tasks.emplace_back(first, i);
+            first = i;
+        }
+    }
+    job->remaining = tasks.size();
+
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        // Spread the chunk's share of progress over its tasks
+        const uint64_t bytes = chunk_bytes / tasks.size() + (t == 0 ? chunk_bytes % tasks.size() : 0);
+        submit_task([this, job, first = tasks[t].first, last = tasks[t].second, chunk_id]() {
+            for (size_t i = first; i < last; ++i) {
+                const auto [symbol, bit] = job->segments[i];
+                const auto [next_symbol, next_bit] = job->segments[i + 1];
+                // Whole bytes the segment touches, a huffman one may share its first and last with its neighbours
+                const uint64_t first_byte = bit / 8, end_byte = (next_bit + 7) / 8;
+                const auto payload = job->payload.subspan(first_byte, end_byte - first_byte);
+                if (!matcher) {
+                    const auto span = trace_span("decode kernel");
+                    const auto counters = perf_span(perf_counters::Stage::Decode, next_symbol - symbol);
+                    job->decode(payload, static_cast<uint32_t>(bit % 8),
+                                std::span(job->decoded).subspan(symbol, next_symbol - symbol));
+                    continue;
+                }
+
+                // Searching decodes into a segment sized window and drops it once matched
+                std::vector<char> window = buffers.acquire(next_symbol - symbol);
+                {
+                    const auto span = trace_span("decode kernel");
+                    const auto counters = perf_span(perf_counters::Stage::Decode, next_symbol - symbol);
+                    job->decode(payload, static_cast<uint32_t>(bit % 8), window);
+                }
+                const auto span = trace_span("match window");
+                job->parts[i] = scan_window(*matcher, std::string_view(window.data(), window.size()));
+                buffers.release(std::move(window));
+            }
+
+            if (job->remaining.fetch_sub(1) == 1) {
+                buffers.release(std::move(job->data), reader_node);
+                if (matcher) {
+                    std::lock_guard<std::mutex> guard(window_mtx);
+                    search_parts.emplace(chunk_id, std::move(job->parts));
+                }
+                if (!expected_checksums.empty()) check_decoded(chunk_id, job->decoded);
+                write_ordered(std::move(job->decoded), chunk_id);
+            }
+        }, bytes);
+    }
+}
+
+std::span<const char> huffman_codec::parse_segments(std::span<const char> body, uint64_t data_count,
+                                                    std::vector<std::pair<uint64_t, uint64_t>> &segments) const {
+    std::span<const char> payload = body;
+    segments.emplace_back(0, 0);
+    if (sync_points) {
+        uint32_t count = 0;
+        if (payload.size() < sizeof(uint32_t)) {
+            throw std::invalid_argument("Corrupt sync point index.");
+        }
+        std::memcpy(&count, payload.data(), sizeof(uint32_t));
+
+        const size_t index_len = sizeof(uint32_t) + static_cast<size_t>(count) * sizeof(sync_point);
+        if (index_len > payload.size()) {
+            throw std::invalid_argument("Corrupt sync point index.");
+        }
+        const auto index = payload.subspan(sizeof(uint32_t), count * sizeof(sync_point));
+        payload = payload.subspan(index_len);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            sync_point point{};
+            std::memcpy(&point, index.data() + i * sizeof(sync_point), sizeof(sync_point));
+            const auto& [prev_symbol, prev_bit] = segments.back();
+            if (point.symbol <= prev_symbol || point.symbol >= data_count ||
+                    point.bit_offset < prev_bit || point.bit_offset > payload.size() * 8) {
+                throw std::invalid_argument("Corrupt sync point index.");
+            }
+            segments.emplace_back(point.symbol, point.bit_offset);
+        }
+    }
+    segments.emplace_back(data_count, payload.size() * 8);
+    return payload;
+}
+
+void huffman_codec::write_ordered(std::vector<char> &&decrypted, size_t chunk_id) {
+    /*
+     * Chunks sit in the .bin in whatever order encode threads finished, so a chunk may be decoded before the ones
+     * that precede it. Instead of blocking a pool thread until its turn comes (which could starve the very chunk it
+     * is waiting on), park it and let whoever completes the gap hand every chunk that is ready by then to the
+     * writer. Searches have no output, their matches are reported right here.
+     */
+    std::unique_lock<std::mutex> lck(window_mtx, std::defer_lock);
+    {
+        const auto span = trace_span("wait window_mtx");
+        lck.lock();
+    }
+    const auto span = trace_span("write ordered");
+    decoded_chunks.emplace(chunk_id, std::move(decrypted));
+
+    auto next = decoded_chunks.find(thread_chunk.load(std::memory_order_relaxed));
+    while (next != decoded_chunks.end()) {
+        const size_t id = next->first;
+        if (const auto dup = duplicate_chunks.find(id); dup != duplicate_chunks.end()) {
+            // Copy of a chunk written before, which is still around because it was marked referenced
+            const auto kept = kept_chunks.find(dup->second);
+            const auto parts = kept_parts.find(dup->second);
+            if (matcher ? parts == kept_parts.end() : kept == kept_chunks.end()) {
+                throw std::invalid_argument("Corrupt duplicate chunk.");
+            }
+            if (matcher) {
+                emit_search(std::vector<search_part>(parts->second));
+                retire_chunk(id);
+            } else {
+                write_queue.emplace_back(id, kept->second);
+            }
+            auto& use = kept_uses[dup->second];
+            --use.pins;
+            use.last_use = ++kept_clock;
+            duplicate_chunks.erase(dup);
+            buffers.release(std::move(next->second));
+        } else if (matcher) {
+            auto parts = search_parts.extract(id);
+            if (referenced_chunks.contains(id)) {
+                auto& use = kept_uses[id];
+                for (const auto& part : parts.mapped()) {
+                    use.bytes += sizeof(part) + part.head.size() + part.tail.size();
+                    for (const auto& match : part.matches)
+                        use.bytes += sizeof(match) + match.text.size();
+                }
+                use.last_use = ++kept_clock;
+                kept_bytes += use.bytes;
+                kept_parts.emplace(id, parts.mapped());
+            }
+            emit_search(std::move(parts.mapped()));
+            buffers.release(std::move(next->second));
+            retire_chunk(id);
+        } else {
+            if (referenced_chunks.contains(id)) {
+                auto& use = kept_uses[id];
+                use.bytes = next->second.size();
+                use.last_use = ++kept_clock;
+                kept_bytes += use.bytes;
+                kept_chunks.emplace(id, next->second);
+            }
+            write_queue.emplace_back(id, std::move(next->second));
+        }
+        decoded_chunks.erase(next);
+        evict_kept();
+
+        next = decoded_chunks.find(thread_chunk.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+    write_cv.notify_one();
+    window_cv.notify_all();
+}
+
+void huffman_codec::evict_kept() {
+    while (kept_bytes > kept_limit) {
+        // Only what can be read again goes, the few chunks of input that can't seek stay
+        auto oldest = kept_uses.end();
+        for (auto it = kept_uses.begin(); it != kept_uses.end(); ++it) {
+            if (it->second.pins == 0 && referenced_records.contains(it->first) &&
+                    (oldest == kept_uses.end() || it->second.last_use < oldest->second.last_use))
+                oldest = it;
+        }
+        if (oldest == kept_uses.end()) return;
+
+        kept_bytes -= oldest->second.bytes;
+        if (const auto kept = kept_chunks.find(oldest->first); kept != kept_chunks.end()) {
+            buffers.release(std::move(kept->second), reader_node);
+            kept_chunks.erase(kept);
+        }
+        kept_parts.erase(oldest->first);
+        kept_uses.erase(oldest);
+    }
+}
+
+std::vector<char> huffman_codec::reread_chunk(size_t chunk_id) {
+    std::unique_lock<std::mutex> lock(window_mtx);
+    const auto [offset, len] = referenced_records.at(chunk_id);
+    lock.unlock();
+
+    const auto span = trace_span("read kept chunk");
+    const auto resume = istrm->tellg();
+    std::vector<char> body = buffers.acquire(len);
+    istrm->seekg(static_cast<std::streamoff>(offset));
+    istrm->read(body.data(), static_cast<std::streamsize>(len));
+    const bool complete = istrm->gcount() == static_cast<std::streamsize>(len);
+    istrm->clear();
+    istrm->seekg(resume);
+    if (!complete) {
+        buffers.release(std::move(body));
+        throw std::invalid_argument("Input file ends in the middle of a chunk.");
+    }
+    return body;
+}
+
+void huffman_codec::run_writer() {
+    if (opts.trace) opts.trace->name_thread("writer");
+
+    std::unique_lock<std::mutex> lock(window_mtx);
+    for (;;) {
+        write_cv.wait(lock, [this]() { return !write_queue.empty() || writer_done; });
+        if (write_queue.empty()) return;
+
+        auto [chunk_id, data] = std::move(write_queue.front());
+        write_queue.pop_front();
+        // A failed or cancelled run only drains the queue, its output is incomplete either way
+        const bool skip = task_error || is_cancelled();
+        lock.unlock();
+
+        if (!skip) {
+            try {
+                if (write_bucket.limited()) {
+                    const auto span = trace_span("throttle write");
+                    write_bucket.take(data.size());
+                }
+                const auto start = std::chrono::steady_clock::now();
+                {
+                    const auto span = trace_span("write ordered");
+                    ostrm->write(data.data(), static_cast<std::streamsize>(data.size()));
+                    if (checkpoint) {
+                        checkpoint_chunk(chunk_id, ordered_offset, data, true);
+                        ordered_offset += data.size();
+                    }
+                }
+                write_ns += nanos_since(start);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(window_mtx);
+                if (!task_error) task_error = std::current_exception();
+            }
+        }
+        buffers.release(std::move(data));
+
+        lock.lock();
+        retire_chunk(chunk_id);
+        window_cv.notify_all();
+    }
+}
+
+void huffman_codec::retire_chunk(size_t chunk_id) {
+    const auto cost = inflight_costs.find(chunk_id);
+    if (cost != inflight_costs.end()) {
+        inflight_bytes -= cost->second;
+        inflight_costs.erase(cost);
+    }
+    --inflight_chunks;
+}
+
+huffman_codec::search_part huffman_codec::scan_window(const line_matcher &matcher, std::string_view window) {
+    search_part part;
+    part.length = window.size();
+
+    const size_t first = window.find('\n');
+    if (first == std::string_view::npos) {
+        part.head = window;
+        return part;
+    }
+    const size_t last = window.rfind('\n');
+    part.head = window.substr(0, first);
+    part.tail = window.substr(last + 1);
+    part.newlines = std::count(window.begin(), window.end(), '\n');
+
+    // Whole lines between the first and the last '\n', a match's line is the number of '\n' in front of it
+    if (last > first) {
+        const std::string_view lines = window.substr(first + 1, last - first - 1);
+        size_t counted = 0, line = 0;
+        matcher.scan(lines, [&](size_t start, size_t end) {
+            line += std::count(lines.begin() + counted, lines.begin() + start, '\n');
+            counted = start;
+            part.matches.push_back({first + 1 + start, 1 + line, std::string(lines.substr(start, end - start))});
+        });
+    }
+    return part;
+}
+
+void huffman_codec::emit_search(std::vector<search_part> &&parts) {
+    for (auto& part : parts) {
+        if (part.newlines == 0) {
+            search_carry += part.head;
+            search_offset += part.length;
+            continue;
+        }
+
+        // The head closes off whatever line the windows before left open
+        search_carry += part.head;
+        if (matcher->matches(search_carry))
+            match_sink({carry_offset, search_line + 1, std::move(search_carry)});
+
+        for (auto& match : part.matches) {
+            match.offset += search_offset;
+            match.line += search_line + 1;
+            match_sink(match);
+        }
+
+        search_line += part.newlines;
+        search_carry = std::move(part.tail);
+        carry_offset = search_offset + part.length - search_carry.size();
+        search_offset += part.length;
+    }
+}
+
+uint64_t huffman_codec::line_index_offset() {
+    const auto pos = istrm->tellg();
+    uint64_t offset = 0;
+    char magic[sizeof(LINE_INDEX_MAGIC)] = {};
+
+    istrm->seekg(-static_cast<std::streamoff>(sizeof(offset) + sizeof(magic)), std::ios::end);
+    istrm->read(reinterpret_cast<char*>(&offset), sizeof(offset));
+    istrm->read(magic, sizeof(magic));
+    if (!*istrm || !std::equal(std::begin(LINE_INDEX_MAGIC), std::end(LINE_INDEX_MAGIC), magic) ||
+            offset < static_cast<uint64_t>(pos)) {
+        throw std::invalid_argument("Corrupt line index.");
+    }
+
+    istrm->seekg(pos);
+    return offset;
+}
+
+huffman_codec::file_index huffman_codec::read_file_index(bool segments) {
+    std::istream& input = *istrm;
+    file_index index;
+    auto& [entries, segment_lines, sums, frames, chunk_frames, closing_offset, frame_closings, segment_offsets] = index;
+    std::vector<uint64_t>* const offsets = segments ? nullptr : &segment_offsets;
+
+    if (!inline_table) {
+        closing_offset = line_index_offset();
+        input.seekg(static_cast<std::streamoff>(closing_offset + 2 * sizeof(size_t)));
+        read_line_index(entries, segment_lines, sums, offsets);
+        frames.push_back(0);
+        frame_closings.push_back(closing_offset);
+        chunk_frames.assign(entries.size(), 0);
+        return index;
+    }
+
+    // A frame doesn't know where it ends, so hop over its records up to the closing one to find its index
+    uint64_t lines = 0;
+    for (uint64_t start = 0;; start = static_cast<uint64_t>(input.tellg())) {
+        input.clear();
+        input.seekg(static_cast<std::streamoff>(start));
+        if (input.peek() == std::char_traits<char>::eof()) break;
+
+        read_file_header();
+        if (!inline_table || !line_index) {
+            throw std::invalid_argument("Frame is followed by data that is not a frame of its own.");
+        }
+        uint64_t table_len = 0;
+        read_exact(input, &table_len, sizeof(table_len));
+        input.seekg(static_cast<std::streamoff>(table_len), std::ios::cur);
+        for (;;) {
+            size_t record[2] = {};
+            read_exact(input, record, sizeof(record));
+            const size_t len = dedup_chunks ? record[1] & CHUNK_LENGTH_MASK : record[1];
+            if (len == 0) break;
+            input.seekg(static_cast<std::streamoff>(len + sizeof(size_t)), std::ios::cur);
+        }
+        closing_offset = static_cast<uint64_t>(input.tellg()) - 2 * sizeof(size_t);
+        frame_closings.push_back(closing_offset);
+
+        std::vector<line_index_entry> frame_entries;
+        std::vector<std::vector<uint64_t>> frame_lines;
+        std::vector<chunk_checksum> frame_sums;
+        std::vector<uint64_t> frame_offsets;
+        read_line_index(frame_entries, frame_lines, frame_sums, offsets ? &frame_offsets : nullptr);
+        const auto frame_end = input.tellg();
+        sums.insert(sums.end(), frame_sums.begin(), frame_sums.end());
+        for (size_t c = 0; c < frame_entries.size(); ++c) {
+            frame_entries[c].file_offset += start;
+            frame_entries[c].first_line += lines;
+            entries.push_back(frame_entries[c]);
+            if (offsets)
+                segment_offsets.push_back(frame_offsets[c]);
+            else
+                segment_lines.push_back(std::move(frame_lines[c]));
+            chunk_frames.push_back(frames.size());
+        }
+        if (!frame_entries.empty()) {
+            const auto& last_lines = offsets ? read_segment_lines(index, entries.size() - 1) : segment_lines.back();
+            lines = frame_entries.back().first_line + std::accumulate(last_lines.begin(), last_lines.end(), uint64_t{0});
+        }
+        frames.push_back(start);
+        input.seekg(frame_end);
+    }
+    return index;
+}
+
+void huffman_codec::read_line_index(std::vector<line_index_entry> &entries,
+                                    std::vector<std::vector<uint64_t>> &segment_lines,
+                                    std::vector<chunk_checksum> &sums, std::vector<uint64_t> *segment_offsets) {
+    const uint64_t index_size = stream_remaining(*istrm);
+    uint64_t chunks = 0;
+    read_exact(*istrm, &chunks, sizeof(chunks));
+    if (chunks > index_size / sizeof(line_index_entry)) {
+        throw std::invalid_argument("Corrupt line index.");
+    }
+    entries.resize(chunks);
+    read_exact(*istrm, entries.data(), chunks * sizeof(line_index_entry));
+
+    if (segment_offsets) {
+        // Counts and checksums stay on disk, the caller reads the counts of the chunks it needs
+        auto offset = static_cast<uint64_t>(istrm->tellg());
+        uint64_t counts = 0;
+        segment_offsets->resize(chunks);
+        for (size_t c = 0; c < chunks; ++c) {
+            if (entries[c].segments > index_size / sizeof(uint64_t) - counts) {
+                throw std::invalid_argument("Corrupt line index.");
+            }
+            (*segment_offsets)[c] = offset + counts * sizeof(uint64_t);
+            counts += entries[c].segments;
+        }
+        sums.clear();
+        istrm->seekg(static_cast<std::streamoff>(counts * sizeof(uint64_t) + (checksums ? chunks * sizeof(chunk_checksum) : 0)),
+                     std::ios::cur);
+    } else {
+        segment_lines.resize(chunks);
+        for (size_t c = 0; c < chunks; ++c) {
+            if (entries[c].segments > index_size / sizeof(uint64_t)) {
+                throw std::invalid_argument("Corrupt line index.");
+            }
+            segment_lines[c].resize(entries[c].segments);
+            read_exact(*istrm, segment_lines[c].data(), segment_lines[c].size() * sizeof(uint64_t));
+        }
+        sums.resize(checksums ? chunks : 0);
+        read_exact(*istrm, sums.data(), sums.size() * sizeof(chunk_checksum));
+    }
+
+    uint64_t index_offset = 0;
+    char magic[sizeof(LINE_INDEX_MAGIC)] = {};
+    read_exact(*istrm, &index_offset, sizeof(index_offset));
+    read_exact(*istrm, magic, sizeof(magic));
+    if (!std::equal(std::begin(LINE_INDEX_MAGIC), std::end(LINE_INDEX_MAGIC), magic)) {
+        throw std::invalid_argument("Corrupt line index.");
+    }
+}
+
+std::vector<uint64_t> huffman_codec::read_segment_lines(const file_index &index, size_t chunk) {
+    std::vector<uint64_t> lines(index.entries[chunk].segments);
+    istrm->clear();
+    istrm->seekg(static_cast<std::streamoff>(index.segment_offsets[chunk]));
+    read_exact(*istrm, lines.data(), lines.size() * sizeof(uint64_t));
+    return lines;
+}
+
+void huffman_codec::read_exact(std::istream &input, void *dst, size_t len) {
+    input.read(static_cast<char*>(dst), static_cast<std::streamsize>(len));
+    if (input.gcount() != static_cast<std::streamsize>(len)) {
+        throw std::invalid_argument("Corrupt line index.");
+    }
+}
+
+void huffman_codec::restore_append_tail(const std::filesystem::path& bin, const std::filesystem::path& undo) {
+    std::ifstream undo_file(undo, std::ios::binary);
+    uint64_t header[2] = {};
+    undo_file.read(reinterpret_cast<char*>(header), sizeof(header));
+    std::string tail(undo_file ? header[1] : 0, '\0');
+    undo_file.read(tail.data(), static_cast<std::streamsize>(tail.size()));
+    undo_file.close();
+
+    // An undo file cut short was being written when the append died, nothing had been written over yet
+    if (undo_file) {
+        std::filesystem::resize_file(bin, header[0]);
+        std::fstream out(bin, std::ios::binary | std::ios::in | std::ios::out);
+        out.seekp(static_cast<std::streamoff>(header[0]));
+        out.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+        if (!out.flush()) {
+            throw std::invalid_argument("Cannot restore binary file from its undo file.");
+        }
+    }
+    std::filesystem::remove(undo);
+}
+
+void huffman_codec::write_line_index() {
+    // Positional writes went around the stream, the index goes right after the last chunk they wrote
+    if (!chunk_offsets.empty())
+        ostrm->seekp(static_cast<std::streamoff>(chunk_offsets.back()));
+
+    uint64_t index_offset = chunks_start;
+    for (const uint64_t size : chunk_sizes)
+        index_offset += size;
+
+    const size_t closing[2] = {SIZE_MAX, 0};
+    ostrm->write(reinterpret_cast<const char*>(closing), sizeof(closing));
+
+    const uint64_t chunks = chunk_lines.size();
+    ostrm->write(reinterpret_cast<const char*>(&chunks), sizeof(chunks));
+
+    line_index_entry entry{chunks_start, 0, 0, 0};
+    for (size_t c = 0; c < chunks; ++c) {
+        entry.segments = chunk_lines[c].size();
+        ostrm->write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+        entry.file_offset += chunk_sizes[c];
+        entry.first_symbol += chunk_symbols[c];
+        entry.first_line += std::accumulate(chunk_lines[c].begin(), chunk_lines[c].end(), uint64_t{0});
+    }
+    for (const auto& lines : chunk_lines)
+        ostrm->write(reinterpret_cast<const char*>(lines.data()), static_cast<std::streamsize>(lines.size() * sizeof(uint64_t)));
+    if (checksums)
+        ostrm->write(reinterpret_cast<const char*>(chunk_checksums.data()), static_cast<std::streamsize>(chunks * sizeof(chunk_checksum)));
+
+    ostrm->write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+    ostrm->write(LINE_INDEX_MAGIC, sizeof(LINE_INDEX_MAGIC));
+}
+
+void huffman_codec::write_file_header(const huffman_codec::Backend backend) {
+    const char header[8] = {FILE_MAGIC[0], FILE_MAGIC[1], FILE_MAGIC[2], FILE_MAGIC[3],
+                            static_cast<char>(FILE_VERSION), static_cast<char>(backend),
+                            static_cast<char>((run_sync_interval == SIZE_MAX ? 0 : FLAG_SYNC_POINTS) |
+                                              (order1 ? FLAG_ORDER1 : 0) | (run_dedup ? FLAG_DEDUP : 0) |
+                                              (opts.framed ? FLAG_FRAMED : 0) | (checksums ? FLAG_CHECKSUMS : 0) |
+                                              (column_coded ? FLAG_COLUMNS : 0) | FLAG_LINE_INDEX),
+                            column_coded ? column_delimiter : '\0'};
+    ostrm->write(header, sizeof(header));
+}
+
+huffman_codec::Backend huffman_codec::read_file_header() {
+    char header[8] = {};
+    istrm->read(header, sizeof(header));
+
+    if (istrm->gcount() != sizeof(header) || !std::equal(std::begin(FILE_MAGIC), std::end(FILE_MAGIC), header)) {
+        // Headerless file from before backends existed, rewind so the first chunk is read normally
+        istrm->clear();
+        istrm->seekg(0, std::ios::beg);
+        sync_points = false;
+        order1 = false;
+        line_index = false;
+        dedup_chunks = false;
+        inline_table = false;
+        checksums = false;
+        column_coded = false;
+        compact_table = false;
+        return Backend::Huffman;
+    }
+    if (static_cast<uint8_t>(header[4]) > FILE_VERSION) {
+        throw std::invalid_argument("Input file was written by a newer format version.");
+    }
+
+    // Version 1 left the flags byte zero
+    const auto flags = static_cast<uint8_t>(header[6]);
+    if (flags & ~(FLAG_SYNC_POINTS | FLAG_ORDER1 | FLAG_LINE_INDEX | FLAG_DEDUP | FLAG_FRAMED | FLAG_CHECKSUMS |
+                  FLAG_COLUMNS | FLAG_COMPACT_TABLE)) {
+        throw std::invalid_argument("Input file uses unknown format flags.");
+    }
+    sync_points = flags & FLAG_SYNC_POINTS;
+    order1 = flags & FLAG_ORDER1;
+    line_index = flags & FLAG_LINE_INDEX;
+    dedup_chunks = flags & FLAG_DEDUP;
+    inline_table = flags & FLAG_FRAMED;
+    checksums = flags & FLAG_CHECKSUMS;
+    column_coded = flags & FLAG_COLUMNS;
+    column_delimiter = column_coded ? header[7] : '\0';
+    compact_table = flags & FLAG_COMPACT_TABLE;
+
+    const auto backend = static_cast<Backend>(header[5]);
+    if (backend != Backend::Huffman && backend != Backend::TANS && backend != Backend::Tunstall) {
+        throw std::invalid_argument("Input file uses an unknown backend.");
+    }
+    if (order1 && backend != Backend::Huffman) {
+        throw std::invalid_argument("Input file combines order-1 tables with a backend that has none.");
+    }
+    if (column_coded && (backend != Backend::Huffman || order1 || sync_points)) {
+        throw std::invalid_argument("Input file combines column coding with settings it has no use for.");
+    }
+    if (compact_table && (!inline_table || backend != Backend::Huffman || order1 || column_coded)) {
+        throw std::invalid_argument("Input file has a compact table where it can't have one.");
+    }
+    return backend;
+}
+
+void huffman_codec::read_huffman_table(std::istream &ifs) {
+    std::string w, repr;
+
+    while (ifs >> w >> repr)
+        huffman_table.emplace(table_char(w), repr);
+}
+
+void huffman_codec::write_huffman_table(std::ostream &ofs) {
+    for (const auto& [ch, repr]: huffman_table)
+        ofs << table_word(ch) << ' ' << repr << std::endl;
+}
+
+void huffman_codec::read_tans_table(std::istream &ifs) {
+    std::string w;
+    uint32_t norm;
+
+    while (ifs >> w >> norm)
+        tans_norm_map.emplace(table_char(w), norm);
+}
+
+void huffman_codec::write_table(std::ostream &ofs, const Backend backend) {
+    if (backend == Backend::TANS)
+        write_tans_table(ofs);
+    else if (backend == Backend::Tunstall)
+        write_tunstall_table(ofs);
+    else if (order1)
+        write_context_table(ofs);
+    else if (column_coded)
+        write_column_table(ofs);
+    else
+        write_huffman_table(ofs);
+}
+
+void huffman_codec::write_tans_table(std::ostream &ofs) {
+    for (const auto& [ch, norm]: tans_norm_map)
+        ofs << table_word(ch) << ' ' << norm << std::endl;
+}
+
+void huffman_codec::read_tunstall_table(std::istream &ifs) {
+    std::string w;
+    uint32_t bits = 0, norm;
+    if (!(ifs >> w >> bits) || w != "TUNSTALL") {
+        throw std::invalid_argument("Table file does not hold a Tunstall table.");
+    }
+
+    std::map<char, uint32_t> norm_map;
+    while (ifs >> w >> norm)
+        norm_map.emplace(table_char(w), norm);
+    tunstall = tunstall_table(norm_map, bits);
+}
+
+void huffman_codec::write_tunstall_table(std::ostream &ofs) {
+    ofs << "TUNSTALL " << tunstall.bits() << std::endl;
+    for (const auto& [ch, norm]: tunstall.norms())
+        ofs << table_word(ch) << ' ' << norm << std::endl;
+}
+
+void huffman_codec::read_context_table(std::istream &ifs) {
+    std::string w;
+    size_t tables = 0;
+    if (!(ifs >> w >> tables) || w != "ORDER1" || tables == 0 || tables > context_model::MAX_TABLES) {
+        throw std::invalid_argument("Table file does not hold order-1 tables.");
+    }
+
+    for (auto& table : context_map) {
+        unsigned index = 0;
+        if (!(ifs >> index) || index >= tables) {
+            throw std::invalid_argument("Corrupt order-1 context map.");
+        }
+        table = static_cast<uint8_t>(index);
+    }
+
+    context_huffman_tables.assign(tables, {});
+    std::map<char, std::string>* current = nullptr;
+    std::string repr;
+    while (ifs >> w >> repr) {
+        if (w == "TABLE") {
+            const size_t index = std::stoul(repr);
+            if (index >= tables) {
+                throw std::invalid_argument("Corrupt order-1 table index.");
+            }
+            current = &context_huffman_tables[index];
+        } else if (current) {
+            current->emplace(table_char(w), repr);
+        } else {
+            throw std::invalid_argument("Order-1 code outside of a table.");
+        }
+    }
+}
+
+void huffman_codec::write_context_table(std::ostream &ofs) {
+    /*
+     * ORDER1 <table count>
+     * <table of each preceding byte, 256 of them>
+     * TABLE <index>
+     * <word repr lines like an order-0 table>
+     * ...
+     */
+    ofs << "ORDER1 " << context_huffman_tables.size() << std::endl;
+    for (size_t c = 0; c < context_map.size(); ++c)
+        ofs << static_cast<unsigned>(context_map[c]) << (c + 1 == context_map.size() ? '\n' : ' ');
+
+    for (size_t t = 0; t < context_huffman_tables.size(); ++t) {
+        ofs << "TABLE " << t << std::endl;
+        for (const auto& [ch, repr] : context_huffman_tables[t])
+            ofs << table_word(ch) << ' ' << repr << std::endl;
+    }
+}
+
+void huffman_codec::read_column_table(std::istream &ifs) {
+    std::string w;
+    size_t tables = 0;
+    if (!(ifs >> w >> tables) || w != "COLUMNS" || tables == 0 || tables > column_model::MAX_COLUMNS) {
+        throw std::invalid_argument("Table file does not hold column tables.");
+    }
+
+    column_tables.assign(tables, {});
+    std::map<char, std::string>* current = nullptr;
+    std::string repr;
+    while (ifs >> w >> repr) {
+        if (w == "TABLE") {
+            const size_t index = std::stoul(repr);
+            if (index >= tables) {
+                throw std::invalid_argument("Corrupt column table index.");
+            }
+            current = &column_tables[index];
+        } else if (current) {
+            current->emplace(table_char(w), repr);
+        } else {
+            throw std::invalid_argument("Column code outside of a table.");
+        }
+    }
+}
+
+void huffman_codec::write_column_table(std::ostream &ofs) {
+    /*
+     * COLUMNS <column count>
+     * TABLE <column>
+     * <word repr lines like an order-0 table>
+     * ...
+     */
+    ofs << "COLUMNS " << column_tables.size() << std::endl;
+    for (size_t c = 0; c < column_tables.size(); ++c) {
+        ofs << "TABLE " << c << std::endl;
+        for (const auto& [ch, repr] : column_tables[c])
+            ofs << table_word(ch) << ' ' << repr << std::endl;
+    }
+}
+
+std::string huffman_codec::table_word(const char ch) {
+    switch (ch) {
+        case '\n':
+            return "BR";
+        case ' ':
+            return "WS";
+        default:
+            return std::string(1, ch);
+    }
+}
+
+char huffman_codec::table_char(const std::string &w) {
+    if (w == "BR") return '\n';
+    if (w == "WS") return ' ';
+    return w.at(0);
 }
@@ -8,49 +8,719 @@
 #include <iostream>
 #include <functional>
 #include <map>
+#include <deque>
+#include <set>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <cmath>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <ranges>
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+#include <optional>
+#include <numeric>
 
 #include "huffman_tree.h"
+#include "tans_table.h"
+#include "tunstall_table.h"
+#include "huffman_kernels.h"
+#include "worker_pool.h"
+#include "buffer_pool.h"
+#include "chunk_tuner.h"
+#include "context_model.h"
+#include "column_model.h"
+#include "line_matcher.h"
+#include "content_hash.h"
+#include "trace_recorder.h"
+#include "perf_counters.h"
+#include "numa_topology.h"
+#include "token_bucket.h"
+#include "checkpoint_file.h"
+#include "crc32c.h"
+
+// Bytes of input consumed so far, encode reads its input twice so its total is twice the input size
+struct codec_progress {
+    uint64_t bytes_done = 0;
+    uint64_t bytes_total = 0;
+};
+
+// Shared between a codec and whoever wants to stop it, cancel() may be called from any thread
+class cancel_token {
+public:
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    [[nodiscard]] bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic_bool cancelled{false};
+};
+
+// Thrown by encode/decode once a cancel_token stopped them, the path overloads remove their partial output first
+class codec_cancelled : public std::runtime_error {
+public:
+    codec_cancelled() : std::runtime_error("Operation cancelled.") {}
+};
+
+// Knobs for a codec run, zero means "pick a default"
+struct codec_options {
+    // Chunks read but not yet written out, the reader blocks once this many are in flight (default 2 per worker)
+    size_t max_inflight = 0;
+    // Rough cap on bytes held by in-flight chunks, also bounds the chunk size (default a window of the largest
+    // chunks chunk_tuner picks, so it doesn't grow with the input)
+    size_t max_memory = 0;
+    // Fixed encode chunk size (default picked by chunk_tuner from the saved tuning)
+    size_t chunk_size = 0;
+    // Input bytes between decode sync points inside a chunk (default 64 KB), SIZE_MAX writes none
+    size_t sync_interval = 0;
+    // Order-1 huffman: up to this many code tables picked by the preceding byte (default 0, plain order-0 coding)
+    size_t context_tables = 0;
+    // Delimited records: split every record on this byte and code each column with its own table into its own
+    // stream, see column_model. Huffman order-0 only, chunks end on a '\n' and have no sync points (default 0, off)
+    char column_delimiter = 0;
+    // Chunks with the same content as an earlier one are stored as a reference to it (default off)
+    bool dedup = false;
+    // Self-contained frame: the table goes into the .bin instead of a table file, so encoded files concatenate
+    bool framed = false;
+    // Append re-encodes once the file's table codes the new data this much worse than a fresh one would (default 0.05)
+    double max_drift = 0;
+    // Pinned workers (a shared pinned pool unless one is passed in), code tables copied to every NUMA node and
+    // chunk buffers on transparent huge pages (default off)
+    bool numa = false;
+    // Caps on input read and output write rates in bytes/s (default uncapped)
+    uint64_t max_read_rate = 0;
+    uint64_t max_write_rate = 0;
+    // Share of their time workers spend on chunks, they idle for the rest of it (default 1, no cap)
+    double max_cpu = 0;
+    // Workers at the lowest CPU and I/O priority (a shared background pool unless one is passed in)
+    bool low_priority = false;
+    // Path overloads save their progress next to the output (its path + ".ckpt") this often in seconds, and a
+    // cancelled or failed run leaves its output behind for a resume (default 0, no checkpoints)
+    double checkpoint_interval = 0;
+    // Carry on from the checkpoint a run with the same input and options left, skipping the chunks it wrote out
+    // and, for encode, the histogram pass (checkpoints every minute unless checkpoint_interval says otherwise)
+    bool resume = false;
+    // Called from the worker threads as chunks finish, never from two at once
+    std::function<void(const codec_progress&)> on_progress = nullptr;
+    // Checked before every chunk, a cancelled run stops within a chunk per worker and throws codec_cancelled
+    std::shared_ptr<cancel_token> cancel = nullptr;
+    // Timeline of reads, kernels and lock waits on every thread, written out by whoever passed it in
+    std::shared_ptr<trace_recorder> trace = nullptr;
+    // Hardware counters around the histogram, encode and decode kernels, reported by whoever passed them in
+    std::shared_ptr<perf_counters> perf = nullptr;
+};
+
+// Threads of one stage of a run and the time they spent working, rather than waiting on the stages around them
+struct stage_stats {
+    size_t threads = 0;
+    double busy_seconds = 0;
+
+    // Share of the run the stage's threads were busy, on average
+    [[nodiscard]] double utilization(double seconds) const
+    {
+        return threads == 0 || seconds <= 0 ? 0 : busy_seconds / (static_cast<double>(threads) * seconds);
+    }
+};
+
+/*
+ * Where the last run of a codec spent its time. Chunks go reader -> coding workers -> writer, with the in-flight
+ * window bounding what sits between them. A stage close to fully utilized while the others idle is the bottleneck.
+ */
+struct pipeline_stats {
+    double seconds = 0;
+    stage_stats read;
+    stage_stats code;
+    // One writer thread for output in chunk order, every worker when encode chunks go to their own offsets
+    stage_stats write;
+    // Most bytes the in-flight window held at once (input plus coded output of its chunks)
+    uint64_t peak_inflight_bytes = 0;
+};
+
+// What huffman_codec::append did
+struct append_result {
+    // Input bytes encoded by the run, the whole input when it re-encoded
+    uint64_t bytes = 0;
+    // Extra bits the new data took with the file's table over a table built for it, 0.05 is 5%
+    double drift = 0;
+    bool reencoded = false;
+};
+
+// What huffman_codec::verify found, chunks are numbered in file order from 0
+struct verify_result {
+    uint64_t chunks = 0;
+    // Chunks whose stored payload doesn't match its checksum
+    std::vector<uint64_t> corrupt_chunks;
+    // Chunks that decode to something other than what was encoded, only checked when decoding
+    std::vector<uint64_t> mismatched_chunks;
+
+    [[nodiscard]] bool ok() const { return corrupt_chunks.empty() && mismatched_chunks.empty(); }
+};
+
+// Line found by huffman_codec::search, offset is where it starts in the decoded text
+struct search_match {
+    uint64_t offset = 0;
+    // Counted from 1
+    uint64_t line = 0;
+    std::string text;
+};
 
 class huffman_codec {
 public:
-    huffman_codec(): frequency_map{}, huffman_table{}, cond_var() {}
+    // Entropy coder used for the chunk payloads, recorded in the .bin header so decode picks it up on its own.
+    // Tunstall trades some ratio for the cheapest decode, see tunstall_table
+    enum class Backend : uint8_t {Huffman = 0, TANS = 1, Tunstall = 2};
 
-    void encode(const std::string_view input_file, const std::optional<std::string_view> output_file, const std::optional<std::string_view> table_file);
+    // Chunks run on the given pool, by default a process wide one that stays warm between runs
+    explicit huffman_codec(const codec_options& opts = {}, std::shared_ptr<worker_pool> pool = nullptr):
+        opts(opts), frequency_map{}, huffman_table{},
+        pool(pool ? std::move(pool) : worker_pool::shared(opts.numa, opts.low_priority)),
+        read_bucket(opts.max_read_rate), write_bucket(opts.max_write_rate)
+    {
+        buffers.set_huge_pages(opts.numa);
+    }
+
+    void encode(const std::string_view input_file, const std::optional<std::string_view> output_file, const std::optional<std::string_view> table_file,
+                const Backend backend = Backend::Huffman);
     void decode(const std::string_view input_file, const std::optional<std::string_view> output_file, const std::string_view table_file);
 
+    /*
+     * In-memory variants, input has to be seekable (encode reads it twice). Framed runs (codec_options::framed)
+     * write nothing to the table stream, and decoding framed input ignores it (the path overloads take an empty
+     * table_file then).
+     */
+    void encode(std::istream& input, std::ostream& output, std::ostream& table, const Backend backend = Backend::Huffman);
+    void decode(std::istream& input, std::ostream& output, std::istream& table);
+
+    /*
+     * Decode tables of one table file, parsed and built once and then shared by any number of codecs and threads
+     * decoding .bin files written with that table. load_tables reads the header at input to know how to parse
+     * table and leaves input where it was; framed input carries its own tables and gets nullptr. decode with
+     * tables that don't fit the file's header throws std::invalid_argument, with nullptr it reads inline tables only.
+     */
+    class decode_tables;
+    [[nodiscard]] std::shared_ptr<const decode_tables> load_tables(std::istream& input, std::istream& table);
+    void decode(std::istream& input, std::ostream& output, std::shared_ptr<const decode_tables> tables);
+
+    /*
+     * Low latency path for small inputs: one pass over a single buffer on the calling thread, no pool and no table
+     * file. The output is a frame of one chunk with its code lengths inline instead of a text table, so decode,
+     * search and lines read it like any other frame. Past the first call on a thread only the output grows on the
+     * heap. encode and decode take this path on their own for framed order-0 huffman runs up to SMALL_INPUT bytes, unless
+     * chunk_size, sync_interval (other than SIZE_MAX), trace, perf or a rate cap is set.
+     */
+    static constexpr size_t SMALL_INPUT = 64 * 1024;
+    static void encode_small(std::span<const char> input, std::vector<char>& output);
+    // Input is one or more frames written by encode_small, concatenated or not
+    static void decode_small(std::span<const char> input, std::vector<char>& output);
+
+    /*
+     * Runs pattern (see line_matcher) over the lines of an encoded file without writing the decoded text anywhere.
+     * Every sync segment is decoded into a window of its own on the pool and matched right there, on_match gets the
+     * matching lines in file order and is never called from two threads at once.
+     */
+    void search(const std::string_view input_file, const std::string_view table_file, const std::string_view pattern,
+                const std::function<void(const search_match&)>& on_match);
+    void search(std::istream& input, std::istream& table, const std::string_view pattern,
+                const std::function<void(const search_match&)>& on_match);
+
+    /*
+     * Writes lines first_line .. first_line + count - 1 (counted from 1) to output. The line index at the end of
+     * the .bin points straight at the chunk and sync segment holding first_line, so only the segments spanning
+     * the requested lines are decoded. Input has to be seekable.
+     */
+    void read_lines(const std::string_view input_file, const std::string_view table_file, uint64_t first_line,
+                    uint64_t count, std::ostream& output);
+    void read_lines(std::istream& input, std::istream& table, uint64_t first_line, uint64_t count, std::ostream& output);
+
+    /*
+     * Writes the given columns (counted from 0) of every record of a column coded file to output, joined by its
+     * delimiter, like cut -f. Only the streams of those columns are decoded.
+     */
+    void read_columns(const std::string_view input_file, const std::string_view table_file,
+                      const std::vector<size_t>& columns, std::ostream& output);
+    void read_columns(std::istream& input, std::istream& table, const std::vector<size_t>& columns, std::ostream& output);
+
+    /*
+     * Encodes whatever input_file gained since bin_file was encoded from it, with the file's own table, and writes
+     * the new chunks over the old line index followed by a new one. The old index is kept in bin_file.undo until
+     * then, a failed or cancelled append puts it back and one killed half way is undone by the next. Only the end of
+     * the input may have changed, the last chunk already encoded is checked against its checksum. When the table
+     * codes the new data more than max_drift worse than a fresh one would, the whole input is encoded again into new
+     * files that replace both old ones once complete. Framed files are grown by concatenating a new frame instead.
+     */
+    append_result append(const std::string_view input_file, const std::string_view bin_file, const std::string_view table_file);
+    /*
+     * Leaves bin untouched and returns the drift without re-encoding when the table is too far off. Otherwise bin is
+     * written in place, and holds no valid index if the append is interrupted.
+     */
+    append_result append(std::istream& input, std::iostream& bin, std::istream& table);
+
+    /*
+     * Checks every chunk of an encoded file against the checksums in its line index. The payloads alone need no
+     * table and go through the pool about as fast as the file can be read. With decode the chunks are decoded as
+     * well, each checked against the checksum of the input it was encoded from, and nothing is written anywhere.
+     */
+    verify_result verify(const std::string_view input_file, const std::string_view table_file, bool decode);
+    verify_result verify(std::istream& input, std::istream& table, bool decode);
+
+    // Stage utilization of the last encode, decode, search or append
+    [[nodiscard]] pipeline_stats stats() const;
+
 private:
+    /*
+     * .bin files start with an 8 byte header: magic, format version, backend, flags and a reserved byte.
+     * Files written before the header existed start straight with a chunk and are decoded as huffman.
+     * Version 1 files have no flags.
+     */
+    static constexpr char FILE_MAGIC[4] = {'H', 'M', 'C', 'F'};
+    static constexpr uint8_t FILE_VERSION = 2;
+    static constexpr uint8_t FLAG_SYNC_POINTS = 1;
+    // Huffman only, the table file holds a context map and several tables (see write_context_table)
+    static constexpr uint8_t FLAG_ORDER1 = 2;
+    static constexpr uint8_t FLAG_LINE_INDEX = 4;
+    static constexpr uint8_t FLAG_DEDUP = 8;
+    /*
+     * With FLAG_FRAMED the header is followed by [uint64 length][table text], and everything (chunk ids, offsets
+     * in the line index) is counted from the frame's own start. Another frame may follow the line index, which is
+     * what `cat a.bin b.bin` gives, decode carries on with its table and numbers its chunks after the ones before.
+     */
+    static constexpr uint8_t FLAG_FRAMED = 16;
+    // Line index ends with the CRC32C of every chunk's input and of its stored payload, see chunk_checksum
+    static constexpr uint8_t FLAG_CHECKSUMS = 32;
+    // Chunks hold column streams (column_model), the last header byte is the delimiter
+    static constexpr uint8_t FLAG_COLUMNS = 64;
+    // Framed huffman order-0 only, the frame's table is [uint16 count][count x (byte, code length)] (encode_small)
+    static constexpr uint8_t FLAG_COMPACT_TABLE = 128;
+
+    /*
+     * With FLAG_DEDUP the top bits of a chunk's payload length mark duplicates. A duplicate's payload is just the
+     * uint64 id of the earlier chunk it repeats, and that chunk is marked referenced so decode keeps it around.
+     */
+    static constexpr size_t CHUNK_DUPLICATE = size_t{1} << 63;
+    static constexpr size_t CHUNK_REFERENCED = size_t{1} << 62;
+    static constexpr size_t CHUNK_LENGTH_MASK = CHUNK_REFERENCED - 1;
+
+    // [chunk_id][payload length][symbol count] in front of every chunk payload
+    static constexpr size_t CHUNK_HEADER = 3 * sizeof(size_t);
+
+    /*
+     * With FLAG_SYNC_POINTS every chunk payload starts with [uint32 count][count x sync_point], each point marks
+     * where a segment of sync_interval symbols begins (the first one starts at 0/0 and isn't listed). Huffman
+     * codes run on across segments, so a point can land mid byte. tANS segments are independent streams with
+     * their own final state, padded to a whole byte. This lets decode split a chunk over as many threads as it
+     * has, no matter how many the encoder had.
+     */
+    struct sync_point {
+        uint64_t symbol;
+        uint64_t bit_offset;
+    };
+    static_assert(sizeof(sync_point) == 16);
+
+    /*
+     * With FLAG_LINE_INDEX the chunks are closed off by an empty [SIZE_MAX][0] record (decode stops there), followed
+     * by the line index:
+     *   [uint64 chunk count][chunk count x line_index_entry][segment newline counts of every chunk, in chunk order]
+     *   [chunk count x chunk_checksum, with FLAG_CHECKSUMS][uint64 offset of the closing record]["HMCLINES"]
+     * Chunks are written in chunk order, so the entries are in file order too.
+     */
+    struct line_index_entry {
+        uint64_t file_offset;
+        uint64_t first_symbol;
+        // Newlines before the chunk
+        uint64_t first_line;
+        uint64_t segments;
+    };
+    static_assert(sizeof(line_index_entry) == 32);
+    static constexpr char LINE_INDEX_MAGIC[8] = {'H', 'M', 'C', 'L', 'I', 'N', 'E', 'S'};
+
+    // Payload is everything of the chunk record after its id and length, the symbol count included
+    struct chunk_checksum {
+        uint32_t data;
+        uint32_t payload;
+    };
+    static_assert(sizeof(chunk_checksum) == 8);
+
+    // Line index of a whole input, offsets and lines counted from its start (first_symbol stays within its frame)
+    struct file_index {
+        std::vector<line_index_entry> entries;
+        std::vector<std::vector<uint64_t>> segment_lines;
+        // Empty for files without checksums
+        std::vector<chunk_checksum> checksums;
+        // Start of every frame, and the frame of every chunk
+        std::vector<uint64_t> frames;
+        std::vector<size_t> chunk_frames;
+        // Closing record of the last frame, and of every frame
+        uint64_t closing_offset = 0;
+        std::vector<uint64_t> frame_closings;
+        // Where every chunk's segment newline counts start in the input, when they weren't read (see read_file_index)
+        std::vector<uint64_t> segment_offsets;
+    };
+
+    using segment_decoder = std::function<void(std::span<const char> payload, uint32_t first_bit, std::span<char> decoded)>;
+
+    struct column_decoder {
+        char delimiter = 0;
+        std::vector<huffman_kernels::decode_table> tables;
+    };
 
     std::vector<char>::size_type BLOCK_SIZE = 0;
     enum class CodecType {Encoding, Decoding};
 
-    void init_streams(const std::string_view& input_file, const std::string_view& output_file, const CodecType codec_type);
+    // A resumed run keeps what the output file holds instead of truncating it
+    void init_streams(const std::string_view& input_file, const std::string_view& output_file, const CodecType codec_type,
+                      bool keep_output = false);
+    std::vector<char>::size_type block_size(std::istream& input) const;
+    size_t inflight_window() const;
+    // Bytes the window may hold, max_memory or a full window of the largest chunks chunk_tuner picks
+    size_t inflight_limit() const;
+    static uint64_t stream_remaining(std::istream& input);
+    bool is_cancelled() const;
+    // No-op unless opts.trace is set
+    trace_recorder::scope trace_span(const char* name) const { return {opts.trace.get(), name}; }
+    // No-op unless opts.perf is set and has counters
+    perf_counters::scope perf_span(perf_counters::Stage stage, uint64_t bytes) const { return {opts.perf.get(), stage, bytes}; }
+    void report_progress(uint64_t bytes);
+    size_t sync_interval() const;
+    size_t sync_count(size_t data_len) const;
+    size_t index_length(size_t data_len) const;
+    static void set_sync_point(std::vector<char>& record, size_t index, const sync_point& point);
+    // Symbols per sync segment, SIZE_MAX without sync points. Order-1 contexts and line counts restart with each
+    size_t segment_symbols() const;
+
+    // Runs task on the pool, counted towards partition's pending tasks, errors and progress
+    void submit_task(std::function<void()> task, uint64_t progress_bytes);
+
+    void encode_streams(const Backend backend);
+    // Tables of a file being appended to, or of the checkpoint a resumed encode starts from
+    void load_encode_tables(const Backend backend, std::istream& table);
+    // Encodes istrm from input_start with the tables of the file in ostrm, writes nothing when they drifted too far
+    append_result append_streams(std::istream& input, std::istream& table);
+    // Relative cost of the first pass histogram under the current tables over freshly built ones
+    double table_drift(const Backend backend) const;
+    double drift_limit() const { return opts.max_drift != 0 ? opts.max_drift : 0.05; }
+    // Hands the encode tables to the per node copies workers code with
+    void place_tables(const Backend backend);
+
+    // Reads the .bin header and the table, then sets up decode_segment for the backend. Without need_tables only
+    // framed input reads any (its inline ones)
+    void prepare_decode(std::istream& table, bool need_tables = true);
+    // Table of the current frame, from the .bin itself for framed files
+    void read_frame_tables(const Backend backend, std::istream& table);
+    // Skips the line index the reader stopped at, false if no frame follows it
+    bool next_frame();
+    void decode_streams(std::istream& table);
+    void search_streams(std::istream& table, const std::string_view pattern);
+    verify_result verify_streams(std::istream& table, bool decode);
+    // Note the chunk in verify_state when it doesn't match its checksum
+    bool payload_intact(size_t chunk_id, std::span<const char> payload);
+    void check_decoded(size_t chunk_id, std::span<const char> decoded);
+
+    void partition(const std::function<void(const std::vector<char>&&, size_t)>& func, const CodecType codec_type);
+
+    void write_huffman_encoded(const std::vector<char>&& data, size_t chunk_id);
+    void write_tans_encoded(const std::vector<char>&& data, size_t chunk_id);
+    void write_tunstall_encoded(const std::vector<char>&& data, size_t chunk_id);
+    // tANS and Tunstall code every sync segment as a stream of its own with whichever table coder is
+    template <class Coder>
+    void write_segments_encoded(const Coder& coder, const std::vector<char>& data, size_t chunk_id);
+    // Encode function of the backend, for the encode pass
+    std::function<void(const std::vector<char>&&, size_t)> encoder(const Backend backend);
+    // Offset of every chunk in the output, computed from the per chunk histograms before the encode pass
+    void plan_chunk_offsets();
+
+    // Splits a chunk at its sync points into decode tasks, the last one to finish writes it out
+    void submit_decoded(std::vector<char>&& data, size_t chunk_id, uint64_t chunk_bytes, size_t chunk_flags,
+                        bool check_payload = true);
+    // Body of a referenced chunk dropped from kept_chunks, read again from istrm by the reader
+    std::vector<char> reread_chunk(size_t chunk_id);
+    // Payload of a chunk body (what follows its symbol count), segment starts (symbol, bit) go into segments
+    std::span<const char> parse_segments(std::span<const char> body, uint64_t data_count,
+                                         std::vector<std::pair<uint64_t, uint64_t>>& segments) const;
+
+    void write_line_index();
+    // Where the closing record sits, read from the end of the input
+    uint64_t line_index_offset();
+    /*
+     * Index right behind a closing record, up to and including its trailer. With segment_offsets the segment counts
+     * and checksums are skipped over, only where every chunk's counts start is kept.
+     */
+    void read_line_index(std::vector<line_index_entry>& entries, std::vector<std::vector<uint64_t>>& segment_lines,
+                         std::vector<chunk_checksum>& checksums, std::vector<uint64_t>* segment_offsets = nullptr);
+    // Walks every frame of the input for theirs, flags are left at the last frame's. Entries only unless segments
+    file_index read_file_index(bool segments = true);
+    // Segment newline counts of one chunk of an index read without them
+    std::vector<uint64_t> read_segment_lines(const file_index& index, size_t chunk);
+    static void read_exact(std::istream& input, void* dst, size_t len);
+    // Puts the tail an append kept aside in undo back at the end of bin, then drops undo
+    static void restore_append_tail(const std::filesystem::path& bin, const std::filesystem::path& undo);
+
+    /*
+     * Sets up checkpoint for a path run writing output from input, settings being whatever else the output depends
+     * on. True when a checkpoint of the same run is there to resume from.
+     */
+    bool open_checkpoint(const std::filesystem::path& output, const std::string_view input, const std::string& settings);
+    // Size and modification time, "-" for missing files
+    static std::string file_stamp(const std::filesystem::path& path);
+    // Chunk layout and tables of an encode run, all a resumed run needs to skip the histogram pass
+    std::string encode_plan(const std::string& table_text) const;
+    // Returns the table text
+    std::string restore_plan(const Backend backend);
+    // Marks the chunks a resumed encode finds intact in the output as done, those go back into the checkpoint
+    std::vector<checkpoint_file::chunk> resumed_chunks();
+    // Skips input and output past the chunks a resumed decode finds intact, returns the first chunk left to decode
+    size_t resume_decode();
+    static bool chunk_intact(std::istream& output, const checkpoint_file::chunk& chunk);
+    void checkpoint_chunk(size_t chunk_id, uint64_t offset, std::span<const char> bytes, bool flush_output);
+
+    // data_crc is the checksum of the chunk's input
+    void write_chunk(std::vector<char>&& record, size_t data_len, size_t chunk_id, uint32_t data_crc);
+    // Fixed offset chunk writes of an encode, open_chunk_output before partition and close_chunk_output after
+    void open_chunk_output();
+    void write_chunk_at(uint64_t offset, std::span<const char> bytes);
+    void close_chunk_output();
+    // Writes a reference instead when the chunk repeats an earlier one, false if it has to be encoded
+    bool write_duplicate(size_t data_len, size_t chunk_id, uint32_t data_crc);
+    // Compares len bytes of istrm at two offsets, for dedup candidates whose hashes matched
+    bool same_input(uint64_t first, uint64_t second, uint64_t len);
+    void write_ordered(std::vector<char>&& decrypted, size_t chunk_id);
+    // Drops kept chunks past kept_limit, under window_mtx
+    void evict_kept();
+    // Writer stage: writes out what write_ordered queued, off the workers and outside any lock
+    void run_writer();
+    // Frees a written chunk's slot in the reader's window, under window_mtx
+    void retire_chunk(size_t chunk_id);
+    void reset_stats();
 
-    void partition(const std::function<void(const std::vector<char>&&, std::mutex&, size_t)>& func, const CodecType codec_type);
+    // What one decoded window adds to a search: its whole lines' matches, and the line pieces at either end
+    struct search_part {
+        uint64_t length = 0;
+        uint64_t newlines = 0;
+        // Everything up to the first '\n', or the whole window if it has none
+        std::string head;
+        // Everything after the last '\n'
+        std::string tail;
+        // Offsets relative to the window, lines are the number of '\n' in the window before the match
+        std::vector<search_match> matches;
+    };
+    static search_part scan_window(const line_matcher& matcher, std::string_view window);
+    // Stitches windows to the lines before them and reports matches, called in chunk order
+    void emit_search(std::vector<search_part>&& parts);
 
-    void write_huffman_encoded(const std::vector<char>&& data, std::mutex& mtx, size_t chunk_id);
-    void write_huffman_decoded(const std::vector<char>&& data, std::mutex& mtx, size_t chunk_id);
+    void fetch_char_freqs(const std::vector<char>&& data, size_t chunk_id);
 
-    void fetch_char_freqs(const std::vector<char>&& data, std::mutex& mtx, [[maybe_unused]] size_t chunk_id);
+    // Runs encode_small or decode_small over the whole input stream when it is small enough, false if it isn't
+    bool encode_small_stream(const Backend backend);
+    bool decode_small_stream();
+    // No tracing, perf counters or rate caps, which only the pool path records and enforces
+    [[nodiscard]] bool small_path_plain() const;
+    // False when a frame isn't one of encode_small's, output holds the frames before it then
+    static bool decode_compact_frames(std::span<const char> input, std::vector<char>& output);
+    static std::array<uint8_t, 256> read_compact_table(std::span<const char> table);
 
-    void read_huffman_table(std::ifstream& ifs);
-    void write_huffman_table(std::ofstream& ofs);
+    void write_file_header(const Backend backend);
+    Backend read_file_header();
 
-    std::ifstream istrm;
-    std::ofstream ostrm;
+    void write_table(std::ostream& ofs, const Backend backend);
+    void read_huffman_table(std::istream& ifs);
+    void write_huffman_table(std::ostream& ofs);
+    void read_tans_table(std::istream& ifs);
+    void write_tans_table(std::ostream& ofs);
+    void read_tunstall_table(std::istream& ifs);
+    void write_tunstall_table(std::ostream& ofs);
+    void read_context_table(std::istream& ifs);
+    void write_context_table(std::ostream& ofs);
+    void read_column_table(std::istream& ifs);
+    void write_column_table(std::ostream& ofs);
+    // Selected columns of a chunk body, with the tables of the frame it is in
+    std::vector<char> project_chunk(std::span<const char> body, size_t chunk_id);
+
+    static std::string table_word(const char ch);
+    static char table_char(const std::string& w);
+
+    codec_options opts;
+    std::ifstream in_file;
+    std::ofstream out_file;
+    std::istream* istrm = nullptr;
+    std::ostream* ostrm = nullptr;
     std::map<char, uint64_t> frequency_map;
     std::map<char, std::string> huffman_table;
 
-    std::map<std::string, char> rev_huffman_table;
-    std::condition_variable cond_var;
+    huffman_kernels::code_table huffman_codes;
+    std::map<char, uint32_t> tans_norm_map;
+    tans_table tans;
+    tunstall_table tunstall;
+
+    // Order-1 run, the histogram is only allocated when one is asked for
+    bool order1 = false;
+    std::unique_ptr<huffman_kernels::context_histogram> context_freqs;
+    std::array<uint8_t, 256> context_map{};
+    std::vector<std::map<char, std::string>> context_huffman_tables;
+    huffman_kernels::context_code_table context_codes;
+    // What workers actually code with, see node_local
+    std::unique_ptr<node_local<huffman_kernels::code_table>> local_codes;
+    std::unique_ptr<node_local<huffman_kernels::context_code_table>> local_context_codes;
+    std::unique_ptr<node_local<tans_table>> local_tans;
+    std::unique_ptr<node_local<tunstall_table>> local_tunstall;
+
+    // Column run, the histogram has a column per table once the histogram pass is over
+    bool column_coded = false;
+    char column_delimiter = 0;
+    std::vector<std::array<uint64_t, 256>> column_freqs;
+    std::vector<std::map<char, std::string>> column_tables;
+    std::vector<huffman_kernels::code_table> column_codes;
+    std::unique_ptr<node_local<std::vector<huffman_kernels::code_table>>> local_column_codes;
+
+    std::shared_ptr<worker_pool> pool;
+    buffer_pool buffers;
+    // Throttle the partition reader and whoever writes chunks out
+    token_bucket read_bucket;
+    token_bucket write_bucket;
+
+    // Output file of path runs. Encode chunks go to fixed offsets in it when their sizes are known up front, in chunk
+    // order otherwise
+    std::filesystem::path out_path;
+    // Handle every fixed offset chunk write of a run goes through, a descriptor for pwrite or a stream under a lock
+    // where there is none
+    int chunk_fd = -1;
+    std::ofstream chunk_out;
+    std::mutex chunk_out_mtx;
+    // Guards the histogram pass' per chunk results
+    std::mutex histogram_mtx;
+    std::vector<std::array<uint64_t, 256>> chunk_freqs;
+    std::vector<uint64_t> chunk_offsets;
+    bool ordered_writes = false;
+    // Header, plus the inline table of a framed file
+    uint64_t chunks_start = 8;
+    // opts.sync_interval as the run in progress uses it, column coding and the file an append grows overrule it
+    size_t run_sync_interval = 0;
+    // opts.dedup as the run in progress uses it, appends never dedup
+    bool run_dedup = false;
+    // Where encoding starts in the input, appends skip what the file already holds
+    uint64_t input_start = 0;
+    // Newlines in every sync segment, symbols and record size of every chunk, for the line index
+    std::vector<std::vector<uint64_t>> chunk_lines;
+    std::vector<uint64_t> chunk_symbols;
+    std::vector<uint64_t> chunk_sizes;
+    // Encode side of checksums, read off the index when appending. Written by whichever worker codes the chunk
+    std::vector<chunk_checksum> chunk_checksums;
+    // Dedup: content of every chunk, and the first chunk with the same content (itself for the unique ones)
+    std::vector<content_hash> chunk_hashes;
+    std::vector<size_t> chunk_sources;
+    std::vector<bool> chunk_referenced;
+
+    // Path runs with checkpoints, and what a resumed one picked up from the checkpoint it found
+    std::unique_ptr<checkpoint_file> checkpoint;
+    std::string run_fingerprint;
+    bool resuming = false;
+    std::string resume_plan;
+    std::vector<checkpoint_file::chunk> resume_chunks;
+    // Encode chunks already in the output of a resumed run, the reader skips them
+    std::vector<bool> chunk_done;
+    // Where the next chunk written in order lands in the output
+    uint64_t ordered_offset = 0;
+
+    // Decode side of the current file
+    bool sync_points = false;
+    bool line_index = false;
+    bool dedup_chunks = false;
+    bool inline_table = false;
+    bool compact_table = false;
+    // Set by read_file_header, encode always writes them
+    bool checksums = false;
+    // Decode tasks take a copy, so the frame after can bring its own tables while they run
+    segment_decoder decode_segment;
+    // Tables the caller loaded, used instead of reading the table stream
+    std::shared_ptr<const decode_tables> preloaded_tables;
+    // Tables of the current frame of a column coded file, and read_columns' picks
+    std::shared_ptr<const node_local<column_decoder>> column_decode;
+    std::vector<size_t> selected_columns;
+    // First chunk id of every frame with the tables it decodes with, under window_mtx
+    std::vector<std::pair<size_t, std::shared_ptr<const node_local<column_decoder>>>> frame_columns;
+    // Chunk ids of a frame start after the ones of the frames before it, an append's after the file's
+    size_t frame_base = 0;
+    size_t frame_end = 0;
+    // Compressed bytes one decode task aims for
+    size_t decode_split = 0;
+
+    // Node of the thread running partition, the one its read buffers come from and go back to
+    unsigned reader_node = 0;
+
+    // In-flight window of partition, also guards the decode reorder state below
+    std::mutex window_mtx;
+    std::condition_variable window_cv;
+    size_t inflight_chunks = 0;
+    size_t inflight_bytes = 0;
+    size_t peak_inflight_bytes = 0;
+    std::map<size_t, size_t> inflight_costs;
+    size_t pending_tasks = 0;
+    std::exception_ptr task_error;
+
+    std::mutex progress_mtx;
+    codec_progress progress;
+
+    // Decoded chunks that finished before the ones in front of them
+    std::map<size_t, std::vector<char>> decoded_chunks;
+    // Dedup decode: what duplicates point at, and the decoded chunks later ones will copy
+    std::map<size_t, size_t> duplicate_chunks;
+    std::set<size_t> referenced_chunks;
+    std::map<size_t, std::vector<char>> kept_chunks;
+    /*
+     * Kept chunks (or their search parts) count against the window. Past kept_limit the least recently used ones go,
+     * unless a duplicate waiting its turn pins them, and a duplicate of one that went reads it again from the input.
+     */
+    struct kept_use {
+        uint64_t last_use = 0;
+        size_t pins = 0;
+        size_t bytes = 0;
+    };
+    std::map<size_t, kept_use> kept_uses;
+    size_t kept_bytes = 0;
+    size_t kept_limit = 0;
+    uint64_t kept_clock = 0;
+    // Offset and length of every referenced chunk's body in the input, unknown for input that can't seek
+    std::map<size_t, std::pair<uint64_t, uint64_t>> referenced_records;
+    // Chunks whose turn came, in order, waiting for the writer. Bounded by the window, they keep their slot until written
+    std::deque<std::pair<size_t, std::vector<char>>> write_queue;
+    std::condition_variable write_cv;
+    bool writer_done = false;
+
+    // Verify run in progress, under window_mtx. Record ends go by record start, as the index has them
+    std::vector<chunk_checksum> expected_checksums;
+    std::map<uint64_t, std::pair<size_t, uint64_t>> verify_records;
+    std::vector<bool> verify_seen;
+    verify_result verify_state;
+
+    // Busy time of each stage in nanoseconds, and the wall time of the partition runs they happened in
+    std::atomic_int64_t read_ns{0};
+    std::atomic_int64_t code_ns{0};
+    std::atomic_int64_t write_ns{0};
+    int64_t run_ns = 0;
+    size_t write_threads = 0;
+
+    // Search run in progress, chunks park their windows next to decoded_chunks until their turn
+    std::unique_ptr<line_matcher> matcher;
+    std::function<void(const search_match&)> match_sink;
+    std::map<size_t, std::vector<search_part>> search_parts;
+    std::map<size_t, std::vector<search_part>> kept_parts;
+    uint64_t search_offset = 0;
+    uint64_t search_line = 0;
+    // Line still waiting for its '\n', and where it starts
+    std::string search_carry;
+    uint64_t carry_offset = 0;
     std::atomic_uint_fast32_t thread_chunk;
 };
 
+class huffman_codec::decode_tables {
+    friend class huffman_codec;
+    // What the .bin header said about the tables, a file saying anything else can't use them
+    Backend backend = Backend::Huffman;
+    bool order1 = false;
+    bool column_coded = false;
+    char column_delimiter = 0;
+    segment_decoder segment;
+    std::shared_ptr<const node_local<column_decoder>> columns;
+};
 
 #endif //HUFFMANCODEC_HUFFMAN_CODEC_H
@@ -0,0 +1,695 @@
+#include "huffman_kernels.h"
+
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <string_view>
+
+#ifdef HUFFMANCODEC_KERNEL_DISPATCH
+#include <immintrin.h>
+#define HMC_TARGET(isa) __attribute__((target(isa)))
+#define HMC_INLINE __attribute__((always_inline)) inline
+#else
+#define HMC_INLINE inline
+#endif
+
+using code_table = huffman_kernels::code_table;
+using decode_table = huffman_kernels::decode_table;
+using context_code_table = huffman_kernels::context_code_table;
+using context_decode_table = huffman_kernels::context_decode_table;
+using context_histogram = huffman_kernels::context_histogram;
+
+// Big endian 64-bit window starting at p, bytes past the end of the stream read as zero
+static HMC_INLINE uint64_t load_be64(const uint8_t* p, size_t avail)
+{
+    uint64_t w = 0;
+    if (avail >= 8) {
+        std::memcpy(&w, p, sizeof(uint64_t));
+        if constexpr (std::endian::native == std::endian::little) w = std::byteswap(w);
+        return w;
+    }
+    for (size_t i = 0; i < avail; ++i)
+        w |= static_cast<uint64_t>(p[i]) << (56 - 8 * i);
+    return w;
+}
+
+static HMC_INLINE void store_be32(uint8_t* p, uint32_t w)
+{
+    if constexpr (std::endian::native == std::endian::little) w = std::byteswap(w);
+    std::memcpy(p, &w, sizeof(uint32_t));
+}
+
+static HMC_INLINE void histogram_impl(std::span<const char> data, std::array<uint64_t, 256>& freqs)
+{
+    // Spread counts over several tables so runs of the same byte don't serialize on a single counter
+    std::array<std::array<uint64_t, 256>, 4> t{};
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t n = data.size();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        ++t[0][p[i]];
+        ++t[1][p[i + 1]];
+        ++t[2][p[i + 2]];
+        ++t[3][p[i + 3]];
+    }
+    for (; i < n; ++i)
+        ++t[0][p[i]];
+
+    for (size_t s = 0; s < 256; ++s)
+        freqs[s] += t[0][s] + t[1][s] + t[2][s] + t[3][s];
+}
+
+/*
+ * Exact encoded size of a chunk, also catches symbols the table has no code for. The bit offset where every
+ * segment of `segment` symbols after the first starts goes into segment_bits, as many as it has room for.
+ */
+static HMC_INLINE uint64_t encoded_bits(std::span<const char> data, size_t segment, const code_table& table,
+                                        std::span<uint64_t> segment_bits)
+{
+    if (!segment_bits.empty() && (data.empty() || segment == 0 || segment_bits.size() > (data.size() - 1) / segment)) {
+        throw std::invalid_argument("More sync segments than symbols.");
+    }
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    uint64_t total_bits = 0;
+    bool missing = false;
+    size_t start = 0;
+    for (size_t s = 0;; ++s) {
+        const size_t end = s < segment_bits.size() ? start + segment : data.size();
+        for (size_t i = start; i < end; ++i) {
+            const uint8_t len = table.len[p[i]];
+            total_bits += len;
+            missing |= len == 0;
+        }
+        if (s == segment_bits.size()) break;
+        segment_bits[s] = total_bits;
+        start = end;
+    }
+    if (missing) {
+        throw std::invalid_argument("Symbol missing from huffman table.");
+    }
+    return total_bits;
+}
+
+/*
+ * Codes are packed MSB first, the same layout the original bit by bit encoder produced. The accumulator only
+ * holds less than a byte (or less than a word in the wide variants) between codes, so shifting a new code in
+ * never drops pending bits.
+ */
+static HMC_INLINE void encode_impl(std::span<const char> data, size_t segment, const code_table& table,
+                                   std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    const uint64_t total_bits = encoded_bits(data, segment, table, segment_bits);
+    const size_t start = converted.size();
+    converted.resize(start + (total_bits + 7) / 8);
+    auto* out = reinterpret_cast<uint8_t*>(converted.data() + start);
+
+    uint64_t acc = 0;
+    uint32_t nbits = 0;
+    for (const char c : data) {
+        const auto s = static_cast<uint8_t>(c);
+        acc = (acc << table.len[s]) | table.code[s];
+        nbits += table.len[s];
+        while (nbits >= 8) {
+            nbits -= 8;
+            *out++ = static_cast<uint8_t>(acc >> nbits);
+        }
+    }
+
+    // If last byte was half way done shift to align
+    if (nbits > 0)
+        *out = static_cast<uint8_t>(acc << (8 - nbits));
+}
+
+// Word at a time flushing, needs every code to be at most 32 bits
+static HMC_INLINE void encode_wide_impl(std::span<const char> data, size_t segment, const code_table& table,
+                                        std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    const uint64_t total_bits = encoded_bits(data, segment, table, segment_bits);
+    const size_t start = converted.size();
+    // Slack for the final 32-bit store
+    converted.resize(start + (total_bits + 7) / 8 + sizeof(uint32_t));
+    auto* out = reinterpret_cast<uint8_t*>(converted.data() + start);
+
+    uint64_t acc = 0;
+    uint32_t nbits = 0;
+    for (const char c : data) {
+        const auto s = static_cast<uint8_t>(c);
+        acc = (acc << table.len[s]) | table.code[s];
+        nbits += table.len[s];
+        if (nbits >= 32) {
+            nbits -= 32;
+            store_be32(out, static_cast<uint32_t>(acc >> nbits));
+            out += 4;
+        }
+    }
+    if (nbits > 0)
+        store_be32(out, static_cast<uint32_t>(acc << (32 - nbits)));
+
+    converted.resize(start + (total_bits + 7) / 8);
+}
+
+static HMC_INLINE void decode_impl(std::span<const char> bits, const decode_table& table, std::span<char> decoded,
+                                   uint32_t first_bit)
+{
+    const auto* p = reinterpret_cast<const uint8_t*>(bits.data());
+    const size_t n = bits.size();
+    const auto* lut = table.lut.data();
+    const auto* tree = table.tree.data();
+
+    uint64_t pos = first_bit;
+    for (char& out : decoded) {
+        const size_t byte = pos >> 3;
+        uint64_t w = load_be64(p + byte, byte < n ? n - byte : 0) << (pos & 7);
+
+        const auto& e = lut[w >> (64 - huffman_kernels::LUT_BITS)];
+        if (e.len != 0) {
+            out = e.symbol;
+            pos += e.len;
+            continue;
+        }
+
+        // Long code, the window still holds at least MAX_CODE_LEN bits so the rest of it is in w
+        w <<= huffman_kernels::LUT_BITS;
+        pos += huffman_kernels::LUT_BITS;
+        uint16_t node = e.node;
+        while (node != decode_table::NO_NODE && !tree[node].leaf) {
+            node = tree[node].child[w >> 63];
+            w <<= 1;
+            ++pos;
+        }
+        if (node == decode_table::NO_NODE) {
+            throw std::invalid_argument("Corrupt huffman chunk.");
+        }
+        out = tree[node].symbol;
+    }
+
+    if (pos > n * 8) {
+        throw std::invalid_argument("Corrupt huffman chunk.");
+    }
+}
+
+static HMC_INLINE void histogram_o1_impl(std::span<const char> data, size_t segment, context_histogram& freqs)
+{
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t n = data.size();
+
+    for (size_t start = 0; start < n; start += segment) {
+        const size_t end = start + std::min(segment, n - start);
+        uint8_t prev = 0;
+        for (size_t i = start; i < end; ++i) {
+            ++freqs[prev][p[i]];
+            prev = p[i];
+        }
+    }
+}
+
+/*
+ * Same MSB first packing as encode_impl, only the table changes with every symbol. Each context gets a pointer to
+ * its table up front so the hot loop is a single extra load.
+ */
+static HMC_INLINE void encode_o1_impl(std::span<const char> data, size_t segment, const context_code_table& table,
+                                      std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    if (!segment_bits.empty() && (data.empty() || segment == 0 || segment_bits.size() > (data.size() - 1) / segment)) {
+        throw std::invalid_argument("More sync segments than symbols.");
+    }
+    std::array<const code_table*, 256> by_context{};
+    for (size_t c = 0; c < 256; ++c)
+        by_context[c] = &table.tables[table.context[c]];
+
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t n = data.size();
+
+    uint64_t total_bits = 0;
+    bool missing = false;
+    for (size_t start = 0; start < n; start += segment) {
+        if (start != 0 && start / segment <= segment_bits.size()) segment_bits[start / segment - 1] = total_bits;
+        const size_t end = start + std::min(segment, n - start);
+        uint8_t prev = 0;
+        for (size_t i = start; i < end; ++i) {
+            const uint8_t len = by_context[prev]->len[p[i]];
+            total_bits += len;
+            missing |= len == 0;
+            prev = p[i];
+        }
+    }
+    if (missing) {
+        throw std::invalid_argument("Symbol missing from huffman table.");
+    }
+
+    const size_t first = converted.size();
+    converted.resize(first + (total_bits + 7) / 8);
+    auto* out = reinterpret_cast<uint8_t*>(converted.data() + first);
+
+    uint64_t acc = 0;
+    uint32_t nbits = 0;
+    for (size_t start = 0; start < n; start += segment) {
+        const size_t end = start + std::min(segment, n - start);
+        uint8_t prev = 0;
+        for (size_t i = start; i < end; ++i) {
+            const code_table& t = *by_context[prev];
+            const uint8_t s = p[i];
+            acc = (acc << t.len[s]) | t.code[s];
+            nbits += t.len[s];
+            while (nbits >= 8) {
+                nbits -= 8;
+                *out++ = static_cast<uint8_t>(acc >> nbits);
+            }
+            prev = s;
+        }
+    }
+    if (nbits > 0)
+        *out = static_cast<uint8_t>(acc << (8 - nbits));
+}
+
+static HMC_INLINE void decode_o1_impl(std::span<const char> bits, const context_decode_table& table,
+                                      std::span<char> decoded, uint32_t first_bit)
+{
+    std::array<const decode_table*, 256> by_context{};
+    for (size_t c = 0; c < 256; ++c)
+        by_context[c] = &table.tables[table.context[c]];
+
+    const auto* p = reinterpret_cast<const uint8_t*>(bits.data());
+    const size_t n = bits.size();
+
+    uint64_t pos = first_bit;
+    uint8_t prev = 0;
+    for (char& out : decoded) {
+        const decode_table& t = *by_context[prev];
+        const size_t byte = pos >> 3;
+        uint64_t w = load_be64(p + byte, byte < n ? n - byte : 0) << (pos & 7);
+
+        const auto& e = t.lut[w >> (64 - huffman_kernels::LUT_BITS)];
+        if (e.len != 0) {
+            out = e.symbol;
+            pos += e.len;
+        } else {
+            w <<= huffman_kernels::LUT_BITS;
+            pos += huffman_kernels::LUT_BITS;
+            uint16_t node = e.node;
+            while (node != decode_table::NO_NODE && !t.tree[node].leaf) {
+                node = t.tree[node].child[w >> 63];
+                w <<= 1;
+                ++pos;
+            }
+            if (node == decode_table::NO_NODE) {
+                throw std::invalid_argument("Corrupt huffman chunk.");
+            }
+            out = t.tree[node].symbol;
+        }
+        prev = static_cast<uint8_t>(out);
+    }
+
+    if (pos > n * 8) {
+        throw std::invalid_argument("Corrupt huffman chunk.");
+    }
+}
+
+static void histogram_scalar(std::span<const char> data, std::array<uint64_t, 256>& freqs)
+{
+    histogram_impl(data, freqs);
+}
+
+static void encode_scalar(std::span<const char> data, size_t segment, const code_table& table,
+                          std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    encode_impl(data, segment, table, converted, segment_bits);
+}
+
+static void decode_scalar(std::span<const char> bits, const decode_table& table, std::span<char> decoded, uint32_t first_bit)
+{
+    decode_impl(bits, table, decoded, first_bit);
+}
+
+static void histogram_o1_scalar(std::span<const char> data, size_t segment, context_histogram& freqs)
+{
+    histogram_o1_impl(data, segment, freqs);
+}
+
+static void encode_o1_scalar(std::span<const char> data, size_t segment, const context_code_table& table,
+                             std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    encode_o1_impl(data, segment, table, converted, segment_bits);
+}
+
+static void decode_o1_scalar(std::span<const char> bits, const context_decode_table& table, std::span<char> decoded,
+                             uint32_t first_bit)
+{
+    decode_o1_impl(bits, table, decoded, first_bit);
+}
+
+#ifdef HUFFMANCODEC_KERNEL_DISPATCH
+// BMI2 builds get shlx/shrx/bzhi for the variable shifts and masks, which is most of what these loops do
+
+HMC_TARGET("bmi2") static void histogram_bmi2(std::span<const char> data, std::array<uint64_t, 256>& freqs)
+{
+    histogram_impl(data, freqs);
+}
+
+HMC_TARGET("bmi2") static void encode_bmi2(std::span<const char> data, size_t segment, const code_table& table,
+                                          std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    if (table.max_len <= 32)
+        encode_wide_impl(data, segment, table, converted, segment_bits);
+    else
+        encode_impl(data, segment, table, converted, segment_bits);
+}
+
+HMC_TARGET("bmi2") static void decode_bmi2(std::span<const char> bits, const decode_table& table, std::span<char> decoded, uint32_t first_bit)
+{
+    decode_impl(bits, table, decoded, first_bit);
+}
+
+// The order-1 loops are bound by the table switch rather than by anything wider registers help with, BMI2 builds
+// of them serve the AVX2 path as well
+
+HMC_TARGET("bmi2") static void encode_o1_bmi2(std::span<const char> data, size_t segment, const context_code_table& table,
+                                             std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    encode_o1_impl(data, segment, table, converted, segment_bits);
+}
+
+HMC_TARGET("bmi2") static void decode_o1_bmi2(std::span<const char> bits, const context_decode_table& table,
+                                             std::span<char> decoded, uint32_t first_bit)
+{
+    decode_o1_impl(bits, table, decoded, first_bit);
+}
+
+HMC_TARGET("avx2,bmi2") static void histogram_avx2(std::span<const char> data, std::array<uint64_t, 256>& freqs)
+{
+    // 32 bytes per load, each byte lane of a 64-bit word gets its own table
+    std::array<std::array<uint64_t, 256>, 8> t{};
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t n = data.size();
+
+    auto count = [&t](uint64_t w) {
+        for (size_t b = 0; b < 8; ++b)
+            ++t[b][(w >> (8 * b)) & 0xFF];
+    };
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        count(static_cast<uint64_t>(_mm256_extract_epi64(v, 0)));
+        count(static_cast<uint64_t>(_mm256_extract_epi64(v, 1)));
+        count(static_cast<uint64_t>(_mm256_extract_epi64(v, 2)));
+        count(static_cast<uint64_t>(_mm256_extract_epi64(v, 3)));
+    }
+    for (; i < n; ++i)
+        ++t[0][p[i]];
+
+    for (size_t s = 0; s < 256; ++s) {
+        uint64_t sum = 0;
+        for (const auto& sub : t)
+            sum += sub[s];
+        freqs[s] += sum;
+    }
+}
+
+HMC_TARGET("avx2,bmi2") static void encode_avx2(std::span<const char> data, size_t segment, const code_table& table,
+                                               std::vector<char>& converted, std::span<uint64_t> segment_bits)
+{
+    // Gathering needs code and length packed in 32 bits
+    if (table.max_len > 24) {
+        if (table.max_len <= 32)
+            encode_wide_impl(data, segment, table, converted, segment_bits);
+        else
+            encode_impl(data, segment, table, converted, segment_bits);
+        return;
+    }
+
+    const uint64_t total_bits = encoded_bits(data, segment, table, segment_bits);
+    const size_t start = converted.size();
+    converted.resize(start + (total_bits + 7) / 8 + sizeof(uint32_t));
+    auto* out = reinterpret_cast<uint8_t*>(converted.data() + start);
+    const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+    const size_t n = data.size();
+
+    uint64_t acc = 0;
+    uint32_t nbits = 0;
+    auto put = [&](uint32_t packed) {
+        const uint32_t len = packed >> 24;
+        acc = (acc << len) | (packed & 0xFFFFFF);
+        nbits += len;
+        if (nbits >= 32) {
+            nbits -= 32;
+            store_be32(out, static_cast<uint32_t>(acc >> nbits));
+            out += 4;
+        }
+    };
+
+    size_t i = 0;
+    alignas(32) uint32_t entries[8];
+    for (; i + 8 <= n; i += 8) {
+        const __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + i)));
+        const __m256i ent = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table.packed.data()), idx, 4);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(entries), ent);
+        for (const uint32_t e : entries)
+            put(e);
+    }
+    for (; i < n; ++i)
+        put(table.packed[p[i]]);
+
+    if (nbits > 0)
+        store_be32(out, static_cast<uint32_t>(acc << (32 - nbits)));
+
+    converted.resize(start + (total_bits + 7) / 8);
+}
+
+HMC_TARGET("avx2,bmi2") static void decode_avx2(std::span<const char> bits, const decode_table& table, std::span<char> decoded, uint32_t first_bit)
+{
+    decode_impl(bits, table, decoded, first_bit);
+}
+#endif
+
+huffman_kernels::code_table huffman_kernels::build_code_table(const std::map<char, std::string> &huffman_table) {
+    code_table table;
+    for (const auto& [ch, repr] : huffman_table) {
+        if (repr.empty() || repr.length() > MAX_CODE_LEN) {
+            throw std::length_error("Huffman code length out of range: " + std::to_string(repr.length()));
+        }
+        const auto s = static_cast<uint8_t>(ch);
+        table.code[s] = std::stoull(repr, nullptr, 2);
+        table.len[s] = static_cast<uint8_t>(repr.length());
+        table.max_len = std::max(table.max_len, table.len[s]);
+    }
+
+    if (table.max_len <= 24) {
+        for (size_t s = 0; s < 256; ++s)
+            table.packed[s] = static_cast<uint32_t>(table.code[s]) | static_cast<uint32_t>(table.len[s]) << 24;
+    }
+    return table;
+}
+
+// Walks code down the tree from the root, adding the nodes it lacks, and marks where it ends as symbol's leaf
+static void insert_code(decode_table& table, uint64_t code, uint8_t len, char symbol)
+{
+    uint16_t node = 0;
+    for (uint8_t l = len; l-- > 0;) {
+        const size_t side = (code >> l) & 1;
+        if (table.tree[node].leaf) {
+            throw std::invalid_argument("Huffman codes are not prefix free.");
+        }
+        if (table.tree[node].child[side] == decode_table::NO_NODE) {
+            table.tree[node].child[side] = static_cast<uint16_t>(table.tree.size());
+            table.tree.emplace_back();
+        }
+        node = table.tree[node].child[side];
+    }
+    table.tree[node].leaf = true;
+    table.tree[node].symbol = symbol;
+}
+
+// Leaves within LUT_BITS of the root fill every slot starting with their code, deeper codes continue from the node
+static void fill_lut(decode_table& table, uint16_t node, uint32_t depth, uint32_t prefix)
+{
+    if (table.tree[node].leaf) {
+        const uint32_t shift = huffman_kernels::LUT_BITS - depth;
+        std::fill_n(table.lut.begin() + (prefix << shift), size_t{1} << shift,
+                    decode_table::entry{table.tree[node].symbol, static_cast<uint8_t>(depth), decode_table::NO_NODE});
+        return;
+    }
+    if (depth == huffman_kernels::LUT_BITS) {
+        table.lut[prefix].node = node;
+        return;
+    }
+    for (uint32_t side = 0; side < 2; ++side)
+        if (table.tree[node].child[side] != decode_table::NO_NODE)
+            fill_lut(table, table.tree[node].child[side], depth + 1, prefix << 1 | side);
+}
+
+static void fill_lut(decode_table& table)
+{
+    table.lut.assign(size_t{1} << huffman_kernels::LUT_BITS, {});
+    // A lone root leaf has no code, slots without a code stay at NO_NODE
+    if (!table.tree[0].leaf) fill_lut(table, 0, 0, 0);
+}
+
+/*
+ * Canonical codes for a set of lengths: shorter codes first, bytes in order within a length, as DEFLATE does.
+ * Lengths that don't fit a prefix code (Kraft sum over 1) are corrupt.
+ */
+static std::array<uint64_t, 256> canonical_codes(const std::array<uint8_t, 256>& lengths)
+{
+    std::array<uint64_t, huffman_kernels::MAX_CODE_LEN + 1> count{};
+    for (const uint8_t len : lengths) {
+        if (len > huffman_kernels::MAX_CODE_LEN) {
+            throw std::length_error("Huffman code length out of range: " + std::to_string(len));
+        }
+        ++count[len];
+    }
+    count[0] = 0;
+
+    std::array<uint64_t, huffman_kernels::MAX_CODE_LEN + 1> next{};
+    uint64_t code = 0;
+    for (uint32_t len = 1; len <= huffman_kernels::MAX_CODE_LEN; ++len) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+        if (count[len] > (uint64_t{1} << len) - code) {
+            throw std::invalid_argument("Huffman code lengths don't make a prefix code.");
+        }
+    }
+
+    std::array<uint64_t, 256> codes{};
+    for (size_t s = 0; s < 256; ++s)
+        if (lengths[s] != 0) codes[s] = next[lengths[s]]++;
+    return codes;
+}
+
+huffman_kernels::decode_table huffman_kernels::build_decode_table(const std::map<char, std::string> &huffman_table) {
+    decode_table table;
+    table.tree.emplace_back();
+
+    for (const auto& [ch, repr] : huffman_table) {
+        if (repr.empty() || repr.length() > MAX_CODE_LEN) {
+            throw std::length_error("Huffman code length out of range: " + std::to_string(repr.length()));
+        }
+        insert_code(table, std::stoull(repr, nullptr, 2), static_cast<uint8_t>(repr.length()), ch);
+    }
+    fill_lut(table);
+    return table;
+}
+
+huffman_kernels::code_table huffman_kernels::canonical_code_table(const std::array<uint8_t, 256> &lengths) {
+    const auto codes = canonical_codes(lengths);
+    code_table table;
+    for (size_t s = 0; s < 256; ++s) {
+        table.code[s] = codes[s];
+        table.len[s] = lengths[s];
+        table.max_len = std::max(table.max_len, lengths[s]);
+    }
+    if (table.max_len <= 24) {
+        for (size_t s = 0; s < 256; ++s)
+            table.packed[s] = static_cast<uint32_t>(table.code[s]) | static_cast<uint32_t>(table.len[s]) << 24;
+    }
+    return table;
+}
+
+void huffman_kernels::canonical_decode_table(const std::array<uint8_t, 256> &lengths, decode_table &table) {
+    const auto codes = canonical_codes(lengths);
+    // Capacity from the table's last use is kept
+    table.tree.clear();
+    table.tree.emplace_back();
+    for (size_t s = 0; s < 256; ++s)
+        if (lengths[s] != 0) insert_code(table, codes[s], lengths[s], static_cast<char>(s));
+    fill_lut(table);
+}
+
+huffman_kernels::context_code_table huffman_kernels::build_context_code_table(
+        const std::array<uint8_t, 256> &context, const std::vector<std::map<char, std::string>> &tables) {
+    context_code_table table;
+    table.context = context;
+    for (const auto& t : tables)
+        table.tables.push_back(build_code_table(t));
+
+    if (std::ranges::any_of(context, [&](uint8_t c) { return c >= table.tables.size(); })) {
+        throw std::invalid_argument("Context refers to a missing table.");
+    }
+    return table;
+}
+
+huffman_kernels::context_decode_table huffman_kernels::build_context_decode_table(
+        const std::array<uint8_t, 256> &context, const std::vector<std::map<char, std::string>> &tables) {
+    context_decode_table table;
+    table.context = context;
+    for (const auto& t : tables)
+        table.tables.push_back(build_decode_table(t));
+
+    if (std::ranges::any_of(context, [&](uint8_t c) { return c >= table.tables.size(); })) {
+        throw std::invalid_argument("Context refers to a missing table.");
+    }
+    return table;
+}
+
+huffman_kernels::Isa huffman_kernels::detect_isa() {
+#ifdef HUFFMANCODEC_KERNEL_DISPATCH
+    __builtin_cpu_init();
+    const bool bmi2 = __builtin_cpu_supports("bmi2");
+    if (bmi2 && __builtin_cpu_supports("avx2")) return Isa::AVX2;
+    if (bmi2) return Isa::BMI2;
+#endif
+    return Isa::Scalar;
+}
+
+const char* huffman_kernels::isa_name(const huffman_kernels::Isa isa) {
+    switch (isa) {
+        case Isa::AVX2:
+            return "avx2";
+        case Isa::BMI2:
+            return "bmi2";
+        default:
+            return "scalar";
+    }
+}
+
+huffman_kernels huffman_kernels::for_isa(huffman_kernels::Isa isa) {
+    isa = std::min(isa, detect_isa());
+
+    huffman_kernels kernels;
+    kernels.isa = isa;
+    switch (isa) {
+#ifdef HUFFMANCODEC_KERNEL_DISPATCH
+        case Isa::AVX2:
+            kernels.histogram = histogram_avx2;
+            kernels.encode = encode_avx2;
+            kernels.decode = decode_avx2;
+            kernels.histogram_o1 = histogram_o1_scalar;
+            kernels.encode_o1 = encode_o1_bmi2;
+            kernels.decode_o1 = decode_o1_bmi2;
+            break;
+        case Isa::BMI2:
+            kernels.histogram = histogram_bmi2;
+            kernels.encode = encode_bmi2;
+            kernels.decode = decode_bmi2;
+            kernels.histogram_o1 = histogram_o1_scalar;
+            kernels.encode_o1 = encode_o1_bmi2;
+            kernels.decode_o1 = decode_o1_bmi2;
+            break;
+#endif
+        default:
+            kernels.histogram = histogram_scalar;
+            kernels.encode = encode_scalar;
+            kernels.decode = decode_scalar;
+            kernels.histogram_o1 = histogram_o1_scalar;
+            kernels.encode_o1 = encode_o1_scalar;
+            kernels.decode_o1 = decode_o1_scalar;
+    }
+    return kernels;
+}
+
+const huffman_kernels& huffman_kernels::get() {
+    static const huffman_kernels kernels = [] {
+        Isa isa = detect_isa();
+        if (const char* env = std::getenv("HUFFMANCODEC_KERNELS")) {
+            const std::string_view forced(env);
+            if (forced == "scalar") isa = Isa::Scalar;
+            else if (forced == "bmi2") isa = Isa::BMI2;
+            else if (forced == "avx2") isa = Isa::AVX2;
+        }
+        return for_isa(isa);
+    }();
+    return kernels;
+}
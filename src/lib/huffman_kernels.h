@@ -0,0 +1,120 @@
+#ifndef HUFFMANCODEC_HUFFMAN_KERNELS_H
+#define HUFFMANCODEC_HUFFMAN_KERNELS_H
+
+#include <map>
+#include <span>
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Multiversioned kernels need per-function target attributes and CPUID builtins (GCC/Clang on x86-64)
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HUFFMANCODEC_KERNEL_DISPATCH
+#endif
+
+/*
+ * Hot loops of the codec: histogram, huffman bit packing and table driven huffman decoding. Every kernel has a
+ * scalar version that runs anywhere plus BMI2 and AVX2 builds of it, the best one the CPU supports is picked once
+ * at startup. Setting HUFFMANCODEC_KERNELS=scalar|bmi2|avx2 forces a path (capped at what the CPU supports), which
+ * is mostly useful for benchmarking.
+ */
+class huffman_kernels {
+public:
+    enum class Isa : uint8_t {Scalar = 0, BMI2 = 1, AVX2 = 2};
+
+    // Codes up to this many bits are resolved by a single lookup, longer ones continue down the tree
+    static constexpr uint32_t LUT_BITS = 11;
+    // Bit packing keeps less than a byte pending between codes, so a code has to fit the rest of a 64-bit word
+    static constexpr uint32_t MAX_CODE_LEN = 57;
+
+    struct code_table {
+        std::array<uint64_t, 256> code{};
+        std::array<uint8_t, 256> len{};
+        // code | len << 24, only filled in when every code fits 24 bits (lets AVX2 gather both at once)
+        std::array<uint32_t, 256> packed{};
+        uint8_t max_len = 0;
+    };
+
+    struct decode_table {
+        static constexpr uint16_t NO_NODE = 0xFFFF;
+
+        // len == 0 means the code is longer than LUT_BITS, decoding carries on from tree[node]
+        struct entry {
+            char symbol = 0;
+            uint8_t len = 0;
+            uint16_t node = NO_NODE;
+        };
+        struct node {
+            std::array<uint16_t, 2> child{NO_NODE, NO_NODE};
+            char symbol = 0;
+            bool leaf = false;
+        };
+
+        std::vector<entry> lut;
+        std::vector<node> tree;
+    };
+
+    /*
+     * Order-1 tables: the byte before a symbol picks which of a handful of code tables codes it. The context
+     * starts over at 0 every `segment` symbols (SIZE_MAX for never) so decode can enter the stream at any sync point.
+     */
+    struct context_code_table {
+        std::array<uint8_t, 256> context{};
+        std::vector<code_table> tables;
+    };
+    struct context_decode_table {
+        std::array<uint8_t, 256> context{};
+        std::vector<decode_table> tables;
+    };
+    // [previous byte][byte]
+    using context_histogram = std::array<std::array<uint64_t, 256>, 256>;
+
+    using histogram_fn = void (*)(std::span<const char> data, std::array<uint64_t, 256>& freqs);
+    /*
+     * Output is appended to a caller provided buffer, so its allocation can be recycled across chunks and a chunk
+     * can be coded straight in behind its header. The bit offset (from where this call's output starts) of every
+     * segment of `segment` symbols after the first goes into segment_bits, for as many as it holds, which is how
+     * sync points get placed without another pass over the chunk. An empty segment_bits leaves segment unused.
+     */
+    using encode_fn = void (*)(std::span<const char> data, size_t segment, const code_table& table,
+                               std::vector<char>& converted, std::span<uint64_t> segment_bits);
+    // Decoding starts first_bit bits into the span, so a stream can be entered at any sync point
+    using decode_fn = void (*)(std::span<const char> bits, const decode_table& table, std::span<char> decoded,
+                               uint32_t first_bit);
+    using histogram_o1_fn = void (*)(std::span<const char> data, size_t segment, context_histogram& freqs);
+    using encode_o1_fn = void (*)(std::span<const char> data, size_t segment, const context_code_table& table,
+                                  std::vector<char>& converted, std::span<uint64_t> segment_bits);
+    // Decodes a single segment, so the context starts at 0
+    using decode_o1_fn = void (*)(std::span<const char> bits, const context_decode_table& table, std::span<char> decoded,
+                                  uint32_t first_bit);
+
+    static code_table build_code_table(const std::map<char, std::string>& huffman_table);
+    static decode_table build_decode_table(const std::map<char, std::string>& huffman_table);
+    // Canonical codes from code lengths alone (0 for bytes without one), nothing is allocated for the code table
+    static code_table canonical_code_table(const std::array<uint8_t, 256>& lengths);
+    // Fills table in place, so a table kept around between calls reuses its buffers
+    static void canonical_decode_table(const std::array<uint8_t, 256>& lengths, decode_table& table);
+    static context_code_table build_context_code_table(const std::array<uint8_t, 256>& context,
+                                                       const std::vector<std::map<char, std::string>>& tables);
+    static context_decode_table build_context_decode_table(const std::array<uint8_t, 256>& context,
+                                                           const std::vector<std::map<char, std::string>>& tables);
+
+    // Kernels picked at startup, shared by every codec instance
+    static const huffman_kernels& get();
+    // Kernels for a specific instruction set, capped at what this CPU supports
+    static huffman_kernels for_isa(Isa isa);
+
+    static Isa detect_isa();
+    static const char* isa_name(Isa isa);
+
+    Isa isa = Isa::Scalar;
+    histogram_fn histogram = nullptr;
+    encode_fn encode = nullptr;
+    decode_fn decode = nullptr;
+    histogram_o1_fn histogram_o1 = nullptr;
+    encode_o1_fn encode_o1 = nullptr;
+    decode_o1_fn decode_o1 = nullptr;
+};
+
+#endif //HUFFMANCODEC_HUFFMAN_KERNELS_H
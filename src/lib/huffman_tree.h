@@ -7,6 +7,8 @@
 
 #include <iostream>
 #include <optional>
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <queue>
@@ -87,9 +89,75 @@ public:
                 };
         //NOLINTEND
 
-        insert_node(insert_node, root, "");
+        // A lone symbol still needs a one bit code, an empty one could not be told apart from nothing
+        insert_node(insert_node, root, root->ch.has_value() ? "0" : "");
         return huffman_table;
     }
+
+    /*
+     * Code length of every byte (0 for the ones that never occur) for the same tree huffman_table builds, without
+     * building it: Moffat and Katajainen's in-place method over the sorted frequencies, all on the stack.
+     */
+    static std::array<uint8_t, 256> code_lengths(const std::array<uint64_t, 256>& freqs)
+    {
+        std::array<std::pair<uint64_t, uint8_t>, 256> sorted;
+        size_t n = 0;
+        for (size_t ch = 0; ch < freqs.size(); ++ch)
+            if (freqs[ch] != 0) sorted[n++] = {freqs[ch], static_cast<uint8_t>(ch)};
+        std::sort(sorted.begin(), sorted.begin() + static_cast<ptrdiff_t>(n));
+
+        std::array<uint8_t, 256> lengths{};
+        if (n == 1) lengths[sorted[0].second] = 1;
+        if (n < 2) return lengths;
+
+        std::array<uint64_t, 256> a;
+        for (size_t i = 0; i < n; ++i)
+            a[i] = sorted[i].first;
+
+        // Internal node weights, each pointing at its parent once merged
+        a[0] += a[1];
+        size_t root = 0, leaf = 2;
+        for (size_t next = 1; next < n - 1; ++next) {
+            if (leaf >= n || a[root] < a[leaf]) {
+                a[next] = a[root];
+                a[root++] = next;
+            } else {
+                a[next] = a[leaf++];
+            }
+            if (leaf >= n || (root < next && a[root] < a[leaf])) {
+                a[next] += a[root];
+                a[root++] = next;
+            } else {
+                a[next] += a[leaf++];
+            }
+        }
+
+        // Parent pointers to internal node depths
+        a[n - 2] = 0;
+        for (size_t next = n - 2; next-- > 0;)
+            a[next] = a[a[next]] + 1;
+
+        // Internal node depths to leaf depths, leaves fill every slot left free at each depth
+        size_t available = 1, used = 0, depth = 0, next = n;
+        ptrdiff_t internal = static_cast<ptrdiff_t>(n) - 2;
+        while (available > 0) {
+            while (internal >= 0 && a[internal] == depth) {
+                ++used;
+                --internal;
+            }
+            while (available > used) {
+                a[--next] = depth;
+                --available;
+            }
+            available = 2 * used;
+            ++depth;
+            used = 0;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+            lengths[sorted[i].second] = static_cast<uint8_t>(a[i]);
+        return lengths;
+    }
 };
 
 #endif //HUFFMANCODEC_HUFFMAN_TREE_H
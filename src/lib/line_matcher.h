@@ -0,0 +1,65 @@
+#ifndef HUFFMANCODEC_LINE_MATCHER_H
+#define HUFFMANCODEC_LINE_MATCHER_H
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <algorithm>
+
+/*
+ * Pattern for `search`: a literal, optionally anchored with a leading ^ and/or a trailing $ to the start/end of
+ * the line. Lines end at '\n', which is never part of them.
+ */
+class line_matcher {
+public:
+    explicit line_matcher(std::string_view pattern) :
+        anchor_start{pattern.starts_with('^')},
+        anchor_end{pattern.size() > anchor_start && pattern.ends_with('$')},
+        literal{pattern.substr(anchor_start, pattern.size() - anchor_start - anchor_end)},
+        searcher{literal.begin(), literal.end()} {}
+
+    // The searcher points into literal
+    line_matcher(const line_matcher&) = delete;
+    line_matcher& operator=(const line_matcher&) = delete;
+
+    [[nodiscard]] bool matches(std::string_view line) const
+    {
+        if (anchor_start && anchor_end) return line == literal;
+        if (anchor_start) return line.starts_with(literal);
+        if (anchor_end) return line.ends_with(literal);
+        return literal.empty() || std::search(line.begin(), line.end(), searcher) != line.end();
+    }
+
+    /*
+     * Calls on_line(start, end) for every matching line of text, where text is made of whole lines (the last one
+     * without its '\n'). Searches the whole text for the literal rather than line by line, so lines without it
+     * cost no more than the search itself.
+     */
+    template<typename F>
+    void scan(std::string_view text, F&& on_line) const
+    {
+        size_t pos = 0;
+        while (pos <= text.size()) {
+            const auto hit = std::search(text.begin() + pos, text.end(), searcher);
+            // An empty literal hits at pos itself, the end of the text still ends a (last) line
+            if (hit == text.end() && !(literal.empty() && pos == text.size())) return;
+
+            const size_t at = hit - text.begin();
+            const size_t nl = at == 0 ? std::string_view::npos : text.rfind('\n', at - 1);
+            const size_t start = nl == std::string_view::npos ? 0 : nl + 1;
+            const size_t end = std::min(text.size(), text.find('\n', at));
+
+            if (matches(text.substr(start, end - start)))
+                on_line(start, end);
+            pos = end + 1;
+        }
+    }
+
+private:
+    bool anchor_start;
+    bool anchor_end;
+    std::string literal;
+    std::boyer_moore_horspool_searcher<std::string::const_iterator> searcher;
+};
+
+#endif //HUFFMANCODEC_LINE_MATCHER_H
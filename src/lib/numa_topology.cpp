@@ -0,0 +1,114 @@
+#include "numa_topology.h"
+
+#include <cctype>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#if __has_include(<sched.h>) && __has_include(<sys/mman.h>)
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+static thread_local unsigned thread_node = 0;
+
+// "0-3,8,10-11" as written to sysfs cpulist files
+static std::vector<unsigned> parse_cpu_list(const std::string& list)
+{
+    std::vector<unsigned> cpus;
+    std::istringstream iss(list);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        const size_t dash = range.find('-');
+        const unsigned first = std::stoul(range.substr(0, dash));
+        const unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for (unsigned cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+const std::vector<std::vector<unsigned>>& numa_topology::nodes() {
+    static const std::vector<std::vector<unsigned>> topology = [] {
+        std::vector<std::pair<unsigned, std::vector<unsigned>>> found;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+            const std::string name = entry.path().filename().string();
+            if (!name.starts_with("node") || name.size() == 4 ||
+                    !std::all_of(name.begin() + 4, name.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+                continue;
+
+            std::ifstream ifs(entry.path() / "cpulist");
+            std::string list;
+            // Memory only nodes have no CPUs to run workers on
+            if (std::getline(ifs, list); !list.empty())
+                found.emplace_back(std::stoul(name.substr(4)), parse_cpu_list(list));
+        }
+        std::ranges::sort(found);
+
+        std::vector<std::vector<unsigned>> result;
+        for (auto& [id, cpus] : found)
+            if (!cpus.empty()) result.push_back(std::move(cpus));
+        if (result.empty()) {
+            result.emplace_back();
+            for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+                result.back().push_back(cpu);
+        }
+        return result;
+    }();
+    return topology;
+}
+
+std::vector<unsigned> numa_topology::cpus() {
+    std::vector<unsigned> all;
+    for (const auto& node : nodes())
+        all.insert(all.end(), node.begin(), node.end());
+
+#if __has_include(<sched.h>) && defined(CPU_SET)
+    // taskset and cpusets leave the process some of them only, pinning to any other one fails
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        std::vector<unsigned> usable;
+        for (const unsigned cpu : all)
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) usable.push_back(cpu);
+        if (!usable.empty()) return usable;
+    }
+#endif
+    return all;
+}
+
+bool numa_topology::pin_to_cpu(unsigned cpu) {
+#if __has_include(<sched.h>) && defined(CPU_SET)
+    if (cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+
+    // A thread the OS didn't pin keeps floating, and keeps node 0 with it
+    const auto& topology = nodes();
+    for (size_t node = 0; node < topology.size(); ++node)
+        if (std::ranges::find(topology[node], cpu) != topology[node].end())
+            thread_node = static_cast<unsigned>(node);
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned numa_topology::current_node() {
+    return thread_node;
+}
+
+void numa_topology::advise_huge_pages(void *data, size_t size) {
+#if defined(MADV_HUGEPAGE)
+    constexpr uintptr_t HUGE_PAGE = 2 * 1024 * 1024;
+    const auto begin = (reinterpret_cast<uintptr_t>(data) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    const auto end = (reinterpret_cast<uintptr_t>(data) + size) & ~(HUGE_PAGE - 1);
+    if (end > begin)
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+#endif
+}
@@ -0,0 +1,58 @@
+#ifndef HUFFMANCODEC_NUMA_TOPOLOGY_H
+#define HUFFMANCODEC_NUMA_TOPOLOGY_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+/*
+ * Which CPUs sit on which NUMA node, read from /sys/devices/system/node (one node holding every CPU anywhere that
+ * isn't available). Pinned worker_pool threads remember their node, so tables and buffers they touch first end up
+ * in memory local to them.
+ */
+class numa_topology {
+public:
+    // CPUs of every node, node ids renumbered from 0 in sysfs order
+    static const std::vector<std::vector<unsigned>>& nodes();
+    // Every CPU the calling thread may run on, node after node
+    static std::vector<unsigned> cpus();
+
+    // Pins the calling thread to cpu and records its node, false (and no node) if the OS refused
+    static bool pin_to_cpu(unsigned cpu);
+    // Node the calling thread got pinned on, 0 for threads that never were
+    static unsigned current_node();
+
+    // Asks for transparent huge pages on the whole 2 MB pages in [data, data + size), a no-op where unsupported
+    static void advise_huge_pages(void* data, size_t size);
+};
+
+/*
+ * Read-only value with a copy per NUMA node. The first thread of a node that asks makes its copy, so the copy's
+ * pages are allocated on that node. On single node machines everyone shares the original.
+ */
+template<typename T>
+class node_local {
+public:
+    explicit node_local(T value) : original(std::move(value)), copies(numa_topology::nodes().size()) {}
+
+    const T& get() const
+    {
+        if (copies.size() <= 1) return original;
+
+        auto& slot = copies[numa_topology::current_node() % copies.size()];
+        std::call_once(slot.once, [&] { slot.copy = std::make_unique<const T>(original); });
+        return *slot.copy;
+    }
+
+private:
+    struct node_copy {
+        std::once_flag once;
+        std::unique_ptr<const T> copy;
+    };
+
+    const T original;
+    mutable std::vector<node_copy> copies;
+};
+
+#endif //HUFFMANCODEC_NUMA_TOPOLOGY_H
@@ -0,0 +1,195 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#if __has_include(<linux/perf_event.h>)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define HUFFMANCODEC_PERF_EVENTS 1
+#endif
+
+#ifdef HUFFMANCODEC_PERF_EVENTS
+static constexpr std::array<std::pair<uint32_t, uint64_t>, perf_counters::EVENTS> event_configs = {{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+}};
+
+// Counts the calling thread on whatever CPU it runs on, cycles lead the group so they all run together
+static int open_event(perf_counters::Event event, int group_fd)
+{
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = event_configs[event].first;
+    attr.config = event_configs[event].second;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+#endif
+
+struct perf_counters::thread_group {
+    std::array<int, EVENTS> fds;
+    // Events in the order the group reads them
+    std::array<Event, EVENTS> order{};
+    size_t count = 0;
+    bool ok = false;
+
+    thread_group() { fds.fill(-1); }
+    ~thread_group()
+    {
+#ifdef HUFFMANCODEC_PERF_EVENTS
+        for (const int fd : fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+};
+
+static std::atomic<uint64_t> next_id{1};
+
+perf_counters::perf_counters() : id{next_id.fetch_add(1, std::memory_order_relaxed)} {
+#ifdef HUFFMANCODEC_PERF_EVENTS
+    const int leader = open_event(Cycles, -1);
+    if (leader < 0) {
+        reason = std::string("perf_event_open failed: ") + std::strerror(errno);
+        if (errno == EACCES || errno == EPERM)
+            reason += " (lower /proc/sys/kernel/perf_event_paranoid to 2 or below)";
+        else if (errno == ENOENT || errno == EOPNOTSUPP)
+            reason += " (no hardware PMU, usual in VMs and containers)";
+        return;
+    }
+    leader_ok = opened[Cycles] = true;
+    for (int event = Instructions; event < EVENTS; ++event) {
+        const int fd = open_event(static_cast<Event>(event), leader);
+        opened[event] = fd >= 0;
+        if (fd >= 0) close(fd);
+    }
+    close(leader);
+#else
+    reason = "hardware counters are only read on Linux";
+#endif
+}
+
+perf_counters::~perf_counters() = default;
+
+perf_counters::thread_group* perf_counters::local() const {
+    // Thread ids come back once a thread exits, these don't
+    static std::atomic<uint64_t> next_thread{1};
+    thread_local const uint64_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+    thread_local uint64_t cached_id = 0;
+    thread_local thread_group* cached = nullptr;
+    if (cached_id == id) return cached;
+
+    std::lock_guard<std::mutex> lock(groups_mtx);
+    auto& group = groups[thread];
+    if (!group) {
+        // Opened with the events the probe found
+        group = std::make_unique<thread_group>();
+#ifdef HUFFMANCODEC_PERF_EVENTS
+        group->ok = true;
+        for (int event = Cycles; event < EVENTS && group->ok; ++event) {
+            if (!opened[event]) continue;
+            const int fd = open_event(static_cast<Event>(event), event == Cycles ? -1 : group->fds[Cycles]);
+            // A group that misses an event the probe had would mix up the counts, the thread goes uncounted instead
+            group->ok = fd >= 0;
+            group->fds[event] = fd;
+            if (fd >= 0) group->order[group->count++] = static_cast<Event>(event);
+        }
+#endif
+    }
+    cached_id = id;
+    cached = group->ok ? group.get() : nullptr;
+    return cached;
+}
+
+bool perf_counters::read(const thread_group &group, std::array<uint64_t, EVENTS> &values, uint64_t &enabled,
+                         uint64_t &running) {
+#ifdef HUFFMANCODEC_PERF_EVENTS
+    // [nr][time enabled][time running][value of every event in the group]
+    uint64_t buffer[3 + EVENTS] = {};
+    const auto len = static_cast<ssize_t>((3 + group.count) * sizeof(uint64_t));
+    if (::read(group.fds[Cycles], buffer, sizeof(buffer)) != len || buffer[0] != group.count) return false;
+
+    enabled = buffer[1];
+    running = buffer[2];
+    for (size_t i = 0; i < group.count; ++i)
+        values[group.order[i]] = buffer[3 + i];
+    return true;
+#else
+    return false;
+#endif
+}
+
+perf_counters::scope::scope(perf_counters *counters, Stage stage, uint64_t bytes) :
+    counters{counters}, stage{stage}, bytes{bytes} {
+    if (!this->counters || !this->counters->available()) {
+        this->counters = nullptr;
+        return;
+    }
+    const thread_group* group = this->counters->local();
+    if (!group || !read(*group, start, start_enabled, start_running)) this->counters = nullptr;
+}
+
+perf_counters::scope::~scope() {
+    if (!counters) return;
+
+    std::array<uint64_t, EVENTS> end{};
+    uint64_t enabled = 0, running = 0;
+    if (!read(*counters->local(), end, enabled, running) || running == start_running) return;
+
+    // Multiplexed groups only ran part of the time, scale them up to all of it
+    const double scale = static_cast<double>(enabled - start_enabled) / static_cast<double>(running - start_running);
+    auto& counts = counters->stages[static_cast<size_t>(stage)];
+    counts.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    for (int event = Cycles; event < EVENTS; ++event)
+        counts.counts[event].fetch_add(static_cast<uint64_t>(static_cast<double>(end[event] - start[event]) * scale),
+                                       std::memory_order_relaxed);
+}
+
+perf_counters::totals perf_counters::stage(Stage stage) const {
+    const auto& counts = stages[static_cast<size_t>(stage)];
+    totals result;
+    result.bytes = counts.bytes.load(std::memory_order_relaxed);
+    for (int event = Cycles; event < EVENTS; ++event)
+        result.counts[event] = counts.counts[event].load(std::memory_order_relaxed);
+    return result;
+}
+
+void perf_counters::write_report(std::ostream &os) const {
+    if (!available()) {
+        os << "Perf counters unavailable: " << reason << std::endl;
+        return;
+    }
+
+    static constexpr const char* stage_names[STAGES] = {"histogram", "encode", "decode"};
+    static constexpr std::pair<Event, const char*> misses[] = {
+        {BranchMisses, "branch-miss/B"}, {L1dMisses, "L1d-miss/B"}, {LlcMisses, "LLC-miss/B"}};
+
+    os << std::left << std::setw(12) << "Kernel" << std::right << std::setw(12) << "MB" << std::setw(8) << "IPC"
+       << std::setw(10) << "cycles/B";
+    for (const auto& [event, name] : misses)
+        os << std::setw(15) << name;
+    os << '\n';
+
+    for (size_t s = 0; s < STAGES; ++s) {
+        const totals t = stage(static_cast<Stage>(s));
+        if (t.bytes == 0) continue;
+        os << std::left << std::setw(12) << stage_names[s] << std::right << std::fixed
+           << std::setw(12) << std::setprecision(1) << static_cast<double>(t.bytes) / (1 << 20)
+           << std::setw(8) << std::setprecision(2) << t.ipc()
+           << std::setw(10) << std::setprecision(2) << t.per_byte(Cycles);
+        for (const auto& [event, name] : misses) {
+            if (has(event))
+                os << std::setw(15) << std::setprecision(5) << t.per_byte(event);
+            else
+                os << std::setw(15) << "n/a";
+        }
+        os << '\n';
+    }
+    os << std::flush;
+}
@@ -0,0 +1,100 @@
+#ifndef HUFFMANCODEC_PERF_COUNTERS_H
+#define HUFFMANCODEC_PERF_COUNTERS_H
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <ostream>
+
+/*
+ * Opt-in hardware counters (perf_event_open) around the histogram, encode and decode kernels. Every thread opens a
+ * counter group of its own the first time it enters a scope of an instance and reads it at both ends, so a scope
+ * only counts its own thread's work. Where the kernel won't hand out counters (not Linux, perf_event_paranoid, containers, VMs
+ * without a PMU) available() is false and scopes do nothing. Counts are user space only.
+ */
+class perf_counters {
+public:
+    enum class Stage { Histogram, Encode, Decode };
+    static constexpr size_t STAGES = 3;
+
+    enum Event { Cycles, Instructions, BranchMisses, L1dMisses, LlcMisses, EVENTS };
+
+    struct totals {
+        // Input bytes the stage went through
+        uint64_t bytes = 0;
+        std::array<uint64_t, EVENTS> counts{};
+
+        [[nodiscard]] double ipc() const
+        {
+            return counts[Cycles] == 0 ? 0 : static_cast<double>(counts[Instructions]) / static_cast<double>(counts[Cycles]);
+        }
+        [[nodiscard]] double per_byte(Event event) const
+        {
+            return bytes == 0 ? 0 : static_cast<double>(counts[event]) / static_cast<double>(bytes);
+        }
+    };
+
+    // Probes the counters on the calling thread
+    perf_counters();
+    ~perf_counters();
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    // Counts the calling thread's events from construction to destruction into stage, does nothing without counters
+    class scope {
+    public:
+        scope(perf_counters* counters, Stage stage, uint64_t bytes);
+        ~scope();
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        perf_counters* counters;
+        Stage stage;
+        uint64_t bytes;
+        std::array<uint64_t, EVENTS> start{};
+        uint64_t start_enabled = 0;
+        uint64_t start_running = 0;
+    };
+
+    [[nodiscard]] bool available() const { return leader_ok; }
+    // Some PMUs lack an event or two (cache events in VMs mostly), the rest still count
+    [[nodiscard]] bool has(Event event) const { return available() && opened[event]; }
+    // Why there are no counters, empty when there are
+    [[nodiscard]] const std::string& unavailable_reason() const { return reason; }
+
+    [[nodiscard]] totals stage(Stage stage) const;
+    // Table of IPC and misses per byte for every stage that ran
+    void write_report(std::ostream& os) const;
+
+private:
+    struct thread_group;
+    // Group of the calling thread for this instance, opened on first use, null if it couldn't be
+    thread_group* local() const;
+    // Reads the calling thread's group, scaled up if the kernel multiplexed it, false if it couldn't
+    static bool read(const thread_group& group, std::array<uint64_t, EVENTS>& values, uint64_t& enabled, uint64_t& running);
+
+    bool leader_ok = false;
+    std::array<bool, EVENTS> opened{};
+    std::string reason;
+
+    // Every thread's group belongs to the instance and is closed with it. Threads remember the last instance they
+    // used by id, an address may come back for a later instance
+    const uint64_t id;
+    mutable std::mutex groups_mtx;
+    mutable std::map<uint64_t, std::unique_ptr<thread_group>> groups;
+
+    struct stage_counts {
+        std::atomic<uint64_t> bytes{0};
+        std::array<std::atomic<uint64_t>, EVENTS> counts{};
+    };
+    std::array<stage_counts, STAGES> stages;
+};
+
+#endif //HUFFMANCODEC_PERF_COUNTERS_H
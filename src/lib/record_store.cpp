@@ -0,0 +1,376 @@
+#include "record_store.h"
+
+#include <deque>
+#include <mutex>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <condition_variable>
+#if __has_include(<sys/mman.h>) && __has_include(<fcntl.h>)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HUFFMANCODEC_MMAP 1
+#endif
+
+#include "huffman_tree.h"
+
+static constexpr size_t TABLE_OFFSET = sizeof(record_store::header);
+static constexpr size_t PAYLOAD_OFFSET = TABLE_OFFSET + 256;
+
+static std::invalid_argument corrupt()
+{
+    return std::invalid_argument("Corrupt record store.");
+}
+
+static void put_varint(std::vector<char>& out, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(static_cast<char>(value | 0x80));
+    out.push_back(static_cast<char>(value));
+}
+
+static uint64_t get_varint(std::span<const char> in, size_t& pos)
+{
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        const auto byte = static_cast<uint8_t>(in[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    throw corrupt();
+}
+
+// Runs task(0) .. task(count - 1) on pool and waits for all of them, the first exception one threw is rethrown
+static void run_tasks(worker_pool& pool, size_t count, const std::function<void(size_t)>& task)
+{
+    std::mutex mtx;
+    std::condition_variable done;
+    size_t pending = count;
+    std::exception_ptr error;
+    for (size_t i = 0; i < count; ++i) {
+        pool.submit([&, i] {
+            try {
+                task(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(mtx);
+                if (!error) error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard(mtx);
+            if (--pending == 0) done.notify_all();
+        });
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    done.wait(lock, [&] { return pending == 0; });
+    if (error) std::rethrow_exception(error);
+}
+
+// Parts to split n items over, each with at least min_items of them
+static size_t part_count(const worker_pool& pool, size_t n, size_t min_items)
+{
+    return std::clamp<size_t>(n / min_items, 1, 4 * static_cast<size_t>(pool.size()));
+}
+
+// Records of one coding part, text holds them when they were read from a stream rather than handed in
+struct record_store::coded_part {
+    std::string text;
+    std::vector<std::string_view> records;
+    std::vector<char> payload;
+    std::vector<uint64_t> sizes;
+    bool queued = false;
+    bool done = false;
+};
+
+// Bytes of records a coding part takes, enough of them to keep every worker busy on small inputs
+static uint64_t part_bytes(const worker_pool& pool, uint64_t total)
+{
+    return std::clamp<uint64_t>(total / (4 * static_cast<uint64_t>(pool.size())), 64 * 1024, 1 << 20);
+}
+
+void record_store::write(std::span<const std::string_view> records, std::ostream &output,
+                         std::shared_ptr<worker_pool> pool) {
+    if (!pool) pool = worker_pool::shared();
+    const size_t parts = part_count(*pool, records.size(), 16 * BLOCK_RECORDS);
+    const auto first = [&](size_t part) { return records.size() * part / parts; };
+
+    std::vector<std::array<uint64_t, 256>> part_freqs(parts);
+    run_tasks(*pool, parts, [&](size_t part) {
+        auto& freqs = part_freqs[part];
+        for (size_t r = first(part); r < first(part + 1); ++r)
+            for (const char c : records[r])
+                ++freqs[static_cast<uint8_t>(c)];
+    });
+    std::array<uint64_t, 256> freqs{};
+    for (const auto& counts : part_freqs)
+        for (size_t ch = 0; ch < 256; ++ch)
+            freqs[ch] += counts[ch];
+
+    const uint64_t limit = part_bytes(*pool, std::accumulate(freqs.begin(), freqs.end(), uint64_t{0}));
+    size_t next = 0;
+    write_parts(output, records.size(), freqs, *pool, [&](coded_part& part) {
+        for (uint64_t bytes = 0; next < records.size() && bytes + part.records.size() < limit; ++next) {
+            part.records.push_back(records[next]);
+            bytes += records[next].size();
+        }
+        return !part.records.empty();
+    });
+}
+
+uint64_t record_store::write(std::istream &lines, std::ostream &output, std::shared_ptr<worker_pool> pool) {
+    if (!pool) pool = worker_pool::shared();
+    const auto start = lines.tellg();
+    std::array<uint64_t, 256> freqs{};
+    uint64_t count = 0;
+    for (std::string line; std::getline(lines, line); ++count)
+        for (const char c : line)
+            ++freqs[static_cast<uint8_t>(c)];
+    lines.clear();
+    if (start < 0 || !lines.seekg(start)) {
+        throw std::invalid_argument("Cannot read input file.");
+    }
+
+    // Second pass, read a part's worth of lines at a time
+    const uint64_t limit = part_bytes(*pool, std::accumulate(freqs.begin(), freqs.end(), uint64_t{0}));
+    write_parts(output, count, freqs, *pool, [&](coded_part& part) {
+        std::vector<size_t> lengths;
+        // Empty lines count against the limit too, or a file of nothing but newlines would be one part
+        for (std::string line; part.text.size() + lengths.size() < limit && std::getline(lines, line);) {
+            part.text += line;
+            lengths.push_back(line.size());
+        }
+        size_t pos = 0;
+        for (const size_t len : lengths) {
+            part.records.emplace_back(part.text.data() + pos, len);
+            pos += len;
+        }
+        return !part.records.empty();
+    });
+    return count;
+}
+
+void record_store::write_parts(std::ostream &output, uint64_t count, const std::array<uint64_t, 256> &freqs,
+                               worker_pool &pool, const std::function<bool(coded_part&)> &next_part) {
+    const auto lengths = huffman_tree::code_lengths(freqs);
+    const huffman_kernels::code_table codes = huffman_kernels::canonical_code_table(lengths);
+    const header hdr{{MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]}, VERSION, count};
+    output.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    output.write(reinterpret_cast<const char*>(lengths.data()), static_cast<std::streamsize>(lengths.size()));
+
+    // A window of parts codes on the pool while the oldest one is written out and dropped, in record order
+    std::mutex mtx;
+    std::condition_variable done;
+    std::exception_ptr error;
+    std::deque<coded_part> window;
+    const size_t max_parts = 2 * static_cast<size_t>(pool.size());
+    std::vector<index_block> blocks;
+    std::vector<char> index_varints;
+    uint64_t written = 0;
+    uint64_t payload_bytes = 0;
+    try {
+        for (bool more = true; more || !window.empty();) {
+            while (more && window.size() < max_parts) {
+                coded_part& part = window.emplace_back();
+                if (!(more = next_part(part))) {
+                    window.pop_back();
+                    break;
+                }
+                part.queued = true;
+                pool.submit([&, coding = &part] {
+                    try {
+                        std::vector<char> converted;
+                        coding->sizes.reserve(coding->records.size());
+                        for (const std::string_view rec : coding->records) {
+                            converted.clear();
+                            if (!rec.empty()) huffman_kernels::get().encode(rec, SIZE_MAX, codes, converted, {});
+                            coding->payload.insert(coding->payload.end(), converted.begin(), converted.end());
+                            coding->sizes.push_back(converted.size());
+                        }
+                    }
+                    catch (...) {
+                        std::lock_guard<std::mutex> guard(mtx);
+                        if (!error) error = std::current_exception();
+                    }
+                    std::lock_guard<std::mutex> guard(mtx);
+                    coding->done = true;
+                    done.notify_all();
+                });
+            }
+            if (window.empty()) break;
+
+            coded_part& part = window.front();
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                done.wait(lock, [&] { return part.done; });
+                if (error) std::rethrow_exception(error);
+            }
+            output.write(part.payload.data(), static_cast<std::streamsize>(part.payload.size()));
+            for (size_t i = 0; i < part.records.size(); ++i, ++written) {
+                if (written % BLOCK_RECORDS == 0) blocks.push_back({payload_bytes, index_varints.size()});
+                put_varint(index_varints, part.records[i].size());
+                put_varint(index_varints, part.sizes[i]);
+                payload_bytes += part.sizes[i];
+            }
+            window.pop_front();
+        }
+    }
+    catch (...) {
+        // Parts still on the pool point into window and the locals here
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [&] { return std::ranges::all_of(window, [](const auto& p) { return !p.queued || p.done; }); });
+        throw;
+    }
+    if (written != count) {
+        throw std::invalid_argument("Input changed while it was being written to the record store.");
+    }
+
+    trailer end;
+    end.blocks_offset = PAYLOAD_OFFSET + payload_bytes;
+    end.varints_offset = end.blocks_offset + blocks.size() * sizeof(index_block);
+    std::ranges::copy(INDEX_MAGIC, end.magic);
+    output.write(reinterpret_cast<const char*>(blocks.data()), static_cast<std::streamsize>(blocks.size() * sizeof(index_block)));
+    output.write(index_varints.data(), static_cast<std::streamsize>(index_varints.size()));
+    output.write(reinterpret_cast<const char*>(&end), sizeof(end));
+    if (!output) {
+        throw std::invalid_argument("Cannot write record store.");
+    }
+}
+
+record_store::record_store(const std::string &path, std::shared_ptr<worker_pool> pool) :
+    pool(pool ? std::move(pool) : worker_pool::shared()) {
+#ifdef HUFFMANCODEC_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        throw std::invalid_argument("Cannot open record store: " + path);
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    void* addr = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::invalid_argument("Cannot map record store: " + path);
+    }
+    // Gets land all over the file, read ahead would only pull in pages nobody asked for
+    madvise(addr, size, MADV_RANDOM);
+    mapping = addr;
+    bytes = {static_cast<const char*>(addr), size};
+#else
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        throw std::invalid_argument("Cannot open record store: " + path);
+    }
+    owned.assign(std::istreambuf_iterator<char>(ifs), {});
+    bytes = owned;
+#endif
+    try {
+        open();
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+}
+
+record_store::record_store(std::span<const char> bytes, std::shared_ptr<worker_pool> pool) :
+    pool(pool ? std::move(pool) : worker_pool::shared()), bytes(bytes) {
+    open();
+}
+
+record_store::~record_store() {
+    release();
+}
+
+void record_store::release() {
+#ifdef HUFFMANCODEC_MMAP
+    if (mapping) munmap(mapping, bytes.size());
+#endif
+    mapping = nullptr;
+}
+
+void record_store::open() {
+    if (bytes.size() < PAYLOAD_OFFSET + sizeof(trailer)) throw corrupt();
+    header hdr;
+    trailer end;
+    std::memcpy(&hdr, bytes.data(), sizeof(hdr));
+    std::memcpy(&end, bytes.data() + bytes.size() - sizeof(end), sizeof(end));
+    if (!std::equal(std::begin(MAGIC), std::end(MAGIC), hdr.magic) ||
+            !std::equal(std::begin(INDEX_MAGIC), std::end(INDEX_MAGIC), end.magic)) {
+        throw std::invalid_argument("Input file is not a record store.");
+    }
+    if (hdr.version > VERSION) {
+        throw std::invalid_argument("Record store was written by a newer version.");
+    }
+
+    const uint64_t index_end = bytes.size() - sizeof(trailer);
+    const uint64_t block_count = hdr.records / BLOCK_RECORDS + (hdr.records % BLOCK_RECORDS != 0);
+    if (end.blocks_offset < PAYLOAD_OFFSET || end.blocks_offset > index_end ||
+            block_count > (index_end - end.blocks_offset) / sizeof(index_block) ||
+            end.varints_offset != end.blocks_offset + block_count * sizeof(index_block)) {
+        throw corrupt();
+    }
+    records = hdr.records;
+    payloads = bytes.subspan(PAYLOAD_OFFSET, end.blocks_offset - PAYLOAD_OFFSET);
+    varints = bytes.subspan(end.varints_offset, index_end - end.varints_offset);
+    blocks.resize(block_count);
+    std::memcpy(blocks.data(), bytes.data() + end.blocks_offset, block_count * sizeof(index_block));
+
+    std::array<uint8_t, 256> lengths{};
+    std::memcpy(lengths.data(), bytes.data() + TABLE_OFFSET, lengths.size());
+    if (std::ranges::any_of(lengths, [](uint8_t len) { return len > huffman_kernels::MAX_CODE_LEN; })) throw corrupt();
+    huffman_kernels::canonical_decode_table(lengths, table);
+}
+
+std::string record_store::get(uint64_t id) const {
+    std::string out;
+    get(id, out);
+    return out;
+}
+
+void record_store::get(uint64_t id, std::string &out) const {
+    if (id >= records) {
+        throw std::out_of_range("No record " + std::to_string(id) + " in a store of " + std::to_string(records) + ".");
+    }
+
+    // Sizes of the records before it in its block add up to where its payload starts
+    const index_block& block = blocks[id / BLOCK_RECORDS];
+    if (block.varint > varints.size()) throw corrupt();
+    size_t pos = block.varint;
+    uint64_t offset = block.payload;
+    for (uint64_t r = id - id % BLOCK_RECORDS; r < id; ++r) {
+        get_varint(varints, pos);
+        offset += get_varint(varints, pos);
+    }
+    const uint64_t length = get_varint(varints, pos);
+    const uint64_t payload_bytes = get_varint(varints, pos);
+    // Every symbol takes a bit at least
+    if (offset > payloads.size() || payload_bytes > payloads.size() - offset || length > 8 * payload_bytes) {
+        throw corrupt();
+    }
+
+    out.resize(length);
+    if (length != 0)
+        huffman_kernels::get().decode(payloads.subspan(offset, payload_bytes), table, out, 0);
+}
+
+std::vector<std::string> record_store::get_batch(std::span<const uint64_t> ids) const {
+    std::vector<std::string> out(ids.size());
+    const size_t parts = part_count(*pool, ids.size(), 2 * BLOCK_RECORDS);
+    if (parts == 1) {
+        // Small batches aren't worth the hand off to the pool
+        for (size_t i = 0; i < ids.size(); ++i)
+            get(ids[i], out[i]);
+        return out;
+    }
+
+    run_tasks(*pool, parts, [&](size_t part) {
+        for (size_t i = ids.size() * part / parts; i < ids.size() * (part + 1) / parts; ++i)
+            get(ids[i], out[i]);
+    });
+    return out;
+}
@@ -0,0 +1,110 @@
+#ifndef HUFFMANCODEC_RECORD_STORE_H
+#define HUFFMANCODEC_RECORD_STORE_H
+
+#include <span>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <functional>
+#include <string_view>
+
+#include "worker_pool.h"
+#include "huffman_kernels.h"
+
+/*
+ * Many small records in one file, coded with a single huffman table built over all of them and decodable one at a
+ * time by ID (the position a record was written at, from 0):
+ *
+ *   [header][code length of every byte][record payloads][index blocks][index varints][trailer]
+ *
+ * A payload is the record's bitstream padded out to a byte, nothing else. The index has a block of two offsets for
+ * every BLOCK_RECORDS records, where their payloads and varints start, then every record's length and payload bytes
+ * as LEB128 varints. That's a few bytes a record, instead of a table file and a 24 byte chunk header each.
+ */
+class record_store {
+public:
+    static constexpr char MAGIC[4] = {'H', 'M', 'R', 'S'};
+    static constexpr char INDEX_MAGIC[8] = {'H', 'M', 'R', 'S', 'I', 'N', 'D', 'X'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t BLOCK_RECORDS = 64;
+
+    struct header {
+        char magic[4] = {};
+        uint32_t version = 0;
+        uint64_t records = 0;
+    };
+    static_assert(sizeof(header) == 16);
+
+    // Offsets from the first payload and from the first varint
+    struct index_block {
+        uint64_t payload = 0;
+        uint64_t varint = 0;
+    };
+    static_assert(sizeof(index_block) == 16);
+
+    struct trailer {
+        uint64_t blocks_offset = 0;
+        uint64_t varints_offset = 0;
+        char magic[8] = {};
+    };
+    static_assert(sizeof(trailer) == 24);
+
+    /*
+     * Codes records into output in the order given, histogram and coding run on pool (the shared one by default).
+     * Parts of about a megabyte are written out as they're coded, only a couple per worker are held at a time. The
+     * caller waits on pool tasks, so this must not be called from one of its own workers.
+     */
+    static void write(std::span<const std::string_view> records, std::ostream& output,
+                      std::shared_ptr<worker_pool> pool = nullptr);
+    // Every line of lines as a record, like getline splits them. Two passes, lines has to be seekable. Returns the
+    // record count. Same pool rules as the other overload
+    static uint64_t write(std::istream& lines, std::ostream& output, std::shared_ptr<worker_pool> pool = nullptr);
+
+    // Maps the file, only the pages of the records asked for are ever read
+    explicit record_store(const std::string& path, std::shared_ptr<worker_pool> pool = nullptr);
+    // Store in memory the caller keeps alive for as long as this is around
+    explicit record_store(std::span<const char> bytes, std::shared_ptr<worker_pool> pool = nullptr);
+    ~record_store();
+
+    record_store(const record_store&) = delete;
+    record_store& operator=(const record_store&) = delete;
+
+    [[nodiscard]] uint64_t size() const { return records; }
+
+    // Throws std::out_of_range for IDs past the last record
+    [[nodiscard]] std::string get(uint64_t id) const;
+    void get(uint64_t id, std::string& out) const;
+    /*
+     * Records of every ID, in the order given. Batches past a couple of blocks' worth of IDs are split over the
+     * pool, so this must not be called from one of its own workers.
+     */
+    [[nodiscard]] std::vector<std::string> get_batch(std::span<const uint64_t> ids) const;
+
+private:
+    struct coded_part;
+    // Header and table for freqs, then the payloads of the parts next_part fills until it returns false, then the index
+    static void write_parts(std::ostream& output, uint64_t count, const std::array<uint64_t, 256>& freqs,
+                            worker_pool& pool, const std::function<bool(coded_part&)>& next_part);
+
+    // Checks the header and trailer, and loads the table and index blocks
+    void open();
+    void release();
+
+    std::shared_ptr<worker_pool> pool;
+    // Whole file, mapped when this opened it (read into owned where there is no mmap)
+    std::span<const char> bytes;
+    void* mapping = nullptr;
+    std::vector<char> owned;
+
+    uint64_t records = 0;
+    std::span<const char> payloads;
+    std::span<const char> varints;
+    std::vector<index_block> blocks;
+    huffman_kernels::decode_table table;
+};
+
+#endif //HUFFMANCODEC_RECORD_STORE_H
@@ -0,0 +1,215 @@
+#ifndef HUFFMANCODEC_TANS_TABLE_H
+#define HUFFMANCODEC_TANS_TABLE_H
+
+#include <map>
+#include <bit>
+#include <span>
+#include <array>
+#include <ranges>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#include "huffman_tree.h"
+
+/*
+ * Table based asymmetric numeral systems (tANS) coder. Frequencies from the same histogram pass the huffman
+ * backend uses are normalized so that they sum up to TABLE_SIZE, then spread over a state table. Every symbol
+ * costs -log2(p) bits on average instead of a whole number of bits like huffman codes, which is where the gain
+ * on skewed data comes from.
+ *
+ * Encoding has to walk the chunk backwards, so bits are read back by the decoder in reverse (LIFO) order. The
+ * encoder appends a single 1 bit as a sentinel after the last code, so the decoder can find where the stream
+ * ends without storing a separate bit count.
+ */
+class tans_table {
+public:
+    static constexpr uint32_t TABLE_LOG = 12;
+    static constexpr uint32_t TABLE_SIZE = 1u << TABLE_LOG;
+
+    template<template<typename, typename, typename...> class Map_Container, CharType K, std::integral V, typename... TArgs>
+    static Map_Container<K, uint32_t> normalize(Map_Container<K, V, TArgs...>&& freq_map)
+    {
+        Map_Container<K, uint32_t> norm_map;
+        const uint64_t total = std::accumulate(freq_map.begin(), freq_map.end(), uint64_t{0},
+                                               [](uint64_t acc, const auto& e) { return acc + e.second; });
+        if (total == 0) return norm_map;
+
+        struct scaled { K ch; uint32_t norm; uint64_t rem; };
+        std::vector<scaled> scaled_freqs;
+        int64_t assigned = 0;
+        for (const auto& [ch, fr] : freq_map) {
+            if (fr == 0) continue;
+            const auto prod = static_cast<unsigned __int128>(fr) * TABLE_SIZE;
+            const auto norm = static_cast<uint32_t>(prod / total);
+            // Every present symbol needs at least one state or it could not be encoded at all
+            scaled_freqs.push_back({ch, std::max<uint32_t>(1, norm), norm == 0 ? 0 : static_cast<uint64_t>(prod % total)});
+            assigned += scaled_freqs.back().norm;
+        }
+
+        if (scaled_freqs.size() > TABLE_SIZE) {
+            throw std::length_error("Too many distinct symbols for the tANS table size.");
+        }
+
+        int64_t diff = static_cast<int64_t>(TABLE_SIZE) - assigned;
+        if (diff > 0) {
+            // Hand out leftover states to the symbols that lost the most when rounding down
+            std::ranges::sort(scaled_freqs, std::greater{}, &scaled::rem);
+            for (size_t i = 0; diff > 0; i = (i + 1) % scaled_freqs.size(), --diff)
+                ++scaled_freqs[i].norm;
+        }
+        while (diff < 0) {
+            // Rounding up rare symbols to 1 overshot the table, take states back from the frequent ones
+            std::ranges::sort(scaled_freqs, std::greater{}, &scaled::norm);
+            for (size_t i = 0; i < scaled_freqs.size() && diff < 0 && scaled_freqs[i].norm > 1; ++i, ++diff)
+                --scaled_freqs[i].norm;
+        }
+
+        for (const auto& s : scaled_freqs)
+            norm_map.emplace(s.ch, s.norm);
+        return norm_map;
+    }
+
+    tans_table() = default;
+
+    explicit tans_table(const std::map<char, uint32_t>& norm_map) : encode_symbols{}, decode_states(TABLE_SIZE)
+    {
+        const uint32_t sum = std::accumulate(norm_map.begin(), norm_map.end(), uint32_t{0},
+                                             [](uint32_t acc, const auto& e) { return acc + e.second; });
+        if (!norm_map.empty() && sum != TABLE_SIZE) {
+            throw std::invalid_argument("tANS table frequencies do not sum up to the table size.");
+        }
+
+        // Spread symbols over the state table, the step is coprime with the table size so every slot gets hit once
+        std::vector<uint8_t> spread(TABLE_SIZE);
+        constexpr uint32_t step = (TABLE_SIZE >> 1) + (TABLE_SIZE >> 3) + 3;
+        uint32_t pos = 0;
+        for (const auto& [ch, norm] : norm_map) {
+            for (uint32_t i = 0; i < norm; ++i) {
+                spread[pos] = static_cast<uint8_t>(ch);
+                pos = (pos + step) & (TABLE_SIZE - 1);
+            }
+        }
+
+        uint32_t cumul = 0;
+        for (const auto& [ch, norm] : norm_map) {
+            auto& sym = encode_symbols[static_cast<uint8_t>(ch)];
+            sym.norm = norm;
+            sym.start = cumul;
+            sym.max_bits = TABLE_LOG - std::bit_width(norm) + 1;
+            cumul += norm;
+        }
+
+        // Both tables walk the states of a symbol in increasing order, which is what keeps them inverse to each other
+        encode_states.resize(TABLE_SIZE);
+        std::array<uint32_t, 256> next{};
+        for (const auto& [ch, norm] : norm_map)
+            next[static_cast<uint8_t>(ch)] = norm;
+
+        for (uint32_t u = 0; u < TABLE_SIZE && !norm_map.empty(); ++u) {
+            const uint8_t s = spread[u];
+            const auto& sym = encode_symbols[s];
+            const uint32_t x = next[s]++;
+            encode_states[sym.start + x - sym.norm] = static_cast<uint16_t>(TABLE_SIZE + u);
+
+            const auto nb = static_cast<uint8_t>(TABLE_LOG + 1 - std::bit_width(x));
+            decode_states[u] = {static_cast<char>(s), nb, static_cast<uint16_t>((x << nb) - TABLE_SIZE)};
+        }
+    }
+
+    // Payload layout: [uint16 final state][bitstream ending in a sentinel bit]
+    void encode(std::span<const char> data, std::vector<char>& converted) const
+    {
+        converted.clear();
+        converted.reserve(data.size() / 2 + 16);
+        converted.resize(sizeof(uint16_t));
+
+        uint64_t acc = 0;
+        uint32_t acc_bits = 0;
+        auto put_bits = [&](uint32_t value, uint32_t nb) {
+            acc |= static_cast<uint64_t>(value) << acc_bits;
+            acc_bits += nb;
+            while (acc_bits >= 8) {
+                converted.push_back(static_cast<char>(acc & 0xFF));
+                acc >>= 8;
+                acc_bits -= 8;
+            }
+        };
+
+        uint32_t state = TABLE_SIZE;
+        for (const char c : data | std::views::reverse) {
+            const auto& sym = encode_symbols[static_cast<uint8_t>(c)];
+            if (sym.norm == 0) {
+                throw std::invalid_argument("Symbol missing from tANS table.");
+            }
+            const uint32_t nb = state >= (sym.norm << sym.max_bits) ? sym.max_bits : sym.max_bits - 1;
+            put_bits(state & ((1u << nb) - 1), nb);
+            state = encode_states[sym.start + (state >> nb) - sym.norm];
+        }
+
+        put_bits(1, 1);
+        if (acc_bits > 0)
+            converted.push_back(static_cast<char>(acc & 0xFF));
+
+        const auto final_state = static_cast<uint16_t>(state - TABLE_SIZE);
+        std::memcpy(converted.data(), &final_state, sizeof(uint16_t));
+    }
+
+    void decode(std::span<const char> payload, std::span<char> decoded) const
+    {
+        if (decoded.empty()) return;
+        if (payload.size() <= sizeof(uint16_t) || payload.back() == 0 || decode_states.empty()) {
+            throw std::invalid_argument("Corrupt tANS chunk.");
+        }
+
+        uint16_t state = 0;
+        std::memcpy(&state, payload.data(), sizeof(uint16_t));
+        // Every state after the first comes out of the table in range, this one comes straight from the payload
+        if (state >= TABLE_SIZE) {
+            throw std::invalid_argument("Corrupt tANS chunk.");
+        }
+        const auto bits = payload.subspan(sizeof(uint16_t));
+
+        // Bit position of the sentinel, everything below it is code bits
+        uint64_t pos = (bits.size() - 1) * 8 + std::bit_width(static_cast<uint8_t>(bits.back())) - 1;
+
+        for (char& out : decoded) {
+            const auto& e = decode_states[state];
+            out = e.symbol;
+            if (pos < e.nb) {
+                throw std::invalid_argument("Corrupt tANS chunk.");
+            }
+            pos -= e.nb;
+
+            // At most TABLE_LOG + 7 bits span three bytes
+            const size_t byte = pos >> 3;
+            uint32_t window = 0;
+            for (size_t i = 0; i < 3 && byte + i < bits.size(); ++i)
+                window |= static_cast<uint32_t>(static_cast<uint8_t>(bits[byte + i])) << (8 * i);
+
+            state = e.base + ((window >> (pos & 7)) & ((1u << e.nb) - 1));
+        }
+    }
+
+private:
+    struct encode_symbol {
+        uint32_t norm = 0;
+        uint32_t start = 0;
+        uint32_t max_bits = 0;
+    };
+
+    struct decode_state {
+        char symbol = 0;
+        uint8_t nb = 0;
+        uint16_t base = 0;
+    };
+
+    std::array<encode_symbol, 256> encode_symbols;
+    std::vector<uint16_t> encode_states;
+    std::vector<decode_state> decode_states;
+};
+
+#endif //HUFFMANCODEC_TANS_TABLE_H
@@ -0,0 +1,52 @@
+#ifndef HUFFMANCODEC_TOKEN_BUCKET_H
+#define HUFFMANCODEC_TOKEN_BUCKET_H
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+
+/*
+ * Caps the rate bytes go through at, e.g. reads of the partition reader. Tokens refill continuously up to a burst
+ * of a tenth of a second's worth, so throughput follows the cap smoothly instead of in stop-and-go bursts. A take
+ * larger than what's in the bucket goes into debt and sleeps it off, a chunk bigger than the burst still gets
+ * through. Rate 0 means no cap.
+ */
+class token_bucket {
+public:
+    explicit token_bucket(uint64_t bytes_per_s = 0) : rate{static_cast<double>(bytes_per_s)}, burst{rate / 10},
+        tokens{burst} {}
+
+    token_bucket(const token_bucket&) = delete;
+    token_bucket& operator=(const token_bucket&) = delete;
+
+    // Blocks until bytes may go through, callers queue up behind each other's debt
+    void take(uint64_t bytes)
+    {
+        if (rate == 0) return;
+
+        std::unique_lock<std::mutex> lock(mtx);
+        const auto now = std::chrono::steady_clock::now();
+        tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+        last = now;
+        tokens -= static_cast<double>(bytes);
+        const double debt = -tokens;
+        lock.unlock();
+
+        if (debt > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(debt / rate));
+    }
+
+    [[nodiscard]] bool limited() const { return rate != 0; }
+
+private:
+    const double rate;
+    const double burst;
+
+    std::mutex mtx;
+    double tokens;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+};
+
+#endif //HUFFMANCODEC_TOKEN_BUCKET_H
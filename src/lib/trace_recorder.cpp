@@ -0,0 +1,91 @@
+#include "trace_recorder.h"
+
+#include <array>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+// Recorders get a process wide id, so a thread's cached buffer can't be mistaken for one of a later recorder
+static std::atomic_uint64_t next_recorder_id{1};
+
+trace_recorder::trace_recorder(size_t events_per_thread) :
+    capacity{std::max<size_t>(1, events_per_thread)}, id{next_recorder_id.fetch_add(1)} {}
+
+trace_recorder::thread_buffer &trace_recorder::local() {
+    // A few recorders per thread is plenty, a thread that outlives more gets a second buffer (and tid) at worst
+    struct cached_buffer {
+        uint64_t id = 0;
+        thread_buffer* buffer = nullptr;
+    };
+    thread_local std::array<cached_buffer, 4> cache{};
+    thread_local size_t next_slot = 0;
+    for (const auto& c : cache)
+        if (c.id == id) return *c.buffer;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    auto buffer = std::make_unique<thread_buffer>();
+    buffer->tid = static_cast<uint32_t>(threads.size() + 1);
+    buffer->ring.resize(capacity);
+    threads.push_back(std::move(buffer));
+
+    cache[next_slot++ % cache.size()] = {id, threads.back().get()};
+    return *threads.back();
+}
+
+void trace_recorder::name_thread(const char *name) {
+    thread_buffer& buffer = local();
+    if (!buffer.name) buffer.name = name;
+}
+
+void trace_recorder::record(const char *name, uint64_t start_ns, uint64_t duration_ns) {
+    thread_buffer& buffer = local();
+    buffer.ring[buffer.recorded++ % capacity] = {name, start_ns, duration_ns};
+}
+
+void trace_recorder::instant(const char *name) {
+    record(name, now(), UINT64_MAX);
+}
+
+uint64_t trace_recorder::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void trace_recorder::write_json(std::ostream &os) const {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    // Timestamps are in microseconds, with the nanoseconds kept as decimals
+    auto micros = [](uint64_t ns) { return std::to_string(ns / 1000) + "." + std::to_string(1000 + ns % 1000).substr(1); };
+
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& thread : threads) {
+        if (thread->name) {
+            os << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->tid
+               << ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+            first = false;
+        }
+
+        // Oldest event first, which is where the next one would go once the ring has wrapped
+        const size_t count = std::min(thread->recorded, capacity);
+        const size_t oldest = thread->recorded - count;
+        for (size_t i = 0; i < count; ++i) {
+            const event& e = thread->ring[(oldest + i) % capacity];
+            os << (first ? "" : ",") << "\n{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << thread->tid
+               << ",\"ts\":" << micros(e.start_ns);
+            if (e.duration_ns == UINT64_MAX)
+                os << ",\"ph\":\"i\",\"s\":\"t\"}";
+            else
+                os << ",\"ph\":\"X\",\"dur\":" << micros(e.duration_ns) << "}";
+            first = false;
+        }
+    }
+    os << "\n]}\n";
+}
+
+void trace_recorder::write_json(const std::filesystem::path &path) const {
+    std::ofstream ofs(path);
+    if (!ofs.is_open()) {
+        throw std::invalid_argument("Cannot open trace file to write: " + path.string());
+    }
+    write_json(ofs);
+}
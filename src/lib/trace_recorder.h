@@ -0,0 +1,83 @@
+#ifndef HUFFMANCODEC_TRACE_RECORDER_H
+#define HUFFMANCODEC_TRACE_RECORDER_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <filesystem>
+
+/*
+ * Opt-in timeline of what every thread of a codec run did, written as Chrome trace JSON (chrome://tracing or
+ * ui.perfetto.dev open it). Each thread records into a ring buffer of its own, so recording takes no lock once a
+ * thread has its buffer. When a ring fills up the oldest events are overwritten. Event names have to outlive the
+ * recorder, string literals are what they are meant for.
+ */
+class trace_recorder {
+public:
+    explicit trace_recorder(size_t events_per_thread = 64 * 1024);
+
+    trace_recorder(const trace_recorder&) = delete;
+    trace_recorder& operator=(const trace_recorder&) = delete;
+
+    // Records a span from construction to destruction, does nothing without a recorder
+    class scope {
+    public:
+        scope(trace_recorder* recorder, const char* name) : recorder{recorder}, name{name}
+        {
+            if (recorder) start = recorder->now();
+        }
+        ~scope()
+        {
+            if (recorder) recorder->record(name, start, recorder->now() - start);
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        trace_recorder* recorder;
+        const char* name;
+        uint64_t start = 0;
+    };
+
+    // Names the calling thread in the trace, the first name a thread gets sticks
+    void name_thread(const char* name);
+    void record(const char* name, uint64_t start_ns, uint64_t duration_ns);
+    void instant(const char* name);
+    // Nanoseconds since the recorder was created
+    [[nodiscard]] uint64_t now() const;
+
+    // Only once every traced thread is done with the run
+    void write_json(std::ostream& os) const;
+    void write_json(const std::filesystem::path& path) const;
+
+private:
+    struct event {
+        const char* name;
+        uint64_t start_ns;
+        // UINT64_MAX for instant events
+        uint64_t duration_ns;
+    };
+
+    struct thread_buffer {
+        uint32_t tid = 0;
+        const char* name = nullptr;
+        std::vector<event> ring;
+        size_t recorded = 0;
+    };
+
+    thread_buffer& local();
+
+    const size_t capacity;
+    const uint64_t id;
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<thread_buffer>> threads;
+};
+
+#endif //HUFFMANCODEC_TRACE_RECORDER_H
@@ -0,0 +1,290 @@
+#ifndef HUFFMANCODEC_TUNSTALL_TABLE_H
+#define HUFFMANCODEC_TUNSTALL_TABLE_H
+
+#include <map>
+#include <span>
+#include <array>
+#include <queue>
+#include <tuple>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Tunstall (variable to fixed) coder. The dictionary is a tree over the symbols of the histogram: starting from
+ * every symbol on its own, the most probable leaf is split into one child per symbol until the codewords run out.
+ * Encoding walks the tree down to a leaf and writes its fixed 8, 12 or 16 bit codeword. Decoding is one table
+ * lookup and one 16 byte copy per codeword, with no bit by bit dependency between them like huffman codes have.
+ *
+ * Only the scaled histogram and the codeword width are stored, the tree is built again from them the same way on
+ * both ends. Strings are at most MAX_WORD bytes so a word and its length fit the 16 bytes the decoder copies.
+ */
+class tunstall_table {
+public:
+    static constexpr uint32_t MAX_WORD = 15;
+    static constexpr uint32_t PROB_LOG = 16;
+
+    // Histogram scaled to 1 << PROB_LOG, present symbols keep at least 1. Only the order leaves get split in
+    // depends on it, so it doesn't have to add up exactly
+    static std::map<char, uint32_t> normalize(const std::map<char, uint64_t>& freq_map)
+    {
+        std::map<char, uint32_t> norm_map;
+        uint64_t total = 0;
+        for (const auto& [ch, fr] : freq_map)
+            total += fr;
+        for (const auto& [ch, fr] : freq_map) {
+            if (fr == 0) continue;
+            const auto norm = static_cast<uint64_t>(static_cast<unsigned __int128>(fr) << PROB_LOG) / total;
+            norm_map.emplace(ch, static_cast<uint32_t>(std::max<uint64_t>(1, norm)));
+        }
+        return norm_map;
+    }
+
+    tunstall_table() { rank.fill(-1); }
+
+    /*
+     * A width of 0 picks whichever of 8, 12 and 16 bits codes the histogram itself the smallest. Narrower tables
+     * stay in cache (16 bytes a codeword), so a wider one has to save over 3% to be picked.
+     */
+    explicit tunstall_table(const std::map<char, uint32_t>& norm_map, uint32_t bits = 0) : norm_map{norm_map}
+    {
+        if (bits == 0) {
+            const std::map<char, uint64_t> freqs(norm_map.begin(), norm_map.end());
+            double best_cost = std::numeric_limits<double>::infinity();
+            for (const uint32_t candidate : {8u, 12u, 16u}) {
+                tunstall_table table(norm_map, candidate);
+                const double cost = table.bits_per_symbol(freqs);
+                if (cost < best_cost * (1 - 1.0 / 32)) {
+                    best_cost = cost;
+                    *this = std::move(table);
+                }
+            }
+            return;
+        }
+        if (bits != 8 && bits != 12 && bits != 16) {
+            throw std::invalid_argument("Tunstall codewords are 8, 12 or 16 bits wide.");
+        }
+        width = bits;
+        build();
+    }
+
+    [[nodiscard]] uint32_t bits() const { return width; }
+    [[nodiscard]] const std::map<char, uint32_t>& norms() const { return norm_map; }
+
+    // Bits per input symbol on data with these symbol counts, infinite if one of them has no codeword
+    [[nodiscard]] double bits_per_symbol(const std::map<char, uint64_t>& freq_map) const
+    {
+        std::array<double, 256> p{};
+        uint64_t total = 0;
+        for (const auto& [ch, fr] : freq_map)
+            total += fr;
+        for (const auto& [ch, fr] : freq_map) {
+            if (fr == 0) continue;
+            if (rank[static_cast<uint8_t>(ch)] < 0) return std::numeric_limits<double>::infinity();
+            p[static_cast<uint8_t>(ch)] = static_cast<double>(fr) / static_cast<double>(total);
+        }
+        if (total == 0) return 0;
+
+        // Symbols per codeword is the chance of passing through every inner node, the root included
+        std::vector<double> prob(trie.size());
+        double symbols = 0;
+        prob[0] = 1;
+        for (size_t node = 0; node < trie.size(); ++node) {
+            if (node > 0) prob[node] = prob[parents[node]] * p[node_symbols[node]];
+            if (!(trie[node] & LEAF)) symbols += prob[node];
+        }
+        return static_cast<double>(width) / symbols;
+    }
+
+    // Payload is the codewords back to back, 12 bit ones two to three bytes with an odd last one in two
+    void encode(std::span<const char> data, std::vector<char>& converted) const
+    {
+        converted.clear();
+        converted.reserve(data.size() + 16);
+
+        uint32_t pending = 0;
+        bool has_pending = false;
+        const auto put = [&](uint32_t code) {
+            if (width == 8) {
+                converted.push_back(static_cast<char>(code));
+            } else if (width == 16) {
+                converted.push_back(static_cast<char>(code & 0xFF));
+                converted.push_back(static_cast<char>(code >> 8));
+            } else if (!has_pending) {
+                pending = code;
+                has_pending = true;
+            } else {
+                const uint32_t pair = pending | code << 12;
+                converted.push_back(static_cast<char>(pair & 0xFF));
+                converted.push_back(static_cast<char>((pair >> 8) & 0xFF));
+                converted.push_back(static_cast<char>(pair >> 16));
+                has_pending = false;
+            }
+        };
+
+        const uint32_t root = trie.empty() ? 0 : trie[0];
+        uint32_t first = root;
+        for (const char c : data) {
+            const int16_t r = rank[static_cast<uint8_t>(c)];
+            if (r < 0) {
+                throw std::invalid_argument("Symbol missing from Tunstall table.");
+            }
+            const uint32_t next = trie[first + r];
+            if (next & LEAF) {
+                put(next ^ LEAF);
+                first = root;
+            } else {
+                first = next;
+            }
+        }
+        // Input ran out inside a word, any leaf below it will do since decode stops at the symbol count
+        if (first != root) {
+            uint32_t node = first;
+            while (!(trie[node] & LEAF))
+                node = trie[node];
+            put(trie[node] ^ LEAF);
+        }
+        if (has_pending) {
+            converted.push_back(static_cast<char>(pending & 0xFF));
+            converted.push_back(static_cast<char>(pending >> 8));
+        }
+    }
+
+    void decode(std::span<const char> payload, std::span<char> decoded) const
+    {
+        char* out = decoded.data();
+        char* const end = out + decoded.size();
+        const auto corrupt = [] { return std::invalid_argument("Corrupt Tunstall chunk."); };
+        const auto emit = [&](uint32_t code) {
+            if (code >= words.size()) throw corrupt();
+            const word& w = words[code];
+            if (end - out >= static_cast<std::ptrdiff_t>(sizeof(word))) {
+                std::memcpy(out, &w, sizeof(word));
+                out += w.len;
+            } else {
+                const auto len = std::min<size_t>(w.len, end - out);
+                std::memcpy(out, w.bytes.data(), len);
+                out += len;
+            }
+        };
+
+        const auto* src = reinterpret_cast<const uint8_t*>(payload.data());
+        size_t pos = 0;
+        const size_t size = payload.size();
+        if (width == 8) {
+            while (out < end && pos < size)
+                emit(src[pos++]);
+        } else if (width == 16) {
+            for (; out < end && pos + 2 <= size; pos += 2)
+                emit(src[pos] | static_cast<uint32_t>(src[pos + 1]) << 8);
+        } else {
+            for (; out < end && pos + 3 <= size; pos += 3) {
+                const uint32_t pair = src[pos] | static_cast<uint32_t>(src[pos + 1]) << 8 |
+                                      static_cast<uint32_t>(src[pos + 2]) << 16;
+                emit(pair & 0xFFF);
+                if (out < end) emit(pair >> 12);
+            }
+            if (out < end && pos + 2 == size)
+                emit((src[pos] | static_cast<uint32_t>(src[pos + 1]) << 8) & 0xFFF);
+        }
+        if (out != end) throw corrupt();
+    }
+
+private:
+    // Leaves hold their codeword with this bit set, inner nodes the index of their first child
+    static constexpr uint32_t LEAF = 1u << 31;
+
+    // Copied whole by the decoder, len sits in the byte past the longest string
+    struct word {
+        std::array<char, MAX_WORD> bytes{};
+        uint8_t len = 0;
+    };
+    static_assert(sizeof(word) == 16);
+
+    void build()
+    {
+        rank.fill(-1);
+        std::vector<uint8_t> alphabet;
+        std::vector<uint32_t> norms;
+        for (const auto& [ch, norm] : norm_map) {
+            if (norm == 0) continue;
+            rank[static_cast<uint8_t>(ch)] = static_cast<int16_t>(alphabet.size());
+            alphabet.push_back(static_cast<uint8_t>(ch));
+            norms.push_back(norm);
+        }
+        if (alphabet.empty()) return;
+
+        const size_t n = alphabet.size();
+        const size_t codes = size_t{1} << width;
+        // Every split past the root adds n - 1 leaves, the root and n nodes at most on top of the codewords
+        const size_t nodes = 1 + n + (n == 1 ? MAX_WORD : codes / (n - 1) * n);
+        std::vector<word> node_words(1);
+        std::vector<uint64_t> prob{uint64_t{1} << 32};
+        node_words.reserve(nodes);
+        prob.reserve(nodes);
+        trie.assign(1, 0);
+        trie.reserve(nodes);
+        parents.assign(1, 0);
+        parents.reserve(nodes);
+        node_symbols.assign(1, 0);
+        node_symbols.reserve(nodes);
+
+        // Children of a split leaf get into the queue one at a time, most probable first, the next one once the
+        // one before it is taken. Ties go to the older leaf so both ends split the same ones
+        std::vector<uint32_t> order(n);
+        for (size_t r = 0; r < n; ++r)
+            order[r] = static_cast<uint32_t>(r);
+        std::ranges::stable_sort(order, std::greater{}, [&](uint32_t r) { return norms[r]; });
+
+        using candidate = std::tuple<uint64_t, uint32_t, uint32_t>;
+        std::priority_queue<candidate> leaves;
+        const auto push = [&](uint32_t node, uint32_t k) {
+            leaves.emplace(prob[node], std::numeric_limits<uint32_t>::max() - node, k);
+        };
+        const auto split = [&](uint32_t node) {
+            const auto first = static_cast<uint32_t>(trie.size());
+            trie[node] = first;
+            for (size_t r = 0; r < n; ++r) {
+                word w = node_words[node];
+                w.bytes[w.len++] = static_cast<char>(alphabet[r]);
+                node_words.push_back(w);
+                prob.push_back(prob[node] * norms[r] >> PROB_LOG);
+                trie.push_back(LEAF);
+                parents.push_back(node);
+                node_symbols.push_back(alphabet[r]);
+            }
+            if (node_words[first].len < MAX_WORD) push(first + order[0], 0);
+        };
+
+        split(0);
+        size_t leaf_count = n;
+        while (!leaves.empty() && leaf_count + n - 1 <= codes) {
+            const auto [p, key, k] = leaves.top();
+            leaves.pop();
+            const uint32_t node = std::numeric_limits<uint32_t>::max() - key;
+            if (k + 1 < n) push(trie[parents[node]] + order[k + 1], k + 1);
+            split(node);
+            leaf_count += n - 1;
+        }
+
+        for (size_t node = 1; node < trie.size(); ++node) {
+            if (!(trie[node] & LEAF)) continue;
+            trie[node] = LEAF | static_cast<uint32_t>(words.size());
+            words.push_back(node_words[node]);
+        }
+    }
+
+    std::map<char, uint32_t> norm_map;
+    uint32_t width = 8;
+    std::array<int16_t, 256> rank{};
+    std::vector<uint32_t> trie;
+    std::vector<uint32_t> parents;
+    std::vector<uint8_t> node_symbols;
+    // Strings of the leaves by codeword
+    std::vector<word> words;
+};
+
+#endif //HUFFMANCODEC_TUNSTALL_TABLE_H
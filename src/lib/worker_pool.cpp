@@ -0,0 +1,76 @@
+#include "worker_pool.h"
+#include "numa_topology.h"
+
+#if __has_include(<sys/resource.h>) && __has_include(<sys/syscall.h>)
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+// Nice 19 and the lowest best-effort I/O priority, for the calling thread only (Linux applies both per thread)
+static void lower_thread_priority()
+{
+#if __has_include(<sys/resource.h>) && defined(SYS_ioprio_set)
+    setpriority(PRIO_PROCESS, 0, 19);
+    constexpr int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_BE = 2, IOPRIO_CLASS_SHIFT = 13;
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | 7);
+#endif
+}
+
+worker_pool::worker_pool(unsigned thread_count, bool pinned, bool background)
+        : pinned{pinned}, background{background}, cpus{pinned ? numa_topology::cpus() : std::vector<unsigned>{}} {
+    thread_count = std::max(1u, thread_count);
+    workers.reserve(thread_count);
+    for (unsigned i = 0; i < thread_count; ++i)
+        workers.emplace_back(&worker_pool::run, this, i);
+}
+
+worker_pool::~worker_pool() {
+    std::unique_lock<std::mutex> lock(mtx);
+    stopping = true;
+    lock.unlock();
+    cond_var.notify_all();
+
+    for (auto&& t : workers)
+        t.join();
+}
+
+void worker_pool::submit(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mtx);
+    tasks.push_back(std::move(task));
+    lock.unlock();
+    cond_var.notify_one();
+}
+
+void worker_pool::run(unsigned index) {
+    if (pinned) {
+        // More workers than CPUs wrap around, they share a CPU rather than float. A CPU the OS refuses (taken out of
+        // the cpuset since) passes the worker on to the next one, a worker refused everywhere floats on node 0
+        for (size_t attempt = 0; attempt < cpus.size(); ++attempt)
+            if (numa_topology::pin_to_cpu(cpus[(index + attempt) % cpus.size()])) break;
+    }
+    if (background) lower_thread_priority();
+
+    while (true) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond_var.wait(lock, [this]() {return stopping || !tasks.empty();});
+        // Drain whatever is queued before shutting down, someone is waiting on it
+        if (tasks.empty()) return;
+
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+
+        task();
+    }
+}
+
+std::shared_ptr<worker_pool> worker_pool::shared(bool pinned, bool background) {
+    static std::mutex pools_mtx;
+    static std::shared_ptr<worker_pool> pools[4];
+
+    std::lock_guard<std::mutex> lock(pools_mtx);
+    auto& pool = pools[pinned + 2 * background];
+    if (!pool) pool = std::make_shared<worker_pool>(std::thread::hardware_concurrency(), pinned, background);
+    return pool;
+}
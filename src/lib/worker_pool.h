@@ -0,0 +1,51 @@
+#ifndef HUFFMANCODEC_WORKER_POOL_H
+#define HUFFMANCODEC_WORKER_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * Fixed set of threads that chunk work gets handed to, so a codec run doesn't pay for spawning a thread per chunk.
+ * Tasks are started in submission order. A task must never wait on another one: chunks that finish out of order
+ * are parked and written out by whichever worker closes the gap, so any number of workers makes progress.
+ */
+class worker_pool {
+public:
+    /*
+     * Pinned workers get a CPU each, filling one NUMA node before moving on to the next (see numa_topology).
+     * Background workers run at the lowest CPU and I/O priority, so co-located services get the machine first.
+     */
+    explicit worker_pool(unsigned thread_count = std::thread::hardware_concurrency(), bool pinned = false,
+                         bool background = false);
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    void submit(std::function<void()> task);
+    [[nodiscard]] unsigned size() const { return static_cast<unsigned>(workers.size()); }
+    [[nodiscard]] bool is_pinned() const { return pinned; }
+
+    // Process wide pool of each kind, created on first use and kept warm for every codec that doesn't bring its own
+    static std::shared_ptr<worker_pool> shared(bool pinned = false, bool background = false);
+
+private:
+    void run(unsigned index);
+
+    const bool pinned;
+    const bool background;
+    // What pinned workers pin to, the CPUs the creating thread may run on
+    const std::vector<unsigned> cpus;
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable cond_var;
+    bool stopping = false;
+};
+
+#endif //HUFFMANCODEC_WORKER_POOL_H
@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include "checkpoint_file.h"
+#include "huffman_codec.h"
+
+static std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+}
+
+class CheckpointTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        dir = std::filesystem::temp_directory_path() / ("huffman_checkpoint_" + std::to_string(::getpid()));
+        std::filesystem::create_directories(dir);
+
+        for (int i = 0; i < 40000; ++i)
+            text += "record " + std::to_string(i * 7919 % 100003) + " of the checkpoint sample\n";
+        std::ofstream(dir / "input.txt", std::ios::binary) << text;
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(dir);
+    }
+
+    // Cancels once done bytes of progress went by, checkpointing every chunk
+    static codec_options cancelled_at(uint64_t done, std::shared_ptr<cancel_token> token)
+    {
+        return {.chunk_size = 16 * 1024, .checkpoint_interval = 1e-9,
+                .on_progress = [=](const codec_progress& p) { if (p.bytes_done >= done) token->cancel(); },
+                .cancel = token};
+    }
+
+    std::filesystem::path dir;
+    std::string text;
+};
+
+TEST_F(CheckpointTest, FileRoundTrip) {
+    checkpoint_file file(dir / "out.ckpt", 0);
+    file.start("run 1", "plan bytes");
+    EXPECT_TRUE(file.add({0, 8, 100, 1, 2, 5}));
+    EXPECT_TRUE(file.add({1, 108, 50, 3, 4, 6}));
+    file.save();
+
+    // Half a record from a save cut short
+    std::ofstream(dir / "out.ckpt", std::ios::binary | std::ios::app) << "partial";
+
+    std::string plan;
+    std::vector<checkpoint_file::chunk> chunks;
+    ASSERT_TRUE(file.load("run 1", plan, chunks));
+    EXPECT_EQ(plan, "plan bytes");
+    ASSERT_EQ(chunks.size(), 2);
+    EXPECT_EQ(chunks[1].id, 1);
+    EXPECT_EQ(chunks[1].offset, 108);
+    EXPECT_EQ(chunks[1].hash_hi, 4);
+    EXPECT_EQ(chunks[1].tag, 6);
+
+    EXPECT_FALSE(file.load("run 2", plan, chunks));
+    file.remove();
+    EXPECT_FALSE(file.load("run 1", plan, chunks));
+}
+
+TEST_F(CheckpointTest, ResumedEncode) {
+    for (const auto backend : {huffman_codec::Backend::Huffman, huffman_codec::Backend::TANS}) {
+        const auto input = (dir / "input.txt").string();
+        const auto bin = (dir / "input.bin").string(), table = (dir / "table.txt").string();
+
+        huffman_codec({.chunk_size = 16 * 1024}).encode(input, (dir / "fresh.bin").string(), table, backend);
+        const std::string fresh = read_file(dir / "fresh.bin");
+
+        // Killed half way through writing chunks, the output and checkpoint stay behind
+        huffman_codec killed(cancelled_at(3 * text.size() / 2, std::make_shared<cancel_token>()));
+        EXPECT_THROW(killed.encode(input, bin, table, backend), codec_cancelled);
+        ASSERT_TRUE(std::filesystem::exists(bin + ".ckpt"));
+
+        // The histogram pass and the chunks already written are skipped
+        uint64_t first_done = UINT64_MAX;
+        huffman_codec resumed({.resume = true, .on_progress = [&](const codec_progress& p) {
+            first_done = std::min(first_done, p.bytes_done);
+        }});
+        resumed.encode(input, bin, table, backend);
+        EXPECT_GT(first_done, 3 * text.size() / 2);
+        EXPECT_FALSE(std::filesystem::exists(bin + ".ckpt"));
+        EXPECT_EQ(read_file(bin), fresh);
+
+        huffman_codec().decode(bin, (dir / "output.txt").string(), table);
+        EXPECT_EQ(read_file(dir / "output.txt"), text);
+    }
+}
+
+TEST_F(CheckpointTest, ResumedDecode) {
+    const auto bin = (dir / "input.bin").string(), table = (dir / "table.txt").string();
+    const auto output = (dir / "output.txt").string();
+    huffman_codec({.chunk_size = 16 * 1024}).encode((dir / "input.txt").string(), bin, table);
+    const auto bin_size = std::filesystem::file_size(bin);
+
+    huffman_codec killed(cancelled_at(bin_size / 2, std::make_shared<cancel_token>()));
+    EXPECT_THROW(killed.decode(bin, output, table), codec_cancelled);
+    ASSERT_TRUE(std::filesystem::exists(output + ".ckpt"));
+
+    // Garbage past what the checkpoint vouches for gets overwritten and cut off
+    std::ofstream(output, std::ios::binary | std::ios::app) << std::string(100000, '#');
+
+    uint64_t first_done = UINT64_MAX;
+    huffman_codec resumed({.resume = true, .on_progress = [&](const codec_progress& p) {
+        first_done = std::min(first_done, p.bytes_done);
+    }});
+    resumed.decode(bin, output, table);
+    EXPECT_GT(first_done, bin_size / 4);
+    EXPECT_EQ(read_file(output), text);
+    EXPECT_FALSE(std::filesystem::exists(output + ".ckpt"));
+}
+
+TEST_F(CheckpointTest, ChangedInputStartsOver) {
+    const auto input = (dir / "input.txt").string();
+    const auto bin = (dir / "input.bin").string(), table = (dir / "table.txt").string();
+
+    huffman_codec killed(cancelled_at(3 * text.size() / 2, std::make_shared<cancel_token>()));
+    EXPECT_THROW(killed.encode(input, bin, table), codec_cancelled);
+
+    text += "one more line\n";
+    std::ofstream(input, std::ios::binary) << text;
+    uint64_t first_done = UINT64_MAX;
+    huffman_codec resumed({.resume = true, .on_progress = [&](const codec_progress& p) {
+        first_done = std::min(first_done, p.bytes_done);
+    }});
+    resumed.encode(input, bin, table);
+    EXPECT_LT(first_done, text.size());
+
+    huffman_codec().decode(bin, (dir / "output.txt").string(), table);
+    EXPECT_EQ(read_file(dir / "output.txt"), text);
+}
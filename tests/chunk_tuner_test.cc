@@ -0,0 +1,48 @@
+#include "chunk_tuner.h"
+#include <gtest/gtest.h>
+
+TEST(ChunkTunerTest, SplitsAcrossWorkers) {
+    const chunk_tuning tuning{4, 64 * 1024, 4 * 1024 * 1024};
+
+    // 64 MB on 8 workers at 4 chunks each
+    EXPECT_EQ(chunk_tuner::chunk_size(64 * 1024 * 1024, 8, tuning), 2 * 1024 * 1024);
+    // Rounded up, so 33 bytes over doesn't produce an extra 33 byte chunk
+    EXPECT_EQ(chunk_tuner::chunk_size(32 * 1024 * 1024 + 33, 8, tuning), 1024 * 1024 + 2);
+}
+
+TEST(ChunkTunerTest, ClampsToLimits) {
+    const chunk_tuning tuning{4, 64 * 1024, 4 * 1024 * 1024};
+
+    EXPECT_EQ(chunk_tuner::chunk_size(1024, 16, tuning), 64 * 1024);
+    EXPECT_EQ(chunk_tuner::chunk_size(100ull * 1024 * 1024 * 1024, 16, tuning), 4 * 1024 * 1024);
+    EXPECT_EQ(chunk_tuner::chunk_size(0, 16, tuning), 64 * 1024);
+
+    // Bogus limits still give a usable chunk size
+    EXPECT_EQ(chunk_tuner::chunk_size(1024 * 1024, 0, {0, 1, 1}), 256);
+    EXPECT_EQ(chunk_tuner::chunk_size(1024 * 1024, 4, {4, 8 * 1024 * 1024, 1024 * 1024}), 1024 * 1024);
+}
+
+TEST(ChunkTunerTest, DefaultCapFollowsCache) {
+    const chunk_tuning tuning{1, 256, 0};
+    EXPECT_EQ(chunk_tuner::chunk_size(1ull << 40, 1, tuning), 4 * chunk_tuner::cache_size());
+}
+
+TEST(ChunkTunerTest, SaveLoadRoundTrip) {
+    const auto path = std::filesystem::temp_directory_path() / "huffman_tuner_test" / "tuning.txt";
+    chunk_tuner::save({8, 32 * 1024, 2 * 1024 * 1024}, path);
+
+    const chunk_tuning tuning = chunk_tuner::load(path);
+    EXPECT_EQ(tuning.chunks_per_worker, 8);
+    EXPECT_EQ(tuning.min_chunk, 32 * 1024);
+    EXPECT_EQ(tuning.max_chunk, 2 * 1024 * 1024);
+
+    std::filesystem::remove_all(path.parent_path());
+}
+
+TEST(ChunkTunerTest, MissingFileGivesDefaults) {
+    const chunk_tuning tuning = chunk_tuner::load(std::filesystem::temp_directory_path() / "huffman_no_such_tuning.txt");
+    const chunk_tuning defaults;
+    EXPECT_EQ(tuning.chunks_per_worker, defaults.chunks_per_worker);
+    EXPECT_EQ(tuning.min_chunk, defaults.min_chunk);
+    EXPECT_EQ(tuning.max_chunk, defaults.max_chunk);
+}
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "column_model.h"
+#include "huffman_tree.h"
+#include "huffman_codec.h"
+
+// Tables built from the data itself, one per column
+static void column_tables(std::string_view data, char delimiter, std::vector<huffman_kernels::code_table>& codes,
+                          std::vector<huffman_kernels::decode_table>& decoders)
+{
+    std::vector<std::array<uint64_t, 256>> freqs(column_model::MAX_COLUMNS);
+    column_model::histogram(data, delimiter, freqs);
+    freqs.resize(column_model::column_count(freqs));
+    for (const auto& counts : freqs) {
+        std::map<char, uint64_t> symbols;
+        for (size_t ch = 0; ch < 256; ++ch)
+            if (counts[ch] != 0) symbols.emplace(static_cast<char>(ch), counts[ch]);
+        const auto table = symbols.empty() ? std::map<char, std::string>{} : huffman_tree::huffman_table(std::move(symbols));
+        codes.push_back(huffman_kernels::build_code_table(table));
+        decoders.push_back(huffman_kernels::build_decode_table(table));
+    }
+}
+
+static std::string round_trip(std::string_view data, char delimiter)
+{
+    std::vector<huffman_kernels::code_table> codes;
+    std::vector<huffman_kernels::decode_table> decoders;
+    column_tables(data, delimiter, codes, decoders);
+
+    std::vector<char> record;
+    column_model::encode(data, delimiter, codes, record);
+    std::string decoded(data.size(), '\0');
+    column_model::decode(record, delimiter, decoders, decoded);
+    return decoded;
+}
+
+static std::string project(std::string_view data, char delimiter, const std::vector<size_t>& selected)
+{
+    std::vector<huffman_kernels::code_table> codes;
+    std::vector<huffman_kernels::decode_table> decoders;
+    column_tables(data, delimiter, codes, decoders);
+
+    std::vector<char> record, out;
+    column_model::encode(data, delimiter, codes, record);
+    column_model::project(record, delimiter, decoders, selected, out);
+    return {out.begin(), out.end()};
+}
+
+TEST(ColumnModelTest, RoundTrip) {
+    std::string csv;
+    for (int i = 0; i < 5000; ++i)
+        csv += std::to_string(1700000000 + i) + ",GET,/api/item/" + std::to_string(i % 97) + "," +
+               std::to_string(200 + (i % 7 == 0) * 204) + "\n";
+    EXPECT_EQ(round_trip(csv, ','), csv);
+
+    // Without its last '\n', and ending on a delimiter
+    EXPECT_EQ(round_trip("a,b,c\nd,e,f", ','), "a,b,c\nd,e,f");
+    EXPECT_EQ(round_trip("a,b,c\nd,e,", ','), "a,b,c\nd,e,");
+    EXPECT_EQ(round_trip("x", ','), "x");
+}
+
+TEST(ColumnModelTest, RaggedRecords) {
+    const std::string ragged = "a\tb\tc\n\nshort\nd\te\tf\tg\th\n\t\t\nlast\tone";
+    EXPECT_EQ(round_trip(ragged, '\t'), ragged);
+
+    // Fields past the last column stay in it
+    std::vector<std::array<uint64_t, 256>> freqs(2);
+    column_model::histogram(std::string_view("a,b,c\n"), ',', freqs);
+    EXPECT_EQ(freqs[0][','], 1);
+    EXPECT_EQ(freqs[1][','], 1);
+    EXPECT_EQ(freqs[1]['c'], 1);
+}
+
+TEST(ColumnModelTest, Projection) {
+    const std::string csv = "id,name,score\n1,ann,90\n2,bob,75\n3,cy\n";
+    EXPECT_EQ(project(csv, ',', {1}), "name\nann\nbob\ncy\n");
+    EXPECT_EQ(project(csv, ',', {2, 0}), "score,id\n90,1\n75,2\n,3\n");
+    EXPECT_EQ(project(csv, ',', {0, 0}), "id,id\n1,1\n2,2\n3,3\n");
+    // Columns past the widest record are empty
+    EXPECT_EQ(project("a,b\nc,d", ',', {1, 5}), "b,\nd,");
+}
+
+TEST(ColumnModelTest, CorruptChunk) {
+    std::vector<huffman_kernels::code_table> codes;
+    std::vector<huffman_kernels::decode_table> decoders;
+    const std::string_view data = "a,b\n";
+    column_tables(data, ',', codes, decoders);
+    std::vector<char> record;
+    column_model::encode(data, ',', codes, record);
+
+    record.resize(record.size() - 1);
+    std::string decoded(4, '\0');
+    EXPECT_THROW(column_model::decode(record, ',', decoders, decoded), std::invalid_argument);
+    EXPECT_THROW(column_model::decode(std::string_view("short"), ',', decoders, decoded), std::invalid_argument);
+}
+
+TEST(ColumnModelTest, CodecColumns) {
+    std::string csv;
+    for (int i = 0; i < 60000; ++i)
+        csv += std::to_string(i) + ",user" + std::to_string(i % 311) + "," + (i % 3 ? "ok" : "retry") + "," +
+               std::to_string(i * 7 % 1000) + "\n";
+    std::stringstream input(csv), bin, table, output;
+    huffman_codec enc({.chunk_size = 64 * 1024, .column_delimiter = ','});
+    enc.encode(input, bin, table);
+
+    huffman_codec dec;
+    std::stringstream bin_in(bin.str()), table_in(table.str());
+    dec.decode(bin_in, output, table_in);
+    EXPECT_EQ(output.str(), csv);
+
+    // Smaller than the same records coded with a single table
+    std::stringstream plain_in(csv), plain, plain_table;
+    huffman_codec({.chunk_size = 64 * 1024}).encode(plain_in, plain, plain_table);
+    EXPECT_LT(bin.str().size(), plain.str().size());
+
+    // Chunks end on records, so every line of the projection is whole
+    std::stringstream cols_bin(bin.str()), cols_table(table.str()), cols;
+    huffman_codec().read_columns(cols_bin, cols_table, {2, 0}, cols);
+    std::string expected;
+    for (int i = 0; i < 60000; ++i)
+        expected += std::string(i % 3 ? "ok" : "retry") + "," + std::to_string(i) + "\n";
+    EXPECT_EQ(cols.str(), expected);
+
+    // Every frame of a framed file has tables of its own
+    std::stringstream framed, unused_table, first(csv.substr(0, csv.find("\n20000,") + 1)),
+            second("a,b\nc,d\n");
+    huffman_codec({.chunk_size = 64 * 1024, .column_delimiter = ',', .framed = true}).encode(first, framed, unused_table);
+    huffman_codec({.chunk_size = 64 * 1024, .column_delimiter = ',', .framed = true}).encode(second, framed, unused_table);
+    std::stringstream frames(framed.str()), no_table, firsts;
+    no_table.setstate(std::ios::failbit);
+    huffman_codec().read_columns(frames, no_table, {0}, firsts);
+    std::string ids;
+    for (int i = 0; i < 20000; ++i)
+        ids += std::to_string(i) + "\n";
+    EXPECT_EQ(firsts.str(), ids + "a\nc\n");
+
+    // Files without columns are turned away
+    std::stringstream plain_bin(plain.str()), plain_tables(plain_table.str()), unused;
+    EXPECT_THROW(huffman_codec().read_columns(plain_bin, plain_tables, {0}, unused), std::invalid_argument);
+    std::stringstream tans_in(csv), tans_bin, tans_table;
+    EXPECT_THROW(huffman_codec({.column_delimiter = ','}).encode(tans_in, tans_bin, tans_table, huffman_codec::Backend::TANS),
+                 std::invalid_argument);
+}
+
+TEST(ColumnModelTest, CodecLongRecords) {
+    // Records longer than the blocks a chunk is extended by end the chunks whole
+    std::string csv, expected;
+    for (int i = 0; i < 60; ++i) {
+        csv += std::to_string(i) + "," + std::string(3000 + i * 997 % 9000, static_cast<char>('a' + i % 26)) + ",x\n";
+        expected += "x\n";
+    }
+    std::stringstream input(csv), bin, table, output;
+    huffman_codec enc({.chunk_size = 64 * 1024, .column_delimiter = ','});
+    enc.encode(input, bin, table);
+    huffman_codec dec;
+    std::stringstream bin_in(bin.str()), table_in(table.str());
+    dec.decode(bin_in, output, table_in);
+    EXPECT_EQ(output.str(), csv);
+    std::stringstream cols_bin(bin.str()), cols_table(table.str()), cols;
+    huffman_codec().read_columns(cols_bin, cols_table, {2}, cols);
+    EXPECT_EQ(cols.str(), expected);
+
+    // One longer than the chunk twice over is cut, it still decodes
+    const std::string huge = csv + "huge," + std::string(150 * 1024, 'h') + ",y\n" + csv;
+    std::stringstream huge_in(huge), huge_bin, huge_table, huge_out;
+    huffman_codec({.chunk_size = 64 * 1024, .column_delimiter = ','}).encode(huge_in, huge_bin, huge_table);
+    huffman_codec().decode(huge_bin, huge_out, huge_table);
+    EXPECT_EQ(huge_out.str(), huge);
+}
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include "context_model.h"
+
+TEST(ContextModelTest, GroupsAlikeContexts) {
+    auto freqs = std::make_unique<huffman_kernels::context_histogram>();
+    // Vowels are followed by consonants and the other way around
+    for (const char v : std::string("aeiou"))
+        for (const char c : std::string("bcdfg"))
+            (*freqs)[v][c] = 100 + v, (*freqs)[c][v] = 50 + c;
+
+    const auto context = context_model::cluster(*freqs, 2);
+    EXPECT_EQ(context_model::table_count(context), 2);
+    for (const char v : std::string("eiou"))
+        EXPECT_EQ(context[v], context['a']);
+    for (const char c : std::string("cdfg"))
+        EXPECT_EQ(context[c], context['b']);
+    EXPECT_NE(context['a'], context['b']);
+}
+
+TEST(ContextModelTest, RespectsTableLimit) {
+    auto freqs = std::make_unique<huffman_kernels::context_histogram>();
+    for (size_t c = 0; c < 256; ++c)
+        (*freqs)[c][c] = 1 + c;
+
+    EXPECT_LE(context_model::table_count(context_model::cluster(*freqs, 5)), 5);
+    EXPECT_LE(context_model::table_count(context_model::cluster(*freqs, 1000)), context_model::MAX_TABLES);
+
+    // Every table gets some counts, so none of them is left without codes
+    const auto context = context_model::cluster(*freqs, 16);
+    for (const auto& table : context_model::table_freqs(*freqs, context))
+        EXPECT_FALSE(table.empty());
+}
+
+TEST(ContextModelTest, EmptyHistogramGivesOneTable) {
+    auto freqs = std::make_unique<huffman_kernels::context_histogram>();
+    const auto context = context_model::cluster(*freqs, 8);
+    EXPECT_EQ(context_model::table_count(context), 1);
+}
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include "crc32c.h"
+
+TEST(Crc32cTest, KnownValues) {
+    EXPECT_EQ(crc32c::of(std::string_view("123456789")), 0xE3069283u);
+    EXPECT_EQ(crc32c::of({}), 0u);
+
+    // iSCSI test patterns from RFC 3720
+    std::string zeros(32, '\0'), ones(32, '\xff'), ascending(32, '\0');
+    for (int i = 0; i < 32; ++i) ascending[i] = static_cast<char>(i);
+    EXPECT_EQ(crc32c::of(zeros), 0x8A9136AAu);
+    EXPECT_EQ(crc32c::of(ones), 0x62A8AB43u);
+    EXPECT_EQ(crc32c::of(ascending), 0x46DD794Eu);
+}
+
+TEST(Crc32cTest, HardwareMatchesSoftware) {
+    std::mt19937 rng(7);
+    std::string data(70000, '\0');
+    for (char& c : data) c = static_cast<char>(rng());
+
+    // Every length and start around the 8 byte steps, then a few long ones
+    for (size_t start = 0; start < 8; ++start)
+        for (size_t len = 0; len < 64; ++len) {
+            const auto span = std::span<const char>(data).subspan(start, len);
+            EXPECT_EQ(crc32c::of(span), crc32c::of_software(span)) << start << ' ' << len;
+        }
+    for (const size_t len : {1000, 4097, 65536, 69990})
+        EXPECT_EQ(crc32c::of(std::span<const char>(data).subspan(3, len)),
+                  crc32c::of_software(std::span<const char>(data).subspan(3, len)));
+}
+
+TEST(Crc32cTest, Chaining) {
+    const std::string text = "the quick brown fox jumps over the lazy dog, again and again and again";
+    const uint32_t whole = crc32c::of(text);
+    for (size_t split = 0; split <= text.size(); ++split) {
+        const auto head = std::string_view(text).substr(0, split), tail = std::string_view(text).substr(split);
+        EXPECT_EQ(crc32c::of(tail, crc32c::of(head)), whole);
+        EXPECT_EQ(crc32c::of_software(tail, crc32c::of(head)), whole);
+    }
+}
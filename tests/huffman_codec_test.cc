@@ -2,15 +2,17 @@
 #include <gtest/gtest.h>
 #include <source_location>
 #include <utility>
+#include <unistd.h>
 
 class HuffmanCodecTest : public testing::Test {
 protected:
     HuffmanCodecTest() = default;
     ~HuffmanCodecTest() override = default;
 
-    void RunCodec(std::string file) {
-        huffman_codec hmc;
-        hmc.encode(file, std::nullopt, std::nullopt);
+    void RunCodec(std::string file, huffman_codec::Backend backend = huffman_codec::Backend::Huffman,
+                  const codec_options& opts = {}) {
+        huffman_codec hmc(opts);
+        hmc.encode(file, std::nullopt, std::nullopt, backend);
         file_no_ext = std::filesystem::path(file).replace_extension().string();
         hmc.decode(file_no_ext + "ENC.bin", file_no_ext + "Res.txt", file_no_ext + "Table.txt");
     }
@@ -96,3 +98,778 @@ TEST_F(HuffmanCodecTest, CodecLibSource) {
     EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/LibSource.txt", TEST_FILES_DIR + "/LibSourceRes.txt"));
 }
 
+TEST_F(HuffmanCodecTest, CodecTANS1M4C) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/1M4C.txt", huffman_codec::Backend::TANS);
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/1M4C.txt", TEST_FILES_DIR + "/1M4CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecTANS250K16C) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/250K16C.txt", huffman_codec::Backend::TANS);
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/250K16C.txt", TEST_FILES_DIR + "/250K16CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecTunstall1M4C) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/1M4C.txt", huffman_codec::Backend::Tunstall);
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/1M4C.txt", TEST_FILES_DIR + "/1M4CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecTunstall250K16C) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/250K16C.txt", huffman_codec::Backend::Tunstall);
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/250K16C.txt", TEST_FILES_DIR + "/250K16CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecBoundedWindow) {
+    // One chunk in flight and small chunks, so the reader has to wait on (and reorder around) every single one
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/250K16C.txt", huffman_codec::Backend::Huffman,
+                               {.max_inflight = 1, .max_memory = 16 * 1024});
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/250K16C.txt", TEST_FILES_DIR + "/250K16CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecTANSBoundedWindow) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/1M4C.txt", huffman_codec::Backend::TANS, {.max_inflight = 3});
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/1M4C.txt", TEST_FILES_DIR + "/1M4CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecWindowPeakBytes) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream one_copy;
+    one_copy << ifs.rdbuf();
+    std::stringstream input;
+    for (int i = 0; i < 4; ++i)
+        input << one_copy.str();
+
+    // Window held by bytes rather than chunks: at most the cap plus the chunk that crossed it, whatever the input size
+    constexpr size_t chunk = 64 * 1024;
+    const auto pool = std::make_shared<worker_pool>(4);
+    for (const codec_options& opts : {codec_options{.max_inflight = 4, .chunk_size = chunk},
+                                      codec_options{.max_memory = 5 * chunk, .chunk_size = chunk}}) {
+        const size_t bound = opts.max_memory != 0 ? opts.max_memory + 2 * chunk : opts.max_inflight * 2 * chunk;
+        std::stringstream bin, table, output;
+        huffman_codec enc(opts, pool);
+        enc.encode(input, bin, table);
+        EXPECT_GT(enc.stats().peak_inflight_bytes, 0);
+        EXPECT_LE(enc.stats().peak_inflight_bytes, bound);
+
+        huffman_codec dec(opts, pool);
+        dec.decode(bin, output, table);
+        EXPECT_EQ(output.str(), input.str());
+        EXPECT_GT(dec.stats().peak_inflight_bytes, 0);
+        EXPECT_LE(dec.stats().peak_inflight_bytes, bound);
+    }
+}
+
+TEST_F(HuffmanCodecTest, CodecProgress) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream input, bin, table, output;
+    input << ifs.rdbuf();
+    const auto size = static_cast<uint64_t>(input.str().size());
+
+    codec_progress last;
+    huffman_codec enc({.chunk_size = 64 * 1024, .on_progress = [&](const codec_progress& p) {
+        EXPECT_GE(p.bytes_done, last.bytes_done);
+        last = p;
+    }});
+    enc.encode(input, bin, table);
+    EXPECT_EQ(last.bytes_total, 2 * size);
+    EXPECT_EQ(last.bytes_done, last.bytes_total);
+
+    last = {};
+    huffman_codec dec({.on_progress = [&](const codec_progress& p) { last = p; }});
+    dec.decode(bin, output, table);
+    EXPECT_EQ(last.bytes_done, last.bytes_total);
+    EXPECT_EQ(output.str(), input.str());
+}
+
+TEST_F(HuffmanCodecTest, CodecCancel) {
+    auto token = std::make_shared<cancel_token>();
+    huffman_codec hmc({.chunk_size = 16 * 1024, .on_progress = [&](const codec_progress&) { token->cancel(); },
+                       .cancel = token});
+
+    const std::string file = TEST_FILES_DIR + "/1M4C.txt";
+    file_no_ext = std::filesystem::path(file).replace_extension().string();
+    EXPECT_THROW(hmc.encode(file, std::nullopt, std::nullopt), codec_cancelled);
+    // Partial output is cleaned up
+    EXPECT_FALSE(std::filesystem::exists(file_no_ext + "ENC.bin"));
+}
+
+TEST_F(HuffmanCodecTest, CodecSyncPointsSplitDecode) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream input;
+    input << ifs.rdbuf();
+
+    for (const auto backend : {huffman_codec::Backend::Huffman, huffman_codec::Backend::TANS,
+                               huffman_codec::Backend::Tunstall}) {
+        input.clear();
+        input.seekg(0);
+        std::stringstream bin, table, output;
+
+        // Whole file in one chunk, so any decode parallelism has to come from the sync points
+        huffman_codec enc({.chunk_size = 4 * 1024 * 1024, .sync_interval = 16 * 1024});
+        enc.encode(input, bin, table, backend);
+
+        size_t tasks = 0;
+        huffman_codec dec({.on_progress = [&](const codec_progress&) { ++tasks; }});
+        dec.decode(bin, output, table);
+
+        EXPECT_GT(tasks, 1);
+        EXPECT_EQ(output.str(), input.str());
+    }
+}
+
+TEST_F(HuffmanCodecTest, CodecNoSyncPoints) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/250K16C.txt", huffman_codec::Backend::TANS, {.sync_interval = SIZE_MAX});
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/250K16C.txt", TEST_FILES_DIR + "/250K16CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecDeterministicOutput) {
+    const std::string file = TEST_FILES_DIR + "/250K16C.txt";
+    file_no_ext = std::filesystem::path(file).replace_extension().string();
+    auto read_all = [](const std::string& path) {
+        std::ifstream ifs(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(ifs), {});
+    };
+
+    for (const auto backend : {huffman_codec::Backend::Huffman, huffman_codec::Backend::TANS,
+                               huffman_codec::Backend::Tunstall}) {
+        std::string reference;
+        for (const unsigned threads : {1u, 3u, 8u}) {
+            huffman_codec hmc({.chunk_size = 16 * 1024, .sync_interval = 4096}, std::make_shared<worker_pool>(threads));
+            hmc.encode(file, std::nullopt, std::nullopt, backend);
+            const std::string bin = read_all(file_no_ext + "ENC.bin");
+
+            if (reference.empty()) reference = bin;
+            EXPECT_EQ(bin, reference) << "threads: " << threads;
+        }
+
+        // In-memory output goes through the ordered writer instead of fixed offsets, same bytes either way
+        std::ifstream ifs(file, std::ios::binary);
+        std::stringstream input, bin, table;
+        input << ifs.rdbuf();
+        huffman_codec hmc({.chunk_size = 16 * 1024, .sync_interval = 4096});
+        hmc.encode(input, bin, table, backend);
+        EXPECT_EQ(bin.str(), reference);
+    }
+}
+
+TEST_F(HuffmanCodecTest, CodecOrder1) {
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/250K16C.txt", huffman_codec::Backend::Huffman, {.context_tables = 8});
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/250K16C.txt", TEST_FILES_DIR + "/250K16CRes.txt"));
+
+    HuffmanCodecTest::RunCodec(TEST_FILES_DIR + "/250K16C.txt", huffman_codec::Backend::Huffman,
+                               {.sync_interval = SIZE_MAX, .context_tables = 8});
+    EXPECT_TRUE(compare_files(TEST_FILES_DIR + "/250K16C.txt", TEST_FILES_DIR + "/250K16CRes.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecOrder1SplitDecode) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream input, bin, table, output;
+    input << ifs.rdbuf();
+
+    // Contexts restart at every sync point, so the segments decode on their own
+    huffman_codec enc({.chunk_size = 4 * 1024 * 1024, .sync_interval = 16 * 1024, .context_tables = 4});
+    enc.encode(input, bin, table);
+
+    size_t tasks = 0;
+    huffman_codec dec({.on_progress = [&](const codec_progress&) { ++tasks; }});
+    dec.decode(bin, output, table);
+
+    EXPECT_GT(tasks, 1);
+    EXPECT_EQ(output.str(), input.str());
+}
+
+TEST_F(HuffmanCodecTest, CodecOrder1BeatsOrder0OnText) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream text;
+    text << ifs.rdbuf();
+
+    auto encoded_size = [&](const codec_options& opts) {
+        std::stringstream input(text.str()), bin, table, output;
+        huffman_codec enc(opts);
+        enc.encode(input, bin, table);
+
+        huffman_codec dec;
+        dec.decode(bin, output, table);
+        EXPECT_EQ(output.str(), text.str());
+        return bin.str().size();
+    };
+
+    EXPECT_LT(encoded_size({.context_tables = 16}), encoded_size({}));
+}
+
+TEST_F(HuffmanCodecTest, CodecOrder1NeedsHuffman) {
+    std::stringstream input("some text"), bin, table;
+    huffman_codec hmc({.context_tables = 4});
+    EXPECT_THROW(hmc.encode(input, bin, table, huffman_codec::Backend::TANS), std::invalid_argument);
+}
+
+// Matches of a plain line by line scan, what search has to agree with
+static std::vector<search_match> reference_search(const std::string& text, const line_matcher& matcher)
+{
+    std::vector<search_match> matches;
+    uint64_t line = 1;
+    for (size_t start = 0; start <= text.size(); ++line) {
+        const size_t end = std::min(text.size(), text.find('\n', start));
+        if ((end > start || end < text.size()) && matcher.matches(std::string_view(text).substr(start, end - start)))
+            matches.push_back({start, line, text.substr(start, end - start)});
+        start = end + 1;
+    }
+    return matches;
+}
+
+TEST_F(HuffmanCodecTest, CodecSearch) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+    std::string text;
+    for (int i = 0; i < 20; ++i)
+        text += source.str();
+    // Last line without a '\n'
+    text += "    return huffman_table;";
+
+    for (const auto backend : {huffman_codec::Backend::Huffman, huffman_codec::Backend::TANS}) {
+        // Small chunks and windows, so plenty of lines straddle both
+        std::stringstream input(text), bin, table;
+        huffman_codec enc({.chunk_size = 16 * 1024, .sync_interval = 1024});
+        enc.encode(input, bin, table, backend);
+        const std::string bin_str = bin.str(), table_str = table.str();
+
+        for (const std::string pattern : {"huffman_table", "^#include", ";$", "^}$", "", "no such thing"}) {
+            SCOPED_TRACE(pattern);
+            std::istringstream bin_in(bin_str), table_in(table_str);
+            std::vector<search_match> found;
+            huffman_codec hmc({}, std::make_shared<worker_pool>(3));
+            hmc.search(bin_in, table_in, pattern, [&](const search_match& m) { found.push_back(m); });
+
+            const auto expected = reference_search(text, line_matcher(pattern));
+            ASSERT_EQ(found.size(), expected.size());
+            for (size_t i = 0; i < found.size(); ++i) {
+                EXPECT_EQ(found[i].offset, expected[i].offset);
+                EXPECT_EQ(found[i].line, expected[i].line);
+                EXPECT_EQ(found[i].text, expected[i].text);
+            }
+        }
+    }
+}
+
+TEST_F(HuffmanCodecTest, CodecReadLines) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+    std::string text;
+    for (int i = 0; i < 20; ++i)
+        text += source.str();
+    text += "no newline at the end";
+
+    // Line n and the ones after it, as a plain scan of the text finds them
+    auto expected_lines = [&](uint64_t first, uint64_t count) {
+        size_t start = 0;
+        for (uint64_t line = 1; line < first && start != std::string::npos; ++line)
+            start = text.find('\n', start) == std::string::npos ? std::string::npos : text.find('\n', start) + 1;
+        if (start == std::string::npos) return std::string();
+        size_t end = start;
+        for (uint64_t i = 0; i < count && end < text.size(); ++i)
+            end = std::min(text.size(), text.find('\n', end) + 1);
+        return text.substr(start, end - start);
+    };
+
+    const std::pair<huffman_codec::Backend, codec_options> runs[] = {
+            {huffman_codec::Backend::Huffman, {.chunk_size = 16 * 1024, .sync_interval = 1024}},
+            {huffman_codec::Backend::TANS, {.chunk_size = 16 * 1024, .sync_interval = 1024}},
+            {huffman_codec::Backend::Huffman, {.chunk_size = 16 * 1024, .sync_interval = SIZE_MAX}},
+            {huffman_codec::Backend::Huffman, {.chunk_size = 16 * 1024, .sync_interval = 1024, .framed = true}},
+    };
+    for (const auto& [backend, opts] : runs) {
+        std::stringstream input(text), bin, table;
+        huffman_codec enc(opts);
+        enc.encode(input, bin, table, backend);
+        const std::string bin_str = bin.str(), table_str = table.str();
+
+        const uint64_t total = std::ranges::count(text, '\n') + 1;
+        std::vector<std::pair<uint64_t, uint64_t>> requests{
+                {1, 1}, {1, 10}, {2, 3}, {100, 50}, {1000, 1}, {total - 1, 5}, {total, 1}, {total + 1, 1}, {5, 0}};
+        // Enough starting lines to land on every chunk, at its start and end too
+        for (uint64_t first = 3; first < total; first += 61)
+            requests.emplace_back(first, 2);
+        for (const auto& [first, count] : requests) {
+            SCOPED_TRACE(std::to_string(first) + "+" + std::to_string(count));
+            std::istringstream bin_in(bin_str), table_in(table_str);
+            std::stringstream lines;
+            huffman_codec dec;
+            dec.read_lines(bin_in, table_in, first, count, lines);
+            EXPECT_EQ(lines.str(), expected_lines(first, count));
+        }
+
+        // The index sits behind the chunks without getting in the way of a plain decode
+        std::istringstream bin_in(bin_str), table_in(table_str);
+        std::stringstream output;
+        huffman_codec dec;
+        dec.decode(bin_in, output, table_in);
+        EXPECT_EQ(output.str(), text);
+    }
+}
+
+TEST_F(HuffmanCodecTest, CodecDedup) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+
+    // Eight copies of one 16 KB block, then one of a different one, then the first again
+    std::string block;
+    while (block.size() < 16 * 1024)
+        block += source.str();
+    block.resize(16 * 1024);
+    std::string other = block;
+    std::ranges::reverse(other);
+    std::string text;
+    for (int i = 0; i < 8; ++i)
+        text += block;
+    text += other + block;
+
+    for (const auto backend : {huffman_codec::Backend::Huffman, huffman_codec::Backend::TANS}) {
+        std::stringstream input(text), bin, dedup_bin, table, dedup_table;
+        huffman_codec plain({.chunk_size = 16 * 1024});
+        plain.encode(input, bin, table, backend);
+
+        input.clear();
+        input.seekg(0);
+        huffman_codec enc({.chunk_size = 16 * 1024, .dedup = true});
+        enc.encode(input, dedup_bin, dedup_table, backend);
+        // Two chunks worth of payload plus eight references
+        EXPECT_LT(dedup_bin.str().size(), bin.str().size() / 3);
+
+        std::stringstream output;
+        huffman_codec dec;
+        dec.decode(dedup_bin, output, dedup_table);
+        EXPECT_EQ(output.str(), text);
+
+        // Searching and line lookups follow the references too
+        size_t matches = 0;
+        std::istringstream bin_in(dedup_bin.str()), table_in(dedup_table.str());
+        huffman_codec search;
+        search.search(bin_in, table_in, "huffman", [&](const search_match&) { ++matches; });
+        EXPECT_EQ(matches, reference_search(text, line_matcher("huffman")).size());
+
+        std::istringstream lines_bin(dedup_bin.str()), lines_table(dedup_table.str());
+        std::stringstream lines;
+        huffman_codec reader;
+        std::vector<std::string> all_lines;
+        std::istringstream text_in(text);
+        for (std::string line; std::getline(text_in, line);)
+            all_lines.push_back(line + '\n');
+        // Lines from the last chunk, which is a reference
+        reader.read_lines(lines_bin, lines_table, all_lines.size() - 3, 2, lines);
+        EXPECT_EQ(lines.str(), all_lines[all_lines.size() - 4] + all_lines[all_lines.size() - 3]);
+    }
+
+    // File output plans chunk offsets up front, references included
+    const auto file = (std::filesystem::temp_directory_path() /
+                       ("DedupSample" + std::to_string(::getpid()) + ".txt")).string();
+    std::ofstream(file, std::ios::binary) << text;
+    HuffmanCodecTest::RunCodec(file, huffman_codec::Backend::Huffman, {.chunk_size = 16 * 1024, .dedup = true});
+    EXPECT_TRUE(compare_files(file, file_no_ext + "Res.txt"));
+    std::filesystem::remove(file);
+}
+
+TEST_F(HuffmanCodecTest, CodecDedupKeptLimit) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+
+    // Twelve different blocks, all of them repeated twice later on, far more than decode may keep around
+    constexpr size_t chunk = 16 * 1024;
+    std::string all = source.str();
+    while (all.size() < 13 * chunk)
+        all += source.str();
+    std::string text;
+    for (int round = 0; round < 3; ++round)
+        for (size_t b = 0; b < 12; ++b)
+            text += all.substr(b * chunk + b, chunk);
+
+    std::stringstream input(text), bin, table;
+    huffman_codec enc({.chunk_size = chunk, .dedup = true});
+    enc.encode(input, bin, table);
+    EXPECT_LT(bin.str().size(), text.size() / 3);
+
+    std::stringstream output;
+    huffman_codec dec({.max_memory = 4 * chunk}, std::make_shared<worker_pool>(3));
+    dec.decode(bin, output, table);
+    EXPECT_EQ(output.str(), text);
+
+    size_t matches = 0;
+    std::istringstream bin_in(bin.str()), table_in(table.str());
+    huffman_codec search({.max_memory = 4 * chunk});
+    search.search(bin_in, table_in, "include", [&](const search_match&) { ++matches; });
+    EXPECT_EQ(matches, reference_search(text, line_matcher("include")).size());
+}
+
+TEST_F(HuffmanCodecTest, CodecFrames) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+
+    // Shards cut mid line, each encoded on its own with whatever settings it likes
+    const std::string text = source.str() + source.str() + source.str();
+    const size_t cut1 = text.size() / 3 + 7, cut2 = 2 * text.size() / 3 + 3;
+    const std::string shards[3] = {text.substr(0, cut1), text.substr(cut1, cut2 - cut1), text.substr(cut2)};
+    const codec_options shard_opts[3] = {{.chunk_size = 4096, .framed = true},
+                                         {.chunk_size = 8192, .context_tables = 4, .framed = true},
+                                         {.chunk_size = 4096, .dedup = true, .framed = true}};
+    const huffman_codec::Backend backends[3] = {huffman_codec::Backend::Huffman, huffman_codec::Backend::Huffman,
+                                                huffman_codec::Backend::TANS};
+
+    std::string concatenated;
+    for (int i = 0; i < 3; ++i) {
+        std::stringstream input(shards[i]), bin, table;
+        huffman_codec enc(shard_opts[i]);
+        enc.encode(input, bin, table, backends[i]);
+        EXPECT_TRUE(table.str().empty());
+        concatenated += bin.str();
+    }
+
+    std::stringstream bin(concatenated), output;
+    std::istringstream no_table;
+    huffman_codec dec;
+    dec.decode(bin, output, no_table);
+    EXPECT_EQ(output.str(), text);
+
+    size_t matches = 0;
+    std::istringstream search_bin(concatenated);
+    huffman_codec search;
+    search.search(search_bin, no_table, "huffman", [&](const search_match&) { ++matches; });
+    EXPECT_EQ(matches, reference_search(text, line_matcher("huffman")).size());
+
+    // Lines on either side of the second cut
+    std::vector<std::string> all_lines;
+    std::istringstream text_in(text);
+    for (std::string line; std::getline(text_in, line);)
+        all_lines.push_back(line + '\n');
+    const uint64_t cut_line = std::count(text.begin(), text.begin() + cut2, '\n') + 1;
+    std::istringstream lines_bin(concatenated);
+    std::stringstream lines;
+    huffman_codec reader;
+    reader.read_lines(lines_bin, no_table, cut_line - 1, 3, lines);
+    EXPECT_EQ(lines.str(), all_lines[cut_line - 2] + all_lines[cut_line - 1] + all_lines[cut_line]);
+
+    // Anything after a frame has to be a frame too
+    std::stringstream plain_in(shards[0]), plain_bin, plain_table;
+    huffman_codec plain;
+    plain.encode(plain_in, plain_bin, plain_table);
+    std::stringstream mixed(concatenated + plain_bin.str()), mixed_out;
+    huffman_codec mixed_dec;
+    EXPECT_THROW(mixed_dec.decode(mixed, mixed_out, no_table), std::invalid_argument);
+
+    // And a file that isn't framed still needs its table
+    std::stringstream plain_copy(plain_bin.str()), plain_out;
+    huffman_codec plain_dec;
+    std::ifstream missing;
+    missing.setstate(std::ios::failbit);
+    EXPECT_THROW(plain_dec.decode(plain_copy, plain_out, missing), std::invalid_argument);
+
+    // File output writes chunks at their offsets behind the inline table, and no table file
+    const std::string file = TEST_FILES_DIR + "/LibSource.txt";
+    file_no_ext = std::filesystem::path(file).replace_extension().string();
+    huffman_codec file_enc({.chunk_size = 4096, .framed = true});
+    file_enc.encode(file, std::nullopt, std::nullopt);
+    EXPECT_FALSE(std::filesystem::exists(file_no_ext + "Table.txt"));
+    huffman_codec file_dec;
+    file_dec.decode(file_no_ext + "ENC.bin", file_no_ext + "Res.txt", "");
+    EXPECT_TRUE(compare_files(file, file_no_ext + "Res.txt"));
+}
+
+TEST_F(HuffmanCodecTest, CodecAppend) {
+    std::ifstream ifs(TEST_FILES_DIR + "/LibSource.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+    const std::string text = source.str() + source.str() + source.str() + source.str();
+    // Grows in the middle of a line, with more of the same kind of text
+    const std::string head = text.substr(0, text.size() / 2 + 11);
+
+    for (const auto& [backend, tables] : {std::pair{huffman_codec::Backend::Huffman, 0},
+                                          std::pair{huffman_codec::Backend::TANS, 0},
+                                          std::pair{huffman_codec::Backend::Tunstall, 0},
+                                          std::pair{huffman_codec::Backend::Huffman, 4}}) {
+        std::stringstream input(head), bin, table;
+        huffman_codec enc({.chunk_size = 8192, .sync_interval = 2048, .context_tables = static_cast<size_t>(tables)});
+        enc.encode(input, bin, table, backend);
+
+        std::stringstream grown(text), table_in(table.str());
+        huffman_codec app({.chunk_size = 4096});
+        const append_result result = app.append(grown, bin, table_in);
+        EXPECT_EQ(result.bytes, text.size() - head.size());
+        EXPECT_LT(result.drift, 0.05);
+        EXPECT_FALSE(result.reencoded);
+
+        std::stringstream bin_in(bin.str()), dec_table(table.str()), output;
+        huffman_codec dec;
+        dec.decode(bin_in, output, dec_table);
+        EXPECT_EQ(output.str(), text);
+
+        // The new index covers old and new chunks alike
+        std::vector<std::string> all_lines;
+        std::istringstream text_in(text);
+        for (std::string line; std::getline(text_in, line);)
+            all_lines.push_back(line + '\n');
+        std::stringstream lines_bin(bin.str()), lines_table(table.str()), lines;
+        huffman_codec reader;
+        reader.read_lines(lines_bin, lines_table, all_lines.size() - 1, 2, lines);
+        EXPECT_EQ(lines.str(), all_lines[all_lines.size() - 2] + all_lines.back());
+
+        // Nothing new, nothing to do
+        std::stringstream same(text), same_table(table.str());
+        huffman_codec again;
+        EXPECT_EQ(again.append(same, bin, same_table).bytes, 0);
+    }
+
+    // Symbols the table has never seen can't be coded with it at all
+    std::stringstream input(head), bin, table;
+    huffman_codec enc;
+    enc.encode(input, bin, table);
+    const std::string before = bin.str();
+    std::stringstream grown(head + std::string(1000, '\x01')), table_in(table.str());
+    huffman_codec app;
+    const append_result result = app.append(grown, bin, table_in);
+    EXPECT_EQ(result.bytes, 0);
+    EXPECT_GT(result.drift, 0.05);
+    EXPECT_EQ(bin.str(), before);
+
+    // An input that changed before its end is refused rather than appended to
+    std::string rewritten = text;
+    rewritten[head.size() - 20] ^= 1;
+    std::stringstream changed(rewritten), changed_table(table.str());
+    huffman_codec changed_app;
+    EXPECT_THROW(changed_app.append(changed, bin, changed_table), std::invalid_argument);
+    EXPECT_EQ(bin.str(), before);
+
+    // Appends never dedup, but that doesn't stick to the codec's own options
+    huffman_codec reused({.chunk_size = 4096, .dedup = true});
+    std::stringstream reused_grown(text), reused_table(table.str()), reused_bin(before);
+    reused.append(reused_grown, reused_bin, reused_table);
+    std::stringstream reused_in(text), reused_out, reused_out_table, fresh_in(text), fresh_out, fresh_out_table;
+    reused.encode(reused_in, reused_out, reused_out_table);
+    huffman_codec({.chunk_size = 4096, .dedup = true}).encode(fresh_in, fresh_out, fresh_out_table);
+    EXPECT_EQ(reused_out.str(), fresh_out.str());
+
+    // The path overload grows the file in place, or encodes all of it again when the table is off
+    const std::string file = TEST_FILES_DIR + "/AppendSample.txt";
+    file_no_ext = std::filesystem::path(file).replace_extension().string();
+    std::ofstream(file, std::ios::binary) << head;
+    huffman_codec file_enc({.chunk_size = 4096});
+    file_enc.encode(file, std::nullopt, std::nullopt);
+    std::ofstream(file, std::ios::binary | std::ios::app) << text.substr(head.size());
+    const auto bin_bytes = [&] {
+        std::ifstream bin_file(file_no_ext + "ENC.bin", std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(bin_file), {});
+    };
+    const std::string file_before = bin_bytes();
+
+    // Cancelled once the new chunks are being written, the old index is put back
+    auto token = std::make_shared<cancel_token>();
+    huffman_codec cancelled({.chunk_size = 4096,
+                             .on_progress = [&](const codec_progress& p) {
+                                 if (p.bytes_done > p.bytes_total / 2) token->cancel();
+                             },
+                             .cancel = token});
+    EXPECT_THROW(cancelled.append(file, file_no_ext + "ENC.bin", file_no_ext + "Table.txt"), codec_cancelled);
+    EXPECT_EQ(bin_bytes(), file_before);
+    EXPECT_FALSE(std::filesystem::exists(file_no_ext + "ENC.bin.undo"));
+
+    huffman_codec grow;
+    EXPECT_FALSE(grow.append(file, file_no_ext + "ENC.bin", file_no_ext + "Table.txt").reencoded);
+    EXPECT_FALSE(std::filesystem::exists(file_no_ext + "ENC.bin.undo"));
+    std::ofstream(file, std::ios::binary | std::ios::app) << std::string(1000, '\x01');
+    huffman_codec file_app;
+    EXPECT_TRUE(file_app.append(file, file_no_ext + "ENC.bin", file_no_ext + "Table.txt").reencoded);
+    EXPECT_FALSE(std::filesystem::exists(file_no_ext + "ENC.tmp.bin"));
+    EXPECT_FALSE(std::filesystem::exists(file_no_ext + "Table.tmp.txt"));
+    huffman_codec file_dec;
+    file_dec.decode(file_no_ext + "ENC.bin", file_no_ext + "Res.txt", file_no_ext + "Table.txt");
+    EXPECT_TRUE(compare_files(file, file_no_ext + "Res.txt"));
+    std::filesystem::remove(file);
+}
+
+TEST_F(HuffmanCodecTest, CodecPipelineStats) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream input, bin, table, output;
+    input << ifs.rdbuf();
+
+    // Order-1 chunks go out in chunk order through the writer, like decoded ones
+    huffman_codec enc({.chunk_size = 64 * 1024, .context_tables = 4});
+    enc.encode(input, bin, table);
+    huffman_codec dec;
+    dec.decode(bin, output, table);
+    EXPECT_EQ(output.str(), input.str());
+
+    for (const pipeline_stats& stats : {enc.stats(), dec.stats()}) {
+        EXPECT_GT(stats.seconds, 0);
+        EXPECT_EQ(stats.read.threads, 1);
+        EXPECT_EQ(stats.write.threads, 1);
+        EXPECT_GT(stats.code.busy_seconds, 0);
+        EXPECT_GT(stats.write.busy_seconds, 0);
+        for (const stage_stats& stage : {stats.read, stats.code, stats.write}) {
+            EXPECT_GE(stage.utilization(stats.seconds), 0);
+            EXPECT_LE(stage.utilization(stats.seconds), 1.01);
+        }
+    }
+}
+
+TEST_F(HuffmanCodecTest, CodecVerify) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream input, bin, table;
+    input << ifs.rdbuf();
+    huffman_codec enc({.chunk_size = 64 * 1024, .dedup = true});
+    enc.encode(input, bin, table);
+
+    // Payloads alone need no table
+    std::stringstream no_table;
+    no_table.setstate(std::ios::failbit);
+    huffman_codec clean;
+    const verify_result result = clean.verify(bin, no_table, false);
+    EXPECT_TRUE(result.ok());
+    EXPECT_GT(result.chunks, 8);
+    std::stringstream bin_in(bin.str()), table_in(table.str());
+    EXPECT_TRUE(clean.verify(bin_in, table_in, true).ok());
+
+    // A flipped bit in the middle of the chunks is caught with or without decoding
+    std::string bytes = bin.str();
+    bytes[bytes.size() / 2] ^= 0x10;
+    for (const bool decode : {false, true}) {
+        std::stringstream flipped(bytes), tables(table.str());
+        huffman_codec verifier;
+        const verify_result bad = verifier.verify(flipped, tables, decode);
+        EXPECT_EQ(bad.corrupt_chunks.size(), 1);
+        EXPECT_TRUE(bad.mismatched_chunks.empty());
+    }
+
+    // The last chunk's input checksum sits right in front of its payload one, the index offset and the magic
+    bytes = bin.str();
+    bytes[bytes.size() - 24] ^= 0x01;
+    std::stringstream wrong_data(bytes), tables(table.str());
+    huffman_codec decoder;
+    const verify_result mismatch = decoder.verify(wrong_data, tables, true);
+    EXPECT_TRUE(mismatch.corrupt_chunks.empty());
+    EXPECT_EQ(mismatch.mismatched_chunks, std::vector<uint64_t>{mismatch.chunks - 1});
+
+    // A length field gone wrong costs its own chunk only, the rest are found again through the index
+    for (const uint64_t bad_len : {uint64_t{1} << 40, uint64_t{0}, uint64_t{100}}) {
+        bytes = bin.str();
+        uint64_t record = 8;
+        for (int c = 0; c < 3; ++c) {
+            uint64_t len = 0;
+            std::memcpy(&len, bytes.data() + record + 8, sizeof(len));
+            // Dedup marks sit in the top two bits
+            record += 24 + (len << 2 >> 2);
+        }
+        std::memcpy(bytes.data() + record + 8, &bad_len, sizeof(bad_len));
+        for (const bool decode : {false, true}) {
+            std::stringstream bad_length(bytes), len_tables(table.str());
+            huffman_codec verifier;
+            const verify_result bad = verifier.verify(bad_length, len_tables, decode);
+            EXPECT_EQ(bad.chunks, result.chunks);
+            EXPECT_EQ(bad.corrupt_chunks, std::vector<uint64_t>{3});
+            EXPECT_TRUE(bad.mismatched_chunks.empty());
+        }
+    }
+
+    // Framed files carry their tables, every frame its own checksums
+    std::stringstream framed, unused, frame_in(input.str().substr(0, 300000)), frame_in2(input.str().substr(300000));
+    huffman_codec({.chunk_size = 64 * 1024, .framed = true}).encode(frame_in, framed, unused);
+    huffman_codec({.chunk_size = 64 * 1024, .framed = true}).encode(frame_in2, framed, unused);
+    std::stringstream frame_table;
+    frame_table.setstate(std::ios::failbit);
+    huffman_codec frames;
+    const verify_result framed_result = frames.verify(framed, frame_table, true);
+    EXPECT_TRUE(framed_result.ok());
+    EXPECT_EQ(framed_result.chunks, (input.str().size() + 64 * 1024 - 1 - 300000) / (64 * 1024) + 5);
+}
+
+TEST_F(HuffmanCodecTest, CodecLoadedTables) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+    const std::string text = source.str().substr(0, 300000);
+
+    std::stringstream input(text), bin, table;
+    huffman_codec().encode(input, bin, table);
+    std::stringstream tans_input(text), tans_bin, tans_table;
+    huffman_codec().encode(tans_input, tans_bin, tans_table, huffman_codec::Backend::TANS);
+
+    // Parsed once, decoded with as often as needed
+    const auto tables = huffman_codec().load_tables(bin, table);
+    ASSERT_NE(tables, nullptr);
+    EXPECT_EQ(bin.tellg(), 0);
+    for (int i = 0; i < 2; ++i) {
+        std::stringstream bin_in(bin.str()), output;
+        huffman_codec().decode(bin_in, output, tables);
+        EXPECT_EQ(output.str(), text);
+    }
+
+    // A file of another backend can't use them
+    std::stringstream wrong_in(tans_bin.str()), unused;
+    EXPECT_THROW(huffman_codec().decode(wrong_in, unused, tables), std::invalid_argument);
+
+    // Frames bring their own
+    std::stringstream framed_in(text), framed, no_table;
+    huffman_codec({.framed = true}).encode(framed_in, framed, no_table);
+    EXPECT_EQ(huffman_codec().load_tables(framed, table), nullptr);
+    std::stringstream framed_out;
+    huffman_codec().decode(framed, framed_out, nullptr);
+    EXPECT_EQ(framed_out.str(), text);
+}
+
+TEST_F(HuffmanCodecTest, CodecSmallInputs) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+
+    for (const size_t size : {size_t{0}, size_t{1}, size_t{64}, size_t{4096}, huffman_codec::SMALL_INPUT}) {
+        const std::string text = source.str().substr(0, size);
+        std::vector<char> bin, decoded;
+        huffman_codec::encode_small(text, bin);
+        huffman_codec::decode_small(bin, decoded);
+        EXPECT_EQ(std::string(decoded.begin(), decoded.end()), text);
+
+        // Framed encode of a small input takes the same path, decode picks it up from the header
+        std::stringstream input(text), framed, unused, output, no_table;
+        no_table.setstate(std::ios::failbit);
+        huffman_codec({.framed = true}).encode(input, framed, unused);
+        EXPECT_EQ(framed.str(), std::string(bin.begin(), bin.end()));
+        huffman_codec().decode(framed, output, no_table);
+        EXPECT_EQ(output.str(), text);
+    }
+
+    // Options only the pool honours keep a small run off that path
+    for (const codec_options& opts : {codec_options{.chunk_size = 4096, .framed = true},
+                                      codec_options{.framed = true, .max_write_rate = 1ULL << 30}}) {
+        const std::string text = source.str().substr(0, 4096);
+        std::stringstream input(text), framed, unused;
+        huffman_codec(opts).encode(input, framed, unused);
+        // Header flag of a compact (encode_small) table
+        EXPECT_FALSE(static_cast<uint8_t>(framed.str()[6]) & 128);
+    }
+
+    // Code lengths in place of a text table
+    const std::string text = source.str().substr(0, 64);
+    std::vector<char> small;
+    huffman_codec::encode_small(text, small);
+    EXPECT_LT(small.size(), 200);
+
+    // Next to a frame with a text table the pool decodes both, lines and verify read compact tables too
+    const std::string big = source.str().substr(0, 3 * huffman_codec::SMALL_INPUT);
+    std::stringstream big_in(big), mixed, unused, no_table;
+    no_table.setstate(std::ios::failbit);
+    huffman_codec({.chunk_size = 64 * 1024, .framed = true}).encode(big_in, mixed, unused);
+    mixed.write(small.data(), static_cast<std::streamsize>(small.size()));
+    std::stringstream mixed_in(mixed.str()), output;
+    huffman_codec().decode(mixed_in, output, no_table);
+    EXPECT_EQ(output.str(), big + text);
+    std::vector<char> rejected;
+    EXPECT_THROW(huffman_codec::decode_small(std::span<const char>(mixed.str()), rejected), std::invalid_argument);
+
+    std::vector<char> three_lines;
+    huffman_codec::encode_small(std::string_view("one\ntwo\nthree\n"), three_lines);
+    std::stringstream lines_in(std::string(three_lines.begin(), three_lines.end())), lines;
+    huffman_codec().read_lines(lines_in, no_table, 2, 1, lines);
+    EXPECT_EQ(lines.str(), "two\n");
+    std::stringstream verify_in(std::string(three_lines.begin(), three_lines.end()));
+    EXPECT_TRUE(huffman_codec().verify(verify_in, no_table, true).ok());
+}
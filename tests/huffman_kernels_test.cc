@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include "huffman_kernels.h"
+#include "huffman_tree.h"
+
+static std::string sample_text(size_t len)
+{
+    std::string text;
+    uint32_t x = 12345;
+    for (size_t i = 0; i < len; ++i) {
+        x = x * 1103515245 + 12345;
+        // Skewed towards the start of the alphabet so code lengths differ a lot
+        const uint32_t r = (x >> 16) % 1000;
+        text += static_cast<char>('a' + (r < 500 ? 0 : r < 750 ? 1 : r < 900 ? 2 : 3 + r % 20));
+    }
+    return text;
+}
+
+static std::map<char, std::string> table_for(const std::string& text)
+{
+    std::map<char, uint64_t> mp;
+    for (const char c : text)
+        ++mp[c];
+    return huffman_tree::huffman_table(std::move(mp));
+}
+
+TEST(HuffmanKernelsTest, AllIsasAgreeWithScalar) {
+    const std::string text = sample_text(10007);
+    const auto table = table_for(text);
+    const auto codes = huffman_kernels::build_code_table(table);
+    const auto decode = huffman_kernels::build_decode_table(table);
+
+    const auto scalar = huffman_kernels::for_isa(huffman_kernels::Isa::Scalar);
+    std::array<uint64_t, 256> scalar_freqs{};
+    scalar.histogram(text, scalar_freqs);
+    std::vector<char> scalar_bits;
+    scalar.encode(text, SIZE_MAX, codes, scalar_bits, {});
+
+    for (const auto isa : {huffman_kernels::Isa::BMI2, huffman_kernels::Isa::AVX2}) {
+        const auto kernels = huffman_kernels::for_isa(isa);
+        SCOPED_TRACE(huffman_kernels::isa_name(kernels.isa));
+
+        std::array<uint64_t, 256> freqs{};
+        kernels.histogram(text, freqs);
+        EXPECT_EQ(freqs, scalar_freqs);
+
+        std::vector<char> bits;
+        kernels.encode(text, SIZE_MAX, codes, bits, {});
+        EXPECT_EQ(bits, scalar_bits);
+
+        // Appended behind what the buffer holds, with the bit offset of every segment after the first
+        constexpr size_t segment = 1000;
+        std::vector<char> record{'h', 'd', 'r'};
+        std::vector<uint64_t> segment_bits(text.size() / segment);
+        kernels.encode(text, segment, codes, record, segment_bits);
+        EXPECT_EQ(std::vector<char>(record.begin() + 3, record.end()), scalar_bits);
+        EXPECT_EQ(std::string(record.begin(), record.begin() + 3), "hdr");
+        uint64_t bit = 0;
+        for (size_t i = 0; i < segment_bits.size(); ++i) {
+            for (size_t j = i * segment; j < (i + 1) * segment; ++j)
+                bit += codes.len[static_cast<uint8_t>(text[j])];
+            EXPECT_EQ(segment_bits[i], bit) << i;
+        }
+        std::vector<uint64_t> too_many(text.size() / segment + 1);
+        EXPECT_THROW(kernels.encode(text, segment, codes, bits, too_many), std::invalid_argument);
+
+        std::string decoded(text.size(), '\0');
+        kernels.decode(bits, decode, decoded, 0);
+        EXPECT_EQ(decoded, text);
+    }
+}
+
+TEST(HuffmanKernelsTest, MatchesBitByBitPacking) {
+    const std::string text = "abracadabra alakazam";
+    const auto table = table_for(text);
+
+    std::string bit_string;
+    for (const char c : text)
+        bit_string += table.at(c);
+    bit_string.resize((bit_string.size() + 7) / 8 * 8, '0');
+
+    std::vector<char> expected;
+    for (size_t i = 0; i < bit_string.size(); i += 8)
+        expected.push_back(static_cast<char>(std::stoi(bit_string.substr(i, 8), nullptr, 2)));
+
+    std::vector<char> bits;
+    huffman_kernels::get().encode(text, SIZE_MAX, huffman_kernels::build_code_table(table), bits, {});
+    EXPECT_EQ(bits, expected);
+}
+
+TEST(HuffmanKernelsTest, LongCodesFallBackToTree) {
+    // Fibonacci frequencies give a maximally deep tree, well past LUT_BITS
+    std::map<char, uint64_t> mp;
+    uint64_t a = 1, b = 1;
+    for (char c = 'A'; c < 'A' + 30; ++c) {
+        mp[c] = a;
+        const uint64_t t = a + b;
+        a = b;
+        b = t;
+    }
+    const auto table = huffman_tree::huffman_table(std::move(mp));
+
+    std::string text;
+    for (char c = 'A'; c < 'A' + 30; ++c)
+        text += std::string(3, c);
+
+    const auto& kernels = huffman_kernels::get();
+    std::vector<char> bits;
+    kernels.encode(text, SIZE_MAX, huffman_kernels::build_code_table(table), bits, {});
+    std::string decoded(text.size(), '\0');
+    kernels.decode(bits, huffman_kernels::build_decode_table(table), decoded, 0);
+    EXPECT_EQ(decoded, text);
+}
+
+TEST(HuffmanKernelsTest, CanonicalTables) {
+    const std::string text = sample_text(5003);
+    std::array<uint64_t, 256> freqs{};
+    huffman_kernels::get().histogram(text, freqs);
+    const auto lengths = huffman_tree::code_lengths(freqs);
+
+    std::vector<char> bits;
+    huffman_kernels::get().encode(text, SIZE_MAX, huffman_kernels::canonical_code_table(lengths), bits, {});
+    // Decode tables are rebuilt over the buffers of the last one
+    huffman_kernels::decode_table decode;
+    huffman_kernels::canonical_decode_table(std::array<uint8_t, 256>{1, 1}, decode);
+    huffman_kernels::canonical_decode_table(lengths, decode);
+    std::string decoded(text.size(), '\0');
+    huffman_kernels::get().decode(bits, decode, decoded, 0);
+    EXPECT_EQ(decoded, text);
+
+    // Three one bit codes can't be told apart
+    std::array<uint8_t, 256> broken{};
+    broken['a'] = broken['b'] = broken['c'] = 1;
+    EXPECT_THROW(huffman_kernels::canonical_decode_table(broken, decode), std::invalid_argument);
+}
+
+TEST(HuffmanKernelsTest, DecodeFromBitOffset) {
+    const std::string text = "abracadabra alakazam, abracadabra alakazam";
+    const auto table = table_for(text);
+    const auto decode = huffman_kernels::build_decode_table(table);
+
+    std::vector<char> bits;
+    huffman_kernels::get().encode(text, SIZE_MAX, huffman_kernels::build_code_table(table), bits, {});
+
+    // Enter the stream mid byte, right where the code of the 5th symbol starts
+    uint32_t start = 0;
+    for (size_t i = 0; i < 5; ++i)
+        start += table.at(text[i]).size();
+
+    for (const auto isa : {huffman_kernels::Isa::Scalar, huffman_kernels::Isa::BMI2, huffman_kernels::Isa::AVX2}) {
+        std::string decoded(text.size() - 5, '\0');
+        huffman_kernels::for_isa(isa).decode(std::span(bits).subspan(start / 8), decode, decoded, start % 8);
+        EXPECT_EQ(decoded, text.substr(5));
+    }
+}
+
+TEST(HuffmanKernelsTest, Order1AllIsasAgree) {
+    const std::string text = sample_text(10007);
+    constexpr size_t segment = 1000;
+
+    auto scalar = huffman_kernels::for_isa(huffman_kernels::Isa::Scalar);
+    huffman_kernels::context_histogram freqs{};
+    scalar.histogram_o1(text, segment, freqs);
+
+    // Two tables: after 'a' and everything else
+    std::array<uint8_t, 256> context{};
+    context['a'] = 1;
+    std::vector<std::map<char, uint64_t>> table_freqs(2);
+    for (size_t c = 0; c < 256; ++c)
+        for (size_t s = 0; s < 256; ++s)
+            if (freqs[c][s] != 0) table_freqs[context[c]][static_cast<char>(s)] += freqs[c][s];
+    std::vector<std::map<char, std::string>> tables;
+    for (auto& f : table_freqs)
+        tables.push_back(huffman_tree::huffman_table(std::move(f)));
+
+    const auto codes = huffman_kernels::build_context_code_table(context, tables);
+    const auto decode = huffman_kernels::build_context_decode_table(context, tables);
+
+    std::vector<char> scalar_bits;
+    scalar.encode_o1(text, segment, codes, scalar_bits, {});
+
+    for (const auto isa : {huffman_kernels::Isa::Scalar, huffman_kernels::Isa::BMI2, huffman_kernels::Isa::AVX2}) {
+        const auto kernels = huffman_kernels::for_isa(isa);
+        SCOPED_TRACE(huffman_kernels::isa_name(kernels.isa));
+
+        huffman_kernels::context_histogram o1{};
+        kernels.histogram_o1(text, segment, o1);
+        EXPECT_EQ(o1, freqs);
+
+        std::vector<char> bits;
+        std::vector<uint64_t> segment_bits(text.size() / segment);
+        kernels.encode_o1(text, segment, codes, bits, segment_bits);
+        EXPECT_EQ(bits, scalar_bits);
+
+        // Every segment starts over in context 0, so each one decodes from its own bit offset
+        uint64_t bit = 0;
+        for (size_t start = 0; start < text.size(); start += segment) {
+            if (start != 0) EXPECT_EQ(segment_bits[start / segment - 1], bit) << start;
+            const size_t len = std::min(segment, text.size() - start);
+            std::string decoded(len, '\0');
+            kernels.decode_o1(std::span(bits).subspan(bit / 8), decode, decoded, static_cast<uint32_t>(bit % 8));
+            EXPECT_EQ(decoded, text.substr(start, len));
+
+            uint8_t prev = 0;
+            for (const char c : decoded) {
+                bit += codes.tables[codes.context[prev]].len[static_cast<uint8_t>(c)];
+                prev = static_cast<uint8_t>(c);
+            }
+        }
+    }
+}
@@ -70,4 +70,35 @@ TEST(HuffmanTreeTest, AlphaNumWS) {
     EXPECT_EQ(res['9'], "01");
     EXPECT_EQ(res[' '], "001");
     EXPECT_EQ(res['\n'], "10");
-}
\ No newline at end of file
+}
+
+TEST(HuffmanTreeTest, CodeLengthsMatchTable) {
+    // Same frequencies as AlphabetOnlyBasic, then a spread of counts with plenty of ties
+    std::array<uint64_t, 256> freqs{};
+    freqs['a'] = 45, freqs['b'] = 13, freqs['c'] = 12, freqs['d'] = 16, freqs['e'] = 9, freqs['f'] = 5;
+    auto lengths = huffman_tree::code_lengths(freqs);
+    EXPECT_EQ(lengths['a'], 1);
+    EXPECT_EQ(lengths['b'], 3);
+    EXPECT_EQ(lengths['f'], 4);
+    EXPECT_EQ(lengths['g'], 0);
+
+    std::map<char, uint64_t> mp;
+    for (int ch = 0; ch < 200; ++ch) {
+        freqs[ch] = 1 + (ch * 37) % 23;
+        mp[static_cast<char>(ch)] = freqs[ch];
+    }
+    for (int ch = 200; ch < 256; ++ch)
+        freqs[ch] = 0;
+    lengths = huffman_tree::code_lengths(freqs);
+    uint64_t table_bits = 0, length_bits = 0;
+    for (const auto& [ch, repr] : huffman_tree::huffman_table(std::move(mp))) {
+        table_bits += freqs[static_cast<uint8_t>(ch)] * repr.size();
+        length_bits += freqs[static_cast<uint8_t>(ch)] * lengths[static_cast<uint8_t>(ch)];
+    }
+    // Ties may be broken the other way, the total never differs
+    EXPECT_EQ(length_bits, table_bits);
+
+    std::array<uint64_t, 256> lone{};
+    lone['x'] = 7;
+    EXPECT_EQ(huffman_tree::code_lengths(lone)['x'], 1);
+}
@@ -0,0 +1,30 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "line_matcher.h"
+
+static std::vector<std::string> scan_lines(const line_matcher& matcher, std::string_view text)
+{
+    std::vector<std::string> lines;
+    matcher.scan(text, [&](size_t start, size_t end) { lines.emplace_back(text.substr(start, end - start)); });
+    return lines;
+}
+
+TEST(LineMatcherTest, Literal) {
+    const line_matcher matcher("ab");
+    EXPECT_TRUE(matcher.matches("xaby"));
+    EXPECT_FALSE(matcher.matches("a b"));
+    EXPECT_EQ(scan_lines(matcher, "ab ab\nnone\nxab\nab"), (std::vector<std::string>{"ab ab", "xab", "ab"}));
+}
+
+TEST(LineMatcherTest, Anchors) {
+    EXPECT_EQ(scan_lines(line_matcher("^ab"), "ab\nxab\nabx"), (std::vector<std::string>{"ab", "abx"}));
+    EXPECT_EQ(scan_lines(line_matcher("ab$"), "ab\nxab\nabx"), (std::vector<std::string>{"ab", "xab"}));
+    EXPECT_EQ(scan_lines(line_matcher("^ab$"), "ab\nxab\nabx\nab ab"), (std::vector<std::string>{"ab"}));
+    // Second hit on a line still counts when the first one fails the anchor
+    EXPECT_EQ(scan_lines(line_matcher("ab$"), "ab x ab"), (std::vector<std::string>{"ab x ab"}));
+}
+
+TEST(LineMatcherTest, EmptyPatternMatchesEveryLine) {
+    EXPECT_EQ(scan_lines(line_matcher(""), "a\n\nb\n"), (std::vector<std::string>{"a", "", "b", ""}));
+    EXPECT_EQ(scan_lines(line_matcher("^$"), "a\n\nb"), (std::vector<std::string>{""}));
+}
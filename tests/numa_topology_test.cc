@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include "numa_topology.h"
+#include "buffer_pool.h"
+#include "huffman_codec.h"
+
+TEST(NumaTopologyTest, EveryCpuOnOneNode) {
+    const auto& nodes = numa_topology::nodes();
+    ASSERT_FALSE(nodes.empty());
+    for (const auto& node : nodes)
+        EXPECT_FALSE(node.empty());
+
+    const auto cpus = numa_topology::cpus();
+    std::set<unsigned> unique(cpus.begin(), cpus.end());
+    EXPECT_EQ(unique.size(), cpus.size());
+}
+
+TEST(NumaTopologyTest, PinnedThreadKnowsItsNode) {
+    const auto& nodes = numa_topology::nodes();
+    // The last CPU the process may run on, whatever cpuset the tests run in
+    const unsigned cpu = numa_topology::cpus().back();
+    unsigned cpu_node = 0;
+    while (std::ranges::find(nodes[cpu_node], cpu) == nodes[cpu_node].end())
+        ++cpu_node;
+    // On a thread of its own, pinning the test runner would stick
+    std::thread([&] {
+        EXPECT_EQ(numa_topology::current_node(), 0);
+        EXPECT_TRUE(numa_topology::pin_to_cpu(cpu));
+        EXPECT_EQ(numa_topology::current_node(), cpu_node);
+    }).join();
+}
+
+TEST(NumaTopologyTest, RefusedPinKeepsNode) {
+    std::thread([] {
+        EXPECT_FALSE(numa_topology::pin_to_cpu(1u << 20));
+        EXPECT_EQ(numa_topology::current_node(), 0);
+    }).join();
+}
+
+TEST(NumaTopologyTest, NodeLocalCopiesMatch) {
+    const node_local<std::vector<int>> local(std::vector<int>{1, 2, 3});
+    std::vector<int> seen;
+    std::thread([&] {
+        numa_topology::pin_to_cpu(numa_topology::cpus().back());
+        seen = local.get();
+    }).join();
+    EXPECT_EQ(seen, (std::vector<int>{1, 2, 3}));
+    EXPECT_EQ(local.get(), seen);
+}
+
+TEST(NumaTopologyTest, HugePageBuffers) {
+    buffer_pool buffers(2);
+    buffers.set_huge_pages(true);
+    std::vector<char> buffer = buffers.acquire(8 * 1024 * 1024);
+    ASSERT_EQ(buffer.size(), 8 * 1024 * 1024);
+    buffer.back() = 'x';
+    buffers.release(std::move(buffer));
+    EXPECT_GE(buffers.acquire(16).capacity(), 8 * 1024 * 1024);
+}
+
+TEST(NumaTopologyTest, BuffersGoBackToTheirNode) {
+    // Released on a pinned thread for the node it was acquired for, not the releasing thread's own
+    const unsigned node = numa_topology::nodes().size() - 1;
+    buffer_pool buffers(4);
+    std::vector<char> buffer = buffers.acquire(1 << 20, node);
+    std::thread([&] {
+        numa_topology::pin_to_cpu(numa_topology::cpus().front());
+        buffers.release(std::move(buffer), node);
+    }).join();
+    EXPECT_GE(buffers.acquire(16, node).capacity(), 1 << 20);
+}
+
+TEST(NumaTopologyTest, PinnedCodecRun) {
+    std::string text;
+    for (int i = 0; i < 50000; ++i)
+        text += "pinned line " + std::to_string(i * 7919 % 1000) + '\n';
+
+    for (const auto backend : {huffman_codec::Backend::Huffman, huffman_codec::Backend::TANS}) {
+        std::stringstream input(text), bin, table, output;
+        huffman_codec enc({.chunk_size = 64 * 1024, .numa = true}, std::make_shared<worker_pool>(4, true));
+        enc.encode(input, bin, table, backend);
+        huffman_codec dec({.numa = true});
+        dec.decode(bin, output, table);
+        EXPECT_EQ(output.str(), text);
+    }
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "perf_counters.h"
+#include "huffman_codec.h"
+
+TEST(PerfCountersTest, ScopeWithoutCountersIsNoOp) {
+    perf_counters::scope scope(nullptr, perf_counters::Stage::Encode, 100);
+}
+
+TEST(PerfCountersTest, UnavailableSaysWhy) {
+    perf_counters perf;
+    std::ostringstream report;
+    perf.write_report(report);
+    if (perf.available()) {
+        EXPECT_TRUE(perf.unavailable_reason().empty());
+        EXPECT_TRUE(perf.has(perf_counters::Cycles));
+        EXPECT_NE(report.str().find("IPC"), std::string::npos);
+    } else {
+        EXPECT_FALSE(perf.unavailable_reason().empty());
+        EXPECT_FALSE(perf.has(perf_counters::Instructions));
+        EXPECT_NE(report.str().find("unavailable"), std::string::npos);
+        // Scopes on a counter set without counters count nothing
+        { perf_counters::scope scope(&perf, perf_counters::Stage::Decode, 100); }
+        EXPECT_EQ(perf.stage(perf_counters::Stage::Decode).bytes, 0);
+    }
+}
+
+TEST(PerfCountersTest, CountsAWorkload) {
+    perf_counters perf;
+    if (!perf.available()) GTEST_SKIP() << perf.unavailable_reason();
+
+    std::vector<uint64_t> values(1 << 20, 3);
+    uint64_t sum = 0;
+    {
+        perf_counters::scope scope(&perf, perf_counters::Stage::Histogram, values.size() * sizeof(uint64_t));
+        for (const uint64_t v : values) sum += v;
+    }
+    EXPECT_EQ(sum, 3 * values.size());
+
+    const auto totals = perf.stage(perf_counters::Stage::Histogram);
+    EXPECT_EQ(totals.bytes, values.size() * sizeof(uint64_t));
+    EXPECT_GT(totals.counts[perf_counters::Cycles], 0);
+    EXPECT_GT(totals.counts[perf_counters::Instructions], values.size() / 2);
+    EXPECT_GT(totals.ipc(), 0);
+}
+
+TEST(PerfCountersTest, CodecRun) {
+    auto perf = std::make_shared<perf_counters>();
+    if (!perf->available()) GTEST_SKIP() << perf->unavailable_reason();
+
+    std::string text;
+    for (int i = 0; i < 20000; ++i)
+        text += "line " + std::to_string(i) + " of the counter sample\n";
+    std::stringstream input(text), bin, table, output;
+    huffman_codec enc({.chunk_size = 64 * 1024, .perf = perf});
+    enc.encode(input, bin, table);
+    huffman_codec dec({.perf = perf});
+    dec.decode(bin, output, table);
+    ASSERT_EQ(output.str(), text);
+
+    // Every kernel went over the whole text once, on whichever worker threads
+    for (const auto stage : {perf_counters::Stage::Histogram, perf_counters::Stage::Encode, perf_counters::Stage::Decode}) {
+        EXPECT_EQ(perf->stage(stage).bytes, text.size());
+        EXPECT_GT(perf->stage(stage).counts[perf_counters::Instructions], 0);
+    }
+}
+
+TEST(PerfCountersTest, InstancesCountApart) {
+    auto first = std::make_unique<perf_counters>();
+    if (!first->available()) GTEST_SKIP() << first->unavailable_reason();
+
+    // Same thread, a group each, and a later instance at a reused address starts from nothing
+    std::vector<uint64_t> values(1 << 18, 5);
+    uint64_t sum = 0;
+    for (int round = 0; round < 2; ++round) {
+        perf_counters second;
+        {
+            perf_counters::scope outer(first.get(), perf_counters::Stage::Encode, 1);
+            perf_counters::scope inner(&second, perf_counters::Stage::Decode, 1);
+            for (const uint64_t v : values) sum += v;
+        }
+        EXPECT_GT(first->stage(perf_counters::Stage::Encode).counts[perf_counters::Instructions], 0);
+        EXPECT_GT(second.stage(perf_counters::Stage::Decode).counts[perf_counters::Instructions], 0);
+        EXPECT_EQ(second.stage(perf_counters::Stage::Decode).bytes, 1);
+        EXPECT_EQ(second.stage(perf_counters::Stage::Encode).bytes, 0);
+    }
+    EXPECT_EQ(sum, 2 * 5 * values.size());
+}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+#include "record_store.h"
+
+// Log-like records of a few hundred bytes, with an empty one and a long one in between
+static std::vector<std::string> make_records(size_t count)
+{
+    std::mt19937 rng(7);
+    std::vector<std::string> records;
+    for (size_t i = 0; i < count; ++i) {
+        std::string rec = "{\"id\":" + std::to_string(i) + ",\"user\":\"user" + std::to_string(rng() % 500) +
+                          "\",\"event\":\"" + (rng() % 3 ? "view" : "purchase") + "\",\"tags\":[";
+        for (size_t t = rng() % 20; t > 0; --t)
+            rec += "\"tag" + std::to_string(rng() % 40) + "\",";
+        rec += "]}";
+        records.push_back(i == 100 ? std::string() : i == 200 ? std::string(70000, 'q') : rec);
+    }
+    return records;
+}
+
+static std::string write_store(const std::vector<std::string>& records, std::shared_ptr<worker_pool> pool)
+{
+    const std::vector<std::string_view> views(records.begin(), records.end());
+    std::stringstream out;
+    record_store::write(views, out, std::move(pool));
+    return out.str();
+}
+
+TEST(RecordStoreTest, GetById) {
+    const auto pool = std::make_shared<worker_pool>(3);
+    const auto records = make_records(5000);
+    const std::string bytes = write_store(records, pool);
+
+    const record_store store(std::span<const char>(bytes), pool);
+    ASSERT_EQ(store.size(), records.size());
+    for (size_t id = 0; id < records.size(); ++id)
+        ASSERT_EQ(store.get(id), records[id]) << "id " << id;
+
+    // One table and a few bytes of index a record, against the raw records
+    uint64_t raw = 0;
+    for (const auto& rec : records)
+        raw += rec.size();
+    EXPECT_LT(bytes.size(), raw * 3 / 4);
+}
+
+TEST(RecordStoreTest, BatchGet) {
+    const auto pool = std::make_shared<worker_pool>(4);
+    const auto records = make_records(3000);
+    const std::string bytes = write_store(records, pool);
+    const record_store store(std::span<const char>(bytes), pool);
+
+    std::mt19937 rng(11);
+    std::vector<uint64_t> ids;
+    for (int i = 0; i < 2000; ++i)
+        ids.push_back(rng() % records.size());
+    ids.push_back(200);
+    ids.push_back(200);
+
+    const auto got = store.get_batch(ids);
+    ASSERT_EQ(got.size(), ids.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+        EXPECT_EQ(got[i], records[ids[i]]);
+
+    // Small batches stay on the calling thread
+    const std::vector<uint64_t> few{2999, 0, 64, 63};
+    const auto small = store.get_batch(few);
+    for (size_t i = 0; i < few.size(); ++i)
+        EXPECT_EQ(small[i], records[few[i]]);
+
+    ids.push_back(records.size());
+    EXPECT_THROW((void) store.get_batch(ids), std::out_of_range);
+}
+
+TEST(RecordStoreTest, File) {
+    const auto records = make_records(700);
+    const auto path = std::filesystem::temp_directory_path() /
+                      ("record_store_test" + std::to_string(::getpid()) + ".hmrs");
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        const std::vector<std::string_view> views(records.begin(), records.end());
+        record_store::write(views, ofs);
+    }
+
+    {
+        const record_store store(path.string());
+        EXPECT_EQ(store.size(), records.size());
+        EXPECT_EQ(store.get(699), records[699]);
+        EXPECT_EQ(store.get(100), "");
+    }
+    std::filesystem::remove(path);
+    EXPECT_THROW(record_store(path.string()), std::invalid_argument);
+
+    // No records at all is still a store
+    std::stringstream empty;
+    record_store::write({}, empty);
+    const std::string empty_bytes = empty.str();
+    const record_store none{std::span<const char>(empty_bytes)};
+    EXPECT_EQ(none.size(), 0);
+    EXPECT_THROW((void) none.get(0), std::out_of_range);
+}
+
+TEST(RecordStoreTest, Lines) {
+    // Lines come out the same store as the records would, coded a part at a time
+    const auto pool = std::make_shared<worker_pool>(3);
+    const auto records = make_records(5000);
+    std::string text;
+    for (const auto& rec : records)
+        text += rec + "\n";
+    std::stringstream lines(text), out;
+    EXPECT_EQ(record_store::write(lines, out, pool), records.size());
+    EXPECT_EQ(out.str(), write_store(records, pool));
+
+    // Last line without a newline is still a record
+    std::stringstream unterminated("one\ntwo"), two;
+    EXPECT_EQ(record_store::write(unterminated, two, pool), 2);
+    const std::string two_bytes = two.str();
+    const record_store store(std::span<const char>(two_bytes), pool);
+    EXPECT_EQ(store.get(1), "two");
+}
+
+TEST(RecordStoreTest, Corrupt) {
+    const auto records = make_records(300);
+    std::string bytes = write_store(records, nullptr);
+
+    std::string not_store = bytes;
+    not_store[0] = 'X';
+    EXPECT_THROW(record_store(std::span<const char>(not_store)), std::invalid_argument);
+    EXPECT_THROW(record_store(std::span<const char>(bytes).first(bytes.size() - 1)), std::invalid_argument);
+
+    // Index blocks pointing past the payloads
+    std::string bad_block = bytes;
+    record_store::trailer end;
+    std::memcpy(&end, bad_block.data() + bad_block.size() - sizeof(end), sizeof(end));
+    const uint64_t far = bytes.size();
+    std::memcpy(bad_block.data() + end.blocks_offset + sizeof(record_store::index_block), &far, sizeof(far));
+    const record_store store{std::span<const char>(bad_block)};
+    EXPECT_EQ(store.get(0), records[0]);
+    EXPECT_THROW((void) store.get(record_store::BLOCK_RECORDS), std::invalid_argument);
+}
@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include "serve.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// Server on its own socket, stopped and joined when the test is done with it
+class ServeTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        path = "/tmp/hmc-serve-test-" + std::to_string(::getpid()) + ".sock";
+        server = std::thread([this] { run_serve(path, 2, 1 << 20); });
+    }
+
+    void TearDown() override
+    {
+        stop_serve();
+        server.join();
+    }
+
+    // Waits for the server to start listening
+    [[nodiscard]] int connect_server() const
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        for (int attempt = 0; attempt < 500; ++attempt) {
+            const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) return fd;
+            ::close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    }
+
+    static bool send_request(int fd, const serve_header& hdr, const std::string& table, const std::string& payload)
+    {
+        return ::write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+               ::write(fd, table.data(), table.size()) == static_cast<ssize_t>(table.size()) &&
+               ::write(fd, payload.data(), payload.size()) == static_cast<ssize_t>(payload.size());
+    }
+
+    static bool read_exact(int fd, char* buf, size_t len)
+    {
+        for (ssize_t n; len > 0; buf += n, len -= static_cast<size_t>(n))
+            if ((n = ::read(fd, buf, len)) <= 0) return false;
+        return true;
+    }
+
+    static bool read_reply(int fd, serve_header& res, std::string& table, std::string& payload)
+    {
+        if (!read_exact(fd, reinterpret_cast<char*>(&res), sizeof(res))) return false;
+        table.resize(res.table_len);
+        payload.resize(res.payload_len);
+        return read_exact(fd, table.data(), table.size()) && read_exact(fd, payload.data(), payload.size());
+    }
+
+    static serve_header request(serve_op op, uint32_t table_len, uint64_t payload_len, uint8_t flags = 0,
+                                uint64_t shm_len = 0)
+    {
+        return {{'H', 'M', 'C', 'Q'}, static_cast<uint8_t>(op), 0, flags, 0, table_len, 0, payload_len, shm_len};
+    }
+
+    std::string path;
+    std::thread server;
+};
+
+TEST_F(ServeTest, RoundTrip) {
+    const int fd = connect_server();
+    ASSERT_GE(fd, 0);
+
+    std::string text;
+    for (int i = 0; i < 2000; ++i)
+        text += "request " + std::to_string(i % 37) + " served\n";
+
+    serve_header res{};
+    std::string table, encoded, decoded, unused;
+    ASSERT_TRUE(send_request(fd, request(serve_op::Encode, 0, text.size()), {}, text));
+    ASSERT_TRUE(read_reply(fd, res, table, encoded));
+    ASSERT_EQ(res.op, static_cast<uint8_t>(serve_status::Ok)) << encoded;
+    EXPECT_LT(encoded.size(), text.size());
+
+    ASSERT_TRUE(send_request(fd, request(serve_op::Decode, table.size(), encoded.size()), table, encoded));
+    ASSERT_TRUE(read_reply(fd, res, unused, decoded));
+    ASSERT_EQ(res.op, static_cast<uint8_t>(serve_status::Ok)) << decoded;
+    EXPECT_EQ(decoded, text);
+
+    // A bad request is answered with an error and the connection stays usable
+    ASSERT_TRUE(send_request(fd, request(static_cast<serve_op>(9), 0, 0), {}, {}));
+    ASSERT_TRUE(read_reply(fd, res, unused, decoded));
+    EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Error));
+    ASSERT_TRUE(send_request(fd, request(serve_op::Ping, 0, 0), {}, {}));
+    ASSERT_TRUE(read_reply(fd, res, unused, decoded));
+    EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Ok));
+    ::close(fd);
+}
+
+TEST_F(ServeTest, TablePath) {
+    const int fd = connect_server();
+    ASSERT_GE(fd, 0);
+    std::string text;
+    for (int i = 0; i < 3000; ++i)
+        text += "cached table " + std::to_string(i % 53) + "\n";
+
+    serve_header res{};
+    std::string table, encoded, decoded, unused;
+    ASSERT_TRUE(send_request(fd, request(serve_op::Encode, 0, text.size()), {}, text));
+    ASSERT_TRUE(read_reply(fd, res, table, encoded));
+    ASSERT_EQ(res.op, static_cast<uint8_t>(serve_status::Ok)) << encoded;
+    const std::string table_path = path + ".table";
+    std::ofstream(table_path, std::ios::binary) << table;
+
+    // Second request decodes with the tables the first one loaded
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(send_request(fd, request(serve_op::Decode, table_path.size(), encoded.size(), SERVE_TABLE_PATH),
+                                 table_path, encoded));
+        ASSERT_TRUE(read_reply(fd, res, unused, decoded));
+        ASSERT_EQ(res.op, static_cast<uint8_t>(serve_status::Ok)) << decoded;
+        EXPECT_EQ(decoded, text);
+    }
+    ::unlink(table_path.c_str());
+    ::close(fd);
+}
+
+TEST_F(ServeTest, MalformedHeader) {
+    // Lengths past the limit are refused before anything is allocated, then the connection is dropped
+    int fd = connect_server();
+    ASSERT_GE(fd, 0);
+    serve_header res{};
+    std::string table, payload;
+    ASSERT_TRUE(send_request(fd, request(serve_op::Decode, UINT32_MAX, UINT64_MAX), {}, {}));
+    ASSERT_TRUE(read_reply(fd, res, table, payload));
+    EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Error));
+    char byte;
+    EXPECT_EQ(::read(fd, &byte, 1), 0);
+    ::close(fd);
+
+    // Shared memory object shorter than the shm_len the header claims
+    const std::string name = "/hmc-serve-test-" + std::to_string(::getpid());
+    const int shm = ::shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    ASSERT_GE(shm, 0);
+    ASSERT_EQ(::ftruncate(shm, 16), 0);
+    ::close(shm);
+
+    fd = connect_server();
+    ASSERT_GE(fd, 0);
+    ASSERT_TRUE(send_request(fd, request(serve_op::Encode, 0, name.size(), SERVE_SHM, 1 << 16), {}, name));
+    ASSERT_TRUE(read_reply(fd, res, table, payload));
+    EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Error));
+
+    // Reply object already there, it's never written over (the 16 byte input is long enough this time)
+    const std::string reply_name = name + "-r";
+    const int existing = ::shm_open(reply_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    ASSERT_GE(existing, 0);
+    ::close(existing);
+    ASSERT_TRUE(send_request(fd, request(serve_op::Encode, 0, name.size(), SERVE_SHM, 4), {}, name));
+    ASSERT_TRUE(read_reply(fd, res, table, payload));
+    EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Error));
+    ::shm_unlink(reply_name.c_str());
+    ::shm_unlink(name.c_str());
+
+    // Names outside the server's own prefix
+    for (const std::string bad : {"/some-other-object", "/hmc-dir/object", "hmc-relative"}) {
+        ASSERT_TRUE(send_request(fd, request(serve_op::Encode, 0, bad.size(), SERVE_SHM, 4), {}, bad));
+        ASSERT_TRUE(read_reply(fd, res, table, payload));
+        EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Error)) << bad;
+        EXPECT_NE(payload.find("must start with"), std::string::npos) << payload;
+    }
+
+    // Still serving after all that
+    ASSERT_TRUE(send_request(fd, request(serve_op::Ping, 0, 0), {}, {}));
+    ASSERT_TRUE(read_reply(fd, res, table, payload));
+    EXPECT_EQ(res.op, static_cast<uint8_t>(serve_status::Ok));
+    ::close(fd);
+}
+
+#endif
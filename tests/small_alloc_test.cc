@@ -0,0 +1,50 @@
+#include "huffman_codec.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <source_location>
+#include <sstream>
+
+// Heap allocations of the calling thread, counted while a test has counting on. This replaces operator new for the
+// whole executable, so it gets one of its own instead of sharing huffman_test
+static thread_local bool counting_allocations = false;
+static thread_local size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    if (counting_allocations) ++allocations;
+    if (void* ptr = std::malloc(size != 0 ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+static const std::string TEST_FILES_DIR = std::filesystem::path(std::source_location::current().file_name()).parent_path().string() + "/test_files";
+
+TEST(SmallAllocTest, SmallInputsDontAllocate) {
+    std::ifstream ifs(TEST_FILES_DIR + "/1M4C.txt", std::ios::binary);
+    std::stringstream source;
+    source << ifs.rdbuf();
+
+    // Once the thread is warm and the output has room, neither side touches the heap
+    for (const size_t size : {size_t{64}, size_t{4096}, huffman_codec::SMALL_INPUT}) {
+        const std::string text = source.str().substr(0, size);
+        std::vector<char> bin, decoded;
+        huffman_codec::encode_small(text, bin);
+        huffman_codec::decode_small(bin, decoded);
+        bin.reserve(2 * bin.size());
+        decoded.reserve(2 * decoded.size());
+
+        for (int call = 0; call < 3; ++call) {
+            bin.clear();
+            decoded.clear();
+            allocations = 0;
+            counting_allocations = true;
+            huffman_codec::encode_small(text, bin);
+            huffman_codec::decode_small(bin, decoded);
+            counting_allocations = false;
+            EXPECT_EQ(allocations, 0) << size << " bytes";
+        }
+        EXPECT_EQ(std::string(decoded.begin(), decoded.end()), text);
+    }
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include "tans_table.h"
+
+TEST(TansTableTest, NormalizeSumsToTableSize) {
+    std::map<char, uint64_t> mp;
+    mp['a'] = 1000000;
+    mp['b'] = 3;
+    mp['c'] = 1;
+    mp['d'] = 250000;
+
+    auto res = tans_table::normalize(std::move(mp));
+
+    uint32_t sum = 0;
+    for (const auto& [ch, norm] : res) {
+        EXPECT_GE(norm, 1u);
+        sum += norm;
+    }
+    EXPECT_EQ(sum, tans_table::TABLE_SIZE);
+    EXPECT_GT(res['a'], res['d']);
+}
+
+TEST(TansTableTest, RoundTripSkewed) {
+    std::string text;
+    for (int i = 0; i < 5000; ++i)
+        text += (i % 97 == 0) ? 'z' : (i % 13 == 0 ? ' ' : 'e');
+
+    std::map<char, uint64_t> mp;
+    for (const char c : text)
+        ++mp[c];
+
+    const tans_table table(tans_table::normalize(std::move(mp)));
+    std::vector<char> encoded;
+    table.encode(text, encoded);
+
+    std::string decoded(text.size(), '\0');
+    table.decode(encoded, decoded);
+
+    EXPECT_EQ(decoded, text);
+    // Skewed input should come out well below one bit per symbol
+    EXPECT_LT(encoded.size(), text.size() / 8);
+}
+
+TEST(TansTableTest, SingleSymbol) {
+    const std::string text(300, 'x');
+    std::map<char, uint64_t> mp{{'x', 300}};
+
+    const tans_table table(tans_table::normalize(std::move(mp)));
+    std::vector<char> encoded;
+    table.encode(text, encoded);
+
+    std::string decoded(text.size(), '\0');
+    table.decode(encoded, decoded);
+    EXPECT_EQ(decoded, text);
+}
+
+TEST(TansTableTest, CorruptPayload) {
+    const std::string text = "corrupt payloads throw instead of reading past the table";
+    std::map<char, uint64_t> mp;
+    for (const char c : text)
+        ++mp[c];
+    const tans_table table(tans_table::normalize(std::move(mp)));
+    std::vector<char> encoded;
+    table.encode(text, encoded);
+    std::string decoded(text.size(), '\0');
+
+    // Starting state past the end of the table
+    std::vector<char> bad_state = encoded;
+    bad_state[0] = bad_state[1] = static_cast<char>(0xFF);
+    EXPECT_THROW(table.decode(bad_state, decoded), std::invalid_argument);
+
+    // No table at all
+    EXPECT_THROW(tans_table().decode(encoded, decoded), std::invalid_argument);
+}
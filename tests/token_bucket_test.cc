@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "token_bucket.h"
+#include "huffman_codec.h"
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(TokenBucketTest, UnlimitedNeverWaits) {
+    token_bucket bucket;
+    EXPECT_FALSE(bucket.limited());
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; ++i)
+        bucket.take(1024 * 1024 * 1024);
+    EXPECT_LT(seconds_since(start), 0.1);
+}
+
+TEST(TokenBucketTest, HoldsTheRate) {
+    token_bucket bucket(1024 * 1024);
+    const auto start = std::chrono::steady_clock::now();
+    // The first tenth of a second's worth is the burst, the rest has to wait for the rate
+    bucket.take(100 * 1024);
+    EXPECT_LT(seconds_since(start), 0.05);
+    bucket.take(100 * 1024);
+    bucket.take(200 * 1024);
+    const double elapsed = seconds_since(start);
+    EXPECT_GT(elapsed, 0.25);
+    EXPECT_LT(elapsed, 1.0);
+}
+
+TEST(TokenBucketTest, ThrottledCodecRun) {
+    std::string text;
+    for (int i = 0; i < 20000; ++i)
+        text += "throttled line " + std::to_string(i) + '\n';
+
+    // Encode reads its input twice
+    std::stringstream input(text), bin, table, output;
+    const auto start = std::chrono::steady_clock::now();
+    huffman_codec enc({.chunk_size = 16 * 1024, .max_read_rate = 2 * text.size(), .max_cpu = 0.5, .low_priority = true});
+    enc.encode(input, bin, table);
+    EXPECT_GT(seconds_since(start), 0.7);
+
+    huffman_codec dec({.max_write_rate = 64 * 1024 * 1024, .low_priority = true});
+    dec.decode(bin, output, table);
+    EXPECT_EQ(output.str(), text);
+}
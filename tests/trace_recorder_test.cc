@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <sstream>
+#include "trace_recorder.h"
+#include "huffman_codec.h"
+
+static size_t count_of(const std::string& text, const std::string& needle)
+{
+    size_t count = 0;
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1))
+        ++count;
+    return count;
+}
+
+TEST(TraceRecorderTest, ThreadsGetTheirOwnTracks) {
+    trace_recorder trace;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            trace.name_thread("worker");
+            for (int i = 0; i < 100; ++i) {
+                trace_recorder::scope span(&trace, "task");
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    std::ostringstream json;
+    trace.write_json(json);
+    EXPECT_EQ(count_of(json.str(), "\"name\":\"task\""), 400);
+    EXPECT_EQ(count_of(json.str(), "\"thread_name\""), 4);
+    for (int tid = 1; tid <= 4; ++tid)
+        EXPECT_NE(json.str().find("\"tid\":" + std::to_string(tid) + ","), std::string::npos);
+}
+
+TEST(TraceRecorderTest, RingKeepsNewestEvents) {
+    trace_recorder trace(4);
+    trace.record("old", 1000, 1000);
+    for (int i = 0; i < 4; ++i)
+        trace.record("new", 2000 + i * 1000, 500);
+    trace.instant("mark");
+
+    std::ostringstream json;
+    trace.write_json(json);
+    EXPECT_EQ(count_of(json.str(), "\"old\""), 0);
+    EXPECT_EQ(count_of(json.str(), "\"new\""), 3);
+    EXPECT_EQ(count_of(json.str(), "\"mark\""), 1);
+    // Microseconds, nanoseconds as decimals
+    EXPECT_NE(json.str().find("\"ts\":3.000,\"ph\":\"X\",\"dur\":0.500"), std::string::npos);
+    EXPECT_NE(json.str().find("\"ph\":\"i\""), std::string::npos);
+}
+
+TEST(TraceRecorderTest, ScopeWithoutRecorderIsNoOp) {
+    trace_recorder::scope span(nullptr, "nothing");
+}
+
+TEST(TraceRecorderTest, CodecRun) {
+    std::string text;
+    for (int i = 0; i < 20000; ++i)
+        text += "line " + std::to_string(i) + " of the trace sample\n";
+
+    auto trace = std::make_shared<trace_recorder>();
+    std::stringstream input(text), bin, table, output;
+    huffman_codec enc({.chunk_size = 64 * 1024, .trace = trace});
+    enc.encode(input, bin, table);
+    huffman_codec dec({.trace = trace});
+    dec.decode(bin, output, table);
+    EXPECT_EQ(output.str(), text);
+
+    std::ostringstream json;
+    trace->write_json(json);
+    for (const char* name : {"\"reader\"", "\"worker\"", "\"read chunk\"", "\"encode kernel\"",
+                             "\"histogram kernel\"", "\"decode kernel\"", "\"write ordered\""})
+        EXPECT_NE(json.str().find(name), std::string::npos) << name;
+}
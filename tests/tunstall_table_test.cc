@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <cmath>
+#include <string>
+#include "tunstall_table.h"
+
+static std::map<char, uint64_t> counts(const std::string& text)
+{
+    std::map<char, uint64_t> mp;
+    for (const char c : text)
+        ++mp[c];
+    return mp;
+}
+
+static std::string round_trip(const tunstall_table& table, const std::string& text, std::vector<char>& encoded)
+{
+    table.encode(text, encoded);
+    std::string decoded(text.size(), '\0');
+    table.decode(encoded, decoded);
+    return decoded;
+}
+
+TEST(TunstallTableTest, RoundTripEveryWidth) {
+    std::string text;
+    for (int i = 0; i < 20000; ++i)
+        text += (i % 97 == 0) ? 'z' : (i % 13 == 0 ? ' ' : (i % 5 == 0 ? 't' : 'e'));
+
+    for (const uint32_t bits : {8u, 12u, 16u}) {
+        const tunstall_table table(tunstall_table::normalize(counts(text)), bits);
+        EXPECT_EQ(table.bits(), bits);
+        std::vector<char> encoded;
+        EXPECT_EQ(round_trip(table, text, encoded), text);
+        // Skewed input should take several symbols per codeword
+        EXPECT_LT(encoded.size(), text.size() / 2);
+    }
+}
+
+TEST(TunstallTableTest, PicksWidth) {
+    // Every byte present leaves no room to split anything with 8 bit codewords
+    std::string text;
+    for (int i = 0; i < 256; ++i)
+        text += std::string(i == 'a' ? 5000 : 1, static_cast<char>(i));
+    const tunstall_table table(tunstall_table::normalize(counts(text)));
+    EXPECT_NE(table.bits(), 8u);
+    EXPECT_LT(table.bits_per_symbol(counts(text)), 8);
+
+    std::vector<char> encoded;
+    EXPECT_EQ(round_trip(table, text, encoded), text);
+    EXPECT_TRUE(std::isinf(tunstall_table(tunstall_table::normalize({{'a', 1}})).bits_per_symbol({{'b', 1}})));
+}
+
+TEST(TunstallTableTest, Tails) {
+    const std::string text(1000, 'x');
+    const tunstall_table table(tunstall_table::normalize({{'x', 1000}}), 12);
+
+    // Lengths that end inside a word and every parity of 12 bit codewords
+    for (const size_t len : {size_t{1}, size_t{14}, size_t{15}, size_t{16}, size_t{31}, size_t{46}, size_t{1000}}) {
+        std::vector<char> encoded;
+        const std::string part = text.substr(0, len);
+        EXPECT_EQ(round_trip(table, part, encoded), part);
+    }
+
+    std::vector<char> encoded;
+    EXPECT_EQ(round_trip(table, "", encoded), "");
+    EXPECT_TRUE(encoded.empty());
+}
+
+TEST(TunstallTableTest, Corrupt) {
+    std::string text;
+    for (int i = 0; i < 1000; ++i)
+        text += "abcde"[i * 7 % 11 % 5];
+    const tunstall_table table(tunstall_table::normalize(counts(text)), 16);
+    std::vector<char> encoded;
+    table.encode(text, encoded);
+
+    std::string decoded(text.size(), '\0');
+    EXPECT_THROW(table.decode(std::span(encoded).first(encoded.size() - 2), decoded), std::invalid_argument);
+    // Five symbols fill 253 of the 256 codewords
+    const tunstall_table narrow(tunstall_table::normalize(counts(text)), 8);
+    const std::vector<char> unknown(text.size(), '\xFF');
+    EXPECT_THROW(narrow.decode(unknown, decoded), std::invalid_argument);
+    EXPECT_THROW(table.encode(std::string_view("xyz"), encoded), std::invalid_argument);
+    EXPECT_THROW(tunstall_table(tunstall_table::normalize(counts(text)), 10), std::invalid_argument);
+}